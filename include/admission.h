@@ -0,0 +1,87 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * @brief Declarations of admission control - deciding, before any work is done, whether a request gets served or is shed with a BUSY response
+ * Two checks, both cheap enough to run on every request:
+ * - a token bucket per uid (SO_PEERCRED, so it can't be dodged by reconnecting). one noisy user gets throttled without affecting anyone else
+ * - a global cap on requests in flight. the server is single-threaded, so a request counts as in flight from being admitted until the loop next goes back to waiting for events - the cap bounds how much work any one wakeup takes on, so nobody waits behind an unbounded pile
+ */
+
+#ifndef NOTICEBOARD_UID_RATE
+	#define NOTICEBOARD_UID_RATE 500 /* requests per second each uid may sustain */
+#endif /* ifndef NOTICEBOARD_UID_RATE */
+
+#ifndef NOTICEBOARD_UID_BURST
+	#define NOTICEBOARD_UID_BURST 1000 /* requests a uid may make in a burst, after being idle */
+#endif /* ifndef NOTICEBOARD_UID_BURST */
+
+#ifndef NOTICEBOARD_MAX_IN_FLIGHT
+	#define NOTICEBOARD_MAX_IN_FLIGHT 256 /* requests admitted per pass of the event loop, across every user */
+#endif /* ifndef NOTICEBOARD_MAX_IN_FLIGHT */
+
+#define ADMISSION_BUCKETS 1024 /* uids tracked at once. power of two */
+#define ADMISSION_PROBES 8 /* slots looked at per uid before reusing the idlest */
+
+#if NOTICEBOARD_UID_RATE < 1 || NOTICEBOARD_UID_BURST < 1 || NOTICEBOARD_MAX_IN_FLIGHT < 1
+	#error "'NOTICEBOARD_UID_RATE', 'NOTICEBOARD_UID_BURST' & 'NOTICEBOARD_MAX_IN_FLIGHT' must be positive"
+#endif /* if NOTICEBOARD_UID_RATE < 1 || NOTICEBOARD_UID_BURST < 1 || NOTICEBOARD_MAX_IN_FLIGHT < 1 */
+
+enum admission_verdict {
+	ADMITTED = 0,
+	THROTTLED = 1, /* uid is over its rate */
+	OVERLOADED = 2 /* too many requests in flight */
+};
+
+/**
+ * @brief AdmissionBucket (struct) - token bucket of one uid
+ */
+struct AdmissionBucket {
+	uint32_t uid;
+
+	int used; /* boolean. slot holds a uid */
+
+	int throttled; /* boolean. requests have been refused since the bucket was last full - so throttling is only reported once per episode */
+
+	uint64_t millitokens; /* thousandths of a request */
+
+	int64_t refilled_ns; /* monotonic time millitokens was last topped up */
+};
+
+/**
+ * @brief Admission (struct) - admission control state
+ */
+struct Admission {
+	struct AdmissionBucket buckets[ADMISSION_BUCKETS];
+
+	uint32_t in_flight;
+
+	uint64_t admitted, throttled, overloaded; /* running totals */
+};
+
+/**
+ * @brief admission_init - sets up admission control with nobody throttled
+ * @param struct Admission *const admission - struct to fill
+ */
+void admission_init(struct Admission *const admission);
+
+/**
+ * @brief admission_admit - decides whether a request is served. admitted requests take a token & count as in flight
+ * @param struct Admission *const admission - admission control state
+ * @param const uid_t uid - sender (SO_PEERCRED)
+ * @return enum admission_verdict - ADMITTED, or why not
+ */
+enum admission_verdict admission_admit(struct Admission *const admission, const uid_t uid);
+
+/**
+ * @brief admission_settle - marks every request in flight as done. call each time the event loop goes back to waiting
+ * @param struct Admission *const admission - admission control state
+ */
+void admission_settle(struct Admission *const admission);
+
+#endif /* ADMISSION_H */
@@ -0,0 +1,64 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "store.h"
+
+/**
+ * @brief Declarations of functionality to stream the whole notes store to & from one sequential archive
+ * Used for backups & host migrations, in place of copying (or re-adding) notes one by one
+ * Layout - every integer is little endian, so archives move between hosts:
+ * - header: magic (uint32_t, ARCHIVE_MAGIC), version (uint32_t, ARCHIVE_VERSION)
+ * - one record per note: uid (uint32_t), subject length (uint32_t, 1 to MAX_SBJ_LEN), subject, expiry (int64_t nanoseconds since the epoch, 0 for never), body length (uint32_t), body
+ * - trailer: uid 0 & subject length 0 (marks the end), then number of records (uint64_t) so truncation is caught
+ * Version 1 archives, whose records have no expiry, are still imported - as notes which never expire
+ */
+
+#define ARCHIVE_MAGIC 0x5241424Eu /* "NBAR" */
+#define ARCHIVE_VERSION 2u
+#define ARCHIVE_VERSION_NO_EXPIRY 1u /* oldest version import still reads */
+#define ARCHIVE_IO_LEN (1024u * 1024u) /* archives are read & written in chunks this big, never record by record */
+
+/**
+ * @brief ArchiveStats (struct) - outcome of an export or import
+ */
+struct ArchiveStats {
+	uint64_t notes; /* notes exported, or imported */
+
+	uint64_t skipped; /* import only - notes left alone as one of the same name already existed */
+
+	uint64_t expired; /* import only - notes not created as they'd expired since being exported */
+
+	uint64_t bytes; /* total size of note bodies transferred */
+};
+
+/**
+ * @brief archive_export - writes every note in the store to an archive
+ * Each user's notes are read in inode order, which tends to follow their placement on disk. Notes which have expired, deleted yet or not, are left out
+ * @param const struct Store *const store - opened store
+ * @param const int out_fd - handle to write the archive to (file, pipe or socket). written sequentially from its current position
+ * @param struct ArchiveStats *const stats - filled with what was exported
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the store, 2 is error writing the archive
+ */
+int archive_export(const struct Store *const store, const int out_fd, struct ArchiveStats *const stats);
+
+/**
+ * @brief archive_import - creates a note for every record of an archive
+ * Notes which already exist are never overwritten. Nothing is flushed per note - the whole store is synced once, at the end
+ * Expiring notes keep their expiry time (recorded on the note & in the index, & scheduled, as for an add with a time to live). Any which has passed since export isn't created
+ * Stops at the first malformed record; notes imported before it are kept
+ * @param const struct Store *const store - opened store
+ * @param const int in_fd - handle to read the archive from. read sequentially from its current position
+ * @param void (*const imported)(const uid_t, const char *const, const uint32_t, const int64_t, void *const) - called with each note's owner, subject, length & expiry once it's been created, in place of adding it to store->index - for an import away from the process holding the index (see transfer.h). NULL indexes it as usual
+ * @param void *const ctx - passed to imported
+ * @param struct ArchiveStats *const stats - filled with what was imported
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the archive, 2 is malformed archive, 3 is error writing to the store
+ */
+int archive_import(const struct Store *const store, const int in_fd, void (*const imported)(const uid_t, const char *const, const uint32_t, const int64_t, void *const), void *const ctx, struct ArchiveStats *const stats);
+
+#endif /* ARCHIVE_H */
@@ -0,0 +1,80 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "request.h"
+
+/**
+ * @brief Declarations of traffic capture - recording the note requests a server receives, for `notereplay` to drive a server with later
+ * Off (0) by default. NOTICEBOARD_CAPTURE 1 records each request's shape (when, whose, which command, subject & sizes), 2 its content too
+ * Requests are recorded as decoded, before admission - shed ones included, as they're part of the load. Ring negotiation, export & import aren't recorded
+ * Layout - every integer is little endian, so captures move between hosts:
+ * - header: magic (uint32_t, CAPTURE_MAGIC), version (uint16_t, CAPTURE_VERSION), flags (uint16_t, CAPTURE_FLAG_*), started (int64_t, realtime nanoseconds)
+ * - one record per request: CAPTURE_RECORD_FIXED_LEN bytes (see below), subject, then stored_len bytes of extra data
+ * GET_RANGE's range, LIST's cursor & SINCE's window (& cursor) are always stored - they're what the request asks for. ADD & APPEND content only with CAPTURE_FLAG_CONTENT
+ */
+
+#ifndef NOTICEBOARD_CAPTURE
+	#define NOTICEBOARD_CAPTURE 0 /* 0 is off, 1 records requests' shape, 2 their content too */
+#endif /* ifndef NOTICEBOARD_CAPTURE */
+
+#ifndef NOTICEBOARD_CAPTURE_NAME
+	#define NOTICEBOARD_CAPTURE_NAME ".capture" /* within the notes directory. replaced at each start, carried on across a takeover */
+#endif /* ifndef NOTICEBOARD_CAPTURE_NAME */
+
+#ifndef NOTICEBOARD_CAPTURE_LIMIT
+	#define NOTICEBOARD_CAPTURE_LIMIT (1024ull * 1024 * 1024) /* bytes. capturing stops (the file is kept) once it would grow past this */
+#endif /* ifndef NOTICEBOARD_CAPTURE_LIMIT */
+
+#ifndef NOTICEBOARD_CAPTURE_BUFFER
+	#define NOTICEBOARD_CAPTURE_BUFFER (64 * 1024) /* bytes. records are written out once this fills, on SIGUSR1 & on shutdown */
+#endif /* ifndef NOTICEBOARD_CAPTURE_BUFFER */
+
+#define CAPTURE_MAGIC 0x5043424Eu /* "NBCP" */
+#define CAPTURE_VERSION 1u
+#define CAPTURE_HEADER_LEN 16
+#define CAPTURE_FLAG_CONTENT 0x0001 /* ADD & APPEND records carry their content */
+
+#define CAPTURE_RECORD_FIXED_LEN 28 /* at (uint64_t, nanoseconds since capture started), uid (uint32_t), ttl_s (uint32_t), extra_data_len (uint32_t, as received), stored_len (uint32_t), flags (uint16_t, REQUEST_FLAG_*), command (uint8_t), sbj_len (uint8_t) */
+#define CAPTURE_RECORD_MAX_LEN (CAPTURE_RECORD_FIXED_LEN + MAX_SBJ_LEN + MAX_EXTRA_DATA_LEN)
+
+#if NOTICEBOARD_CAPTURE < 0 || NOTICEBOARD_CAPTURE > 2
+	#error "'NOTICEBOARD_CAPTURE' must be 0, 1 or 2"
+#endif /* if NOTICEBOARD_CAPTURE < 0 || NOTICEBOARD_CAPTURE > 2 */
+
+#if NOTICEBOARD_CAPTURE_BUFFER < CAPTURE_RECORD_MAX_LEN
+	#error "'NOTICEBOARD_CAPTURE_BUFFER' must hold at least one record (CAPTURE_RECORD_MAX_LEN)"
+#endif /* if NOTICEBOARD_CAPTURE_BUFFER < CAPTURE_RECORD_MAX_LEN */
+
+/**
+ * @brief capture_open - starts capturing. does nothing if capture is off
+ * A fresh start replaces any capture left by an earlier run. A takeover carries on the one the old server flushed, so a capture can span a deploy - unless its header doesn't match this build's (version or content flag), in which case it's replaced too
+ * @param const int dir_fd - directory to capture into
+ * @param const char *const name - filename
+ * @param const int resume - boolean. append to a capture already there (the server took over), rather than starting afresh
+ * @return int - zero is success, non-zero is failure
+ * 1 is error creating the file (the server carries on without capturing)
+ */
+int capture_open(const int dir_fd, const char *const name, const int resume);
+
+/**
+ * @brief capture_request - records a decoded request. does nothing if capture is off, not open, or past its limit
+ * @param const uid_t uid - whose request it was
+ * @param const struct Request *const request - the request
+ */
+void capture_request(const uid_t uid, const struct Request *const request);
+
+/**
+ * @brief capture_flush - writes out whatever's been recorded but not yet written
+ */
+void capture_flush(void);
+
+/**
+ * @brief capture_close - flushes & stops capturing
+ */
+void capture_close(void);
+
+#endif /* CAPTURE_H */
@@ -2,30 +2,167 @@
 #define CLIENT_HANDLING_H
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
 #include "request.h"
+#include "response.h"
+#include "store.h"
+#include "ring.h"
+#include "admission.h"
+#include "fd_transfer.h"
+#include "timer_wheel.h"
+#include "trace.h"
+#include "transfer.h"
 
 /**
  * @brief Declarations of functionality to manage each server-client relationship
  */
 
+#ifndef NOTICEBOARD_ADMIN_UID
+	#define NOTICEBOARD_ADMIN_UID 0 /* only this user may EXPORT or IMPORT the whole store */
+#endif /* ifndef NOTICEBOARD_ADMIN_UID */
+
+#ifndef NOTICEBOARD_MAX_NOTE_LEN
+	#define NOTICEBOARD_MAX_NOTE_LEN (16 * 1024 * 1024) /* largest a note may grow to through APPEND. a single request still carries at most MAX_EXTRA_DATA_LEN */
+#endif /* ifndef NOTICEBOARD_MAX_NOTE_LEN */
+
+#if NOTICEBOARD_MAX_NOTE_LEN < MAX_EXTRA_DATA_LEN || NOTICEBOARD_MAX_NOTE_LEN > 4294967295
+	#error "'NOTICEBOARD_MAX_NOTE_LEN' must be between MAX_EXTRA_DATA_LEN and UINT32_MAX (the index records note lengths in 32 bits)"
+#endif /* if NOTICEBOARD_MAX_NOTE_LEN < MAX_EXTRA_DATA_LEN || NOTICEBOARD_MAX_NOTE_LEN > 4294967295 */
+
+#define SESSION_IN_LEN (MAX_REQUEST_LEN + 1) /* a whole request, plus the marker byte of any handles following it */
+#define SESSION_OUT_LEN (2 * MAX_RESPONSE_LEN) /* worst case is a GET - data & acknowledgement */
+
+/**
+ * @brief session_phase - where a session's socket is up to. each phase other than idle has its own deadline (see server.c)
+ */
+enum session_phase {
+	SESSION_IDLE = 0, /* between requests */
+	SESSION_HEADER = 1, /* part of a request's header has arrived */
+	SESSION_PAYLOAD = 2, /* header complete, waiting on the rest of the request (or the handles following it) */
+	SESSION_WRITE = 3, /* responses queued which the client hasn't taken yet. nothing more is read until they're gone */
+	SESSION_TRANSFER = 4 /* export or import running in the background (see transfer.h). nothing more is read until it's answered, & the socket's only watched for hangups */
+};
+
+/**
+ * @brief Session (struct) - one client connection. it stays open across requests until the client hangs up, and may carry a shared-memory ring (see ring.h)
+ * The socket is non-blocking - requests are gathered into in_buf over as many readiness events as they take, so a slow or stalled client only ever holds up itself
+ */
+struct Session {
+	int sock; /* client socket. -1 if unused. client closing it ends the session */
+
+	uid_t uid; /* SO_PEERCRED of sock - every request on this session, socket or ring, acts as this user */
+
+	enum session_phase phase;
+
+	int phase_restarted; /* boolean. phase (or a new request within it) began since the server last looked, so its deadline should be restarted */
+
+	struct TimerLink deadline; /* on the server's timer wheel whilst the current phase has a deadline */
+
+	uint8_t in_buf[SESSION_IN_LEN]; /* bytes received but not yet acted upon */
+	size_t in_len;
+
+	uint8_t out_buf[SESSION_OUT_LEN]; /* encoded responses not yet sent */
+	size_t out_len, out_sent;
+
+	int64_t read_ns; /* when in_buf was last read into (see trace.h) */
+
+	struct TraceRecord trace; /* phase timestamps of the request being received or answered */
+
+	int answering; /* boolean. a request's responses are in out_buf - once they've gone, its trace is complete */
+
+	int fds[MAX_TRANSFER_FDS]; /* handles received (SCM_RIGHTS) ahead of the request which takes them */
+	size_t fd_count;
+
+	int parked; /* boolean. between requests & no longer polled, awaiting a handoff (see handoff.h) */
+
+	int has_ring; /* boolean. ring below has been negotiated */
+
+	struct Ring ring;
+};
+
+/**
+ * @brief session_open - starts a session on a newly accepted socket, establishing who is behind it
+ * @param struct Session *const session - unused session to fill
+ * @param const int client_sock - accepted socket. made non-blocking. ownership passes to session on success
+ * @return int - 0 == success, non-zero is failure
+ * 1 = unable to establish peer credentials or configure socket
+ */
+int session_open(struct Session *const session, const int client_sock);
+
+/**
+ * @brief session_resume - picks up a session another server handed over (see handoff.h)
+ * @param struct Session *const session - unused session to fill
+ * @param const int client_sock - session's socket. ownership passes to session on success
+ * @param const int *const ring_fds - memfd, request & response doorbells of its ring. NULL if it has none
+ * @return int - 0 == success, non-zero is failure
+ * 1 = unable to re-establish the session (every handle has been closed)
+ */
+int session_resume(struct Session *const session, const int client_sock, const int *const ring_fds);
+
+/**
+ * @brief session_idle - says whether a session is between requests, with nothing part received or waiting to be sent - so could be handed to another server as is
+ * @param const struct Session *const session - session
+ * @return int - boolean
+ */
+int session_idle(const struct Session *const session);
+
+/**
+ * @brief client_connection - function to actually handle data coming to and from process behind socket handle. call whenever the socket is ready
+ * Reads whatever has arrived, serves every complete request, & sends responses - stopping as soon as the socket would block, with session->phase saying what's awaited
+ * An export or import is left running in the background, the session in SESSION_TRANSFER until it's answered (see session_transferred)
+ * @param const struct Store *const store - opened notes store to act upon
+ * @param struct Admission *const admission - admission control. note operations it refuses are answered BUSY without being looked at
+ * @param struct Session *const session - session whose socket is ready. if a request negotiates a ring, session->has_ring becomes set & the caller should start polling its request doorbell (see session_serve)
+ * @return int - 0 == success, non-zero is failure
+ * 1 = issue understanding request or using socket (connection is out of step and should be closed), 3 = client closed connection
+ */
+int client_connection(const struct Store *const store, struct Admission *const admission, struct Session *const session);
+
+/**
+ * @brief session_serve - services every request waiting in a session's ring. call whenever its request doorbell is readable
+ * Stops early (without error) if the response queue can't fit another response - the client rings the request doorbell again once it has drained responses
+ * @param const struct Store *const store - opened notes store to act upon
+ * @param struct Admission *const admission - as per client_connection
+ * @param struct Session *const session - session from client_connection
+ * @return int - 0 == success, non-zero is failure
+ * 1 = ring is corrupt or unusable, session should be ended
+ */
+int session_serve(const struct Store *const store, struct Admission *const admission, struct Session *const session);
+
+/**
+ * @brief session_transferred - answers the export or import a session was waiting on, then carries on with the session as client_connection would
+ * @param const struct Store *const store - opened notes store
+ * @param struct Admission *const admission - admission control
+ * @param struct Session *const session - session in SESSION_TRANSFER, which started the transfer
+ * @param const struct Transfer *const transfer - the transfer, finished (see transfer_poll)
+ * @return int - as per client_connection
+ */
+int session_transferred(const struct Store *const store, struct Admission *const admission, struct Session *const session, const struct Transfer *const transfer);
+
 /**
- * @brief client_connection - function to actually handle data coming to and from process behind socket handle
- * @param const int client_sock - IPC socket / file handle to communicate with
+ * @brief session_close - ends a session, releasing its ring, socket & any handles received but never used. its deadline is the caller's to cancel
+ * @param struct Session *const session - session from client_connection
  * @return int - 0 == success, non-zero is failure
- * 1 = issue understanding request, 2 = issue handling request
+ * 1 = error releasing a resource
  */
-int client_connection(const int client_sock);
+int session_close(struct Session *const session);
 
 /**
  * @brief execute_request - executes request on server-side
+ * @param const int uid_dir_fd - directory handle of the requesting user's notes (see store_uid_dir)
  * @param const enum request_command cmd - request
- * @param const char *const sbj - null terminated / c-string sbj
+ * @param const char *const sbj - null terminated / c-string sbj. used as filename within uid_dir_fd
  * @param const uint32_t extra_data_len - length of extra data. set to 0 if none
  * @param const char *const extra_data - pointer to extra data. set to NULL if none and ignored if extra_data_len is 0
- * @param const int client_sock - endpoint to send response to (either w/ or withoutextra data)
+ * @param const int64_t expires_ns - ADD only. when the new note expires (realtime clock, nanoseconds), 0 for never
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds), for when there's no complete index to have caught expired notes. each note acted upon is checked against the expiry recorded on it (see store_note_expiry) & treated as absent (& deleted) once that's passed. 0 skips the check
+ * @param struct Response *const data_resp - response carrying data back (GET, GET_RANGE & APPEND). extra_data_content must point to MAX_EXTRA_DATA_LEN bytes. status is set to DATA if there's data to send, else left alone
  * @return int - non-zero exit code is success, else failure
  * 1 is error servicing request
  */
-int execute_request(const enum request_command cmd, const char *const sbj, const uint32_t extra_data_len, const char *const extra_data, const int client_sock);
+int execute_request(const int uid_dir_fd, const enum request_command cmd, const char *const sbj, const uint32_t extra_data_len, const char *const extra_data, const int64_t expires_ns, const int64_t now_ns, struct Response *const data_resp);
 
 #endif /* CLIENT_HANDLING_H */
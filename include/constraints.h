@@ -3,11 +3,16 @@
 #pragma once
 
 /**
- * @brief Header-only macros for constraining message lengths
+ * @brief Header-only macros for constraining message lengths, and identifying the wire protocol version
  * This isn't to be included directly - request and response will utilise these, respectively
  */
 
 #define MAX_SBJ_LEN 30 /* maximum subject length. excludes NULL terminator */
 #define MAX_EXTRA_DATA_LEN 2000 /* limit messages to 2000 characters. excludes NULL terminator */
 
+#define PROTOCOL_V1 1 /* original layout - packets start with their command / status byte, lengths in host byte order */
+#define PROTOCOL_V2 2 /* packets start with PROTOCOL_MAGIC & carry a request id. little endian throughout */
+#define PROTOCOL_MAGIC 0x3250424Eu /* "NBP2" on the wire. its first byte ('N') is never a valid v1 command or status, which is how the versions are told apart */
+#define PROTOCOL_MAGIC_BYTE ((uint8_t)(PROTOCOL_MAGIC & 0xFF))
+
 #endif /* CONSTRAINTS_H */
@@ -0,0 +1,132 @@
+#ifndef EXPIRY_H
+#define EXPIRY_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "constraints.h"
+#include "timer_wheel.h"
+
+/**
+ * @brief Declarations of note expiry - deleting notes added with a time to live (see REQUEST_FLAG_TTL) once it runs out
+ * Each expiring note gets a timer on a wheel ticking in seconds of the realtime clock. Expiry times outlive the process, so they're also kept in the index, its snapshot & an xattr on the note (see store.h)
+ * The index owns each note's timer (see IndexEntry::timer) - inserting a note with an expiry schedules one, & removing or replacing the note cancels it, so timers never outnumber expiring notes
+ * Fired timers are deleted at most NOTICEBOARD_EXPIRY_BATCH per pass of the event loop, so a mass expiry never holds requests up. Lookups treat a note as gone from the moment it expires, whether it has been deleted yet or not
+ * Relies on the index - without one, an expiring note is only hidden & deleted when a request for it finds its recorded expiry has passed (see execute_request)
+ */
+
+#ifndef NOTICEBOARD_EXPIRY_BATCH
+	#define NOTICEBOARD_EXPIRY_BATCH 64 /* expired notes deleted per pass of the event loop */
+#endif /* ifndef NOTICEBOARD_EXPIRY_BATCH */
+
+#if NOTICEBOARD_EXPIRY_BATCH < 1
+	#error "'NOTICEBOARD_EXPIRY_BATCH' must be positive"
+#endif /* if NOTICEBOARD_EXPIRY_BATCH < 1 */
+
+#ifndef NOTICEBOARD_EXPIRY_RETRY_S
+	#define NOTICEBOARD_EXPIRY_RETRY_S 60 /* seconds before an expired note which couldn't be deleted is tried again */
+#endif /* ifndef NOTICEBOARD_EXPIRY_RETRY_S */
+
+#if NOTICEBOARD_EXPIRY_RETRY_S < 1
+	#error "'NOTICEBOARD_EXPIRY_RETRY_S' must be positive"
+#endif /* if NOTICEBOARD_EXPIRY_RETRY_S < 1 */
+
+struct Store; /* see store.h */
+struct Index; /* see index.h */
+struct IndexEntry; /* likewise */
+
+/**
+ * @brief NoteExpiry (struct) - the timer of one expiring note
+ */
+struct NoteExpiry {
+	struct TimerLink link; /* first member, so a fired link is its NoteExpiry */
+
+	int due; /* boolean. set once fired - it's then on Expiry::due rather than the wheel, & freed by expiry_reap even if cancelled first */
+
+	uint32_t uid;
+
+	char sbj[MAX_SBJ_LEN + 1]; /* null terminated */
+};
+
+/**
+ * @brief Expiry (struct) - every pending expiry
+ */
+struct Expiry {
+	struct TimerWheel wheel; /* ticks are seconds since the epoch */
+
+	struct TimerLink due; /* fired timers whose notes are yet to be deleted */
+
+	size_t due_count;
+
+	uint64_t deleted; /* running total of notes deleted on expiry */
+};
+
+/**
+ * @brief expiry_init - sets up expiry with nothing pending
+ * @param struct Expiry *const expiry - struct to fill
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds)
+ */
+void expiry_init(struct Expiry *const expiry, const int64_t now_ns);
+
+/**
+ * @brief expiry_free - releases every pending timer. take it off the index first (see Index::expiry), as the index's entries are left pointing at them
+ * @param struct Expiry *const expiry - expiry from expiry_init
+ */
+void expiry_free(struct Expiry *const expiry);
+
+/**
+ * @brief expiry_schedule - sets a note to be deleted once it expires, replacing any timer it already has. called by the index (see index_insert)
+ * @param struct Expiry *const expiry - expiry state
+ * @param struct IndexEntry *const entry - the note's index entry, with its expiry time set. its timer is filled in
+ * @return int - zero is success, non-zero is failure
+ * 1 is error allocating (note is still hidden once expired, but only deleted by a later run)
+ */
+int expiry_schedule(struct Expiry *const expiry, struct IndexEntry *const entry);
+
+/**
+ * @brief expiry_cancel - drops a note's timer, if it has one. called by the index (see index_remove)
+ * @param struct Expiry *const expiry - expiry state
+ * @param struct IndexEntry *const entry - the note's index entry. its timer is cleared
+ */
+void expiry_cancel(struct Expiry *const expiry, struct IndexEntry *const entry);
+
+/**
+ * @brief expiry_load - schedules every expiring note in an index, then hands the index the expiry state so it keeps the timers up to date. call once, after index_build
+ * @param struct Expiry *const expiry - expiry state
+ * @param struct Index *const index - built index
+ * @return int - zero is success, non-zero is failure
+ * 1 is error allocating (some notes left unscheduled)
+ */
+int expiry_load(struct Expiry *const expiry, struct Index *const index);
+
+/**
+ * @brief expiry_next_ms - how long until expiry_reap could next have anything to do
+ * @param const struct Expiry *const expiry - expiry state
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds)
+ * @return int64_t - milliseconds (0 means now - e.g. a batch is still outstanding), -1 if nothing is pending
+ */
+int64_t expiry_next_ms(const struct Expiry *const expiry, const int64_t now_ns);
+
+/**
+ * @brief expiry_reap - deletes up to NOTICEBOARD_EXPIRY_BATCH expired notes. whatever's left over waits for the next call
+ * @param struct Expiry *const expiry - expiry state
+ * @param const struct Store *const store - opened store, with its index
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds)
+ * @return size_t - number of notes deleted
+ */
+size_t expiry_reap(struct Expiry *const expiry, const struct Store *const store, const int64_t now_ns);
+
+/**
+ * @brief expiry_delete - deletes one expired note from disk & the index, now
+ * @param const struct Store *const store - opened store
+ * @param const int uid_dir_fd - directory handle of the owner's notes
+ * @param const uid_t uid - owner
+ * @param const char *const sbj - null terminated subject
+ * @return int - zero is success (including the note already being gone), non-zero is failure
+ * 1 is error deleting
+ */
+int expiry_delete(const struct Store *const store, const int uid_dir_fd, const uid_t uid, const char *const sbj);
+
+#endif /* EXPIRY_H */
@@ -0,0 +1,49 @@
+#ifndef FD_TRANSFER_H
+#define FD_TRANSFER_H
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @brief Declarations of functionality to hand file descriptors between processes over a UNIX socket (SCM_RIGHTS)
+ */
+
+#define MAX_TRANSFER_FDS 4 /* most handles sent in one go */
+
+/**
+ * @brief fd_send - sends file descriptors (plus one marker byte, as ancillary data can't travel alone) over a UNIX socket
+ * @param const int sock - connected UNIX socket
+ * @param const int *const fds - handles to send
+ * @param const size_t fd_count - number of handles. 1 to MAX_TRANSFER_FDS
+ * @return int - zero is success, non-zero is failure
+ * 1 is error encoding, 2 is error sending
+ */
+int fd_send(const int sock, const int *const fds, const size_t fd_count);
+
+/**
+ * @brief fd_recv - receives file descriptors sent by fd_send
+ * Handles received are set close-on-exec. If fewer than expected arrive, any which did are closed
+ * @param const int sock - connected UNIX socket
+ * @param int *const fds - array to fill with received handles
+ * @param const size_t fd_count - exact number of handles expected. 1 to MAX_TRANSFER_FDS
+ * @return int - zero is success, non-zero is failure
+ * 1 is error receiving, 2 is error decoding (wrong number / kind of ancillary data)
+ */
+int fd_recv(const int sock, int *const fds, const size_t fd_count);
+
+/**
+ * @brief fd_recv_stream - reads whatever stream data is available, keeping any handles which arrive alongside it
+ * For non-blocking readers which can't know in advance where fd_send's marker byte falls - the marker is left in buf like any other byte
+ * Handles received are set close-on-exec. Any beyond what fds has room for are closed
+ * @param const int sock - connected UNIX socket
+ * @param void *const buf - buffer to read into
+ * @param const size_t buf_len - capacity of buf
+ * @param int *const fds - array to append received handles to
+ * @param size_t *const fd_count - number of handles already in fds. increased by however many are appended
+ * @param const size_t fd_cap - capacity of fds
+ * @return ssize_t - bytes read, 0 if the peer has hung up, -1 on error (errno set - EAGAIN if nothing is available)
+ */
+ssize_t fd_recv_stream(const int sock, void *const buf, const size_t buf_len, int *const fds, size_t *const fd_count, const size_t fd_cap);
+
+#endif /* FD_TRANSFER_H */
@@ -0,0 +1,138 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "client_handling.h"
+
+/**
+ * @brief Declarations of listening-socket handoff - replacing a running server without ever refusing a connection
+ * A new server started with --takeover connects to the running one's control socket - owner-only (0600, SO_PEERCRED uid must equal the server's euid) - & sends a HandoffHeader. The running server reads that from its event loop, as it does requests, so a connection which never sends one holds no one up. It then:
+ * - stops accepting - new connections queue in the listening socket's backlog, which stays bound throughout
+ * - drains: each session is parked (no longer polled) once it's between requests. sessions still mid-request after NOTICEBOARD_HANDOFF_DRAIN_MS are closed
+ * - snapshots its index (the warm state), so the new server's index is rebuilt from it without rescanning anyone
+ * - copies its hot tier & frequency sketch into a sealed memfd (see tier_save), so the new server's cache starts as warm as its index
+ * - passes the listening & control sockets (& that memfd), then every parked session's socket (& ring handles), over the control connection with SCM_RIGHTS, & exits
+ * The new server picks every session up where it was left - requests the clients sent meanwhile are simply waiting in their sockets (or rings)
+ * Messages are in native byte order - both ends are on the one host
+ */
+
+#ifndef NOTICEBOARD_HANDOFF_DRAIN_MS
+	#define NOTICEBOARD_HANDOFF_DRAIN_MS 5000 /* longest a handoff waits on sessions part way through a request */
+#endif /* ifndef NOTICEBOARD_HANDOFF_DRAIN_MS */
+
+#if NOTICEBOARD_HANDOFF_DRAIN_MS < 0
+	#error "'NOTICEBOARD_HANDOFF_DRAIN_MS' mustn't be negative"
+#endif /* if NOTICEBOARD_HANDOFF_DRAIN_MS < 0 */
+
+#define HANDOFF_REQUEST_TIMEOUT_MS 1000 /* for the new server to say what it wants, once connected. it's given up on after this */
+#define HANDOFF_MAGIC 0x4F48424Eu /* "NBHO" */
+#define HANDOFF_VERSION 2u
+#define HANDOFF_FLAG_TIER_STATE 0x1u /* HandoffHeader::flags. the hot tier's state (see tier_save) follows the listening & control sockets, in the same SCM_RIGHTS message */
+
+/**
+ * @brief HandoffHeader (struct) - opens each direction of a handoff. the new server's has a session_count of 0
+ * The old server follows its own with the listening & control sockets (& the hot tier's state, if flagged) in one fd_send, then per session a uint32_t handle count (1, or 4 with a ring - socket, memfd, request & response doorbells) & those handles (one fd_send)
+ */
+struct HandoffHeader {
+	uint32_t magic; /* HANDOFF_MAGIC */
+
+	uint32_t version; /* HANDOFF_VERSION */
+
+	uint64_t session_count;
+
+	uint64_t flags; /* HANDOFF_FLAG_* bits. 0 from the new server */
+};
+
+/**
+ * @brief HandoffSession (struct) - a session as received, not yet resumed
+ */
+struct HandoffSession {
+	int fds[MAX_TRANSFER_FDS]; /* socket, then (if has_ring) memfd, request & response doorbells. -1 once taken */
+
+	int has_ring; /* boolean */
+};
+
+/**
+ * @brief HandoffRequest (struct) - a connection to the control socket, whilst its HandoffHeader arrives
+ */
+struct HandoffRequest {
+	int peer; /* non-blocking until the header is complete. -1 if there's no request */
+
+	pid_t pid; /* of the peer, for reporting */
+
+	size_t received; /* bytes of header so far */
+
+	struct HandoffHeader header;
+};
+
+/**
+ * @brief Handoff (struct) - everything a new server takes over
+ */
+struct Handoff {
+	int listener; /* listening socket. -1 once taken */
+
+	int control; /* listening control socket, for the next handoff. -1 once taken */
+
+	int tier_state; /* hot tier & frequency sketch (see tier_restore). -1 if none came, or once taken */
+
+	struct HandoffSession *sessions;
+	size_t session_count;
+};
+
+/**
+ * @brief handoff_listen - creates the control socket a later server takes over through
+ * @param const char *const name - socketfile to bind. any left by an earlier (stopped) server is replaced
+ * @return int - listening socket, or -1 on failure
+ */
+int handoff_listen(const char *const name);
+
+/**
+ * @brief handoff_accept - accepts a connection on the control socket, if it's from our own user. nothing is read from it yet (see handoff_read)
+ * @param const int control - listening control socket
+ * @param struct HandoffRequest *const request - filled with the connection (non-blocking) to poll for readability
+ * @return int - zero is success, non-zero is failure
+ * 1 is refused or error accepting (request->peer is -1)
+ */
+int handoff_accept(const int control, struct HandoffRequest *const request);
+
+/**
+ * @brief handoff_read - reads whatever's arrived of a takeover request, without blocking
+ * @param struct HandoffRequest *const request - from handoff_accept
+ * @return int - 0 is complete & valid (request->peer is made blocking, & is the connection to hand over through), 1 is incomplete (poll again), 2 is refused - invalid, or the peer hung up (request->peer is closed & -1)
+ */
+int handoff_read(struct HandoffRequest *const request);
+
+/**
+ * @brief handoff_send - passes the listening & control sockets, then every open session, to the new server
+ * Each session is passed as is - the caller should only be left with sessions between requests (see session_idle)
+ * @param const int peer - connection whose request handoff_read completed. not closed
+ * @param const int listener - listening socket
+ * @param const int control - listening control socket
+ * @param const int tier_state - hot tier's state from tier_save, -1 for none. not closed
+ * @param const struct Session *const sessions - session table. those with a socket are passed
+ * @param const size_t session_cap - length of sessions
+ * @return int - zero is success, non-zero is failure
+ * 1 is error sending the listening sockets (the new server hasn't taken over - carry on), 2 is error sending a session (it has - that & later sessions are lost)
+ */
+int handoff_send(const int peer, const int listener, const int control, const int tier_state, const struct Session *const sessions, const size_t session_cap);
+
+/**
+ * @brief handoff_receive - takes over from the server running behind a control socket. blocks until it has drained
+ * @param const char *const name - control socketfile of the running server
+ * @param struct Handoff *const handoff - filled with what was taken over. release with handoff_free
+ * @return int - zero is success, non-zero is failure
+ * 1 is error connecting (nothing is running), 2 is error receiving. if the listening socket arrived before the error, it's been taken over regardless - along with the sessions which arrived
+ */
+int handoff_receive(const char *const name, struct Handoff *const handoff);
+
+/**
+ * @brief handoff_free - closes whatever of a handoff hasn't been taken
+ * @param struct Handoff *const handoff - from handoff_receive
+ */
+void handoff_free(struct Handoff *const handoff);
+
+#endif /* HANDOFF_H */
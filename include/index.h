@@ -0,0 +1,228 @@
+#ifndef INDEX_H
+#define INDEX_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "request.h"
+#include "store.h"
+
+struct Expiry; /* see expiry.h */
+struct NoteExpiry; /* likewise */
+
+/**
+ * @brief Declarations of the in-memory index of every note in the store
+ * Lets the server answer "does this note exist", "which notes does this user have" & "when does this note expire" without touching the filesystem
+ * Rebuilding it means a readdir & stat of every note, so it's also persisted as a snapshot:
+ * - written atomically (temporary file then rename) on clean shutdown & periodically whilst running, if anything has changed
+ * - memory-mapped & checksummed at startup. Each user's notes are trusted only if their uid directory's mtime is unchanged since the snapshot, and older than the snapshot itself (so a change made within the same timestamp tick isn't missed)
+ * - any user failing that check (or missing from the snapshot) is rescanned from disk. no usable snapshot at all means everyone is
+ * Snapshots use native byte order - they're a cache for this host, not an interchange format (see archive.h for that)
+ * Packed (cold) notes are indexed like any other, with where their record sits in the user's pack (see pack.h). packing or unpacking always changes the uid directory's mtime, so snapshots stay honest about them
+ */
+
+#define INDEX_SNAPSHOT_MAGIC 0x4E424958u /* "NBIX" */
+#define INDEX_SNAPSHOT_VERSION 3u
+#define INDEX_TOMBSTONE 0xFF /* IndexEntry::sbj_len of a removed entry. probing continues past these */
+#define INDEX_ORDER_LEVELS 16 /* height cap of the views' skip lists. with 1 in 4 nodes promoted per level, plenty for billions of notes */
+
+/**
+ * @brief IndexEntry (struct) - one note. sbj_len of 0 marks an empty slot
+ */
+struct IndexEntry {
+	int64_t created_ns; /* creation time (realtime clock, nanoseconds). rescanned notes use their mtime */
+
+	int64_t expires_ns; /* when the note expires (realtime clock, nanoseconds). 0 means never. an entry past this is treated as absent, deleted yet or not (see expiry.h) */
+
+	uint64_t pack_offset; /* its record in the user's pack if the note is cold (see pack.h). 0 means it's a plain file */
+
+	int64_t read_ns; /* when the note was last read (realtime clock, nanoseconds). starts as created_ns. rescanned notes use the later of their mtime & atime */
+
+	struct NoteExpiry *timer; /* its pending expiry, owned by Index::expiry. NULL if it has none, or expiry isn't tracked. never snapshotted */
+
+	uint32_t uid; /* owner */
+
+	uint32_t size; /* length of note body */
+
+	uint8_t sbj_len; /* 1 to MAX_SBJ_LEN, 0 if empty, INDEX_TOMBSTONE if removed */
+
+	char sbj[MAX_SBJ_LEN]; /* not null terminated */
+};
+
+/**
+ * @brief IndexOrderNode (struct) - one note in one of the index's views. a skip list node, ordered by uid then subject (bytewise) in the ordered view, or by uid, creation time then subject in the time view
+ */
+struct IndexOrderNode {
+	int64_t created_ns; /* time view only. 0 in the ordered view */
+
+	uint32_t uid;
+
+	uint8_t sbj_len;
+
+	char sbj[MAX_SBJ_LEN]; /* not null terminated */
+
+	uint8_t height; /* number of levels this node is linked into. 1 to INDEX_ORDER_LEVELS */
+
+	struct IndexOrderNode *next[]; /* one per level */
+};
+
+/**
+ * @brief Index (struct) - open-addressed (linear probing) hash table of IndexEntry, keyed by uid & subject
+ * Alongside it, two skip lists of the same notes, so one user's notes can be walked from any point without visiting anybody else's:
+ * - the ordered view, by subject (see index_list)
+ * - the time view, by creation time (see index_since)
+ */
+struct Index {
+	struct IndexEntry *slots;
+
+	struct IndexOrderNode *order; /* head of the ordered view - a sentinel linked into every level */
+
+	struct IndexOrderNode *by_time; /* head of the time view - likewise */
+
+	uint64_t order_seed; /* xorshift state, picks each new node's height */
+
+	size_t cap; /* number of slots. power of two */
+
+	size_t count; /* live entries */
+
+	size_t used; /* live entries plus tombstones - decides when to rehash */
+
+	size_t packed; /* live entries which are packed */
+
+	uint64_t generation; /* bumped on every change. lets periodic snapshots be skipped when nothing happened */
+
+	struct Expiry *expiry; /* timers of every expiring note, scheduled & cancelled as entries are inserted, replaced & removed. NULL until expiry_load */
+
+	int complete; /* boolean. cleared if an insert ever failed - from then on, a missing entry can't be taken to mean a missing note */
+};
+
+/**
+ * @brief index_init - creates an empty index
+ * @param struct Index *const index - index struct to fill
+ * @param const size_t expected - number of notes expected (sizes the table up front). 0 is fine
+ * @return int - zero is success, non-zero is failure
+ * 1 is error allocating
+ */
+int index_init(struct Index *const index, const size_t expected);
+
+/**
+ * @brief index_free - releases an index
+ * @param struct Index *const index - index from index_init
+ */
+void index_free(struct Index *const index);
+
+/**
+ * @brief index_find - looks a note up
+ * @param const struct Index *const index - index
+ * @param const uid_t uid - owner
+ * @param const char *const sbj - null terminated subject
+ * @return const struct IndexEntry* - entry, NULL if absent
+ */
+const struct IndexEntry *index_find(const struct Index *const index, const uid_t uid, const char *const sbj);
+
+/**
+ * @brief index_insert - adds (or replaces) a note's entry. the note is taken to be a plain file (see index_set_pack). a changed expiry time moves the note's timer
+ * @param struct Index *const index - index
+ * @param const uid_t uid - owner
+ * @param const char *const sbj - null terminated subject. 1 to MAX_SBJ_LEN characters
+ * @param const uint32_t size - length of note body
+ * @param const int64_t created_ns - creation time, nanoseconds since the epoch
+ * @param const int64_t expires_ns - expiry time, nanoseconds since the epoch. 0 for never
+ * @return int - zero is success, non-zero is failure
+ * 1 is error allocating (index marked incomplete), 2 is invalid subject
+ */
+int index_insert(struct Index *const index, const uid_t uid, const char *const sbj, const uint32_t size, const int64_t created_ns, const int64_t expires_ns);
+
+/**
+ * @brief index_remove - drops a note's entry, cancelling its timer
+ * @param struct Index *const index - index
+ * @param const uid_t uid - owner
+ * @param const char *const sbj - null terminated subject
+ * @return int - zero is success, non-zero is failure
+ * 1 is no such entry
+ */
+int index_remove(struct Index *const index, const uid_t uid, const char *const sbj);
+
+/**
+ * @brief index_set_pack - records that a note has been packed, moved within its pack, or unpacked
+ * @param struct Index *const index - index
+ * @param const uid_t uid - owner
+ * @param const char *const sbj - null terminated subject
+ * @param const uint64_t pack_offset - its record in the user's pack. 0 once it's a plain file again
+ * @return int - zero is success, non-zero is failure
+ * 1 is no such entry
+ */
+int index_set_pack(struct Index *const index, const uid_t uid, const char *const sbj, const uint64_t pack_offset);
+
+/**
+ * @brief index_touch - records that a note has been read. not a change worth snapshotting for on its own
+ * @param struct Index *const index - index
+ * @param const uid_t uid - owner
+ * @param const char *const sbj - null terminated subject
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds)
+ * @return const struct IndexEntry* - entry, NULL if absent
+ */
+const struct IndexEntry *index_touch(struct Index *const index, const uid_t uid, const char *const sbj, const int64_t now_ns);
+
+/**
+ * @brief index_next - finds the note ordered next after a key, whoever's it is. for sweeps across the whole index a few notes at a time
+ * @param const struct Index *const index - index
+ * @param const uid_t uid - owner of the key
+ * @param const char *const after - subject of the key (not null terminated)
+ * @param const size_t after_len - length of after. 0 (with a uid of 0) starts from the very first note
+ * @return const struct IndexEntry* - entry, NULL if none is ordered after the key
+ */
+const struct IndexEntry *index_next(const struct Index *const index, const uid_t uid, const char *const after, const size_t after_len);
+
+/**
+ * @brief index_list - pages through one user's notes in subject order (bytewise)
+ * @param const struct Index *const index - index
+ * @param const uid_t uid - owner
+ * @param const char *const after - subject to resume after (not null terminated). only notes ordered after it are listed
+ * @param const size_t after_len - length of after. 0 starts from the beginning
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds). expired notes are skipped
+ * @param char (*const sbjs)[MAX_SBJ_LEN + 1] - filled with null terminated subjects
+ * @param const size_t max - capacity of sbjs
+ * @return size_t - number of subjects listed. fewer than max means there are no more
+ */
+size_t index_list(const struct Index *const index, const uid_t uid, const char *const after, const size_t after_len, const int64_t now_ns, char (*const sbjs)[MAX_SBJ_LEN + 1], const size_t max);
+
+/**
+ * @brief index_since - pages through one user's notes created within a window, oldest first (ties in subject order)
+ * @param const struct Index *const index - index
+ * @param const uid_t uid - owner
+ * @param const int64_t from_ns - start of the window (realtime clock, nanoseconds). inclusive
+ * @param const int64_t until_ns - end of the window (realtime clock, nanoseconds). exclusive. 0 is no end
+ * @param const int64_t after_ns - creation time of the note to resume after. ignored if after_len is 0
+ * @param const char *const after - subject of the note to resume after (not null terminated). only notes ordered after it are listed
+ * @param const size_t after_len - length of after. 0 starts from the beginning of the window
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds). expired notes are skipped
+ * @param struct IndexEntry *const found - filled with copies of the notes' entries
+ * @param const size_t max - capacity of found
+ * @return size_t - number of notes listed. fewer than max means there are no more
+ */
+size_t index_since(const struct Index *const index, const uid_t uid, const int64_t from_ns, const int64_t until_ns, const int64_t after_ns, const char *const after, const size_t after_len, const int64_t now_ns, struct IndexEntry *const found, const size_t max);
+
+/**
+ * @brief index_build - fills an empty index from the store, reusing the snapshot for every user it's still valid for
+ * @param struct Index *const index - empty index from index_init
+ * @param const struct Store *const store - opened store. the snapshot lives in its root directory
+ * @param const char *const snapshot_name - snapshot filename. should begin with '.' so it can never clash with a uid directory or legacy note
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the store
+ */
+int index_build(struct Index *const index, const struct Store *const store, const char *const snapshot_name);
+
+/**
+ * @brief index_snapshot - persists the index
+ * @param const struct Index *const index - index. nothing is written if it's incomplete
+ * @param const struct Store *const store - opened store
+ * @param const char *const snapshot_name - as per index_build
+ * @return int - zero is success, non-zero is failure
+ * 1 is error allocating, 2 is error writing
+ */
+int index_snapshot(const struct Index *const index, const struct Store *const store, const char *const snapshot_name);
+
+#endif /* INDEX_H */
@@ -0,0 +1,207 @@
+#ifndef LIBNOTE_H
+#define LIBNOTE_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "request.h"
+
+/**
+ * @brief Declarations of the embeddable client library (libnote)
+ * A handle keeps one connection to `noticeboard` open across any number of operations, so services needn't spawn `note` (and connect afresh) per note
+ * Note contents are returned straight into caller-provided buffers
+ * Requests are sent in protocol v2, each with its own id. Responses are matched back to operations by id, so they may complete in any order
+ * Operation return codes are shared - 0 is success, 1 is error communicating (handle is no longer usable, close it), 2 is request refused by server (e.g. note missing or already exists), 3 is invalid arguments (e.g. subject too long, buffer too small), 4 is server busy (over this user's rate limit, or overloaded) - nothing was done, retry later
+ */
+
+#define NOTE_OPEN_RING 0x1 /* note_open flag. requests & responses travel through a shared-memory ring (see ring.h) rather than the socket */
+
+#define NOTE_BATCH_WINDOW 32 /* most operations in flight at once during note_batch. keeps both directions' socket buffers from filling (& deadlocking) */
+
+struct NoteHandle; /* opaque */
+
+/**
+ * @brief NoteOp (struct) - one operation of a batch
+ */
+struct NoteOp {
+	uint8_t cmd; /* (uint8_t)request_command::ADD, GET, REMOVE, GET_RANGE, APPEND, LIST or SINCE */
+
+	const char *sbj; /* null terminated subject. 1 to MAX_SBJ_LEN characters. LIST & SINCE ignore it, but it must still be valid */
+
+	const void *content; /* ADD & APPEND only - note content (or what to add to it). LIST only - the cursor, as the last page ended with (see LIST_*). SINCE only - the window, then the cursor (see SINCE_*) */
+
+	uint32_t content_len; /* ADD & APPEND only - length of content. 0 to MAX_EXTRA_DATA_LEN (less REQUEST_TTL_LEN when ttl_s is set) */
+
+	uint32_t ttl_s; /* ADD only - seconds until the note expires & is deleted, 0 for never */
+
+	void *buf; /* GET, GET_RANGE, LIST & SINCE only - buffer to receive content (or the raw page) */
+
+	uint32_t buf_len; /* GET & GET_RANGE only - capacity of buf. for GET_RANGE, also how much is asked for (at most MAX_EXTRA_DATA_LEN is sent) */
+
+	uint64_t offset; /* GET_RANGE only - where in the note to start reading */
+
+	uint32_t result_len; /* GET, GET_RANGE, LIST & SINCE only - filled with length of content received */
+
+	uint64_t note_len; /* APPEND only - filled with the note's length afterwards (i.e. where the next append will start) */
+
+	int result; /* filled with outcome (see return codes above) */
+};
+
+/**
+ * @brief NoteListing (struct) - one note, as listed by note_list or note_since
+ */
+struct NoteListing {
+	char sbj[MAX_SBJ_LEN + 1]; /* null terminated */
+
+	uint64_t size; /* length of note */
+
+	int64_t mtime_ns; /* last modified (note_list) or created (note_since), nanoseconds since the epoch */
+};
+
+/**
+ * @brief NoteCursor (struct) - how far through a listing note_list (or note_since) has got. opaque. one listing's cursor means nothing to the other
+ */
+struct NoteCursor {
+	uint8_t len; /* 0 before the first page, & again after the last */
+
+	uint8_t data[SINCE_CURSOR_MAX_LEN]; /* the longer of the two */
+};
+
+/**
+ * @brief note_open - connects to `noticeboard`
+ * @param const char *const socket_path - path to server's socketfile
+ * @param const int flags - bitwise OR of NOTE_OPEN_* flags, or 0
+ * @return struct NoteHandle* - connection handle, NULL on failure
+ */
+struct NoteHandle *note_open(const char *const socket_path, const int flags);
+
+/**
+ * @brief note_close - disconnects & frees a handle
+ * @param struct NoteHandle *const handle - handle from note_open. NULL is ignored
+ * @return int - zero is success, non-zero is failure
+ * 1 is error releasing a resource
+ */
+int note_close(struct NoteHandle *const handle);
+
+/**
+ * @brief note_add - creates a note
+ * @param struct NoteHandle *const handle - open handle
+ * @param const char *const sbj - null terminated subject
+ * @param const void *const content - note content
+ * @param const uint32_t content_len - length of content. 0 to MAX_EXTRA_DATA_LEN
+ * @return int - see return codes above
+ */
+int note_add(struct NoteHandle *const handle, const char *const sbj, const void *const content, const uint32_t content_len);
+
+/**
+ * @brief note_add_ttl - creates a note which expires after a while
+ * From then on it can no longer be read, appended to or removed, & the server deletes it soon after
+ * @param struct NoteHandle *const handle - open handle
+ * @param const char *const sbj - null terminated subject
+ * @param const void *const content - note content
+ * @param const uint32_t content_len - length of content. 0 to MAX_EXTRA_DATA_LEN - REQUEST_TTL_LEN
+ * @param const uint32_t ttl_s - seconds until it expires. 0 for never (same as note_add)
+ * @return int - see return codes above
+ */
+int note_add_ttl(struct NoteHandle *const handle, const char *const sbj, const void *const content, const uint32_t content_len, const uint32_t ttl_s);
+
+/**
+ * @brief note_get - reads a whole note into a caller-provided buffer
+ * A response carries at most MAX_EXTRA_DATA_LEN bytes, but APPEND grows notes past that - the rest is fetched with GET_RANGE, a page at a time, until one comes back short. pages are separate requests, so an append landing part way through may be partly seen
+ * @param struct NoteHandle *const handle - open handle
+ * @param const char *const sbj - null terminated subject
+ * @param void *const buf - buffer to receive content. not null terminated
+ * @param const uint32_t buf_len - capacity of buf. at least MAX_EXTRA_DATA_LEN, else a note longer than buf_len may be refused outright (3, content_len filled with the length of the response that didn't fit). a note's length is as note_list reports & note_append returns
+ * @param uint32_t *const content_len - filled with length of content received
+ * @return int - see return codes above. 3 with content_len equal to buf_len means the note is longer than buf - buf holds its start, & note_get_range can fetch the rest
+ */
+int note_get(struct NoteHandle *const handle, const char *const sbj, void *const buf, const uint32_t buf_len, uint32_t *const content_len);
+
+/**
+ * @brief note_get_range - reads a slice of a note into a caller-provided buffer, so only that slice crosses the connection
+ * @param struct NoteHandle *const handle - open handle
+ * @param const char *const sbj - null terminated subject
+ * @param const uint64_t offset - where in the note to start reading
+ * @param void *const buf - buffer to receive content. not null terminated
+ * @param const uint32_t buf_len - capacity of buf, & how much to read. at most MAX_EXTRA_DATA_LEN is read at once
+ * @param uint32_t *const content_len - filled with length of content received. less than asked for (0 if offset is at or past the end) when the note runs out
+ * @return int - see return codes above
+ */
+int note_get_range(struct NoteHandle *const handle, const char *const sbj, const uint64_t offset, void *const buf, const uint32_t buf_len, uint32_t *const content_len);
+
+/**
+ * @brief note_append - adds content to the end of an existing note, without sending the rest of it
+ * @param struct NoteHandle *const handle - open handle
+ * @param const char *const sbj - null terminated subject
+ * @param const void *const content - content to add
+ * @param const uint32_t content_len - length of content. 0 to MAX_EXTRA_DATA_LEN
+ * @param uint64_t *const note_len - filled with the note's length afterwards. NULL if not wanted
+ * @return int - see return codes above. 2 includes the note not existing, or growing past the server's limit
+ */
+int note_append(struct NoteHandle *const handle, const char *const sbj, const void *const content, const uint32_t content_len, uint64_t *const note_len);
+
+/**
+ * @brief note_remove - deletes a note
+ * @param struct NoteHandle *const handle - open handle
+ * @param const char *const sbj - null terminated subject
+ * @return int - see return codes above
+ */
+int note_remove(struct NoteHandle *const handle, const char *const sbj);
+
+/**
+ * @brief note_list - lists the next page of the caller's notes, in subject order
+ * Call with a zeroed cursor for the first page, then again with the cursor it hands back until its len is 0
+ * @param struct NoteHandle *const handle - open handle
+ * @param struct NoteCursor *const cursor - where to carry on from. updated to where the next page starts
+ * @param struct NoteListing *const listings - filled with the page's notes. must hold LIST_PAGE_MAX_ENTRIES
+ * @param size_t *const listing_count - filled with number of notes in the page. may be 0 even with more to come
+ * @return int - see return codes above
+ */
+int note_list(struct NoteHandle *const handle, struct NoteCursor *const cursor, struct NoteListing *const listings, size_t *const listing_count);
+
+/**
+ * @brief note_since - lists the next page of the caller's notes created within a time window, oldest first
+ * Call with a zeroed cursor for the first page, then again (with the same window) with the cursor it hands back until its len is 0
+ * @param struct NoteHandle *const handle - open handle
+ * @param const int64_t from_ns - start of the window, nanoseconds since the epoch. inclusive
+ * @param const int64_t until_ns - end of the window, nanoseconds since the epoch. exclusive. 0 for no end
+ * @param struct NoteCursor *const cursor - where to carry on from. updated to where the next page starts
+ * @param struct NoteListing *const listings - filled with the page's notes. must hold SINCE_PAGE_MAX_ENTRIES
+ * @param size_t *const listing_count - filled with number of notes in the page
+ * @return int - see return codes above
+ */
+int note_since(struct NoteHandle *const handle, const int64_t from_ns, const int64_t until_ns, struct NoteCursor *const cursor, struct NoteListing *const listings, size_t *const listing_count);
+
+/**
+ * @brief note_batch - pipelines many operations over the one connection, rather than waiting out a round trip per operation
+ * @param struct NoteHandle *const handle - open handle
+ * @param struct NoteOp *const ops - operations, sent in order (though the server may complete them in any). each op's result (& result_len) is filled in
+ * @param const size_t op_count - number of operations
+ * @return int - zero if every operation succeeded, else the first non-zero result. if 1, later operations may not have been attempted (their result is left as 1)
+ */
+int note_batch(struct NoteHandle *const handle, struct NoteOp *const ops, const size_t op_count);
+
+/**
+ * @brief note_export - has the server stream every note (of every user) into an archive (see archive.h). admin only
+ * The archive is written through a handle passed to the server, so it needn't be reachable from inside the server's chroot
+ * Always travels over the socket, even on a ring handle
+ * @param struct NoteHandle *const handle - open handle
+ * @param const int archive_fd - writable handle (file, pipe or socket) to receive the archive. left open
+ * @param uint64_t *const note_count - filled with number of notes exported. may be NULL
+ * @return int - see return codes above
+ */
+int note_export(struct NoteHandle *const handle, const int archive_fd, uint64_t *const note_count);
+
+/**
+ * @brief note_import - has the server create a note for every record of an archive (as written by note_export). admin only
+ * Existing notes are left alone. The server syncs once the whole archive has been written out, rather than per note
+ * Always travels over the socket, even on a ring handle
+ * @param struct NoteHandle *const handle - open handle
+ * @param const int archive_fd - readable handle to the archive. left open
+ * @param uint64_t *const note_count - filled with number of notes imported. may be NULL
+ * @return int - see return codes above
+ */
+int note_import(struct NoteHandle *const handle, const int archive_fd, uint64_t *const note_count);
+
+#endif /* LIBNOTE_H */
@@ -0,0 +1,59 @@
+#ifndef LISTING_H
+#define LISTING_H
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "request.h"
+#include "store.h"
+
+/**
+ * @brief Declarations of note listing - answering LIST requests a page at a time
+ * Notes are listed in subject order (bytewise), resuming after the cursor the previous page ended with. Cursors name a position rather than an offset, so notes added or removed between pages never cause others to be skipped or repeated
+ * Each page is built on its own - nothing is held between pages, & nothing beyond one page is ever gathered:
+ * - with a complete index, its ordered view is walked straight from the cursor
+ * - without one, the user's directory is read once per page, keeping only the smallest few subjects past the cursor
+ * Sizes & mtimes come from a stat of each listed note, so they're as fresh as the page itself
+ * SINCE requests are answered the same way, a page at a time, but oldest first within a time window:
+ * - with a complete index, its time view is walked straight from the window's start (or the cursor) to its end, so a page costs the same however many notes the user has
+ * - without one, the user's directory is read & every note statted once per page. mtime stands in for creation time, as it does when the index rescans
+ */
+
+#ifndef NOTICEBOARD_LIST_PAGE
+	#define NOTICEBOARD_LIST_PAGE 64 /* most notes listed per page. pages also stop once MAX_EXTRA_DATA_LEN is full */
+#endif /* ifndef NOTICEBOARD_LIST_PAGE */
+
+#if NOTICEBOARD_LIST_PAGE < 1 || NOTICEBOARD_LIST_PAGE > SINCE_PAGE_MAX_ENTRIES
+	#error "'NOTICEBOARD_LIST_PAGE' must be between 1 and SINCE_PAGE_MAX_ENTRIES"
+#endif /* if NOTICEBOARD_LIST_PAGE < 1 || NOTICEBOARD_LIST_PAGE > SINCE_PAGE_MAX_ENTRIES */
+
+/**
+ * @brief listing_page - builds one page of a user's notes
+ * @param const struct Store *const store - opened store (its index is used if complete)
+ * @param const uid_t uid - owner of the notes to list
+ * @param const uint8_t *const cursor - cursor which ended the previous page. ignored if cursor_len is 0
+ * @param const uint32_t cursor_len - length of cursor. 0 for the first page
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds). expired notes aren't listed
+ * @param uint8_t *const page - filled with the page (see LIST_*). must hold MAX_EXTRA_DATA_LEN bytes
+ * @param uint32_t *const page_len - filled with length of page
+ * @return int - zero is success, non-zero is failure
+ * 1 is invalid cursor, 2 is error reading the store
+ */
+int listing_page(const struct Store *const store, const uid_t uid, const uint8_t *const cursor, const uint32_t cursor_len, const int64_t now_ns, uint8_t *const page, uint32_t *const page_len);
+
+/**
+ * @brief listing_since - builds one page of a user's notes created within a time window
+ * @param const struct Store *const store - opened store (its index is used if complete)
+ * @param const uid_t uid - owner of the notes to list
+ * @param const uint8_t *const query - the window (see REQUEST_SINCE_LEN), then the cursor which ended the previous page (none for the first)
+ * @param const uint32_t query_len - length of query
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds). expired notes aren't listed
+ * @param uint8_t *const page - filled with the page (see SINCE_*). must hold MAX_EXTRA_DATA_LEN bytes
+ * @param uint32_t *const page_len - filled with length of page
+ * @return int - zero is success, non-zero is failure
+ * 1 is invalid window or cursor, 2 is error reading the store
+ */
+int listing_since(const struct Store *const store, const uid_t uid, const uint8_t *const query, const uint32_t query_len, const int64_t now_ns, uint8_t *const page, uint32_t *const page_len);
+
+#endif /* LISTING_H */
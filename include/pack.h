@@ -0,0 +1,190 @@
+#ifndef PACK_H
+#define PACK_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constraints.h"
+
+/**
+ * @brief Declarations of pack files - the cold tier, where rarely read notes are kept compressed (see tier.h)
+ * Each user has at most one pack, NOTICEBOARD_PACK_NAME in their uid directory. A packed note has no file of its own - its record in the pack is the note
+ * Layout - every integer is little endian, as packs hold notes rather than a cache of them:
+ * - header (PACK_HEADER_LEN): magic (uint32_t, PACK_MAGIC), version (uint32_t, PACK_VERSION), end (uint64_t), dead (uint64_t), 8 reserved bytes
+ * - records, up to end: PACK_RECORD_FIXED_LEN bytes (see below), subject, then stored_len bytes of (possibly compressed) body
+ * Records are only ever appended past end, synced, & then end is moved over them - anything beyond end is a torn append, & is written over by the next
+ * Removing (or unpacking) a note clears its record's PACK_FLAG_LIVE & adds it to dead. A pack mostly dead is worth compacting (see pack_compact_begin)
+ * A note with a plain file as well as a live record (a crash part way through packing or unpacking) is the file - the record is killed when the user is next rescanned (see index.h)
+ * Compression is LZ77, LZ4 style - fast to decompress, & needing nothing beyond a small table to compress. bodies it wouldn't shrink are stored as they are
+ */
+
+#ifndef NOTICEBOARD_PACK_NAME
+	#define NOTICEBOARD_PACK_NAME ".pack" /* within each uid directory. leading '.' keeps it clear of subjects */
+#endif /* ifndef NOTICEBOARD_PACK_NAME */
+
+#ifndef NOTICEBOARD_COLD_MAX_LEN
+	#define NOTICEBOARD_COLD_MAX_LEN (64 * 1024) /* bytes. longer notes are never packed */
+#endif /* ifndef NOTICEBOARD_COLD_MAX_LEN */
+
+#if NOTICEBOARD_COLD_MAX_LEN < MAX_EXTRA_DATA_LEN || NOTICEBOARD_COLD_MAX_LEN > (16 * 1024 * 1024)
+	#error "'NOTICEBOARD_COLD_MAX_LEN' must be between MAX_EXTRA_DATA_LEN and 16MiB"
+#endif /* if NOTICEBOARD_COLD_MAX_LEN < MAX_EXTRA_DATA_LEN || NOTICEBOARD_COLD_MAX_LEN > (16 * 1024 * 1024) */
+
+#define PACK_MAGIC 0x4B50424Eu /* "NBPK" */
+#define PACK_VERSION 1u
+#define PACK_HEADER_LEN 32
+#define PACK_RECORD_FIXED_LEN 24 /* flags (uint8_t, PACK_FLAG_*), sbj_len (uint8_t), 2 reserved bytes, raw_len (uint32_t), stored_len (uint32_t), checksum (uint32_t, FNV-1a of subject & stored body), created_ns (int64_t) */
+#define PACK_FLAG_LIVE 0x01 /* cleared once the note is removed or unpacked */
+#define PACK_FLAG_COMPRESSED 0x02 /* body is compressed. else stored as is */
+
+/**
+ * @brief PackRecord (struct) - a live record, as found by pack_for_each
+ */
+struct PackRecord {
+	uint64_t offset; /* of the record within the pack. never 0 - the header comes first */
+
+	int64_t created_ns;
+
+	uint32_t raw_len; /* length of the note */
+
+	uint8_t sbj_len;
+
+	char sbj[MAX_SBJ_LEN + 1]; /* null terminated */
+};
+
+/**
+ * @brief PackNote (struct) - a note to pack (pack_add) or keep (pack_compact_copy)
+ */
+struct PackNote {
+	char sbj[MAX_SBJ_LEN + 1]; /* null terminated */
+
+	int64_t created_ns;
+
+	uint64_t offset; /* pack_compact_copy - its record in the old pack, replaced with where it's copied to in the new, 0 if it was corrupt. pack_add - filled with its new record, 0 if it couldn't be packed */
+};
+
+/**
+ * @brief PackCompaction (struct) - a compaction under way (see pack_compact_begin). dir_fd of -1 if there's none
+ */
+struct PackCompaction {
+	int dir_fd; /* directory handle of the user's notes */
+
+	int old_fd; /* pack being compacted */
+
+	int fd; /* new pack */
+
+	uint64_t old_end; /* of the pack being compacted. fixed, as nothing's appended to it meanwhile */
+
+	uint64_t end; /* of the new pack, so far */
+
+	uint64_t dead; /* bytes of records dropped from the new pack since they were copied */
+};
+
+/**
+ * @brief pack_visitor - callback for pack_for_each
+ * @param const struct PackRecord *const record - live record. only valid for the duration of the call
+ * @param void *const ctx - caller's context, as given to pack_for_each
+ * @return int - zero to carry on, non-zero to stop the walk (returned by pack_for_each)
+ */
+typedef int (*pack_visitor)(const struct PackRecord *const record, void *const ctx);
+
+/**
+ * @brief pack_for_each - visits every live record of a user's pack, in the order they were packed
+ * @param const int uid_dir_fd - directory handle of the user's notes
+ * @param const pack_visitor visitor - called once per live record
+ * @param void *const ctx - passed through to visitor
+ * @return int - zero is success (including there being no pack), non-zero is failure
+ * -1 is error reading the pack (records before the error have been visited), else whatever non-zero value visitor returned
+ */
+int pack_for_each(const int uid_dir_fd, const pack_visitor visitor, void *const ctx);
+
+/**
+ * @brief pack_read - reads (& decompresses) one packed note
+ * @param const int uid_dir_fd - directory handle of the user's notes
+ * @param const uint64_t offset - record, as found by pack_for_each or given back by pack_add / pack_compact_copy
+ * @param const char *const sbj - null terminated subject the record should belong to
+ * @param uint8_t *const buf - filled with the note. must hold NOTICEBOARD_COLD_MAX_LEN bytes
+ * @param uint32_t *const len - filled with length of the note
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading, 2 is the record isn't (or is no longer) that note, or is corrupt
+ */
+int pack_read(const int uid_dir_fd, const uint64_t offset, const char *const sbj, uint8_t *const buf, uint32_t *const len);
+
+/**
+ * @brief pack_add - packs notes from their plain files, appending them to the user's pack (created if need be), then deletes the files
+ * Notes which are missing, empty or longer than NOTICEBOARD_COLD_MAX_LEN are skipped (their offset left 0), as is everything if writing fails
+ * The uid directory is touched before anything is written, so an index snapshot taken before can't outlive a crash part way through (see index.h)
+ * @param const int uid_dir_fd - directory handle of the user's notes
+ * @param struct PackNote *const notes - notes to pack. offset filled in
+ * @param const size_t count - number of notes
+ * @return int - zero is success, non-zero is failure
+ * 1 is error writing the pack (nothing packed)
+ */
+int pack_add(const int uid_dir_fd, struct PackNote *const notes, const size_t count);
+
+/**
+ * @brief pack_compact_begin - starts compacting a user's pack - writing a new one with only the records still wanted, a few at a time, so no one call rewrites the whole pack
+ * The new pack is written to a temporary file, & only renamed over the old by pack_compact_finish, so until then (or if the compaction is abandoned) the old pack is the pack, & its offsets stand
+ * Nothing may be appended to the pack whilst it's being compacted - records may still be killed, but the caller must then drop any copy already made (pack_compact_drop)
+ * @param const int uid_dir_fd - directory handle of the user's notes. not kept - the compaction holds its own
+ * @param struct PackCompaction *const compaction - filled in
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the old pack, 2 is error creating the new one
+ */
+int pack_compact_begin(const int uid_dir_fd, struct PackCompaction *const compaction);
+
+/**
+ * @brief pack_compact_copy - copies records from the old pack to the end of the new. writeback of what's copied is started, but not waited on
+ * @param struct PackCompaction *const compaction - compaction under way
+ * @param struct PackNote *const notes - notes to keep. offset updated
+ * @param const size_t count - number of notes
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the old pack, 2 is error writing the new one. either way, the compaction is abandoned
+ */
+int pack_compact_copy(struct PackCompaction *const compaction, struct PackNote *const notes, const size_t count);
+
+/**
+ * @brief pack_compact_drop - kills a record already copied to the new pack, once its note has been removed or unpacked from the old
+ * @param struct PackCompaction *const compaction - compaction under way
+ * @param const uint64_t offset - record in the new pack, as given back by pack_compact_copy
+ * @return int - zero is success, non-zero is failure
+ * 1 is error writing (the compaction is abandoned)
+ */
+int pack_compact_drop(struct PackCompaction *const compaction, const uint64_t offset);
+
+/**
+ * @brief pack_compact_finish - syncs the new pack & renames it over the old, ending the compaction. a new pack with no live records deletes the pack instead
+ * @param struct PackCompaction *const compaction - compaction under way
+ * @return int - zero is success, non-zero is failure
+ * 2 is error writing the new pack (the compaction is abandoned - the old pack is left as it was)
+ */
+int pack_compact_finish(struct PackCompaction *const compaction);
+
+/**
+ * @brief pack_compact_abandon - gives up on a compaction, deleting the new pack. does nothing if there's none under way
+ * @param struct PackCompaction *const compaction - compaction
+ */
+void pack_compact_abandon(struct PackCompaction *const compaction);
+
+/**
+ * @brief pack_kill - marks a record dead, once its note has been removed or unpacked
+ * Also touches the uid directory, so an index snapshot taken before can't bring the note back (see index.h)
+ * @param const int uid_dir_fd - directory handle of the user's notes
+ * @param const uint64_t offset - record
+ * @return int - zero is success, non-zero is failure
+ * 1 is error writing
+ */
+int pack_kill(const int uid_dir_fd, const uint64_t offset);
+
+/**
+ * @brief pack_usage - reads how much of a user's pack is in use
+ * @param const int uid_dir_fd - directory handle of the user's notes
+ * @param uint64_t *const end - filled with bytes of header & records. 0 if there's no pack
+ * @param uint64_t *const dead - filled with bytes of dead records
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the pack
+ */
+int pack_usage(const int uid_dir_fd, uint64_t *const end, uint64_t *const dead);
+
+#endif /* PACK_H */
@@ -2,6 +2,7 @@
 #define REQUEST_H
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <limits.h>
 
@@ -14,15 +15,47 @@
 enum request_command {
 	ADD = 0,
 	GET = 1,
-	REMOVE = 2
+	REMOVE = 2,
+	RING = 3, /* negotiate shared-memory ring transport. handles follow the request via SCM_RIGHTS (see ring.h) */
+	EXPORT = 4, /* admin only. stream every note into the archive whose (writable) handle follows the request via SCM_RIGHTS (see archive.h) */
+	IMPORT = 5, /* admin only. create notes from the archive whose (readable) handle follows the request via SCM_RIGHTS */
+	GET_RANGE = 6, /* read only a slice of a note. extra data is the range (see REQUEST_RANGE_LEN) */
+	APPEND = 7, /* add extra data to the end of an existing note. answered with the note's new length (uint64_t, little endian) */
+	LIST = 8, /* page through the caller's notes in subject order. subject is ignored. extra data is the cursor which ended the previous page (none for the first). answered with a page (see LIST_*) */
+	SINCE = 9 /* page through the caller's notes created within a time window, oldest first. subject is ignored. extra data is the window (see REQUEST_SINCE_LEN) then the cursor which ended the previous page. answered with a page (see SINCE_*) */
 };
 
+#define REQUEST_RANGE_LEN 12 /* GET_RANGE extra data - offset (uint64_t) then length (uint32_t), little endian. lengths beyond MAX_EXTRA_DATA_LEN are cut to it */
+
+#define LIST_CURSOR_MAX_LEN MAX_SBJ_LEN /* cursors are opaque - clients hand back exactly what the last page ended with */
+#define LIST_ENTRY_FIXED_LEN 17 /* each entry of a page is subject length (uint8_t), subject, size (uint64_t), then mtime (int64_t, nanoseconds since the epoch). little endian */
+#define LIST_PAGE_MAX_ENTRIES ((MAX_EXTRA_DATA_LEN - 1 - LIST_CURSOR_MAX_LEN) / (LIST_ENTRY_FIXED_LEN + 1)) /* a page is cursor length (uint8_t), cursor (0 length on the last page), then as many entries as fit */
+
+#define REQUEST_SINCE_LEN 16 /* SINCE extra data before the cursor - window start (inclusive) then end (exclusive, 0 for none). int64_t nanoseconds since the epoch, little endian */
+#define SINCE_CURSOR_MAX_LEN (8 + MAX_SBJ_LEN) /* as LIST's, opaque - though it's the creation time (int64_t) then subject of the last note looked at */
+#define SINCE_PAGE_MAX_ENTRIES ((MAX_EXTRA_DATA_LEN - 1 - SINCE_CURSOR_MAX_LEN) / (LIST_ENTRY_FIXED_LEN + 1)) /* pages are laid out as LIST's, except each entry's time is when the note was created */
+
+#define REQUEST_FLAG_TTL 0x0001 /* v2 ADD only. the extra data starts with the note's time to live (see REQUEST_TTL_LEN), then its content */
+#define REQUEST_FLAGS_KNOWN (REQUEST_FLAG_TTL)
+#define REQUEST_TTL_LEN 4 /* time to live - seconds (uint32_t, little endian, non-zero). counts towards MAX_EXTRA_DATA_LEN on the wire */
+
+#define REQUEST_V2_HEADER_LEN 24 /* magic (uint32_t), version (uint8_t), opcode (uint8_t), flags (uint16_t), id (uint64_t), sbj_len (uint32_t), extra_data_len (uint32_t) */
+#define MAX_REQUEST_LEN (REQUEST_V2_HEADER_LEN + MAX_SBJ_LEN + MAX_EXTRA_DATA_LEN) /* largest request packet of either version, once encoded */
+
 /**
  * @brief Request (struct) - struct to store details to send to server
  */
 struct Request {
+	uint8_t version; /* PROTOCOL_V1 or PROTOCOL_V2 - decides the wire layout, & how the server answers */
+
+	uint16_t flags; /* v2 only. REQUEST_FLAG_* bits, as received. when sending, leave 0 - request_encode sets whichever the other fields call for */
+
+	uint64_t id; /* v2 only. chosen by the client & echoed in the response, so responses can be matched to requests whatever order they come back in */
+
 	uint8_t cmd; /* (uint8_t)request_command::* */
 
+	uint32_t ttl_s; /* ADD only - seconds until the note expires, 0 for never. travels as REQUEST_FLAG_TTL (v2 only), so isn't counted in extra_data_len */
+
 	uint32_t sbj_len; /* 1 to MAX_SBJ_LEN; for sbj_content */
 
 	uint8_t sbj_content[MAX_SBJ_LEN]; /* for subject (i.e. filename / title). set as stack buffer as..., well its mandatory and small */
@@ -39,7 +72,7 @@ struct Request {
 };
 
 /**
- * @brief request_send - encodes request packet and sends to server
+ * @brief request_send - encodes request packet (in client_request->version's layout) and sends to server
  * This function DOES NOT CARE about invalid requests, but that data can actually be sent - seperation of concerns
  * @param const struct Request *const client_request - populated request struct to be sent
  * @param const int server_sock - endpoint to send packet contents to
@@ -49,12 +82,41 @@ struct Request {
 int request_send(const struct Request *const client_request, const int server_sock);
 
 /**
- * @brief request_send - decodes request packet from client
- * @param const struct Request *const client_request - empty request struct to be filled
- * @param const int client_sock - endpoint to get packet contents
- * @return int - non-zero exit code is success, else failure
- * 1 is error receiving, 2 is error decoding
+ * @brief request_frame - works out how long the request (of either version) at the start of a buffer is, without decoding it. lets a non-blocking reader gather bytes until a whole request has arrived
+ * @param const uint8_t *const buf - bytes received so far
+ * @param const size_t buf_len - number of bytes in buf
+ * @param size_t *const frame_len - set to the request's full encoded length, once its header (v1: everything up to & including extra_data_len, v2: the fixed header) is within buf
+ * @param uint8_t *const cmd - set to the request's command, alongside frame_len
+ * @return int - 0 is header complete (frame_len & cmd set), 1 is header incomplete, 2 is invalid (magic, version, command or a length out of range - the connection is out of step)
+ */
+int request_frame(const uint8_t *const buf, const size_t buf_len, size_t *const frame_len, uint8_t *const cmd);
+
+/**
+ * @brief request_handle_count - how many handles follow a request via SCM_RIGHTS (see fd_transfer.h)
+ * @param const uint8_t cmd - command byte
+ * @return size_t - number of handles. 0 for plain note operations
+ */
+size_t request_handle_count(const uint8_t cmd);
+
+/**
+ * @brief request_encode - encodes request packet into a buffer, in client_request->version's layout
+ * @param const struct Request *const client_request - populated request struct to be encoded
+ * @param uint8_t *const buf - buffer to encode into
+ * @param const size_t buf_len - capacity of buf
+ * @param size_t *const encoded_len - filled with number of bytes used
+ * @return int - zero is success, non-zero is failure
+ * 1 is error encoding (including buffer too small)
+ */
+int request_encode(const struct Request *const client_request, uint8_t *const buf, const size_t buf_len, size_t *const encoded_len);
+
+/**
+ * @brief request_decode - decodes (and sanitises, as subject_check describes) a request packet of either version held entirely within a buffer
+ * @param struct Request *const client_request - empty request struct to be filled. extra_data_content must point to MAX_EXTRA_DATA_LEN bytes. version & id are filled in first, so are usable to answer even if decoding fails later on
+ * @param const uint8_t *const buf - buffer holding exactly one encoded request
+ * @param const size_t buf_len - number of bytes in buf
+ * @return int - zero is success, non-zero is failure
+ * 2 is error decoding
  */
-int request_recv(struct Request *const client_request, const int client_sock);
+int request_decode(struct Request *const client_request, const uint8_t *const buf, const size_t buf_len);
 
 #endif /* REQUEST_H */
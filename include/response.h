@@ -2,6 +2,7 @@
 #define RESPONSE_H
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "constraints.h"
@@ -11,12 +12,21 @@
  */
 
 enum response_status {
-	OK = 0,
-	DATA = 1,
-	FAIL = 2
+	OK = 0, /* v2 carries any data requested (e.g. a note's contents) in this one response */
+	DATA = 1, /* v1 only. carries data requested, ahead of the acknowledgement */
+	FAIL = 2,
+	BUSY = 3 /* request shed without being looked at - sender is over its rate limit, or the server is overloaded. retry later */
 };
 
+#define RESPONSE_HEADER_LEN (sizeof(uint8_t) + sizeof(uint32_t)) /* v1 - status & extra data length */
+#define RESPONSE_V2_HEADER_LEN 20 /* magic (uint32_t), version (uint8_t), status (uint8_t), reserved (uint16_t, 0), id (uint64_t), extra data length (uint32_t) */
+#define MAX_RESPONSE_LEN (RESPONSE_V2_HEADER_LEN + MAX_EXTRA_DATA_LEN) /* largest response packet of either version, once encoded */
+
 struct Response {
+	uint8_t version; /* PROTOCOL_V1 or PROTOCOL_V2 - same as the request being answered */
+
+	uint64_t id; /* v2 only. id of the request being answered */
+
 	uint8_t status; /* (uint8_t)response_status::* */
 
 	uint32_t extra_data_len; /* sizeof(*extra_data_content); 0 to UINT32_MAX bytes */
@@ -27,7 +37,7 @@ struct Response {
 };
 
 /**
- * @brief response_send - encodes response packet and sends to client
+ * @brief response_send - encodes response packet (in server_response->version's layout) and sends to client
  * @param const struct Response *const server_response - populated response struct to be sent
  * @param const int client_sock - endpoint to send packet contents to
  * @return int - non-zero exit code is success, else failure
@@ -36,7 +46,7 @@ struct Response {
 int response_send(const struct Response *const server_response, const int client_sock);
 
 /**
- * @brief response_recv - decodes response packet from server
+ * @brief response_recv - decodes response packet (of either version) from server
  * @param const struct Response *const server_response - empty response struct to be filled
  * @param const int client_sock - endpoint to get packet contents
  * @return int - non-zero exit code is success, else failure
@@ -44,4 +54,65 @@ int response_send(const struct Response *const server_response, const int client
  */
 int response_recv(struct Response *const server_response, const int client_sock);
 
+/**
+ * @brief response_recv_into - as response_recv, but extra data is read straight into extra_data_content only if it fits within capacity
+ * Extra data which doesn't fit (or has no buffer) is consumed & discarded so the connection stays usable
+ * @param struct Response *const server_response - empty response struct to be filled
+ * @param const uint32_t capacity - size of buffer at extra_data_content
+ * @param const int client_sock - endpoint to get packet contents
+ * @return int - non-zero exit code is success, else failure
+ * 1 is error receiving, 2 is error decoding (including extra data too big for buffer)
+ */
+int response_recv_into(struct Response *const server_response, const uint32_t capacity, const int client_sock);
+
+/**
+ * @brief response_recv_header - receives & decodes just the header of a response (of either version), leaving its extra data waiting
+ * Lets a client which matches responses up by id pick where the extra data should go before reading it (see response_recv_extra)
+ * @param struct Response *const server_response - empty response struct to be filled. extra_data_content is left alone
+ * @param const int client_sock - endpoint to get packet contents
+ * @return int - non-zero exit code is success, else failure
+ * 1 is error receiving, 2 is error decoding
+ */
+int response_recv_header(struct Response *const server_response, const int client_sock);
+
+/**
+ * @brief response_recv_extra - receives the extra data announced by a header from response_recv_header, as response_recv_into does
+ * @param struct Response *const server_response - response whose header has been received. extra_data_content is the buffer to read into (NULL to discard)
+ * @param const uint32_t capacity - size of buffer at extra_data_content
+ * @param const int client_sock - endpoint to get packet contents
+ * @return int - non-zero exit code is success, else failure
+ * 1 is error receiving, 2 is extra data too big for buffer (consumed & discarded)
+ */
+int response_recv_extra(struct Response *const server_response, const uint32_t capacity, const int client_sock);
+
+/**
+ * @brief response_encode - encodes response packet into a buffer, in server_response->version's layout
+ * @param const struct Response *const server_response - populated response struct to be encoded
+ * @param uint8_t *const buf - buffer to encode into
+ * @param const size_t buf_len - capacity of buf
+ * @param size_t *const encoded_len - filled with number of bytes used
+ * @return int - zero is success, non-zero is failure
+ * 1 is error encoding (including buffer too small)
+ */
+int response_encode(const struct Response *const server_response, uint8_t *const buf, const size_t buf_len, size_t *const encoded_len);
+
+/**
+ * @brief response_decode_header - decodes just the fixed-size start of a response packet (everything but extra data) of either version
+ * @param struct Response *const server_response - empty response struct to be filled. extra_data_content is left alone
+ * @param const uint8_t *const buf - buffer holding at least the header of the version expected - RESPONSE_HEADER_LEN bytes for v1, RESPONSE_V2_HEADER_LEN for v2
+ * @return int - zero is success, non-zero is failure
+ * 2 is error decoding
+ */
+int response_decode_header(struct Response *const server_response, const uint8_t *const buf);
+
+/**
+ * @brief response_decode - decodes a response packet (of either version) held entirely within a buffer
+ * @param struct Response *const server_response - empty response struct to be filled. as with response_recv, extra data is dropped if extra_data_content is NULL
+ * @param const uint8_t *const buf - buffer holding exactly one encoded response
+ * @param const size_t buf_len - number of bytes in buf
+ * @return int - zero is success, non-zero is failure
+ * 2 is error decoding
+ */
+int response_decode(struct Response *const server_response, const uint8_t *const buf, const size_t buf_len);
+
 #endif /* RESPONSE_H */
@@ -0,0 +1,171 @@
+#ifndef RING_H
+#define RING_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Declarations of functionality for the shared-memory ring transport
+ * For local clients sending at high rates, copying every packet through the socket dominates. Instead, a client can negotiate a ring:
+ * - the client creates a sealed memfd holding two single-producer / single-consumer queues (requests, responses) and one eventfd "doorbell" per queue
+ * - it sends a RING request over the socket, then passes the three handles with SCM_RIGHTS. The socket's SO_PEERCRED still decides whose notes are touched
+ * - from then on, packets (same layout as on the wire) travel as messages through the queues. Producers ring the doorbell once per batch pushed
+ * - closing the socket ends the session
+ * Neither side trusts indices written by the other - every message length & position is bounds checked before use
+ */
+
+#define RING_MAGIC 0x4E425247u /* "NBRG" */
+#define RING_DEFAULT_CAPACITY (64u * 1024u) /* bytes per queue. must be a power of two */
+#define RING_MIN_CAPACITY 4096u
+#define RING_MAX_CAPACITY (16u * 1024u * 1024u)
+#define RING_CACHE_LINE 64
+
+enum ring_queue {
+	RING_REQUESTS = 0, /* client produces, server consumes */
+	RING_RESPONSES = 1 /* server produces, client consumes */
+};
+
+/**
+ * @brief RingIndices (struct) - shared producer / consumer positions of one queue. kept on separate cache lines so each side only dirties its own
+ */
+struct RingIndices {
+	uint64_t head; /* total bytes ever produced. written by producer only */
+	uint8_t pad_head[RING_CACHE_LINE - sizeof(uint64_t)];
+
+	uint64_t tail; /* total bytes ever consumed. written by consumer only */
+	uint8_t pad_tail[RING_CACHE_LINE - sizeof(uint64_t)];
+};
+
+/**
+ * @brief RingHeader (struct) - start of the shared mapping. queue data follows it, requests then responses
+ */
+struct RingHeader {
+	uint32_t magic; /* RING_MAGIC */
+	uint32_t capacity; /* bytes per queue */
+	uint8_t pad[RING_CACHE_LINE - 2 * sizeof(uint32_t)];
+
+	struct RingIndices queues[2]; /* indexed by enum ring_queue */
+};
+
+/**
+ * @brief Ring (struct) - one side's view of a ring
+ */
+struct Ring {
+	int memfd; /* shared memory backing the ring */
+
+	int doorbells[2]; /* eventfds, indexed by enum ring_queue. signalled after pushing to that queue */
+
+	uint32_t capacity; /* private copy - never re-read from shared memory */
+
+	size_t map_len;
+
+	struct RingHeader *header;
+
+	uint8_t *data[2]; /* start of each queue's bytes, indexed by enum ring_queue */
+
+	uint64_t cursor[2]; /* private copy of whichever index we own per queue (head if we produce, tail if we consume) */
+};
+
+/**
+ * @brief ring_create - creates a new ring (client side)
+ * @param struct Ring *const ring - ring struct to fill
+ * @param const uint32_t capacity - bytes per queue. power of two between RING_MIN_CAPACITY & RING_MAX_CAPACITY
+ * @return int - zero is success, non-zero is failure
+ * 1 is invalid capacity, 2 is error creating / mapping shared memory
+ */
+int ring_create(struct Ring *const ring, const uint32_t capacity);
+
+/**
+ * @brief ring_attach - maps a ring created by a peer (server side)
+ * The memfd must be sealed against resizing, else the peer could shrink it and fault us
+ * @param struct Ring *const ring - ring struct to fill
+ * @param const int memfd - shared memory handle received from peer. ownership passes to ring
+ * @param const int request_doorbell - eventfd for RING_REQUESTS. ownership passes to ring
+ * @param const int response_doorbell - eventfd for RING_RESPONSES. ownership passes to ring
+ * @return int - zero is success, non-zero is failure (all three handles closed)
+ * 1 is invalid ring (seals, size, header), 2 is error mapping shared memory
+ */
+int ring_attach(struct Ring *const ring, const int memfd, const int request_doorbell, const int response_doorbell);
+
+/**
+ * @brief ring_destroy - unmaps ring & closes its handles
+ * @param struct Ring *const ring - ring from ring_create / ring_attach
+ * @return int - zero is success, non-zero is failure
+ * 1 is error releasing a resource
+ */
+int ring_destroy(struct Ring *const ring);
+
+/**
+ * @brief ring_push - appends one message to a queue we produce. doesn't ring the doorbell (see ring_notify)
+ * @param struct Ring *const ring - ring
+ * @param const enum ring_queue queue - queue to push to
+ * @param const void *const msg - message bytes
+ * @param const uint32_t msg_len - number of bytes in msg
+ * @return int - zero is success, non-zero is failure
+ * 1 is queue full (retry once consumer has caught up), 2 is message can never fit
+ */
+int ring_push(struct Ring *const ring, const enum ring_queue queue, const void *const msg, const uint32_t msg_len);
+
+/**
+ * @brief ring_pop - removes one message from a queue we consume
+ * @param struct Ring *const ring - ring
+ * @param const enum ring_queue queue - queue to pop from
+ * @param void *const buf - buffer to copy message into
+ * @param const uint32_t buf_len - capacity of buf
+ * @param uint32_t *const msg_len - filled with number of bytes copied
+ * @return int - zero is success, non-zero is failure
+ * 1 is queue empty, 2 is queue corrupt (or message larger than buf) - the ring should be abandoned
+ */
+int ring_pop(struct Ring *const ring, const enum ring_queue queue, void *const buf, const uint32_t buf_len, uint32_t *const msg_len);
+
+/**
+ * @brief ring_pop_split - as ring_pop, but scatters the message - its first head_len bytes into head, the remainder into body
+ * Lets a consumer pull a packet's fixed header onto its stack and the payload straight into a caller's buffer, without a bounce copy
+ * @param struct Ring *const ring - ring
+ * @param const enum ring_queue queue - queue to pop from
+ * @param void *const head - buffer for start of message
+ * @param const uint32_t head_len - exact number of bytes for head. messages shorter than this are corrupt
+ * @param void *const body - buffer for rest of message
+ * @param const uint32_t body_len - capacity of body
+ * @param uint32_t *const msg_len - filled with total message length
+ * @return int - zero is success, non-zero is failure
+ * 1 is queue empty, 2 is queue corrupt (or message doesn't fit) - the ring should be abandoned
+ */
+int ring_pop_split(struct Ring *const ring, const enum ring_queue queue, void *const head, const uint32_t head_len, void *const body, const uint32_t body_len, uint32_t *const msg_len);
+
+/**
+ * @brief ring_space - free bytes in a queue we produce
+ * @param const struct Ring *const ring - ring
+ * @param const enum ring_queue queue - queue to inspect
+ * @return size_t - number of bytes available, including per-message framing
+ */
+size_t ring_space(const struct Ring *const ring, const enum ring_queue queue);
+
+/**
+ * @brief ring_message_space - bytes of queue a message occupies once framed
+ * @param const uint32_t msg_len - message length
+ * @return size_t - framed length
+ */
+size_t ring_message_space(const uint32_t msg_len);
+
+/**
+ * @brief ring_notify - rings a queue's doorbell, waking the consumer
+ * @param const struct Ring *const ring - ring
+ * @param const enum ring_queue queue - queue just pushed to
+ * @return int - zero is success, non-zero is failure
+ * 1 is error signalling
+ */
+int ring_notify(const struct Ring *const ring, const enum ring_queue queue);
+
+/**
+ * @brief ring_wait - blocks until a queue's doorbell has been rung, then resets it
+ * @param const struct Ring *const ring - ring
+ * @param const enum ring_queue queue - queue to wait upon
+ * @param const int timeout_ms - as per poll(2). -1 waits forever
+ * @return int - zero is success, non-zero is failure
+ * 1 is error waiting, 2 is timed out
+ */
+int ring_wait(const struct Ring *const ring, const enum ring_queue queue, const int timeout_ms);
+
+#endif /* RING_H */
@@ -0,0 +1,115 @@
+#ifndef STORE_H
+#define STORE_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Declarations of functionality to lay notes out on disk
+ * Notes are sharded by owner - <notes dir>/[<fan-out>/...]<uid>/<subject>
+ * All path resolution goes through directory handles (openat & co.) so a lookup only ever touches one user's directory
+ */
+
+#ifndef NOTICEBOARD_SHARD_LEVELS
+	#define NOTICEBOARD_SHARD_LEVELS 0 /* number of hashed fan-out directory levels above each uid directory. 0 means <notes dir>/<uid>/ */
+#endif /* ifndef NOTICEBOARD_SHARD_LEVELS */
+
+#define MAX_SHARD_LEVELS 4 /* each level consumes one byte of a 32-bit hash of the uid */
+#define STORE_DIR_PERMISSIONS 0700 /* uid & fan-out directories - only the server may look inside */
+#define STORE_NOTE_PERMISSIONS 0600 /* note files - only the server may read or write */
+#define STORE_EXPIRING_NOTE_PERMISSIONS (S_ISVTX | STORE_NOTE_PERMISSIONS) /* notes with a time to live. the (otherwise meaningless) sticky bit shows up in the stat a rescan does anyway, so only these notes need opening to read their expiry */
+#define STORE_EXPIRY_XATTR "user.noticeboard.expires" /* on expiring notes - when they expire (int64_t nanoseconds since the epoch, little endian) */
+
+#if NOTICEBOARD_SHARD_LEVELS < 0 || NOTICEBOARD_SHARD_LEVELS > MAX_SHARD_LEVELS
+	#error "'NOTICEBOARD_SHARD_LEVELS' must be between 0 and MAX_SHARD_LEVELS"
+#endif /* if NOTICEBOARD_SHARD_LEVELS < 0 || NOTICEBOARD_SHARD_LEVELS > MAX_SHARD_LEVELS */
+
+struct Index; /* see index.h */
+struct Tiers; /* see tier.h */
+struct Transfer; /* see transfer.h */
+
+/**
+ * @brief Store (struct) - handle to the root of the notes directory
+ */
+struct Store {
+	int dir_fd; /* directory handle of the notes directory. every other path is resolved relative to this */
+
+	unsigned int shard_levels; /* number of fan-out levels between dir_fd and each uid directory */
+
+	struct Index *index; /* in-memory index of every note, kept up to date by whatever changes the store. NULL if none is kept */
+
+	struct Tiers *tiers; /* hot tier & packer, told of every read & change. NULL if notes are only ever plain files */
+
+	struct Transfer *transfer; /* export or import running in the background. NULL if neither can be run */
+};
+
+/**
+ * @brief store_open - opens a handle to the notes directory
+ * @param struct Store *const store - store struct to be filled
+ * @param const char *const notes_dir - path to (existing) notes directory
+ * @return int - zero is success, non-zero is failure
+ * 1 is error opening directory
+ */
+int store_open(struct Store *const store, const char *const notes_dir);
+
+/**
+ * @brief store_close - releases handle to the notes directory
+ * @param struct Store *const store - store opened by store_open
+ * @return int - zero is success, non-zero is failure
+ * 1 is error closing directory
+ */
+int store_close(struct Store *const store);
+
+/**
+ * @brief store_uid_dir - opens the directory holding every note of a given user
+ * @param const struct Store *const store - opened store
+ * @param const uid_t uid - owner of the notes
+ * @param const int create - boolean. if non-zero, missing fan-out & uid directories are created
+ * @return int - directory handle (caller closes) on success, -1 on failure
+ * errno is left as set by the failing call, so ENOENT means the user simply has no notes (yet)
+ */
+int store_uid_dir(const struct Store *const store, const uid_t uid, const int create);
+
+/**
+ * @brief store_note_expiry - reads when a note expires from the note itself (see STORE_EXPIRY_XATTR). for when there's no index to ask
+ * @param const int note_fd - handle of the note, opened for reading or writing
+ * @return int64_t - when the note expires (realtime clock, nanoseconds). 0 if it never does, or that can't be told
+ */
+int64_t store_note_expiry(const int note_fd);
+
+/**
+ * @brief store_uid_visitor - callback for store_for_each_uid
+ * @param const uid_t uid - owner of the directory
+ * @param const int uid_dir_fd - directory handle of that user's notes. only valid for the duration of the call
+ * @param void *const ctx - caller's context, as given to store_for_each_uid
+ * @return int - zero to carry on, non-zero to stop the walk (returned by store_for_each_uid)
+ */
+typedef int (*store_uid_visitor)(const uid_t uid, const int uid_dir_fd, void *const ctx);
+
+/**
+ * @brief store_for_each_uid - visits every uid directory in the store, descending through any fan-out levels
+ * Anything which isn't laid out as expected (e.g. unmigrated flat-layout files, stray names) is skipped
+ * @param const struct Store *const store - opened store
+ * @param const store_uid_visitor visitor - called once per uid directory
+ * @param void *const ctx - passed through to visitor
+ * @return int - zero is success, non-zero is failure
+ * -1 is error reading a directory, else whatever non-zero value visitor returned
+ */
+int store_for_each_uid(const struct Store *const store, const store_uid_visitor visitor, void *const ctx);
+
+/**
+ * @brief store_migrate - moves notes from the old flat layout (<notes dir>/<subject><uid>) into their uid directories
+ * The old filenames have no separator, so the owner is recovered by matching the longest known uid which is a suffix of the filename (leaving at least one character of subject)
+ * Files which match no known uid are left where they are (and reported)
+ * @param const struct Store *const store - opened store
+ * @param const uid_t *const uids - list of known uids (e.g. from the password database)
+ * @param const size_t uid_count - number of entries in uids
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the notes directory, 2 is error moving one or more notes
+ */
+int store_migrate(const struct Store *const store, const uid_t *const uids, const size_t uid_count);
+
+#endif /* STORE_H */
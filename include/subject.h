@@ -0,0 +1,35 @@
+#ifndef SUBJECT_H
+#define SUBJECT_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constraints.h"
+
+/**
+ * @brief Declarations of subject validation - shared by the server (every request it decodes) & libnote (so a bad subject is refused before it's sent)
+ * A subject becomes a filename, so:
+ * - it's refused if it holds ';', '/', '.' or '\\' anywhere in its given length
+ * - it ends at its first NULL, if it has one
+ * - leading whitespace (' ', '\t', '\n' & '\r') is skipped, & at least one character must be left after it
+ * The whole subject is classified in a single pass - with SSE2 (when the build targets it), a handful of vector compares per 16 bytes, loaded straight from the subject without copying or reading past its end, else a byte at a time
+ * Nothing is moved - the caller is handed where the subject starts & how long it is
+ */
+
+#if MAX_SBJ_LEN > 63
+	#error "'MAX_SBJ_LEN' must be at most 63 - subjects are classified into 64 bit masks"
+#endif /* if MAX_SBJ_LEN > 63 */
+
+/**
+ * @brief subject_check - validates a subject & finds it once trimmed
+ * @param const uint8_t *const sbj - subject as given. needn't be null terminated
+ * @param const size_t sbj_len - length of sbj. 1 to MAX_SBJ_LEN
+ * @param size_t *const offset - filled with where the subject starts within sbj (past any leading whitespace)
+ * @param size_t *const len - filled with length of the subject from offset (up to any NULL)
+ * @return int - zero is success, non-zero is failure
+ * 1 is invalid length, 2 is invalid character, 3 is nothing left once trimmed
+ */
+int subject_check(const uint8_t *const sbj, const size_t sbj_len, size_t *const offset, size_t *const len);
+
+#endif /* SUBJECT_H */
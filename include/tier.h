@@ -0,0 +1,298 @@
+#ifndef TIER_H
+#define TIER_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "constraints.h"
+#include "request.h"
+#include "pack.h"
+
+/**
+ * @brief Declarations of tiered note storage - where each note lives, by how often it's read
+ * - hot: the start of the most read notes (as much as a GET returns), copied into an arena allocated up front. served with no filesystem access at all
+ * - warm: plain files, one per note (see store.h). every note starts here
+ * - cold: rarely read notes, compressed into their user's pack (see pack.h) by a packer running a little at a time from the event loop
+ * Each pass of the packer writes at most NOTICEBOARD_PACK_PASS_BYTES of notes, whether packing them or compacting a pack. A compaction takes as many passes as the pack needs, & has the packer to itself until it's done
+ * How often each note is read is estimated with a count-min sketch, halved every so often so the estimates favour recent reads
+ * - a note is admitted hot once it's been read NOTICEBOARD_HOT_MIN_READS times. a full hot tier only admits it in place of a sampled note read less often (TinyLFU)
+ * - a cold note read NOTICEBOARD_WARM_MIN_READS times is unpacked back into a plain file
+ * - a warm note is packed once it's gone unread for NOTICEBOARD_COLD_AFTER_S, or for a whole lap of the packer whilst there are more than NOTICEBOARD_WARM_NOTES warm notes
+ * Notes with a time to live, & notes longer than NOTICEBOARD_COLD_MAX_LEN, are never packed
+ * Relies on the index - it's the only record of which notes are packed, & where
+ */
+
+#ifndef NOTICEBOARD_HOT_BYTES
+	#define NOTICEBOARD_HOT_BYTES (8 * 1024 * 1024) /* arena of the hot tier. 0 disables it */
+#endif /* ifndef NOTICEBOARD_HOT_BYTES */
+
+#ifndef NOTICEBOARD_HOT_BLOCK_LEN
+	#define NOTICEBOARD_HOT_BLOCK_LEN 256 /* bytes per arena block. each hot note takes a chain of them */
+#endif /* ifndef NOTICEBOARD_HOT_BLOCK_LEN */
+
+#ifndef NOTICEBOARD_HOT_NOTES
+	#define NOTICEBOARD_HOT_NOTES 4096 /* most notes the hot tier holds, however small */
+#endif /* ifndef NOTICEBOARD_HOT_NOTES */
+
+#ifndef NOTICEBOARD_HOT_MIN_READS
+	#define NOTICEBOARD_HOT_MIN_READS 2 /* estimated recent reads before a note is admitted hot */
+#endif /* ifndef NOTICEBOARD_HOT_MIN_READS */
+
+#ifndef NOTICEBOARD_WARM_NOTES
+	#define NOTICEBOARD_WARM_NOTES 0 /* plain files kept before the packer starts on notes not yet idle for NOTICEBOARD_COLD_AFTER_S. 0 is no limit */
+#endif /* ifndef NOTICEBOARD_WARM_NOTES */
+
+#ifndef NOTICEBOARD_WARM_MIN_READS
+	#define NOTICEBOARD_WARM_MIN_READS 3 /* estimated recent reads before a cold note is unpacked */
+#endif /* ifndef NOTICEBOARD_WARM_MIN_READS */
+
+#ifndef NOTICEBOARD_COLD_AFTER_S
+	#define NOTICEBOARD_COLD_AFTER_S (7 * 24 * 60 * 60) /* seconds unread before a note is packed */
+#endif /* ifndef NOTICEBOARD_COLD_AFTER_S */
+
+#ifndef NOTICEBOARD_PACK_INTERVAL_MS
+	#define NOTICEBOARD_PACK_INTERVAL_MS 1000 /* between passes of the packer. 0 disables packing */
+#endif /* ifndef NOTICEBOARD_PACK_INTERVAL_MS */
+
+#ifndef NOTICEBOARD_PACK_SCAN
+	#define NOTICEBOARD_PACK_SCAN 1024 /* index entries the packer looks at per pass */
+#endif /* ifndef NOTICEBOARD_PACK_SCAN */
+
+#ifndef NOTICEBOARD_PACK_BATCH
+	#define NOTICEBOARD_PACK_BATCH 64 /* most notes packed per pass - all of one user's */
+#endif /* ifndef NOTICEBOARD_PACK_BATCH */
+
+#ifndef NOTICEBOARD_PACK_PASS_BYTES
+	#define NOTICEBOARD_PACK_PASS_BYTES (1024 * 1024) /* most bytes of notes packed, or copied by a compaction, per pass. at least one note always is */
+#endif /* ifndef NOTICEBOARD_PACK_PASS_BYTES */
+
+#ifndef NOTICEBOARD_TIER_SKETCH_WIDTH
+	#define NOTICEBOARD_TIER_SKETCH_WIDTH 16384 /* counters per row of the frequency sketch. 4 rows of 1 byte each */
+#endif /* ifndef NOTICEBOARD_TIER_SKETCH_WIDTH */
+
+#if NOTICEBOARD_HOT_BYTES < 0
+	#error "'NOTICEBOARD_HOT_BYTES' mustn't be negative"
+#endif /* if NOTICEBOARD_HOT_BYTES < 0 */
+
+#if NOTICEBOARD_HOT_BLOCK_LEN < 16 || NOTICEBOARD_HOT_BLOCK_LEN > MAX_EXTRA_DATA_LEN
+	#error "'NOTICEBOARD_HOT_BLOCK_LEN' must be between 16 and MAX_EXTRA_DATA_LEN"
+#endif /* if NOTICEBOARD_HOT_BLOCK_LEN < 16 || NOTICEBOARD_HOT_BLOCK_LEN > MAX_EXTRA_DATA_LEN */
+
+#if NOTICEBOARD_HOT_BYTES / NOTICEBOARD_HOT_BLOCK_LEN >= 4294967295
+	#error "'NOTICEBOARD_HOT_BYTES' holds too many blocks - raise NOTICEBOARD_HOT_BLOCK_LEN"
+#endif /* if NOTICEBOARD_HOT_BYTES / NOTICEBOARD_HOT_BLOCK_LEN >= 4294967295 */
+
+#if NOTICEBOARD_HOT_NOTES < 1
+	#error "'NOTICEBOARD_HOT_NOTES' must be positive"
+#endif /* if NOTICEBOARD_HOT_NOTES < 1 */
+
+#if NOTICEBOARD_HOT_MIN_READS < 1 || NOTICEBOARD_HOT_MIN_READS > 255 || NOTICEBOARD_WARM_MIN_READS < 1 || NOTICEBOARD_WARM_MIN_READS > 255
+	#error "'NOTICEBOARD_HOT_MIN_READS' & 'NOTICEBOARD_WARM_MIN_READS' must be between 1 and 255"
+#endif /* if NOTICEBOARD_HOT_MIN_READS < 1 || NOTICEBOARD_HOT_MIN_READS > 255 || NOTICEBOARD_WARM_MIN_READS < 1 || NOTICEBOARD_WARM_MIN_READS > 255 */
+
+#if NOTICEBOARD_WARM_NOTES < 0 || NOTICEBOARD_COLD_AFTER_S < 0 || NOTICEBOARD_PACK_INTERVAL_MS < 0
+	#error "'NOTICEBOARD_WARM_NOTES', 'NOTICEBOARD_COLD_AFTER_S' & 'NOTICEBOARD_PACK_INTERVAL_MS' mustn't be negative"
+#endif /* if NOTICEBOARD_WARM_NOTES < 0 || NOTICEBOARD_COLD_AFTER_S < 0 || NOTICEBOARD_PACK_INTERVAL_MS < 0 */
+
+#if NOTICEBOARD_PACK_SCAN < 1 || NOTICEBOARD_PACK_BATCH < 1 || NOTICEBOARD_PACK_PASS_BYTES < 1
+	#error "'NOTICEBOARD_PACK_SCAN', 'NOTICEBOARD_PACK_BATCH' & 'NOTICEBOARD_PACK_PASS_BYTES' must be positive"
+#endif /* if NOTICEBOARD_PACK_SCAN < 1 || NOTICEBOARD_PACK_BATCH < 1 || NOTICEBOARD_PACK_PASS_BYTES < 1 */
+
+#if NOTICEBOARD_TIER_SKETCH_WIDTH < 64 || (NOTICEBOARD_TIER_SKETCH_WIDTH & (NOTICEBOARD_TIER_SKETCH_WIDTH - 1)) != 0
+	#error "'NOTICEBOARD_TIER_SKETCH_WIDTH' must be a power of two, at least 64"
+#endif /* if NOTICEBOARD_TIER_SKETCH_WIDTH < 64 || (NOTICEBOARD_TIER_SKETCH_WIDTH & (NOTICEBOARD_TIER_SKETCH_WIDTH - 1)) != 0 */
+
+#define TIER_SKETCH_ROWS 4
+#define TIER_NO_BLOCK UINT32_MAX /* ends a chain of arena blocks */
+
+struct Store; /* see store.h */
+
+/**
+ * @brief HotNote (struct) - one hot note's slot. sbj_len of 0 marks an empty slot
+ */
+struct HotNote {
+	uint64_t hash; /* of uid & subject - places the slot, & keys the frequency sketch */
+
+	uint32_t uid;
+
+	uint32_t len; /* bytes held. the whole note, or as much of it as a GET returns */
+
+	uint32_t first_block; /* of its chain in the arena */
+
+	uint8_t whole; /* boolean. len is the whole note, so any range of it can be served */
+
+	uint8_t sbj_len;
+
+	char sbj[MAX_SBJ_LEN]; /* not null terminated */
+};
+
+/**
+ * @brief TierMove (struct) - a note copied by the compaction under way, moved over in the index once the compaction's finished
+ */
+struct TierMove {
+	uint64_t from; /* its record in the old pack */
+
+	uint64_t to; /* in the new. 0 if it was corrupt, so left behind */
+
+	char sbj[MAX_SBJ_LEN + 1]; /* null terminated */
+};
+
+/**
+ * @brief Tiers (struct) - the hot tier, read frequencies & the packer's progress
+ * Everything is allocated by tier_init - admitting & evicting hot notes only moves blocks between chains & the free list
+ */
+struct Tiers {
+	uint8_t *arena; /* NOTICEBOARD_HOT_BYTES, in blocks of NOTICEBOARD_HOT_BLOCK_LEN */
+
+	uint32_t *block_next; /* per block, the next in its chain (or the free list). TIER_NO_BLOCK ends each */
+
+	uint32_t free_block; /* head of the free list */
+
+	size_t free_blocks;
+
+	struct HotNote *hot; /* open-addressed (linear probing) table of hot notes. deletion shifts later entries back, so there are no tombstones */
+
+	size_t hot_cap; /* slots. power of two, at least twice NOTICEBOARD_HOT_NOTES. 0 if the hot tier is disabled */
+
+	size_t hot_count;
+
+	size_t hand; /* next slot eviction samples from */
+
+	uint8_t *sketch; /* TIER_SKETCH_ROWS rows of NOTICEBOARD_TIER_SKETCH_WIDTH saturating counters */
+
+	size_t sketch_adds; /* reads counted since the sketch was last halved */
+
+	uint32_t cursor_uid; /* packer's place in the index - it carries on after this note */
+
+	uint8_t cursor_len; /* 0 (with a uid of 0) to start from the very first note */
+
+	char cursor_sbj[MAX_SBJ_LEN];
+
+	uint64_t usage_uid; /* last user whose pack was checked for compacting. UINT64_MAX for none */
+
+	struct PackCompaction compaction; /* of compact_uid's pack. dir_fd of -1 if none is under way */
+
+	uint32_t compact_uid;
+
+	uint8_t compact_len; /* compaction's place amongst the user's notes - it carries on after this one. 0 to start from their first */
+
+	char compact_sbj[MAX_SBJ_LEN];
+
+	struct TierMove *moves; /* notes the compaction's copied so far */
+
+	size_t move_count, move_cap;
+
+	int64_t lap_started_ns; /* when the packer last started from the very first note */
+
+	int64_t last_lap_started_ns; /* when it started the lap before. a note unread since then has gone a whole lap unread */
+
+	uint64_t hot_hits, cold_reads, packed, unpacked; /* running totals */
+};
+
+/**
+ * @brief tier_init - allocates the hot tier & frequency sketch
+ * @param struct Tiers *const tiers - struct to fill
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds)
+ * @return int - zero is success, non-zero is failure
+ * 1 is error allocating
+ */
+int tier_init(struct Tiers *const tiers, const int64_t now_ns);
+
+/**
+ * @brief tier_free - releases the hot tier & frequency sketch
+ * @param struct Tiers *const tiers - from tier_init
+ */
+void tier_free(struct Tiers *const tiers);
+
+/**
+ * @brief tier_save - copies the hot tier & frequency sketch into a sealed memfd, for a server taking over from this one (see handoff.h)
+ * @param const struct Tiers *const tiers - tiers
+ * @return int - memfd (caller closes) on success, -1 on failure
+ */
+int tier_save(const struct Tiers *const tiers);
+
+/**
+ * @brief tier_restore - takes on the hot tier & frequency sketch a previous server saved, so a takeover doesn't start cold
+ * Hot notes are only admitted if the index still agrees with them - present, unexpired & the same length - & only as many as fit. a sketch of another width is ignored
+ * @param struct Tiers *const tiers - tiers, fresh from tier_init
+ * @param const struct Store *const store - opened store, with its index built
+ * @param const int state_fd - memfd from tier_save. not closed
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds)
+ * @return int - zero is success, non-zero is failure
+ * 1 is unusable state (tiers left as they were)
+ */
+int tier_restore(struct Tiers *const tiers, const struct Store *const store, const int state_fd, const int64_t now_ns);
+
+/**
+ * @brief tier_read - counts a read of a note, & serves it if it's hot or cold
+ * A cold note read often enough is unpacked along the way
+ * @param struct Tiers *const tiers - tiers
+ * @param const struct Store *const store - opened store, with an index
+ * @param const uid_t uid - owner
+ * @param const char *const sbj - null terminated subject
+ * @param const uint64_t offset - where in the note to start (0 for a GET)
+ * @param const uint32_t length - most bytes to serve. at most MAX_EXTRA_DATA_LEN
+ * @param uint8_t *const buf - filled with the bytes read. holds MAX_EXTRA_DATA_LEN
+ * @param uint32_t *const len - filled with the number of bytes read. 0 if offset is at or past the end
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds)
+ * @return int - zero is success (served), non-zero is failure
+ * 1 is the note is warm (or unknown) - read its file, 2 is error reading it from its pack
+ */
+int tier_read(struct Tiers *const tiers, const struct Store *const store, const uid_t uid, const char *const sbj, const uint64_t offset, const uint32_t length, uint8_t *const buf, uint32_t *const len, const int64_t now_ns);
+
+/**
+ * @brief tier_offer - offers a note just read from its file to the hot tier, which admits it if it's read often enough
+ * @param struct Tiers *const tiers - tiers
+ * @param const struct Store *const store - opened store, with an index
+ * @param const uid_t uid - owner
+ * @param const char *const sbj - null terminated subject
+ * @param const uint8_t *const data - start of the note, as a GET returned it
+ * @param const uint32_t len - length of data
+ */
+void tier_offer(struct Tiers *const tiers, const struct Store *const store, const uid_t uid, const char *const sbj, const uint8_t *const data, const uint32_t len);
+
+/**
+ * @brief tier_forget - drops a note from the hot tier, once it's changed or gone
+ * @param struct Tiers *const tiers - tiers
+ * @param const uid_t uid - owner
+ * @param const char *const sbj - null terminated subject
+ */
+void tier_forget(struct Tiers *const tiers, const uid_t uid, const char *const sbj);
+
+/**
+ * @brief tier_unpack - brings a cold note back to a plain file, so it can be changed. nothing to do for any other note
+ * @param struct Tiers *const tiers - tiers
+ * @param const struct Store *const store - opened store, with an index
+ * @param const int uid_dir_fd - directory handle of the user's notes
+ * @param const uid_t uid - owner
+ * @param const char *const sbj - null terminated subject
+ * @return int - zero is success, non-zero is failure
+ * 1 is error (the note stays packed)
+ */
+int tier_unpack(struct Tiers *const tiers, const struct Store *const store, const int uid_dir_fd, const uid_t uid, const char *const sbj);
+
+/**
+ * @brief tier_remove_packed - removes a cold note - marks its record dead & drops it from the index
+ * @param struct Tiers *const tiers - tiers
+ * @param const struct Store *const store - opened store, with an index
+ * @param const int uid_dir_fd - directory handle of the user's notes
+ * @param const uid_t uid - owner
+ * @param const char *const sbj - null terminated subject of a packed note
+ * @return int - zero is success, non-zero is failure
+ * 1 is error writing the pack (the note's still there)
+ */
+int tier_remove_packed(struct Tiers *const tiers, const struct Store *const store, const int uid_dir_fd, const uid_t uid, const char *const sbj);
+
+/**
+ * @brief tier_pack - one pass of the packer. looks at up to NOTICEBOARD_PACK_SCAN notes, then packs up to NOTICEBOARD_PACK_BATCH of one user's (NOTICEBOARD_PACK_PASS_BYTES at most), or starts compacting one user's pack if it's mostly dead
+ * Whilst a compaction is under way, each pass only carries it on - copying up to NOTICEBOARD_PACK_BATCH notes (NOTICEBOARD_PACK_PASS_BYTES at most) - until it's finished
+ * @param struct Tiers *const tiers - tiers
+ * @param const struct Store *const store - opened store, with an index
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds)
+ * @return size_t - number of notes packed
+ */
+size_t tier_pack(struct Tiers *const tiers, const struct Store *const store, const int64_t now_ns);
+
+#endif /* TIER_H */
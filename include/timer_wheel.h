@@ -0,0 +1,104 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Declarations of a hierarchical timer wheel
+ * Tracks any number of deadlines with O(1) scheduling & cancelling, and expiry work proportional to what actually expires - no syscall or heap operation per timer
+ * Time is in abstract ticks; callers choose what a tick means. Timers are intrusive (a TimerLink lives inside whatever it times), so the wheel never allocates
+ * TIMER_LEVELS levels of TIMER_SLOTS slots each. level n holds timers due within TIMER_SLOTS^(n+1) ticks; as time passes, slots of higher levels are cascaded down into lower ones
+ * Timers further out than the wheel spans are parked in its furthest slot & re-filed each time they cascade
+ */
+
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1u << TIMER_SLOT_BITS)
+
+/**
+ * @brief TimerLink (struct) - one timer. embed in the structure being timed
+ */
+struct TimerLink {
+	struct TimerLink *prev, *next; /* NULL when not scheduled */
+
+	uint64_t expires; /* tick the timer is due */
+};
+
+/**
+ * @brief TimerWheel (struct) - the wheel itself. each slot is a circular list headed by a sentinel
+ */
+struct TimerWheel {
+	struct TimerLink slots[TIMER_LEVELS][TIMER_SLOTS];
+
+	uint64_t current; /* next tick to be processed - every tick before it has been */
+
+	size_t count; /* scheduled timers */
+};
+
+/**
+ * @brief timer_wheel_init - sets up an empty wheel
+ * @param struct TimerWheel *const wheel - wheel to fill
+ * @param const uint64_t now - current tick
+ */
+void timer_wheel_init(struct TimerWheel *const wheel, const uint64_t now);
+
+/**
+ * @brief timer_link_init - marks a timer as not scheduled. call once before first use
+ * @param struct TimerLink *const link - timer
+ */
+void timer_link_init(struct TimerLink *const link);
+
+/**
+ * @brief timer_scheduled - whether a timer is currently on the wheel
+ * @param const struct TimerLink *const link - timer
+ * @return int - Boolean. 1 if scheduled, 0 if not
+ */
+int timer_scheduled(const struct TimerLink *const link);
+
+/**
+ * @brief timer_schedule - puts a timer on the wheel (moving it if already there)
+ * @param struct TimerWheel *const wheel - wheel
+ * @param struct TimerLink *const link - timer
+ * @param const uint64_t expires - tick timer is due. ticks already passed mean it's due at the next expiry
+ */
+void timer_schedule(struct TimerWheel *const wheel, struct TimerLink *const link, const uint64_t expires);
+
+/**
+ * @brief timer_cancel - takes a timer off the wheel. harmless if it isn't on it
+ * @param struct TimerWheel *const wheel - wheel
+ * @param struct TimerLink *const link - timer
+ */
+void timer_cancel(struct TimerWheel *const wheel, struct TimerLink *const link);
+
+/**
+ * @brief timer_expire - advances the wheel to a tick, taking off every timer due by then
+ * @param struct TimerWheel *const wheel - wheel
+ * @param const uint64_t now - current tick
+ * @param struct TimerLink *const expired - sentinel of a list (see timer_list_init) to which expired timers are appended, in no particular order. they're no longer scheduled once taken off it
+ * @return size_t - number of timers expired
+ */
+size_t timer_expire(struct TimerWheel *const wheel, const uint64_t now, struct TimerLink *const expired);
+
+/**
+ * @brief timer_list_init - sets up an empty list sentinel, for timer_expire
+ * @param struct TimerLink *const list - sentinel
+ */
+void timer_list_init(struct TimerLink *const list);
+
+/**
+ * @brief timer_list_pop - takes the first timer off a list, leaving it unscheduled
+ * @param struct TimerLink *const list - sentinel
+ * @return struct TimerLink* - timer, NULL if list is empty
+ */
+struct TimerLink *timer_list_pop(struct TimerLink *const list);
+
+/**
+ * @brief timer_next - how long until timer_expire could next have anything to do
+ * @param const struct TimerWheel *const wheel - wheel
+ * @return int64_t - ticks from wheel's current position (0 means due now), -1 if nothing is scheduled
+ */
+int64_t timer_next(const struct TimerWheel *const wheel);
+
+#endif /* TIMER_WHEEL_H */
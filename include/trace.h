@@ -0,0 +1,133 @@
+#ifndef TRACE_H
+#define TRACE_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Declarations of request tracing - where each request's time went
+ * Two independent mechanisms, marking the same phase boundaries (see trace_phase):
+ * - static (USDT / SDT) probes, for bpftrace, perf, systemtap & co. Built in whenever <sys/sdt.h> is available (or NOTICEBOARD_USDT is 1), where each is a single nop until a tracer attaches. Otherwise they compile to nothing
+ * - an in-process ring of the last NOTICEBOARD_TRACE_RING requests' phase timestamps, dumped to NOTICEBOARD_TRACE_NAME in the notes directory on SIGUSR1 & decoded by `notetrace`. Off (0) by default, costing nothing
+ * Dumps use native byte order - they're for this host, like the index snapshot
+ */
+
+#ifndef NOTICEBOARD_USDT
+	#if defined(__has_include)
+		#if __has_include(<sys/sdt.h>)
+			#define NOTICEBOARD_USDT 1
+		#endif /* if __has_include(<sys/sdt.h>) */
+	#endif /* if defined(__has_include) */
+#endif /* ifndef NOTICEBOARD_USDT */
+
+#ifndef NOTICEBOARD_USDT
+	#define NOTICEBOARD_USDT 0
+#endif /* ifndef NOTICEBOARD_USDT */
+
+#if NOTICEBOARD_USDT
+	#include <sys/sdt.h>
+	#define TRACE_PROBE1(name, a) DTRACE_PROBE1(noticeboard, name, a)
+	#define TRACE_PROBE2(name, a, b) DTRACE_PROBE2(noticeboard, name, a, b)
+	#define TRACE_PROBE3(name, a, b, c) DTRACE_PROBE3(noticeboard, name, a, b, c)
+#else
+	#define TRACE_PROBE1(name, a) ((void)0)
+	#define TRACE_PROBE2(name, a, b) ((void)0)
+	#define TRACE_PROBE3(name, a, b, c) ((void)0)
+#endif /* if NOTICEBOARD_USDT */
+
+#ifndef NOTICEBOARD_TRACE_RING
+	#define NOTICEBOARD_TRACE_RING 0 /* requests whose phase timestamps are kept (the most recent). 0 turns the ring off */
+#endif /* ifndef NOTICEBOARD_TRACE_RING */
+
+#ifndef NOTICEBOARD_TRACE_NAME
+	#define NOTICEBOARD_TRACE_NAME ".trace" /* within the notes directory. leading '.' keeps it clear of uid directories & subjects */
+#endif /* ifndef NOTICEBOARD_TRACE_NAME */
+
+#define TRACE_RING_MAX 16777216 /* most records a ring (& so a dump) may hold */
+
+#if NOTICEBOARD_TRACE_RING < 0 || NOTICEBOARD_TRACE_RING > TRACE_RING_MAX
+	#error "'NOTICEBOARD_TRACE_RING' must be between 0 and TRACE_RING_MAX"
+#endif /* if NOTICEBOARD_TRACE_RING < 0 || NOTICEBOARD_TRACE_RING > TRACE_RING_MAX */
+
+#define TRACE_DUMP_MAGIC 0x5254424Eu /* "NBTR" */
+#define TRACE_DUMP_VERSION 1u
+
+/**
+ * @brief trace_phase - boundaries a request passes, in order. the USDT probe of the same name fires at each (arguments in brackets)
+ */
+enum trace_phase {
+	TRACE_ACCEPTED = 0, /* connection accepted - accept (socket). only the first request on a connection carries this & the next */
+	TRACE_CREDENTIALED = 1, /* SO_PEERCRED read - peercred (socket, uid) */
+	TRACE_RECV_START = 2, /* first bytes of the request read (or its ring's doorbell read) - recv__start (socket) */
+	TRACE_RECV_DONE = 3, /* whole request received & decoded - recv__done (socket, id, command) */
+	TRACE_EXEC_START = 4, /* admitted, about to touch the store - execute__start (uid, command, id) */
+	TRACE_EXEC_DONE = 5, /* done with the store - execute__done (uid, command, outcome) */
+	TRACE_SEND_DONE = 6, /* response entirely handed to the socket (or ring) - send__done (socket, id, status) */
+	TRACE_PHASES = 7
+};
+
+/**
+ * @brief TraceRecord (struct) - one request's trip through the server
+ */
+struct TraceRecord {
+	int64_t at_ns[TRACE_PHASES]; /* monotonic clock, nanoseconds. 0 for phases the request didn't pass (e.g. accept on all but a connection's first) */
+
+	uint64_t id; /* request id. 0 for v1 */
+
+	uint32_t uid;
+
+	uint8_t cmd; /* (uint8_t)request_command::* */
+
+	uint8_t status; /* response status */
+
+	uint8_t ring; /* boolean. arrived through a shared-memory ring */
+
+	uint8_t pad;
+};
+
+/**
+ * @brief TraceDumpHeader (struct) - start of a dump. that many TraceRecord follow, oldest first
+ */
+struct TraceDumpHeader {
+	uint32_t magic; /* TRACE_DUMP_MAGIC */
+
+	uint32_t version; /* TRACE_DUMP_VERSION */
+
+	uint64_t record_count;
+
+	uint64_t recorded; /* requests traced since startup. more than record_count means older ones were overwritten */
+};
+
+/**
+ * @brief trace_clock - reads the clock phase timestamps are taken from
+ * @return int64_t - monotonic nanoseconds. 0 (without reading the clock) if the ring is off
+ */
+static inline int64_t trace_clock(void)
+{
+#if NOTICEBOARD_TRACE_RING > 0
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#else
+	return 0;
+#endif /* if NOTICEBOARD_TRACE_RING > 0 */
+}
+
+/**
+ * @brief trace_commit - adds a finished request to the ring, overwriting the oldest once full. does nothing if the ring is off
+ * @param const struct TraceRecord *const record - record to copy in
+ */
+void trace_commit(const struct TraceRecord *const record);
+
+/**
+ * @brief trace_dump - writes the ring's contents out (to a temporary file, then renamed into place)
+ * @param const int dir_fd - directory to write into
+ * @param const char *const name - filename
+ * @return int - zero is success, non-zero is failure
+ * 1 is the ring is off, 2 is error writing
+ */
+int trace_dump(const int dir_fd, const char *const name);
+
+#endif /* TRACE_H */
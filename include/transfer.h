@@ -0,0 +1,110 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "constraints.h"
+#include "request.h"
+#include "archive.h"
+#include "store.h"
+
+struct Session; /* see client_handling.h */
+
+/**
+ * @brief Declarations of running an export or import (see archive.h) in the background, so the event loop never waits on the archive
+ * The archive handle is the client's, so reading or writing it can block for as long as the client (or whatever's behind the handle) likes. So each transfer runs in a forked child, which streams the archive with blocking I/O of its own while the server carries on serving everyone else
+ * An export needs nothing back from the child. An import does - the notes it creates belong in the index, which only the server holds. The child reports each note over a pipe once created, & the server indexes up to NOTICEBOARD_TRANSFER_BATCH of them per pass of the event loop. Each is checked against the filesystem first, so one removed in between isn't indexed
+ * Imported notes become visible as they're indexed. One transfer runs at a time. The child keeps copies of every handle the server had when it forked, until it exits
+ * Shutting down (or handing over) mid-transfer kills the child. Everything it reported is indexed - but an interrupted import may have created a note it never got to report, so the index is then marked incomplete, & the next start rebuilds it
+ */
+
+#ifndef NOTICEBOARD_TRANSFER_BATCH
+	#define NOTICEBOARD_TRANSFER_BATCH 64 /* imported notes indexed per pass of the event loop */
+#endif /* ifndef NOTICEBOARD_TRANSFER_BATCH */
+
+#if NOTICEBOARD_TRANSFER_BATCH < 1
+	#error "'NOTICEBOARD_TRANSFER_BATCH' must be positive"
+#endif /* if NOTICEBOARD_TRANSFER_BATCH < 1 */
+
+/**
+ * @brief TransferReport (struct) - one message from the child. sent whole, as one write (well under PIPE_BUF), so none are ever interleaved or split
+ */
+struct TransferReport {
+	int64_t expires_ns; /* note's expiry, as archived. 0 for never */
+
+	uint32_t uid; /* owner */
+
+	uint32_t size; /* length of note body */
+
+	int result; /* last report only - archive_export's or archive_import's return */
+
+	struct ArchiveStats stats; /* last report only - what was transferred */
+
+	uint8_t sbj_len; /* 1 to MAX_SBJ_LEN. 0 marks the last report, carrying the outcome instead of a note */
+
+	char sbj[MAX_SBJ_LEN]; /* not null terminated */
+};
+
+/**
+ * @brief Transfer (struct) - the transfer under way, if any
+ */
+struct Transfer {
+	pid_t pid; /* child running it. 0 if there's none */
+
+	int report_fd; /* read end of the child's reports (non-blocking). -1 if there's no transfer */
+
+	enum request_command cmd; /* EXPORT or IMPORT */
+
+	struct Session *session; /* session waiting on the answer. the caller's to check it's still waiting once the transfer's done */
+
+	uint8_t version; /* protocol version of the request being answered */
+
+	uint32_t id; /* its id */
+
+	int finished; /* boolean. the last report has arrived (or the child went without sending it) */
+
+	int result; /* once finished - as per TransferReport::result. -1 if the child died without saying */
+
+	struct ArchiveStats stats; /* once finished - as per TransferReport::stats */
+
+	uint8_t buf[sizeof(struct TransferReport)]; /* a report part read */
+
+	size_t buf_len;
+};
+
+/**
+ * @brief transfer_init - sets up with no transfer under way
+ * @param struct Transfer *const transfer - struct to fill
+ */
+void transfer_init(struct Transfer *const transfer);
+
+/**
+ * @brief transfer_start - forks a child to run an export or import
+ * @param struct Transfer *const transfer - transfer state. none may be under way
+ * @param const struct Store *const store - opened store
+ * @param const enum request_command cmd - EXPORT or IMPORT
+ * @param const int archive_fd - archive handle. always taken - closed (in this process) before returning
+ * @return int - zero is success, non-zero is failure
+ * 1 is a transfer already under way, 2 is error starting the child
+ */
+int transfer_start(struct Transfer *const transfer, const struct Store *const store, const enum request_command cmd, const int archive_fd);
+
+/**
+ * @brief transfer_poll - indexes up to NOTICEBOARD_TRANSFER_BATCH of the child's reports, & reaps the child once it's done. call whenever report_fd is readable
+ * @param struct Transfer *const transfer - transfer under way
+ * @param const struct Store *const store - opened store, with its index
+ * @return int - Boolean. 1 once the transfer is finished (result & stats filled in, report_fd closed), 0 if it's still going
+ */
+int transfer_poll(struct Transfer *const transfer, const struct Store *const store);
+
+/**
+ * @brief transfer_abort - kills the child of a transfer under way, indexing whatever it reported first. does nothing if there's none
+ * @param struct Transfer *const transfer - transfer state
+ * @param const struct Store *const store - opened store, with its index
+ */
+void transfer_abort(struct Transfer *const transfer, const struct Store *const store);
+
+#endif /* TRANSFER_H */
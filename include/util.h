@@ -0,0 +1,52 @@
+#ifndef UTIL_H
+#define UTIL_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Declarations of small helpers shared by the server's modules & the tools - whole-buffer reads & writes, carrying on after short ones, & clock reads in nanoseconds
+ */
+
+/**
+ * @brief write_all - writes a whole buffer, carrying on after short writes
+ * @param const int fd - handle to write to
+ * @param const void *const buf - bytes to write
+ * @param const size_t len - length of buf
+ * @return int - zero is success, non-zero is failure
+ * 1 is error writing (errno set)
+ */
+int write_all(const int fd, const void *const buf, const size_t len);
+
+/**
+ * @brief pread_all - preads a whole buffer, carrying on after short reads
+ * @param const int fd - file
+ * @param void *const buf - buffer to fill
+ * @param const size_t len - length of buf
+ * @param const uint64_t offset - where in the file
+ * @return int - zero is success, non-zero is failure
+ * 1 is error (or end of file reached)
+ */
+int pread_all(const int fd, void *const buf, const size_t len, const uint64_t offset);
+
+/**
+ * @brief pwrite_all - pwrites a whole buffer, carrying on after short writes
+ * @param const int fd - file
+ * @param const void *const buf - bytes to write
+ * @param const size_t len - length of buf
+ * @param const uint64_t offset - where in the file
+ * @return int - zero is success, non-zero is failure
+ * 1 is error (errno set)
+ */
+int pwrite_all(const int fd, const void *const buf, const size_t len, const uint64_t offset);
+
+/**
+ * @brief clock_ns - reads a clock
+ * @param const clockid_t clock - e.g. CLOCK_MONOTONIC, CLOCK_MONOTONIC_COARSE (no syscall - plenty for rates per second) or CLOCK_REALTIME (for expiry times, which are wall-clock times as given to clients)
+ * @return int64_t - nanoseconds
+ */
+int64_t clock_ns(const clockid_t clock);
+
+#endif /* UTIL_H */
@@ -0,0 +1,119 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <time.h>
+#include <sys/types.h>
+
+#include "util.h"
+#include "admission.h"
+
+/**
+ * @brief Definitions of admission control
+ */
+
+#define MILLITOKENS_PER_REQUEST 1000u
+#define BURST_MILLITOKENS ((uint64_t)NOTICEBOARD_UID_BURST * MILLITOKENS_PER_REQUEST)
+
+/**
+ * @brief bucket_refill - tops a bucket up for the time passed since it last was
+ * @param struct AdmissionBucket *const bucket - bucket in use
+ * @param const int64_t now - current monotonic time
+ */
+static void bucket_refill(struct AdmissionBucket *const bucket, const int64_t now)
+{
+	const int64_t elapsed_ns = now - bucket->refilled_ns;
+	if (elapsed_ns <= 0) {
+		return;
+	}
+
+	/* long enough idle to be full anyway? skip the multiply, which could otherwise overflow */
+	const int64_t full_after_ns = (int64_t)(BURST_MILLITOKENS * 1000000 / NOTICEBOARD_UID_RATE);
+	if (elapsed_ns >= full_after_ns) {
+		bucket->millitokens = BURST_MILLITOKENS;
+	} else {
+		bucket->millitokens += (uint64_t)elapsed_ns * NOTICEBOARD_UID_RATE / 1000000; /* rate * elapsed seconds * 1000 */
+		if (bucket->millitokens > BURST_MILLITOKENS) {
+			bucket->millitokens = BURST_MILLITOKENS;
+		}
+	}
+	bucket->refilled_ns = now;
+}
+
+/**
+ * @brief bucket_find - finds a uid's bucket, claiming one if it has none
+ * a full bucket is indistinguishable from no bucket, so when every probed slot is taken, the fullest (idlest) one is reused
+ * @param struct Admission *const admission - admission control state
+ * @param const uint32_t uid - uid to find
+ * @param const int64_t now - current monotonic time
+ * @return struct AdmissionBucket* - refilled bucket
+ */
+static struct AdmissionBucket *bucket_find(struct Admission *const admission, const uint32_t uid, const int64_t now)
+{
+	const size_t start = (size_t)(uid * 2654435761u) & (ADMISSION_BUCKETS - 1); /* same multiplicative hash as the store's fan-out - uids are handed out sequentially */
+	struct AdmissionBucket *victim = NULL;
+
+	for (size_t probe = 0; probe < ADMISSION_PROBES; ++probe) {
+		struct AdmissionBucket *const bucket = &admission->buckets[(start + probe) & (ADMISSION_BUCKETS - 1)];
+		if (!bucket->used) {
+			if (victim == NULL || victim->used) {
+				victim = bucket;
+			}
+			continue;
+		}
+
+		bucket_refill(bucket, now);
+		if (bucket->uid == uid) {
+			return bucket;
+		}
+		if (victim == NULL || (victim->used && bucket->millitokens > victim->millitokens)) {
+			victim = bucket;
+		}
+	}
+
+	victim->uid = uid;
+	victim->used = 1;
+	victim->throttled = 0;
+	victim->millitokens = BURST_MILLITOKENS;
+	victim->refilled_ns = now;
+
+	return victim;
+}
+
+void admission_init(struct Admission *const admission)
+{
+	memset(admission, '\0', sizeof(*admission));
+}
+
+enum admission_verdict admission_admit(struct Admission *const admission, const uid_t uid)
+{
+	if (admission->in_flight >= NOTICEBOARD_MAX_IN_FLIGHT) { /* checked first - shedding for load shouldn't cost anyone a token */
+		++admission->overloaded;
+		return OVERLOADED;
+	}
+
+	struct AdmissionBucket *const bucket = bucket_find(admission, (uint32_t)uid, clock_ns(CLOCK_MONOTONIC_COARSE));
+	if (bucket->millitokens < MILLITOKENS_PER_REQUEST) {
+		if (!bucket->throttled) {
+			fprintf(stderr, "Throttling uid %u - over %d requests per second\n", (unsigned int)uid, NOTICEBOARD_UID_RATE);
+			bucket->throttled = 1;
+		}
+		++admission->throttled;
+		return THROTTLED;
+	}
+
+	if (bucket->millitokens == BURST_MILLITOKENS) { /* only a full bucket ends the episode, else a uid trickling along at its limit would be reported over & over */
+		bucket->throttled = 0;
+	}
+	bucket->millitokens -= MILLITOKENS_PER_REQUEST;
+	++admission->in_flight;
+	++admission->admitted;
+
+	return ADMITTED;
+}
+
+void admission_settle(struct Admission *const admission)
+{
+	admission->in_flight = 0;
+}
@@ -0,0 +1,641 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+#include "request.h"
+#include "subject.h"
+#include "store.h"
+#include "index.h"
+#include "pack.h"
+#include "util.h"
+#include "archive.h"
+
+/**
+ * @brief Definitions of functionality to stream the whole notes store to & from one sequential archive
+ */
+
+/**
+ * @brief ArchiveWriter (struct) - output buffer, so the archive is written in ARCHIVE_IO_LEN chunks
+ */
+struct ArchiveWriter {
+	int fd;
+
+	uint8_t *buf; /* ARCHIVE_IO_LEN bytes */
+
+	size_t len; /* bytes buffered */
+};
+
+/**
+ * @brief ArchiveReader (struct) - input buffer, so the archive is read in ARCHIVE_IO_LEN chunks
+ */
+struct ArchiveReader {
+	int fd;
+
+	uint8_t *buf; /* ARCHIVE_IO_LEN bytes */
+
+	size_t pos; /* next unconsumed byte */
+
+	size_t len; /* bytes buffered */
+};
+
+/**
+ * @brief ExportEntry (struct) - one note of the uid directory being exported
+ */
+struct ExportEntry {
+	ino_t ino;
+
+	char name[MAX_SBJ_LEN + 1];
+};
+
+/**
+ * @brief ExportContext (struct) - state carried across store_for_each_uid's calls to export_uid
+ */
+struct ExportContext {
+	struct ArchiveWriter *writer;
+
+	struct ArchiveStats *stats;
+
+	const struct Index *index; /* NULL if the store has none */
+
+	struct ExportEntry *entries; /* reused from one uid directory to the next */
+
+	size_t entry_cap;
+
+	int64_t now_ns; /* when the export started (realtime clock, nanoseconds). notes expired by then are left out */
+
+	uid_t uid; /* user being exported, for export_packed */
+
+	int uid_dir_fd;
+};
+
+static uint8_t packed_buf[NOTICEBOARD_COLD_MAX_LEN]; /* a packed note being exported */
+
+/**
+ * @brief writer_flush - writes out everything buffered
+ * @param struct ArchiveWriter *const writer - archive being written
+ * @return int - zero is success, non-zero is failure
+ * 1 is error writing
+ */
+static int writer_flush(struct ArchiveWriter *const writer)
+{
+	if (write_all(writer->fd, writer->buf, writer->len) != 0) {
+		fprintf(stderr, "Error writing archive (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+	writer->len = 0;
+
+	return 0;
+}
+
+/**
+ * @brief writer_put - appends bytes to the archive, flushing whenever the buffer fills
+ * @param struct ArchiveWriter *const writer - archive being written
+ * @param const void *const data - bytes to append
+ * @param size_t len - number of bytes
+ * @return int - zero is success, non-zero is failure
+ * 1 is error writing
+ */
+static int writer_put(struct ArchiveWriter *const writer, const void *const data, size_t len)
+{
+	const uint8_t *pos = data;
+	while (len > 0) {
+		if (writer->len == ARCHIVE_IO_LEN && writer_flush(writer) != 0) {
+			return 1;
+		}
+
+		const size_t chunk = (len < ARCHIVE_IO_LEN - writer->len ? len : ARCHIVE_IO_LEN - writer->len);
+		memcpy(writer->buf + writer->len, pos, chunk);
+		writer->len += chunk;
+		pos += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief writer_put_u32 - appends a little endian uint32_t. see writer_put
+ */
+static int writer_put_u32(struct ArchiveWriter *const writer, const uint32_t value)
+{
+	const uint32_t encoded = htole32(value);
+	return writer_put(writer, &encoded, sizeof(encoded));
+}
+
+/**
+ * @brief writer_put_i64 - appends a little endian int64_t. see writer_put
+ */
+static int writer_put_i64(struct ArchiveWriter *const writer, const int64_t value)
+{
+	const uint64_t encoded = htole64((uint64_t)value);
+	return writer_put(writer, &encoded, sizeof(encoded));
+}
+
+/**
+ * @brief writer_put_file - appends a note's body, reading it straight into the output buffer
+ * @param struct ArchiveWriter *const writer - archive being written
+ * @param const int note_fd - note to read from its current position
+ * @param size_t len - exact number of bytes to read
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading (or note shorter than len), 2 is error writing
+ */
+static int writer_put_file(struct ArchiveWriter *const writer, const int note_fd, size_t len)
+{
+	while (len > 0) {
+		if (writer->len == ARCHIVE_IO_LEN && writer_flush(writer) != 0) {
+			return 2;
+		}
+
+		const size_t chunk = (len < ARCHIVE_IO_LEN - writer->len ? len : ARCHIVE_IO_LEN - writer->len);
+		const ssize_t bytes_read = read(note_fd, writer->buf + writer->len, chunk);
+		if (bytes_read == -1 && errno == EINTR) {
+			continue;
+		} else if (bytes_read <= 0) {
+			return 1;
+		}
+		writer->len += (size_t)bytes_read;
+		len -= (size_t)bytes_read;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief reader_fill - makes sure at least `want` bytes are buffered, reading as much as fits whenever the buffer runs low
+ * @param struct ArchiveReader *const reader - archive being read
+ * @param const size_t want - bytes needed. at most ARCHIVE_IO_LEN
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading, 2 is archive ended first
+ */
+static int reader_fill(struct ArchiveReader *const reader, const size_t want)
+{
+	if (reader->len - reader->pos >= want) {
+		return 0;
+	}
+
+	memmove(reader->buf, reader->buf + reader->pos, reader->len - reader->pos); /* at most a record header's worth */
+	reader->len -= reader->pos;
+	reader->pos = 0;
+
+	while (reader->len < want) {
+		const ssize_t bytes_read = read(reader->fd, reader->buf + reader->len, ARCHIVE_IO_LEN - reader->len);
+		if (bytes_read == -1 && errno == EINTR) {
+			continue;
+		} else if (bytes_read == -1) {
+			fprintf(stderr, "Error reading archive (errno %d: %s)\n", errno, strerror(errno));
+			return 1;
+		} else if (bytes_read == 0) {
+			fprintf(stderr, "Archive ended part way through a record\n");
+			return 2;
+		}
+		reader->len += (size_t)bytes_read;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief reader_take - consumes bytes from the archive
+ * @param struct ArchiveReader *const reader - archive being read
+ * @param void *const data - buffer to copy into
+ * @param const size_t len - number of bytes. at most ARCHIVE_IO_LEN
+ * @return int - as per reader_fill
+ */
+static int reader_take(struct ArchiveReader *const reader, void *const data, const size_t len)
+{
+	const int ret = reader_fill(reader, len);
+	if (ret != 0) {
+		return ret;
+	}
+
+	memcpy(data, reader->buf + reader->pos, len);
+	reader->pos += len;
+
+	return 0;
+}
+
+/**
+ * @brief reader_take_u32 - consumes a little endian uint32_t. see reader_take
+ */
+static int reader_take_u32(struct ArchiveReader *const reader, uint32_t *const value)
+{
+	uint32_t encoded = 0;
+	const int ret = reader_take(reader, &encoded, sizeof(encoded));
+	*value = le32toh(encoded);
+
+	return ret;
+}
+
+/**
+ * @brief reader_take_i64 - consumes a little endian int64_t. see reader_take
+ */
+static int reader_take_i64(struct ArchiveReader *const reader, int64_t *const value)
+{
+	uint64_t encoded = 0;
+	const int ret = reader_take(reader, &encoded, sizeof(encoded));
+	*value = (int64_t)le64toh(encoded);
+
+	return ret;
+}
+
+/**
+ * @brief subject_valid - checks an archived subject is one a request could have created
+ * the subject becomes a filename, so it's held to subject_check's rules (see subject.h) - & as it's stored trimmed, any leading whitespace or NULL means no request could have reached it
+ * @param const char *const sbj - subject (not null terminated)
+ * @param const uint32_t sbj_len - length of sbj
+ * @return int - Boolean. 1 if valid, 0 if not
+ */
+static int subject_valid(const char *const sbj, const uint32_t sbj_len)
+{
+	size_t offset = 0;
+	size_t len = 0;
+
+	return (subject_check((const uint8_t*)sbj, sbj_len, &offset, &len) == 0 && offset == 0 && len == sbj_len);
+}
+
+/**
+ * @brief compare_entries - qsort comparator, ordering ExportEntry by inode
+ */
+static int compare_entries(const void *const a, const void *const b)
+{
+	const ino_t ino_a = ((const struct ExportEntry*)a)->ino;
+	const ino_t ino_b = ((const struct ExportEntry*)b)->ino;
+
+	return (ino_a > ino_b) - (ino_a < ino_b);
+}
+
+/**
+ * @brief export_packed - pack_for_each visitor. appends one packed note to the archive, decompressed - archives hold notes, not how they're stored
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the pack, 2 is error writing the archive
+ */
+static int export_packed(const struct PackRecord *const record, void *const ctx)
+{
+	struct ExportContext *const export = ctx;
+
+	struct stat statbuf;
+	if (fstatat(export->uid_dir_fd, record->sbj, &statbuf, AT_SYMLINK_NOFOLLOW) == 0) { /* a plain file has it - exported already */
+		return 0;
+	}
+
+	uint32_t len;
+	const int ret = pack_read(export->uid_dir_fd, record->offset, record->sbj, packed_buf, &len);
+	if (ret == 2) {
+		fprintf(stderr, "Skipping %u/%s - not a note which can be archived\n", (unsigned int)export->uid, record->sbj);
+		return 0;
+	} else if (ret != 0) {
+		return 1;
+	}
+
+	if (
+		writer_put_u32(export->writer, (uint32_t)export->uid) != 0
+		||
+		writer_put_u32(export->writer, record->sbj_len) != 0
+		||
+		writer_put(export->writer, record->sbj, record->sbj_len) != 0
+		||
+		writer_put_i64(export->writer, 0) != 0 /* expiring notes are never packed */
+		||
+		writer_put_u32(export->writer, len) != 0
+		||
+		writer_put(export->writer, packed_buf, len) != 0
+	) {
+		return 2;
+	}
+
+	++export->stats->notes;
+	export->stats->bytes += len;
+
+	return 0;
+}
+
+/**
+ * @brief export_uid - store_for_each_uid visitor. appends every note of one user to the archive
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the store, 2 is error writing the archive
+ */
+static int export_uid(const uid_t uid, const int uid_dir_fd, void *const ctx)
+{
+	struct ExportContext *const export = ctx;
+
+	const int scan_fd = dup(uid_dir_fd); /* closedir will close the handle it's given, so give it its own */
+	DIR *const dir = (scan_fd == -1 ? NULL : fdopendir(scan_fd));
+	if (dir == NULL) {
+		fprintf(stderr, "Error reading notes directory of uid %u (errno %d: %s)\n", (unsigned int)uid, errno, strerror(errno));
+		if (scan_fd != -1) {
+			close(scan_fd);
+		}
+		return 1;
+	}
+	rewinddir(dir);
+
+	/* list first, then read in inode order - directory order bears no relation to where the files sit on disk */
+	size_t entry_count = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if ((entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN) || strlen(entry->d_name) > MAX_SBJ_LEN || !subject_valid(entry->d_name, (uint32_t)strlen(entry->d_name))) { /* also skips "." & ".." */
+			continue;
+		}
+
+		if (entry_count == export->entry_cap) {
+			const size_t new_cap = (export->entry_cap == 0 ? 64 : export->entry_cap * 2);
+			struct ExportEntry *const grown = realloc(export->entries, new_cap * sizeof(*grown));
+			if (grown == NULL) {
+				fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+				closedir(dir);
+				return 1;
+			}
+			export->entries = grown;
+			export->entry_cap = new_cap;
+		}
+
+		export->entries[entry_count].ino = entry->d_ino;
+		strcpy(export->entries[entry_count].name, entry->d_name); /* length checked above */
+		++entry_count;
+	}
+	closedir(dir);
+
+	if (entry_count > 1) { /* entries is still NULL if no user so far has had a plain file - every note packed */
+		qsort(export->entries, entry_count, sizeof(*export->entries), compare_entries);
+	}
+
+	for (size_t i = 0; i < entry_count; ++i) {
+		const char *const sbj = export->entries[i].name;
+		const int note_fd = openat(uid_dir_fd, sbj, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+		if (note_fd == -1) {
+			if (errno == ELOOP || errno == ENOENT) { /* not a note - server never creates symlinks. or removed (or packed - its record comes later) since listing */
+				continue;
+			}
+			fprintf(stderr, "Error opening note %u/%s (errno %d: %s)\n", (unsigned int)uid, sbj, errno, strerror(errno));
+			return 1;
+		}
+
+		struct stat statbuf;
+		if (fstat(note_fd, &statbuf) != 0 || !S_ISREG(statbuf.st_mode) || statbuf.st_size > (off_t)UINT32_MAX) {
+			fprintf(stderr, "Skipping %u/%s - not a note which can be archived\n", (unsigned int)uid, sbj);
+			close(note_fd);
+			continue;
+		}
+
+		const struct IndexEntry *const indexed = (export->index != NULL ? index_find(export->index, uid, sbj) : NULL);
+		const int64_t expires_ns = (indexed != NULL ? indexed->expires_ns : store_note_expiry(note_fd)); /* the index has it even if the xattr couldn't be set */
+		if (expires_ns != 0 && expires_ns <= export->now_ns) { /* gone as far as anyone can tell - just not deleted yet */
+			close(note_fd);
+			continue;
+		}
+
+		int ret = 0;
+		if (
+			writer_put_u32(export->writer, (uint32_t)uid) != 0
+			||
+			writer_put_u32(export->writer, (uint32_t)strlen(sbj)) != 0
+			||
+			writer_put(export->writer, sbj, strlen(sbj)) != 0
+			||
+			writer_put_i64(export->writer, expires_ns) != 0
+			||
+			writer_put_u32(export->writer, (uint32_t)statbuf.st_size) != 0
+		) {
+			ret = 2;
+		} else {
+			ret = writer_put_file(export->writer, note_fd, (size_t)statbuf.st_size);
+			if (ret == 1) {
+				fprintf(stderr, "Error reading note %u/%s (errno %d: %s)\n", (unsigned int)uid, sbj, errno, strerror(errno));
+			}
+		}
+		close(note_fd);
+
+		if (ret != 0) {
+			return ret;
+		}
+
+		++export->stats->notes;
+		export->stats->bytes += (uint64_t)statbuf.st_size;
+	}
+
+	export->uid = uid;
+	export->uid_dir_fd = uid_dir_fd;
+	const int walked = pack_for_each(uid_dir_fd, export_packed, export);
+
+	return (walked == -1 ? 1 : walked);
+}
+
+int archive_export(const struct Store *const store, const int out_fd, struct ArchiveStats *const stats)
+{
+	memset(stats, '\0', sizeof(*stats));
+
+	struct ArchiveWriter writer = { .fd = out_fd, .buf = malloc(ARCHIVE_IO_LEN), .len = 0 };
+	if (writer.buf == NULL) {
+		fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	struct ExportContext export = { .writer = &writer, .stats = stats, .index = store->index, .entries = NULL, .entry_cap = 0, .now_ns = clock_ns(CLOCK_REALTIME), .uid = 0, .uid_dir_fd = -1 };
+	int exit_code = 0;
+
+	if (writer_put_u32(&writer, ARCHIVE_MAGIC) != 0 || writer_put_u32(&writer, ARCHIVE_VERSION) != 0) {
+		exit_code = 2;
+		goto end;
+	}
+
+	const int walked = store_for_each_uid(store, export_uid, &export);
+	if (walked != 0) {
+		exit_code = (walked == -1 ? 1 : walked);
+		goto end;
+	}
+
+	const uint64_t count = htole64(stats->notes);
+	if (writer_put_u32(&writer, 0) != 0 || writer_put_u32(&writer, 0) != 0 || writer_put(&writer, &count, sizeof(count)) != 0 || writer_flush(&writer) != 0) { /* trailer */
+		exit_code = 2;
+		goto end;
+	}
+
+end:
+	free(export.entries);
+	free(writer.buf);
+
+	return exit_code;
+}
+
+/**
+ * @brief import_body - writes a record's body out to its (newly created) note
+ * @param struct ArchiveReader *const reader - archive, positioned at the body
+ * @param const int note_fd - note to write to, or -1 to just skip over the body
+ * @param uint32_t len - body length
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the archive, 2 is malformed archive, 3 is error writing the note
+ */
+static int import_body(struct ArchiveReader *const reader, const int note_fd, uint32_t len)
+{
+	while (len > 0) {
+		if (reader->pos == reader->len) {
+			const int ret = reader_fill(reader, 1); /* tops up with as much as the buffer holds */
+			if (ret != 0) {
+				return ret;
+			}
+		}
+
+		const size_t available = reader->len - reader->pos;
+		const size_t chunk = (len < available ? len : available);
+		if (note_fd != -1 && write_all(note_fd, reader->buf + reader->pos, chunk) != 0) { /* straight from the input buffer */
+			return 3;
+		}
+		reader->pos += chunk;
+		len -= (uint32_t)chunk;
+	}
+
+	return 0;
+}
+
+int archive_import(const struct Store *const store, const int in_fd, void (*const imported)(const uid_t, const char *const, const uint32_t, const int64_t, void *const), void *const ctx, struct ArchiveStats *const stats)
+{
+	memset(stats, '\0', sizeof(*stats));
+
+	struct ArchiveReader reader = { .fd = in_fd, .buf = malloc(ARCHIVE_IO_LEN), .pos = 0, .len = 0 };
+	if (reader.buf == NULL) {
+		fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+	posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL); /* just a hint - fails harmlessly on pipes */
+
+	int exit_code = 0;
+	uid_t dir_uid = 0;
+	int dir_fd = -1; /* archives hold each user's notes together, so the uid directory is kept open between records */
+	const int64_t now_ns = clock_ns(CLOCK_REALTIME);
+
+	uint32_t magic, version;
+	if ((exit_code = reader_take_u32(&reader, &magic)) != 0 || (exit_code = reader_take_u32(&reader, &version)) != 0) {
+		goto end;
+	}
+	if (magic != ARCHIVE_MAGIC || version < ARCHIVE_VERSION_NO_EXPIRY || version > ARCHIVE_VERSION) {
+		fprintf(stderr, "Not a notes archive (or unsupported version %u)\n", version);
+		exit_code = 2;
+		goto end;
+	}
+
+	while (1) {
+		uint32_t uid, sbj_len, body_len;
+		if ((exit_code = reader_take_u32(&reader, &uid)) != 0 || (exit_code = reader_take_u32(&reader, &sbj_len)) != 0) {
+			goto end;
+		}
+
+		if (sbj_len == 0) { /* trailer */
+			uint64_t count;
+			if ((exit_code = reader_take(&reader, &count, sizeof(count))) != 0) {
+				goto end;
+			}
+			if (uid != 0 || le64toh(count) != stats->notes + stats->skipped + stats->expired) {
+				fprintf(stderr, "Archive trailer doesn't match its contents\n");
+				exit_code = 2;
+			}
+			goto end;
+		}
+
+		char sbj[MAX_SBJ_LEN + 1];
+		if (sbj_len > MAX_SBJ_LEN) {
+			fprintf(stderr, "Archived subject too long (%u)\n", sbj_len);
+			exit_code = 2;
+			goto end;
+		}
+		int64_t expires_ns = 0;
+		if ((exit_code = reader_take(&reader, sbj, sbj_len)) != 0 || (version > ARCHIVE_VERSION_NO_EXPIRY && (exit_code = reader_take_i64(&reader, &expires_ns)) != 0) || (exit_code = reader_take_u32(&reader, &body_len)) != 0) {
+			goto end;
+		}
+		sbj[sbj_len] = '\0';
+
+		if (expires_ns < 0) {
+			fprintf(stderr, "Archived expiry of '%s' is invalid\n", sbj);
+			exit_code = 2;
+			goto end;
+		}
+
+		if (!subject_valid(sbj, sbj_len)) {
+			fprintf(stderr, "Archived subject '%s' is invalid\n", sbj);
+			exit_code = 2;
+			goto end;
+		}
+
+		if (dir_fd == -1 || dir_uid != (uid_t)uid) {
+			if (dir_fd != -1) {
+				close(dir_fd);
+			}
+			dir_uid = (uid_t)uid;
+			dir_fd = store_uid_dir(store, dir_uid, 1);
+			if (dir_fd == -1) {
+				fprintf(stderr, "Error creating directory for uid %u (errno %d: %s)\n", uid, errno, strerror(errno));
+				exit_code = 3;
+				goto end;
+			}
+		}
+
+		const int expired = (expires_ns != 0 && expires_ns <= now_ns);
+		const struct IndexEntry *const packed = (store->index != NULL ? index_find(store->index, (uid_t)uid, sbj) : NULL);
+		int note_fd = -1;
+		if (!expired && (packed == NULL || packed->pack_offset == 0)) { /* a packed note has no file for O_EXCL to trip over, but exists all the same */
+			note_fd = openat(dir_fd, sbj, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, (expires_ns != 0 ? STORE_EXPIRING_NOTE_PERMISSIONS : STORE_NOTE_PERMISSIONS));
+			if (note_fd == -1 && errno != EEXIST) {
+				fprintf(stderr, "Error creating note %u/%s (errno %d: %s)\n", uid, sbj, errno, strerror(errno));
+				exit_code = 3;
+				goto end;
+			}
+		}
+
+		exit_code = import_body(&reader, note_fd, body_len);
+		if (exit_code == 0 && note_fd != -1 && expires_ns != 0) {
+			const uint64_t expires_le = htole64((uint64_t)expires_ns);
+			if (fsetxattr(note_fd, STORE_EXPIRY_XATTR, &expires_le, sizeof(expires_le), 0) != 0) { /* as for an add - the index (& its snapshot) still has it */
+				fprintf(stderr, "Error recording expiry of %u/%s (errno %d: %s)\n", uid, sbj, errno, strerror(errno));
+			}
+		}
+		if (expired) {
+			++stats->expired;
+		} else if (note_fd == -1) { /* existing note wins */
+			++stats->skipped;
+		} else {
+			close(note_fd);
+			if (exit_code != 0) {
+				unlinkat(dir_fd, sbj, 0); /* don't leave a truncated note behind */
+			} else {
+				++stats->notes;
+				stats->bytes += body_len;
+				if (imported != NULL) {
+					imported((uid_t)uid, sbj, body_len, expires_ns, ctx);
+				} else if (store->index != NULL) {
+					index_insert(store->index, (uid_t)uid, sbj, body_len, clock_ns(CLOCK_REALTIME), expires_ns); /* schedules its expiry too */
+				}
+			}
+		}
+
+		if (exit_code != 0) {
+			if (exit_code == 3) {
+				fprintf(stderr, "Error writing note %u/%s (errno %d: %s)\n", uid, sbj, errno, strerror(errno));
+			}
+			goto end;
+		}
+	}
+
+end:
+	if (dir_fd != -1) {
+		close(dir_fd);
+	}
+	free(reader.buf);
+
+	if (stats->notes > 0 && syncfs(store->dir_fd) != 0) { /* the one durability barrier for the whole import */
+		fprintf(stderr, "Error syncing imported notes to disk (errno %d: %s)\n", errno, strerror(errno));
+		exit_code = (exit_code != 0 ? exit_code : 3);
+	}
+
+	return exit_code;
+}
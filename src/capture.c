@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "store.h"
+#include "util.h"
+#include "capture.h"
+
+/**
+ * @brief Definitions of traffic capture
+ */
+
+#if NOTICEBOARD_CAPTURE > 0
+static int capture_fd = -1;
+static int64_t capture_started_ns = 0; /* monotonic clock - records are timed from here */
+static uint64_t capture_size = 0; /* bytes written or buffered so far */
+static uint64_t capture_count = 0; /* requests recorded */
+static uint8_t capture_buf[NOTICEBOARD_CAPTURE_BUFFER];
+static size_t capture_buf_len = 0;
+
+/**
+ * @brief put_le - appends an integer to the buffer, little endian
+ * @param uint8_t *const pos - where to write
+ * @param const uint64_t value - value to write
+ * @param const size_t len - width in bytes (2, 4 or 8)
+ * @return uint8_t * - just past what was written
+ */
+static uint8_t *put_le(uint8_t *const pos, const uint64_t value, const size_t len)
+{
+	for (size_t i = 0; i < len; ++i) {
+		pos[i] = (uint8_t)(value >> (8 * i));
+	}
+
+	return pos + len;
+}
+
+/**
+ * @brief capture_stop - gives up capturing after an error, keeping whatever made it out
+ */
+static void capture_stop(void)
+{
+	fprintf(stderr, "Error writing capture (errno %d: %s) - no longer capturing\n", errno, strerror(errno));
+	close(capture_fd);
+	capture_fd = -1;
+	capture_buf_len = 0;
+}
+#endif /* if NOTICEBOARD_CAPTURE > 0 */
+
+int capture_open(const int dir_fd, const char *const name, const int resume)
+{
+#if NOTICEBOARD_CAPTURE > 0
+	capture_fd = openat(dir_fd, name, O_RDWR | O_CREAT | O_APPEND | O_NOFOLLOW | O_CLOEXEC, STORE_NOTE_PERMISSIONS);
+	if (capture_fd == -1) {
+		fprintf(stderr, "Error creating capture (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	capture_buf_len = 0;
+	capture_count = 0;
+
+	struct stat statbuf;
+	uint8_t header[CAPTURE_HEADER_LEN];
+	if (resume && fstat(capture_fd, &statbuf) == 0 && statbuf.st_size >= CAPTURE_HEADER_LEN && pread_all(capture_fd, header, sizeof(header), 0) == 0) {
+		uint32_t magic;
+		uint16_t version;
+		uint16_t flags;
+		int64_t started_ns;
+		memcpy(&magic, header, sizeof(magic));
+		memcpy(&version, header + 4, sizeof(version));
+		memcpy(&flags, header + 6, sizeof(flags));
+		memcpy(&started_ns, header + 8, sizeof(started_ns));
+		if (le32toh(magic) == CAPTURE_MAGIC && le16toh(version) == CAPTURE_VERSION && le16toh(flags) == (NOTICEBOARD_CAPTURE > 1 ? CAPTURE_FLAG_CONTENT : 0)) { /* carry on the same timeline - records are timed from when the capture, not this server, started */
+			capture_started_ns = clock_ns(CLOCK_MONOTONIC) - (clock_ns(CLOCK_REALTIME) - (int64_t)le64toh((uint64_t)started_ns));
+			capture_size = (uint64_t)statbuf.st_size;
+			fprintf(stdout, "Capturing requests%s on the end of %s\n", (NOTICEBOARD_CAPTURE > 1 ? " (with content)" : ""), name);
+			return 0;
+		}
+	}
+
+	if (ftruncate(capture_fd, 0) != 0) { /* a fresh capture - either asked for, or what's there can't be carried on */
+		fprintf(stderr, "Error emptying capture (errno %d: %s)\n", errno, strerror(errno));
+		close(capture_fd);
+		capture_fd = -1;
+		return 1;
+	}
+
+	capture_started_ns = clock_ns(CLOCK_MONOTONIC);
+
+	uint8_t *pos = put_le(capture_buf, CAPTURE_MAGIC, 4);
+	pos = put_le(pos, CAPTURE_VERSION, 2);
+	pos = put_le(pos, (NOTICEBOARD_CAPTURE > 1 ? CAPTURE_FLAG_CONTENT : 0), 2);
+	pos = put_le(pos, (uint64_t)clock_ns(CLOCK_REALTIME), 8);
+	capture_buf_len = CAPTURE_HEADER_LEN;
+	capture_size = CAPTURE_HEADER_LEN;
+
+	fprintf(stdout, "Capturing requests%s to %s\n", (NOTICEBOARD_CAPTURE > 1 ? " (with content)" : ""), name);
+#else
+	(void)dir_fd;
+	(void)name;
+	(void)resume;
+#endif /* if NOTICEBOARD_CAPTURE > 0 */
+
+	return 0;
+}
+
+void capture_request(const uid_t uid, const struct Request *const request)
+{
+#if NOTICEBOARD_CAPTURE > 0
+	if (capture_fd == -1) {
+		return;
+	}
+
+	uint32_t stored_len = 0;
+	if (request->cmd == GET_RANGE || request->cmd == LIST || request->cmd == SINCE || (NOTICEBOARD_CAPTURE > 1 && (request->cmd == ADD || request->cmd == APPEND))) {
+		stored_len = request->extra_data_len;
+	}
+
+	const size_t record_len = CAPTURE_RECORD_FIXED_LEN + request->sbj_len + stored_len;
+	if (capture_size + record_len > NOTICEBOARD_CAPTURE_LIMIT) {
+		fprintf(stdout, "Capture reached its limit after %llu request(s) - no longer capturing\n", (unsigned long long)capture_count);
+		capture_close();
+		return;
+	}
+	if (capture_buf_len + record_len > sizeof(capture_buf)) {
+		capture_flush();
+		if (capture_fd == -1) {
+			return;
+		}
+	}
+
+	uint8_t *pos = capture_buf + capture_buf_len;
+	pos = put_le(pos, (uint64_t)(clock_ns(CLOCK_MONOTONIC) - capture_started_ns), 8);
+	pos = put_le(pos, (uint32_t)uid, 4);
+	pos = put_le(pos, request->ttl_s, 4);
+	pos = put_le(pos, request->extra_data_len, 4);
+	pos = put_le(pos, stored_len, 4);
+	pos = put_le(pos, request->flags, 2);
+	*pos++ = request->cmd;
+	*pos++ = (uint8_t)request->sbj_len;
+	memcpy(pos, request->sbj_content, request->sbj_len);
+	pos += request->sbj_len;
+	if (stored_len > 0) {
+		memcpy(pos, request->extra_data_content, stored_len);
+	}
+	capture_buf_len += record_len;
+	capture_size += record_len;
+	++capture_count;
+#else
+	(void)uid;
+	(void)request;
+#endif /* if NOTICEBOARD_CAPTURE > 0 */
+}
+
+void capture_flush(void)
+{
+#if NOTICEBOARD_CAPTURE > 0
+	if (capture_fd == -1) {
+		return;
+	}
+
+	if (write_all(capture_fd, capture_buf, capture_buf_len) != 0) {
+		capture_stop();
+		return;
+	}
+	capture_buf_len = 0;
+#endif /* if NOTICEBOARD_CAPTURE > 0 */
+}
+
+void capture_close(void)
+{
+#if NOTICEBOARD_CAPTURE > 0
+	if (capture_fd == -1) {
+		return;
+	}
+
+	capture_flush();
+	if (capture_fd != -1) {
+		close(capture_fd);
+		capture_fd = -1;
+		fprintf(stdout, "Captured %llu request(s) (%llu bytes)\n", (unsigned long long)capture_count, (unsigned long long)capture_size);
+	}
+#endif /* if NOTICEBOARD_CAPTURE > 0 */
+}
@@ -6,14 +6,11 @@
 
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
-#include <sys/un.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <sys/stat.h>
+#include <time.h>
 
-#include "request.h"
-#include "response.h"
+#include "libnote.h"
 
 #ifndef NOTICEBOARD_SOCK_NAME
 	#error "'NOTICEBOARD_SOCK_NAME' must be set to a UNIX IPC socketfile"
@@ -21,15 +18,22 @@
 
 /**
  * @brief Client application to be ran each by ordinary users
- * Adds, views & removes notes
+ * Adds, views (whole or in part), appends to, removes & lists notes, or (as the admin) exports & imports the whole store. A thin command line wrapper over libnote
  */
 
+#define NOTE_SINCE_MAX_HOURS (24 * 365 * 100) /* a century - well clear of overflowing nanoseconds since the epoch */
+
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
 #pragma GCC diagnostic push
 const char* argp_program_bug_address = "salih.msa@outlook.com" ;
-static const char args_doc[] = "COMMAND SUBJECT" ; /* description of non-option specified command line arguments */
-static const char doc[] = "note -- client-side program to either write, read, or remove notes" ; /* general program documentation */
+static const char args_doc[] = "COMMAND [SUBJECT|PATH|HOURS]" ; /* description of non-option specified command line arguments */
+static const char doc[] = "note -- client-side program to either write, read, append to, or remove notes, list every note you have, or those created in the last HOURS hours (since). the admin may also export or import every note to / from an archive at PATH" ; /* general program documentation */
 static struct argp_option options[] = { /* OPTIONS FOR ARGP. each entry stores: {NAME, KEY, ARG, FLAGS, DOC} */
+	{"ring", 'r', 0, 0, "Send the request through a shared-memory ring negotiated over the socket, rather than the socket itself"},
+	{"offset", 'o', "BYTES", 0, "read only - start reading this far into the note"},
+	{"length", 'l', "BYTES", 0, "read only - read at most this many bytes"},
+	{"ttl", 't', "SECONDS", 0, "write only - the note expires (& is deleted) this many seconds after it's written"},
+	{"until", 'u', "HOURS", 0, "since only - leave out notes created in the last HOURS hours"},
 	{0}
 };
 
@@ -37,9 +41,21 @@ static struct argp_option options[] = { /* OPTIONS FOR ARGP. each entry stores:
  * @brief struct arguments - this structure is used to communicate with parse_opt (for it to store the values it parses within it)
  */
 struct arguments {
-	const char *cmd; /* read/write/view */
+	const char *cmd; /* read/write/append/remove/list/since/export/import */
+
+	const char *sbj; /* name of note text / subject. archive path for export & import. hours for since. NULL for list */
+
+	int ring; /* boolean. use shared-memory ring transport */
+
+	int ranged; /* boolean. read only a slice of the note (offset and/or length given) */
+
+	unsigned long long offset; /* ranged reads - where to start */
+
+	uint32_t length; /* ranged reads - most to read */
 
-	const char *sbj; /* name of note text / subject */
+	uint32_t ttl_s; /* writes - seconds until the note expires, 0 for never */
+
+	unsigned long until_h; /* since - hours ago the window ends, 0 for now */
 };
 
 /**
@@ -54,12 +70,51 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
 	struct arguments *arguments = state->input;
 
 	switch (key) {
+		case 'r':
+			arguments->ring = 1;
+			break;
+		case 'o':
+		case 'l': {
+			char *arg_end;
+			errno = 0;
+			const unsigned long long value = strtoull(arg, &arg_end, 10);
+			if (errno != 0 || arg[0] < '0' || arg[0] > '9' || *arg_end != '\0' || (key == 'l' && (value < 1 || value > MAX_EXTRA_DATA_LEN))) {
+				argp_error(state, "--%s should be a number of bytes%s", (key == 'o' ? "offset" : "length"), (key == 'l' ? " (1 to MAX_EXTRA_DATA_LEN)" : ""));
+			}
+			if (key == 'o') {
+				arguments->offset = value;
+			} else {
+				arguments->length = (uint32_t)value;
+			}
+			arguments->ranged = 1;
+			break;
+		}
+		case 't': {
+			char *arg_end;
+			errno = 0;
+			const unsigned long long value = strtoull(arg, &arg_end, 10);
+			if (errno != 0 || arg[0] < '0' || arg[0] > '9' || *arg_end != '\0' || value < 1 || value > UINT32_MAX) {
+				argp_error(state, "--ttl should be a number of seconds (1 to %u)", (unsigned int)UINT32_MAX);
+			}
+			arguments->ttl_s = (uint32_t)value;
+			break;
+		}
+		case 'u': {
+			char *arg_end;
+			errno = 0;
+			const unsigned long value = strtoul(arg, &arg_end, 10);
+			if (errno != 0 || arg[0] < '0' || arg[0] > '9' || *arg_end != '\0' || value > NOTE_SINCE_MAX_HOURS) {
+				argp_error(state, "--until should be a number of hours (0 to %d)", NOTE_SINCE_MAX_HOURS);
+			}
+			arguments->until_h = value;
+			break;
+		}
 		case ARGP_KEY_ARG:
 			if (state->arg_num == 0) { /* if arg 1 */
-				if (strcmp(arg, "write") == 0 || strcmp(arg, "read") == 0 || strcmp(arg, "remove") == 0) { /* no issue with using strcmp for 100% string literals (namely those "" and argv's) */
+				if (strcmp(arg, "write") == 0 || strcmp(arg, "read") == 0 || strcmp(arg, "append") == 0 || strcmp(arg, "remove") == 0 || strcmp(arg, "list") == 0 || strcmp(arg, "since") == 0 || strcmp(arg, "export") == 0 || strcmp(arg, "import") == 0) { /* no issue with using strcmp for 100% string literals (namely those "" and argv's) */
 					arguments->cmd = arg;
 				} else {
-					fprintf(stderr, "Arg #1 should be any of the following: write read remove\n");
+					fprintf(stderr, "Arg #1 should be any of the following: write read append remove list since export import\n");
 					argp_usage(state);
 				}
 			} else if (state->arg_num == 1) { /* if arg 2 */
@@ -69,7 +124,7 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
 			}
 			break;
 		case ARGP_KEY_END:
-			if (state->arg_num < 2) { /* if end arg is not end of expected range ... */
+			if (state->arg_num < 1 || (state->arg_num < 2 && strcmp(arguments->cmd, "list") != 0)) { /* if end arg is not end of expected range (list takes no subject) ... */
 				argp_usage(state);
 			}
 			break;
@@ -89,6 +144,24 @@ static struct argp argp = { /* argp - The ARGP structure itself */
 };
 #pragma GCC diagnostic pop /* end of argp, so end of repressing weird messages */
 
+/**
+ * @brief print_listings - prints a page of listed notes, one per line
+ * @param const struct NoteListing *const listings - page's notes
+ * @param const size_t listing_count - number of notes
+ */
+static void print_listings(const struct NoteListing *const listings, const size_t listing_count)
+{
+	for (size_t i = 0; i < listing_count; ++i) {
+		const time_t mtime = (time_t)(listings[i].mtime_ns / 1000000000);
+		struct tm mtime_tm;
+		char mtime_str[sizeof("YYYY-MM-DD HH:MM:SS")] = "?";
+		if (localtime_r(&mtime, &mtime_tm) != NULL) {
+			strftime(mtime_str, sizeof(mtime_str), "%Y-%m-%d %H:%M:%S", &mtime_tm);
+		}
+		fprintf(stdout, "%-*s %10llu byte(s)  %s\n", MAX_SBJ_LEN, listings[i].sbj, (unsigned long long)listings[i].size, mtime_str);
+	}
+}
+
 /**
  * @brief main - driver of `note`
  * @param int argc - number of arguments. should be 3
@@ -101,176 +174,157 @@ int main(int argc, char **argv)
 	/** Initialisation **/
 	const char *const notes_socket = NOTICEBOARD_ROOT_DIR_NAME "/" NOTICEBOARD_SOCK_NAME; /* set actual variables to be content of macros */
 	struct arguments arguments;
+	arguments.sbj = NULL;
+	arguments.ring = 0;
+	arguments.ranged = 0;
+	arguments.offset = 0;
+	arguments.length = MAX_EXTRA_DATA_LEN;
+	arguments.ttl_s = 0;
+	arguments.until_h = 0;
 	argp_parse(&argp, argc, argv, 0, 0, &arguments); /* number, content, etc. of cmd-line args checked here */
 	const char *cmd = arguments.cmd;
 	const char *sbj = arguments.sbj;
 
-	/* Number 1: create UNIX (IPC) socket
-	 * AF_UNIX / AF_LOCAL (as opposed to AF_INET)
-	 * 0 just selects first protocol which implements what's requested
-	 * we connect to the IPC socket created by the server
-	 * we also disable stupid SIGPIPE
-	 * (from here, we also goto a cleanup section. man do i hate C sometimes)
-	 */
-	int exit_code = 0;
-	
-	const int sock = socket(AF_UNIX, SOCK_STREAM, 0);
-	if (sock == -1) {  /* validly can be any non-negative so check for -1 which is error */
-		fprintf(stderr, "Failure to create socket (errno %d: %s)\n", errno, strerror(errno));
-		return 1;
-	}
-
 	if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {   /* working with sockets can introduce a SIGPIPE signal
 							* can't exactly use this like an exception, so ignore and purely use exit codes
 							* more portable than using setsockopt(...)
 							*/
 		fprintf(stderr, "Failure to set signal to handle SIGPIPE (errno %d: %s)\n", errno, strerror(errno));
-		exit_code = 1;
-		goto eop;
-	}
-
-	struct sockaddr_un address; /* unix-derived domain sockets address */
-	address.sun_family = AF_UNIX;
-
-	if (sizeof(address.sun_path) < strlen(notes_socket) + 1) { /* this shouldn't be a problem but different OSs differ for this val. linux is 108. simply crash program if we can't fit this in. also +1 is because strlen is len - null terminator */
-		fprintf(stderr, "(Internal error) Somehow the IPC socket's name is too long. Review source code\n");
-		exit_code = 1;
-		goto eop;
+		return 1;
 	}
-	memset(address.sun_path, '\0', sizeof(address.sun_path));
-	strncpy(address.sun_path, notes_socket, strlen(notes_socket));
 
-	socklen_t addrlen = sizeof(address);
-
-//	fprintf(stdout, "Creating listener to a UNIX domain socket @ %s\n", notes_socket);
-	if (connect(sock, (struct sockaddr*)&address, addrlen) != 0) { /* set socket up to serve as a server */
-		fprintf(stderr, "Failure to connect socket to end-point (errno %d: %s)\n", errno, strerror(errno));
-		exit_code = 1;
-		goto eop;
+	/* Number 1: connect to the server
+	 * all of the socket (and optionally ring) handling lives in libnote - we're just another user of it
+	 */
+	struct NoteHandle *const handle = note_open(notes_socket, (arguments.ring ? NOTE_OPEN_RING : 0));
+	if (handle == NULL) {
+		return 1;
 	}
 
 	/** Main Program **/
 
-	/* Number 2: send data
-	 * determine course of action based of cmd:
-	   * add: reach message from stdin, send to server
-	   * view: just send subject to server and await response
-	   * remove: just send subject to server
-	 * we'll be using switch-case, which will basically copy bytes over to a buffer
-	 * send string matching a valid API command (add = add, see = view, rmv = remove) - 3 letters just to make it easier
-	 * await confirmation / data
+	/* Number 2: carry out command
+	 * write: read message from stdin, send to server
+	 * read: fetch note (or just the slice asked for) into a buffer & print it. a note longer than the buffer is printed a page at a time
+	 * append: read message from stdin, send to server to add to the end of the note
+	 * remove: just send subject to server
+	 * list: fetch a page of notes at a time, printing each page as it comes
+	 * since: as list, but only notes created within the window, oldest first
+	 * export / import: open the archive ourselves (with our own permissions) & hand it to the server
 	 */
-//	fprintf(stdout, "Determining request to send to server\n");
-	struct Request req;
-
-	if (strcmp(cmd, "write") == 0) {
-		req.cmd = ADD;
-	} else if (strcmp(cmd, "read") == 0) {
-		req.cmd = GET;
-	} else if (strcmp(cmd, "remove") == 0) {
-		req.cmd = REMOVE;
-	} else {
-		fprintf(stderr, "Invalid command (%s). Not sure why input parser didn't catch this...\n", cmd);
+	int exit_code = 0;
+	char *const file_contents = malloc(MAX_EXTRA_DATA_LEN + 1); /* +1 so a read note can be null terminated for printing */
+	if (file_contents == NULL) {
+		fprintf(stderr, "Allocating block failed\n");
 		exit_code = 2;
 		goto eop;
 	}
-//	fprintf(stdout, "Request: %s -> %d\n", cmd, req.cmd);
-
-	req.sbj_len = strlen(sbj); /* set sbj_len */
-	if (req.sbj_len > sizeof(req.sbj_content)) {
-		fprintf(stderr, "Command-line subject exceeds acceptabled length (maximum %u, was given %lu)\n", req.sbj_len, sizeof(req.sbj_content));
-		return 2;
-	}
-
-#pragma GCC diagnostic ignored "-Wcast-qual"
-#pragma GCC diagnostic push
-	memcpy(req.sbj_content, (uint8_t*)sbj, sizeof(req.sbj_content)); /* set sbj_content */
-#pragma GCC diagnostic pop /* this is a really tricky issue due to my warning setup. i know this specific issue isn't a problem */ 
-
-	/* we need to know what to set for extra_data_* */
-	if (req.cmd == ADD) { /* we need to read into stdin for this, so the send procedure requires reading in and sending out */
-		char *file_contents = malloc(MAX_EXTRA_DATA_LEN); /* read from stdin using fgets & ioctl */
-		if (!file_contents) {
-			fprintf(stderr, "Allocating block failed\n");
-			exit_code = 2;
-			goto eop;
-		}
-
-		memset(file_contents, '\0', MAX_EXTRA_DATA_LEN);
+	memset(file_contents, '\0', MAX_EXTRA_DATA_LEN + 1);
 
+	int ret;
+	if (strcmp(cmd, "write") == 0 || strcmp(cmd, "append") == 0) {
 		write(STDOUT_FILENO, "> ", sizeof("> ")); /* prompt */
-		ssize_t bytes_read = read(STDIN_FILENO, file_contents, MAX_EXTRA_DATA_LEN);
+		const ssize_t bytes_read = read(STDIN_FILENO, file_contents, MAX_EXTRA_DATA_LEN);
 		if (bytes_read <= 0) {
 			fprintf(stderr, "Failure to get any contents from stdin (errno %d: %s)\n", errno, strerror(errno));
-			free(file_contents);
 			exit_code = 2;
 			goto eop;
 		}
 
-		req.extra_data_len = bytes_read;
-		req.extra_data_content = (uint8_t*)file_contents;
-
-		int ret = request_send(&req, sock);
-		free(file_contents);
-		if (ret != 0) {
-			exit_code = 2;
-			goto eop;
+		if (strcmp(cmd, "write") == 0) {
+			ret = (arguments.ttl_s != 0 ? note_add_ttl(handle, sbj, file_contents, (uint32_t)bytes_read, arguments.ttl_s) : note_add(handle, sbj, file_contents, (uint32_t)bytes_read));
+		} else {
+			uint64_t note_len = 0;
+			ret = note_append(handle, sbj, file_contents, (uint32_t)bytes_read, &note_len);
+			if (ret == 0) {
+				fprintf(stdout, "Note is now %llu byte(s) long\n", (unsigned long long)note_len);
+			}
 		}
-	} else { /* for viewing and removal, we just send the subject / arg 2 */
-		req.extra_data_len = 0;
-		req.extra_data_content = NULL;
-
-		if (request_send(&req, sock) != 0) {
+	} else if (strcmp(cmd, "read") == 0) {
+		uint32_t content_len = 0;
+		ret = (arguments.ranged ? note_get_range(handle, sbj, arguments.offset, file_contents, arguments.length, &content_len) : note_get(handle, sbj, file_contents, MAX_EXTRA_DATA_LEN, &content_len));
+		if (ret == 0 || (!arguments.ranged && ret == 3 && content_len == MAX_EXTRA_DATA_LEN)) {
+			fprintf(stdout, "Note: ");
+			fwrite(file_contents, 1, content_len, stdout);
+			int more = (ret == 3); /* longer than one buffer (grown by appends) - print the rest a page at a time, rather than holding it all */
+			ret = 0;
+			for (uint64_t offset = content_len; more && ret == 0; offset += content_len) {
+				ret = note_get_range(handle, sbj, offset, file_contents, MAX_EXTRA_DATA_LEN, &content_len);
+				if (ret == 0) {
+					fwrite(file_contents, 1, content_len, stdout);
+					more = (content_len == MAX_EXTRA_DATA_LEN); /* a full page - there may be more */
+				}
+			}
+			fprintf(stdout, "\n");
+		}
+	} else if (strcmp(cmd, "remove") == 0) {
+		ret = note_remove(handle, sbj);
+	} else if (strcmp(cmd, "list") == 0) {
+		struct NoteListing listings[LIST_PAGE_MAX_ENTRIES];
+		struct NoteCursor cursor = { .len = 0 };
+		size_t listing_count;
+		do {
+			ret = note_list(handle, &cursor, listings, &listing_count);
+			if (ret == 0) {
+				print_listings(listings, listing_count);
+			}
+		} while (ret == 0 && cursor.len != 0);
+	} else if (strcmp(cmd, "since") == 0) {
+		char *hours_end;
+		errno = 0;
+		const unsigned long hours = strtoul(sbj, &hours_end, 10);
+		if (errno != 0 || sbj[0] < '0' || sbj[0] > '9' || *hours_end != '\0' || hours > NOTE_SINCE_MAX_HOURS || arguments.until_h > hours) {
+			fprintf(stderr, "since takes a number of hours (0 to %d), no fewer than --until\n", NOTE_SINCE_MAX_HOURS);
 			exit_code = 2;
 			goto eop;
 		}
-	}
-
-	sleep(1); /* we wait 1 second. either the server responds or we're screwed */
-
-	if (req.cmd == GET) { /* we expect two responses when we make a GET request - the payload and then an ack */
-		struct Response resp;
 
-		resp.extra_data_content = malloc(MAX_EXTRA_DATA_LEN + 1);
-		if (resp.extra_data_content == NULL) {
-			fprintf(stderr, "Unable to allocate buffer to actually read file (errno %d: %s)\n", errno, strerror(errno));
-			exit_code = 1;
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		const int64_t now_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+		const int64_t hour_ns = (int64_t)3600 * 1000000000;
+		struct NoteListing listings[SINCE_PAGE_MAX_ENTRIES];
+		struct NoteCursor cursor = { .len = 0 };
+		size_t listing_count;
+		do {
+			ret = note_since(handle, now_ns - (int64_t)hours * hour_ns, (arguments.until_h > 0 ? now_ns - (int64_t)arguments.until_h * hour_ns : 0), &cursor, listings, &listing_count);
+			if (ret == 0) {
+				print_listings(listings, listing_count);
+			}
+		} while (ret == 0 && cursor.len != 0);
+	} else if (strcmp(cmd, "export") == 0 || strcmp(cmd, "import") == 0) {
+		const int exporting = (strcmp(cmd, "export") == 0);
+		const int archive_fd = (exporting ? open(sbj, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) : open(sbj, O_RDONLY | O_CLOEXEC));
+		if (archive_fd == -1) {
+			fprintf(stderr, "Failure to open archive '%s' (errno %d: %s)\n", sbj, errno, strerror(errno));
+			exit_code = 2;
 			goto eop;
 		}
-		memset(resp.extra_data_content, '\0', MAX_EXTRA_DATA_LEN + 1);
 
-		if (response_recv(&resp, sock) != 0 || resp.status != DATA) {
-			fprintf(stderr, "Error getting data response\n");
-			free(resp.extra_data_content);
-			exit_code = 2;
-			goto eop; /* no point even checking for positive acknowledgement and our GET... failed to get */
+		uint64_t note_count = 0;
+		ret = (exporting ? note_export(handle, archive_fd, &note_count) : note_import(handle, archive_fd, &note_count));
+		close(archive_fd);
+		if (ret == 0) {
+			fprintf(stdout, "%s %llu note(s)\n", (exporting ? "Exported" : "Imported"), (unsigned long long)note_count);
 		}
-
-		fprintf(stdout, "Note: %s\n", (char*)resp.extra_data_content);
-
-		free(resp.extra_data_content);
-		resp.extra_data_content = NULL;
-	}
-
-	struct Response resp;
-	resp.extra_data_content = NULL;
-
-	if (response_recv(&resp, sock) != 0) {
-		fprintf(stderr, "Error getting ACK response\n");
+	} else {
+		fprintf(stderr, "Invalid command (%s). Not sure why input parser didn't catch this...\n", cmd);
 		exit_code = 2;
 		goto eop;
 	}
 
-	if (resp.status != OK) {
+	if (ret == 4) {
+		fprintf(stderr, "Server is busy - try again later\n");
+		exit_code = 2;
+	} else if (ret != 0) {
 		fprintf(stderr, "Error getting good response\n");
 		exit_code = 2;
-		goto eop;
 	}
 
 	/** End of Program (EOP) **/
 eop:
-	if (close(sock) != 0) { /* attempt to close socket whilst reporting errors */
-		fprintf(stderr, "Error closing socket %d (errno %d: %s)\n", sock, errno, strerror(errno));
+	free(file_contents);
+	if (note_close(handle) != 0) {
 		exit_code = 3;
 	}
 	return exit_code;
@@ -1,188 +1,976 @@
 #define _GNU_SOURCE
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <time.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/xattr.h>
 
 #include "request.h"
 #include "response.h"
+#include "store.h"
+#include "ring.h"
+#include "fd_transfer.h"
+#include "transfer.h"
+#include "index.h"
+#include "expiry.h"
+#include "tier.h"
+#include "listing.h"
+#include "admission.h"
+#include "capture.h"
+#include "util.h"
 #include "client_handling.h"
 
 /**
  * @brief Definitions of functionality to manage each server-client relationship
  */
 
-int client_connection(const int client_sock)
+/**
+ * @brief range_parse - decodes the range a GET_RANGE asks for
+ * @param const uint32_t extra_data_len - length of extra_data
+ * @param const char *const extra_data - request's extra data
+ * @param uint64_t *const offset - filled with where in the note to start
+ * @param uint32_t *const length - filled with how many bytes to read. cut to MAX_EXTRA_DATA_LEN
+ * @return int - zero is success, non-zero is failure
+ * 1 is malformed range
+ */
+static int range_parse(const uint32_t extra_data_len, const char *const extra_data, uint64_t *const offset, uint32_t *const length)
 {
-	int exit_code = 0;
-	struct ucred peer_cred;
-	int uid_len;
-	struct Request client_request;
-	client_request.extra_data_content = NULL;
-	char *filename = NULL;
+	if (extra_data_len != REQUEST_RANGE_LEN) {
+		fprintf(stderr, "Range of note to get must be %d bytes (was given %u)\n", REQUEST_RANGE_LEN, extra_data_len);
+		return 1;
+	}
 
-	/* initialise necessary details */
-	socklen_t peer_cred_len = sizeof(peer_cred); /* as usual, getsockopt takes a mutable iot so this is as such */
+	memcpy(offset, extra_data, sizeof(*offset));
+	memcpy(length, extra_data + sizeof(*offset), sizeof(*length));
+	*offset = le64toh(*offset);
+	*length = le32toh(*length);
+	if (*offset > INT64_MAX) {
+		fprintf(stderr, "Offset into note out of range\n");
+		return 1;
+	}
+	if (*length > MAX_EXTRA_DATA_LEN) { /* as much as one response can carry - the client asks again for the rest */
+		*length = MAX_EXTRA_DATA_LEN;
+	}
 
-	if (getsockopt(client_sock, SOL_SOCKET, SO_PEERCRED, &peer_cred, &peer_cred_len) != 0) { /* we want to access the uid of user behind IPC socket via UNIX API */
-		fprintf(stderr, "Error manipulating client sock (errno %d: %s)\n", errno, strerror(errno));
-		exit_code = 1;
-		goto end;
+	return 0;
+}
+
+/**
+ * @brief note_expired - checks a note against the expiry recorded on the note itself, deleting it if that's passed. for when the index can't vouch for it
+ * @param const int uid_dir_fd - directory handle of the owner's notes
+ * @param const char *const sbj - null terminated subject
+ * @param const int note_fd - handle of the note if already open, -1 to open it here
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds). 0 means the index is left to decide, so nothing is checked
+ * @return int - Boolean. 1 if the note has expired (& is now gone), 0 if not or it can't be told
+ */
+static int note_expired(const int uid_dir_fd, const char *const sbj, const int note_fd, const int64_t now_ns)
+{
+	if (now_ns == 0) {
+		return 0;
 	}
 
-	uid_len = snprintf(NULL, 0, "%d", peer_cred.uid); /* we work out the text representation of the uid - needed to append to subject name */
-	if (uid_len <= 0) {
-		fprintf(stderr, "Error determining formatting for sock uid to-be-appended-to-subject\n");
-		exit_code = 1;
-		goto end;
+	const int fd = (note_fd != -1 ? note_fd : openat(uid_dir_fd, sbj, O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+	if (fd == -1) {
+		return 0;
+	}
+	const int64_t expires_ns = store_note_expiry(fd);
+	if (fd != note_fd) {
+		close(fd);
 	}
 
-	client_request.extra_data_content = malloc(MAX_EXTRA_DATA_LEN);
-	if (client_request.extra_data_content == NULL) {
-		fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
-		exit_code = 1;
-		goto end;
+	if (expires_ns == 0 || expires_ns > now_ns) {
+		return 0;
 	}
-	memset(client_request.extra_data_content, '\0', MAX_EXTRA_DATA_LEN);
-	memset(client_request.sbj_content, '\0', MAX_SBJ_LEN);
 
-	/* get details */
-	if (request_recv(&client_request, client_sock) != 0) {
-		fprintf(stderr, "Error during request receival\n");
-		exit_code = 1;
-		goto end;
+	if (unlinkat(uid_dir_fd, sbj, 0) != 0 && errno != ENOENT) { /* gone as far as anyone can tell either way - deleting it now just finishes the job */
+		fprintf(stderr, "Unable to delete expired file %s (errno %d: %s)\n", sbj, errno, strerror(errno));
 	}
+	fprintf(stderr, "Note titled %s has expired\n", sbj);
 
-	/* act upon details */
-	filename = malloc(MAX_SBJ_LEN + uid_len + 1);
-	if (filename == NULL) {
-		fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
-		exit_code = 1;
-		goto end;
+	return 1;
+}
+
+/**
+ * @brief serve_request - resolves a decoded request to the caller's notes directory & executes it
+ * @param const struct Store *const store - opened notes store
+ * @param const uid_t uid - owner of the notes to act upon
+ * @param const struct Request *const client_request - decoded & sanitised request
+ * @param struct Response *const data_resp - as per execute_request
+ * @return int - 0 == success, non-zero is failure
+ * 2 = issue handling request
+ */
+static int serve_request(const struct Store *const store, const uid_t uid, const struct Request *const client_request, struct Response *const data_resp)
+{
+	char sbj[MAX_SBJ_LEN + 1]; /* subject as a c-string - forms the filename within the user's directory */
+	memcpy(sbj, client_request->sbj_content, client_request->sbj_len);
+	sbj[client_request->sbj_len] = '\0';
+
+	const int64_t now_ns = clock_ns(CLOCK_REALTIME);
+
+	if (client_request->cmd == LIST) { /* concerns every note of the caller's, not the one subject */
+		if (listing_page(store, uid, client_request->extra_data_content, client_request->extra_data_len, now_ns, data_resp->extra_data_content, &data_resp->extra_data_len) != 0) {
+			return 2;
+		}
+		data_resp->status = DATA;
+		return 0;
+	} else if (client_request->cmd == SINCE) {
+		if (listing_since(store, uid, client_request->extra_data_content, client_request->extra_data_len, now_ns, data_resp->extra_data_content, &data_resp->extra_data_len) != 0) {
+			return 2;
+		}
+		data_resp->status = DATA;
+		return 0;
 	}
-	memset(filename, '\0', MAX_SBJ_LEN + uid_len + 1);
-	memcpy(filename, client_request.sbj_content, MAX_SBJ_LEN);
-	if (snprintf(filename + client_request.sbj_len, ((MAX_SBJ_LEN + uid_len) - client_request.sbj_len) - 1, "%d", peer_cred.uid) <= 0) { /* create the filename - subject + uid. write until last byte - memset would've set null terminator for last byte */
-		fprintf(stderr, "Error creating subject + uid\n");
-		exit_code = 1;
-		goto end;
+
+	if (store->index != NULL) {
+		const struct IndexEntry *const entry = index_find(store->index, uid, sbj);
+		if (entry != NULL && entry->expires_ns != 0 && entry->expires_ns <= now_ns) { /* expired but not reaped yet - it's gone as far as anyone can tell, so finish the job now */
+			const int expired_dir_fd = store_uid_dir(store, uid, 0);
+			if (expired_dir_fd != -1) {
+				expiry_delete(store, expired_dir_fd, uid, sbj);
+				close(expired_dir_fd);
+			}
+			if (client_request->cmd != ADD) {
+				fprintf(stderr, "Note titled %s has expired\n", sbj);
+				return 2;
+			}
+		}
+	}
+
+	if (store->index != NULL && store->index->complete) { /* the index knows every note, so existence checks needn't touch the filesystem */
+		const int exists = (index_find(store->index, uid, sbj) != NULL);
+		if (client_request->cmd == ADD && exists) {
+			fprintf(stderr, "Cannot overwrite existing note of same name\n");
+			return 2;
+		} else if ((client_request->cmd == GET || client_request->cmd == GET_RANGE) && !exists) {
+			fprintf(stderr, "Cannot get contents of non-existant note\n");
+			return 2;
+		} else if (client_request->cmd == APPEND && !exists) {
+			fprintf(stderr, "Cannot append to non-existant note\n");
+			return 2;
+		} else if (client_request->cmd == REMOVE && !exists) {
+			fprintf(stderr, "Cannot delete non-existant note\n");
+			return 2;
+		}
+	}
+
+	if (store->tiers != NULL && (client_request->cmd == GET || client_request->cmd == GET_RANGE)) { /* hot notes are served from memory, cold ones from their pack */
+		uint64_t offset = 0;
+		uint32_t length = MAX_EXTRA_DATA_LEN;
+		if (client_request->cmd == GET_RANGE && range_parse(client_request->extra_data_len, client_request->extra_data_content, &offset, &length) != 0) {
+			return 2;
+		}
+
+		const int served = tier_read(store->tiers, store, uid, sbj, offset, length, data_resp->extra_data_content, &data_resp->extra_data_len, now_ns);
+		if (served == 0) {
+			data_resp->status = DATA;
+			if (client_request->cmd == GET) {
+				fprintf(stdout, "Retrieved note titled %s\n", sbj);
+			} else {
+				fprintf(stdout, "Retrieved %u byte(s) at offset %llu of note titled %s\n", (unsigned int)data_resp->extra_data_len, (unsigned long long)offset, sbj);
+			}
+			return 0;
+		} else if (served == 2) {
+			return 2;
+		}
+	}
+
+	const int uid_dir_fd = store_uid_dir(store, uid, client_request->cmd == ADD); /* only adding a note warrants creating the user's directory */
+	if (uid_dir_fd == -1) {
+		if (errno == ENOENT) {
+			fprintf(stderr, "No notes exist for uid %u\n", (unsigned int)uid);
+		} else {
+			fprintf(stderr, "Error opening notes directory of uid %u (errno %d: %s)\n", (unsigned int)uid, errno, strerror(errno));
+		}
+		return 2;
+	}
+
+	const struct IndexEntry *const packed = (store->tiers != NULL ? index_find(store->index, uid, sbj) : NULL);
+	if (packed != NULL && packed->pack_offset != 0 && (client_request->cmd != APPEND || tier_unpack(store->tiers, store, uid_dir_fd, uid, sbj) != 0)) { /* a cold note has no file of its own to act upon. appending brings it back as one first */
+		int packed_ret = 1;
+		if (client_request->cmd == ADD) {
+			fprintf(stderr, "Cannot overwrite existing note of same name\n");
+		} else if (client_request->cmd == REMOVE && (packed_ret = tier_remove_packed(store->tiers, store, uid_dir_fd, uid, sbj)) == 0) {
+			fprintf(stdout, "Removed note titled %s\n", sbj);
+		}
+		close(uid_dir_fd);
+		return (packed_ret != 0 ? 2 : 0);
+	}
+
+	const int64_t expires_ns = (client_request->ttl_s != 0 ? now_ns + (int64_t)client_request->ttl_s * 1000000000 : 0);
+	const int64_t expiry_check_ns = (store->index == NULL || !store->index->complete ? now_ns : 0); /* expired notes the index knows of were dealt with above. any it doesn't are only known to have expired by the note itself */
+	const int ret = execute_request(uid_dir_fd, client_request->cmd, sbj, client_request->extra_data_len, client_request->extra_data_content, expires_ns, expiry_check_ns, data_resp);
+	close(uid_dir_fd);
+
+	if (ret == 0 && store->index != NULL) {
+		if (client_request->cmd == ADD) {
+			index_insert(store->index, uid, sbj, client_request->extra_data_len, now_ns, expires_ns); /* on failure the index marks itself incomplete & stops being trusted. schedules the note's expiry too */
+		} else if (client_request->cmd == REMOVE) {
+			index_remove(store->index, uid, sbj);
+		} else if (client_request->cmd == APPEND) {
+			const struct IndexEntry *const entry = index_find(store->index, uid, sbj);
+			if (entry != NULL) {
+				uint64_t note_len;
+				memcpy(&note_len, data_resp->extra_data_content, sizeof(note_len));
+				index_insert(store->index, uid, sbj, (uint32_t)le64toh(note_len), entry->created_ns, entry->expires_ns); /* same entry, new length */
+			}
+		}
+	}
+
+	if (ret == 0 && store->tiers != NULL) {
+		if (client_request->cmd == GET) {
+			tier_offer(store->tiers, store, uid, sbj, data_resp->extra_data_content, data_resp->extra_data_len);
+		} else if (client_request->cmd == APPEND || client_request->cmd == REMOVE) { /* whatever's hot is out of date */
+			tier_forget(store->tiers, uid, sbj);
+		}
+	}
+
+	return (ret != 0 ? 2 : 0);
+}
+
+/**
+ * @brief negotiate_ring - attaches to the ring whose handles followed a RING request
+ * @param struct Session *const session - session the RING request arrived on
+ * @param const int *const fds - memfd, request doorbell, response doorbell. always taken - closed on failure
+ * @return int - 0 == success, non-zero is failure
+ * 2 = issue handling request
+ */
+static int negotiate_ring(struct Session *const session, const int *const fds)
+{
+	if (session->has_ring) {
+		fprintf(stderr, "Refusing ring negotiation on socket %d\n", session->sock);
+		for (size_t i = 0; i < 3; ++i) {
+			close(fds[i]);
+		}
+		return 2;
+	}
+
+	if (ring_attach(&session->ring, fds[0], fds[1], fds[2]) != 0) {
+		return 2;
+	}
+
+	session->has_ring = 1;
+	fprintf(stdout, "Established ring session for uid %u on socket %d\n", (unsigned int)session->uid, session->sock);
+
+	return 0;
+}
+
+/**
+ * @brief transfer_archive - starts streaming the whole store through the archive handle which followed an EXPORT or IMPORT request, in the background
+ * the client opens the archive itself (as itself), so the server never needs access to - or a path for - anything outside its chroot
+ * @param const struct Store *const store - opened notes store
+ * @param struct Session *const session - session the request arrived on. answered once the transfer's done (see session_transferred)
+ * @param const struct Request *const client_request - EXPORT or IMPORT request
+ * @param const int archive_fd - archive handle. always taken - closed before returning
+ * @return int - 0 == success, non-zero is failure
+ * 2 = issue handling request
+ */
+static int transfer_archive(const struct Store *const store, struct Session *const session, const struct Request *const client_request, const int archive_fd)
+{
+	const char *const what = (client_request->cmd == EXPORT ? "export" : "import");
+	if (session->uid != NOTICEBOARD_ADMIN_UID) {
+		fprintf(stderr, "Refusing %s from uid %u - not the admin\n", what, (unsigned int)session->uid);
+		close(archive_fd);
+		return 2;
+	} else if (store->transfer == NULL) {
+		fprintf(stderr, "Refusing %s - this server can't run one\n", what);
+		close(archive_fd);
+		return 2;
 	}
 
-	if (execute_request(client_request.cmd, filename, client_request.extra_data_len, client_request.extra_data_content, client_sock) != 0) {
-		exit_code = 2;
-		goto end;
+	const int ret = transfer_start(store->transfer, store, (enum request_command)client_request->cmd, archive_fd);
+	if (ret == 1) {
+		fprintf(stderr, "Refusing %s - another export or import is under way\n", what);
+		return 2;
+	} else if (ret != 0) {
+		return 2;
 	}
 
-end: /* this is why I hate using C for even slightly bigger projects. resource control is a bloody nightmare
-	  * tl;dr this function is called repeatedly and is main body
-	  * cannot afford memory leaks so horrible but required cleanup
-	  */
-	if (client_request.extra_data_content != NULL) {
-		free(client_request.extra_data_content);
-		client_request.extra_data_content = NULL;
+	store->transfer->session = session;
+	store->transfer->version = client_request->version;
+	store->transfer->id = client_request->id;
+
+	return 0;
+}
+
+/**
+ * @brief session_set_phase - records what a session's socket is waiting on
+ * @param struct Session *const session - session
+ * @param const enum session_phase phase - new phase. a change restarts the deadline
+ */
+static inline void session_set_phase(struct Session *const session, const enum session_phase phase)
+{
+	if (session->phase != phase) {
+		session->phase = phase;
+		session->phase_restarted = 1;
 	}
+}
+
+/**
+ * @brief session_queue - encodes a response onto the end of a session's send buffer
+ * @param struct Session *const session - session
+ * @param const struct Response *const resp - response to queue
+ * @return int - 0 == success, non-zero is failure
+ * 1 = issue encoding response (or no room - which would be a bug, as only one request's responses are ever queued)
+ */
+static int session_queue(struct Session *const session, const struct Response *const resp)
+{
+	size_t encoded_len;
+	if (response_encode(resp, session->out_buf + session->out_len, SESSION_OUT_LEN - session->out_len, &encoded_len) != 0) {
+		return 1;
+	}
+	session->out_len += encoded_len;
+
+	return 0;
+}
+
+/**
+ * @brief session_flush - sends as much of a session's send buffer as the socket will take without blocking
+ * @param struct Session *const session - session
+ * @return int - 0 == success (check out_sent against out_len for whether everything went), non-zero is failure
+ * 1 = error sending
+ */
+static int session_flush(struct Session *const session)
+{
+	while (session->out_sent < session->out_len) {
+		const ssize_t sent = send(session->sock, session->out_buf + session->out_sent, session->out_len - session->out_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			} else if (errno == EAGAIN) {
+				return 0;
+			}
+			fprintf(stderr, "Error sending response (errno %d: %s)\n", errno, strerror(errno));
+			return 1;
+		}
+		session->out_sent += (size_t)sent;
+	}
+
+	session->out_len = session->out_sent = 0;
+	return 0;
+}
 
-	if (filename != NULL) {
-		free(filename);
-		filename = NULL;
+/**
+ * @brief session_release_fds - closes any received handles no request has taken
+ * @param struct Session *const session - session
+ */
+static void session_release_fds(struct Session *const session)
+{
+	for (size_t i = 0; i < session->fd_count; ++i) {
+		close(session->fds[i]);
 	}
+	session->fd_count = 0;
+}
 
+/**
+ * @brief session_answer - pushes the answer to a request, in the request's own protocol version
+ * v1 sends any data requested as a DATA response ahead of the acknowledgement; v2 sends exactly one response, data included, tagged with the request's id
+ * @param struct Session *const session - session request arrived on
+ * @param int (*const push)(struct Session *const, const struct Response *const) - where responses go (send buffer or ring)
+ * @param const struct Request *const client_request - request being answered. only version & id are used, so it needn't have decoded fully
+ * @param const uint8_t status - OK, FAIL or BUSY
+ * @param const struct Response *const data_resp - data to carry back, if status is OK & its status is DATA
+ * @return int - 0 == success, non-zero is failure
+ * 1 = issue pushing a response
+ */
+static int session_answer(struct Session *const session, int (*const push)(struct Session *const, const struct Response *const), const struct Request *const client_request, const uint8_t status, const struct Response *const data_resp)
+{
 	struct Response resp;
-	resp.status = (exit_code != 0 ? FAIL : OK);
+	resp.version = client_request->version;
+	resp.id = client_request->id;
+	resp.status = status;
 	resp.extra_data_len = 0;
 	resp.extra_data_content = NULL;
 
-	if (response_send(&resp, client_sock) != 0) {
-		fprintf(stderr, "Error during sending acknowledgement response\n");
-		exit_code = (exit_code != 0 ? exit_code : 2);
+	if (status == OK && data_resp->status == DATA) {
+		if (resp.version == PROTOCOL_V2) {
+			resp.extra_data_len = data_resp->extra_data_len;
+			resp.extra_data_content = data_resp->extra_data_content;
+		} else {
+			struct Response data = *data_resp;
+			data.version = PROTOCOL_V1;
+			if (push(session, &data) != 0) {
+				return 1;
+			}
+		}
 	}
 
-	return exit_code;
+	return push(session, &resp);
 }
 
 /**
- * @brief check_file_exists - see if file exists
- * @param const char *const filename - null-terminated array / c-string pertaining to name of file
- * @return int - Boolean as to file's existance. 1 if file exists, 0 if not
+ * @brief session_dispatch - acts upon the complete request at the start of a session's receive buffer, queueing its response(s)
+ * @param const struct Store *const store - opened notes store
+ * @param struct Admission *const admission - admission control
+ * @param struct Session *const session - session. in_buf holds frame_len bytes of request, then (if handle_count) the marker byte of its handles
+ * @param const size_t frame_len - encoded length of request (see request_frame)
+ * @param const size_t handle_count - handles which followed it (see request_handle_count)
+ * @return int - 0 == success, non-zero is failure
+ * 1 = issue queueing a response or handles missing (connection is out of step)
  */
-static inline int check_file_exists(const char *const filename)
+static int session_dispatch(const struct Store *const store, struct Admission *const admission, struct Session *const session, const size_t frame_len, const size_t handle_count)
 {
-	const int access_code = access(filename, F_OK);
-	return (access_code == 0);
+	char extra_data_content[MAX_EXTRA_DATA_LEN];
+	char data_content[MAX_EXTRA_DATA_LEN]; /* GET responses are read into here */
+	struct Request client_request;
+	client_request.extra_data_content = extra_data_content;
+	struct Response data_resp;
+	data_resp.status = OK;
+	data_resp.extra_data_len = 0;
+	data_resp.extra_data_content = data_content;
+
+	int request_code = 0;
+	int shed = 0; /* boolean. request refused by admission control */
+
+	int fds[MAX_TRANSFER_FDS];
+	if (handle_count > 0) { /* handles arrive with their marker byte, so they're here by now or never coming */
+		if (session->fd_count < handle_count) {
+			fprintf(stderr, "Expected %lu handle(s) but received %lu\n", (unsigned long)handle_count, (unsigned long)session->fd_count);
+			session_release_fds(session);
+			return 1;
+		}
+		memcpy(fds, session->fds, handle_count * sizeof(int));
+		memmove(session->fds, session->fds + handle_count, (session->fd_count - handle_count) * sizeof(int));
+		session->fd_count -= handle_count;
+		session_release_fds(session); /* anything else was sent unasked */
+	}
+
+	client_request.cmd = UINT8_MAX; /* anything that isn't a command, should the request be too broken to say */
+	const int decode_ret = request_decode(&client_request, session->in_buf, frame_len);
+	session->trace.at_ns[TRACE_RECV_DONE] = trace_clock();
+	TRACE_PROBE3(recv__done, session->sock, client_request.id, client_request.cmd);
+
+	if (decode_ret != 0) { /* framing was fine, so only this request is bad - the connection's still in step */
+		fprintf(stderr, "Error during request receival\n");
+		for (size_t i = 0; i < handle_count; ++i) {
+			close(fds[i]);
+		}
+		request_code = 2;
+	} else {
+		session->trace.at_ns[TRACE_EXEC_START] = trace_clock();
+		TRACE_PROBE3(execute__start, session->uid, client_request.cmd, client_request.id);
+		if (client_request.cmd == RING) {
+			request_code = negotiate_ring(session, fds);
+		} else if (client_request.cmd == EXPORT || client_request.cmd == IMPORT) {
+			request_code = transfer_archive(store, session, &client_request, fds[0]);
+			if (request_code == 0) { /* answered once it's done */
+				session_set_phase(session, SESSION_TRANSFER);
+			}
+		} else {
+			capture_request(session->uid, &client_request); /* only note operations are captured (or rationed) - the others carry handles which must be taken regardless */
+			if (admission_admit(admission, session->uid) != ADMITTED) {
+				shed = 1;
+			} else {
+				request_code = serve_request(store, session->uid, &client_request, &data_resp);
+			}
+		}
+		session->trace.at_ns[TRACE_EXEC_DONE] = trace_clock();
+		TRACE_PROBE3(execute__done, session->uid, client_request.cmd, request_code);
+	}
+
+	const uint8_t status = (shed ? BUSY : (request_code != 0 ? FAIL : OK));
+	session->trace.id = client_request.id;
+	session->trace.uid = (uint32_t)session->uid;
+	session->trace.cmd = client_request.cmd;
+	session->trace.status = status;
+	if (session->phase == SESSION_TRANSFER) {
+		return 0;
+	}
+	session->answering = 1; /* trace is finished off once the response has gone */
+
+	return session_answer(session, session_queue, &client_request, status, &data_resp);
 }
 
-int execute_request(const enum request_command cmd, const char *const sbj, const uint32_t extra_data_len, const char *const extra_data, const int client_sock)
+/**
+ * @brief session_answered - finishes off the trace of a request whose response has entirely gone, & starts the next one's
+ * @param struct Session *const session - session whose send buffer has just emptied
+ */
+static void session_answered(struct Session *const session)
 {
-	if (cmd == ADD) { /* based on command, execute different paths */
-		if (check_file_exists(sbj) == 1) {
-			fprintf(stderr, "Cannot overwrite existing note of same name\n");
+	session->trace.at_ns[TRACE_SEND_DONE] = trace_clock();
+	TRACE_PROBE3(send__done, session->sock, session->trace.id, session->trace.status);
+	trace_commit(&session->trace);
+
+	memset(&session->trace, '\0', sizeof(session->trace));
+	session->answering = 0;
+	if (session->in_len > 0) { /* next request arrived alongside this one */
+		session->trace.at_ns[TRACE_RECV_START] = session->read_ns;
+		TRACE_PROBE1(recv__start, session->sock);
+	}
+}
+
+int session_open(struct Session *const session, const int client_sock)
+{
+	struct ucred peer_cred;
+	socklen_t peer_cred_len = sizeof(peer_cred); /* as usual, getsockopt takes a mutable iot so this is as such */
+
+	if (getsockopt(client_sock, SOL_SOCKET, SO_PEERCRED, &peer_cred, &peer_cred_len) != 0) { /* we want to access the uid of user behind IPC socket via UNIX API */
+		fprintf(stderr, "Error manipulating client sock (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	const int flags = fcntl(client_sock, F_GETFL);
+	if (flags == -1 || fcntl(client_sock, F_SETFL, flags | O_NONBLOCK) != 0) {
+		fprintf(stderr, "Error making client sock non-blocking (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	memset(&session->trace, '\0', sizeof(session->trace));
+	session->trace.at_ns[TRACE_CREDENTIALED] = trace_clock(); /* whoever accepted it fills in when that was */
+	TRACE_PROBE2(peercred, client_sock, peer_cred.uid);
+	session->answering = 0;
+	session->read_ns = 0;
+
+	session->sock = client_sock;
+	session->uid = peer_cred.uid; /* fixed for the life of the connection, so asked for once rather than per request */
+	session->phase = SESSION_IDLE;
+	session->phase_restarted = 1;
+	timer_link_init(&session->deadline);
+	session->in_len = 0;
+	session->out_len = session->out_sent = 0;
+	session->fd_count = 0;
+	session->parked = 0;
+	session->has_ring = 0;
+
+	return 0;
+}
+
+int session_resume(struct Session *const session, const int client_sock, const int *const ring_fds)
+{
+	if (session_open(session, client_sock) != 0) {
+		close(client_sock);
+		if (ring_fds != NULL) {
+			for (size_t i = 0; i < 3; ++i) {
+				close(ring_fds[i]);
+			}
+		}
+		return 1;
+	}
+
+	if (ring_fds != NULL) {
+		if (ring_attach(&session->ring, ring_fds[0], ring_fds[1], ring_fds[2]) != 0) {
+			session_close(session);
+			return 1;
+		}
+		session->has_ring = 1; /* ring's own indices live in the shared memory, so it carries on exactly where it was */
+	}
+
+	return 0;
+}
+
+int session_idle(const struct Session *const session)
+{
+	return session->sock != -1 && session->phase == SESSION_IDLE && session->in_len == 0 && session->out_len == 0 && session->fd_count == 0;
+}
+
+int client_connection(const struct Store *const store, struct Admission *const admission, struct Session *const session)
+{
+	if (session->phase == SESSION_TRANSFER) { /* its socket is only watched for hangups meanwhile - so the client's gone */
+		return 3;
+	}
+
+	int has_read = 0; /* boolean. one read per call - anything further is left for the next pass, so a client streaming requests can't starve the rest */
+	for (;;) {
+		/* responses first - nothing more is read whilst the client isn't taking them */
+		if (session_flush(session) != 0) {
+			return 1;
+		}
+		if (session->out_sent < session->out_len) {
+			session_set_phase(session, SESSION_WRITE);
+			return 0;
+		}
+		if (session->answering) {
+			session_answered(session);
+		}
+
+		/* serve the next request, if all of it is here */
+		size_t frame_len = 0;
+		uint8_t cmd = 0;
+		const int framed = request_frame(session->in_buf, session->in_len, &frame_len, &cmd);
+		if (framed == 2) { /* can't tell where the next request would start - tell the client (in whichever version it seemed to be speaking), then give up on it */
+			struct Response resp = { .version = (session->in_buf[0] == PROTOCOL_MAGIC_BYTE ? PROTOCOL_V2 : PROTOCOL_V1), .id = 0, .status = FAIL, .extra_data_len = 0, .extra_data_content = NULL };
+			if (session_queue(session, &resp) == 0) {
+				session_flush(session);
+			}
 			return 1;
 		}
 
-		FILE *new_file = fopen(sbj, "w");
-		if (new_file == NULL) {
-			fprintf(stderr, "Error opening '%s' as write-file (errno %d: %s)\n", sbj, errno, strerror(errno));
+		if (framed == 0) {
+			const size_t handle_count = request_handle_count(cmd);
+			const size_t consumed = frame_len + (handle_count > 0 ? 1 : 0); /* plus marker byte */
+			if (session->in_len >= consumed) {
+				const int ret = session_dispatch(store, admission, session, frame_len, handle_count);
+				session->in_len -= consumed;
+				memmove(session->in_buf, session->in_buf + consumed, session->in_len);
+				session->phase_restarted = 1; /* whatever comes next is a new request, with a fresh deadline */
+				if (ret != 0) {
+					return 1;
+				} else if (session->phase == SESSION_TRANSFER) { /* nothing more is read until it's answered */
+					return 0;
+				}
+				continue;
+			}
+		}
+		session_set_phase(session, (framed == 0 ? SESSION_PAYLOAD : (session->in_len > 0 ? SESSION_HEADER : SESSION_IDLE)));
+
+		/* need more of it */
+		if (has_read) {
+			return 0;
+		}
+		has_read = 1;
+		const ssize_t bytes_read = fd_recv_stream(session->sock, session->in_buf + session->in_len, SESSION_IN_LEN - session->in_len, session->fds, &session->fd_count, MAX_TRANSFER_FDS);
+		if (bytes_read == 0) { /* connections are reused, so the client hanging up is perfectly normal - even mid-request there's nobody left to tell */
+			return 3;
+		} else if (bytes_read < 0) {
+			if (errno == EAGAIN) {
+				return 0;
+			}
+			fprintf(stderr, "Error reading request (errno %d: %s)\n", errno, strerror(errno));
 			return 1;
 		}
+		session->read_ns = trace_clock();
+		if (session->in_len == 0) { /* start of a new request */
+			session->trace.at_ns[TRACE_RECV_START] = session->read_ns;
+			TRACE_PROBE1(recv__start, session->sock);
+		}
+		session->in_len += (size_t)bytes_read;
+	}
+}
+
+int session_transferred(const struct Store *const store, struct Admission *const admission, struct Session *const session, const struct Transfer *const transfer)
+{
+	char data_content[sizeof(uint64_t)];
+	struct Response data_resp = { .status = OK, .extra_data_len = 0, .extra_data_content = data_content };
+	if (transfer->result == 0) { /* the number of notes transferred */
+		const uint64_t count = htole64(transfer->stats.notes);
+		memcpy(data_content, &count, sizeof(count));
+		data_resp.extra_data_len = sizeof(count);
+		data_resp.status = DATA;
+	}
+
+	struct Request client_request; /* only version & id are answered */
+	memset(&client_request, '\0', sizeof(client_request));
+	client_request.version = transfer->version;
+	client_request.id = transfer->id;
+
+	const uint8_t status = (transfer->result == 0 ? OK : FAIL);
+	session->trace.at_ns[TRACE_EXEC_DONE] = trace_clock();
+	session->trace.status = status;
+	session->answering = 1;
+	session_set_phase(session, SESSION_IDLE); /* client_connection takes it from here */
+	if (session_answer(session, session_queue, &client_request, status, &data_resp) != 0) {
+		return 1;
+	}
+
+	return client_connection(store, admission, session);
+}
+
+/**
+ * @brief session_respond - encodes a response into a session's response queue
+ * @param struct Session *const session - session
+ * @param const struct Response *const resp - response to push
+ * @return int - 0 == success, non-zero is failure
+ * 1 = issue encoding or pushing response
+ */
+static int session_respond(struct Session *const session, const struct Response *const resp)
+{
+	uint8_t encoded[MAX_RESPONSE_LEN];
+	size_t encoded_len;
+
+	if (response_encode(resp, encoded, sizeof(encoded), &encoded_len) != 0) {
+		return 1;
+	}
+
+	if (ring_push(&session->ring, RING_RESPONSES, encoded, (uint32_t)encoded_len) != 0) { /* caller checked for space, so running out now means the peer is misbehaving */
+		fprintf(stderr, "Error pushing response into ring\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int session_serve(const struct Store *const store, struct Admission *const admission, struct Session *const session)
+{
+	uint64_t doorbell_count;
+	if (read(session->ring.doorbells[RING_REQUESTS], &doorbell_count, sizeof(doorbell_count)) != sizeof(doorbell_count) && errno != EAGAIN) { /* reset doorbell before draining so a push racing with us re-arms it */
+		fprintf(stderr, "Error reading ring doorbell (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	const int64_t rung_ns = trace_clock(); /* every request drained now was waiting from (at the latest) here */
+
+	uint8_t encoded[MAX_REQUEST_LEN];
+	char extra_data_content[MAX_EXTRA_DATA_LEN];
+	char data_content[MAX_EXTRA_DATA_LEN];
+	int responded = 0;
+	int exit_code = 0;
+
+	while (ring_space(&session->ring, RING_RESPONSES) >= 2 * ring_message_space(MAX_RESPONSE_LEN)) { /* worst case is a GET - data & acknowledgement */
+		uint32_t encoded_len;
+		const int popped = ring_pop(&session->ring, RING_REQUESTS, encoded, sizeof(encoded), &encoded_len);
+		if (popped == 1) {
+			break;
+		} else if (popped != 0) {
+			exit_code = 1;
+			break;
+		}
+
+		struct Request client_request;
+		client_request.extra_data_content = extra_data_content;
+		struct Response data_resp;
+		data_resp.status = OK;
+		data_resp.extra_data_len = 0;
+		data_resp.extra_data_content = data_content;
+
+		struct TraceRecord trace;
+		memset(&trace, '\0', sizeof(trace));
+		trace.at_ns[TRACE_RECV_START] = rung_ns;
+		TRACE_PROBE1(recv__start, session->sock);
 
-		if (fwrite(extra_data, sizeof(uint8_t), extra_data_len, new_file) != extra_data_len) {
+		int request_code = 0;
+		int shed = 0;
+		client_request.cmd = UINT8_MAX;
+		const int decode_ret = request_decode(&client_request, encoded, encoded_len);
+		trace.at_ns[TRACE_RECV_DONE] = trace_clock();
+		TRACE_PROBE3(recv__done, session->sock, client_request.id, client_request.cmd);
+
+		if (decode_ret != 0) {
+			fprintf(stderr, "Error decoding request from ring\n");
+			request_code = 1;
+		} else if (client_request.cmd == RING || client_request.cmd == EXPORT || client_request.cmd == IMPORT) { /* these carry handles, which only the socket can */
+			fprintf(stderr, "Request must be sent over the socket, not the ring\n");
+			request_code = 2;
+		} else {
+			trace.at_ns[TRACE_EXEC_START] = trace_clock();
+			TRACE_PROBE3(execute__start, session->uid, client_request.cmd, client_request.id);
+			capture_request(session->uid, &client_request);
+			if (admission_admit(admission, session->uid) != ADMITTED) {
+				shed = 1;
+			} else {
+				request_code = serve_request(store, session->uid, &client_request, &data_resp);
+			}
+			trace.at_ns[TRACE_EXEC_DONE] = trace_clock();
+			TRACE_PROBE3(execute__done, session->uid, client_request.cmd, request_code);
+		}
+
+		const uint8_t status = (shed ? BUSY : (request_code != 0 ? FAIL : OK));
+		if (session_answer(session, session_respond, &client_request, status, &data_resp) != 0) {
+			exit_code = 1;
+			break;
+		}
+
+		trace.at_ns[TRACE_SEND_DONE] = trace_clock();
+		trace.id = client_request.id;
+		trace.uid = (uint32_t)session->uid;
+		trace.cmd = client_request.cmd;
+		trace.status = status;
+		trace.ring = 1;
+		TRACE_PROBE3(send__done, session->sock, trace.id, trace.status);
+		trace_commit(&trace);
+		responded = 1;
+	}
+
+	if (responded && ring_notify(&session->ring, RING_RESPONSES) != 0) { /* one wakeup per batch, not per response */
+		exit_code = 1;
+	}
+
+	return exit_code;
+}
+
+int session_close(struct Session *const session)
+{
+	if (session == NULL || session->sock == -1) {
+		return 0;
+	}
+
+	int exit_code = 0;
+	if (session->has_ring && ring_destroy(&session->ring) != 0) {
+		exit_code = 1;
+	}
+	session->has_ring = 0;
+	session_release_fds(session);
+
+	if (close(session->sock) != 0) {
+		fprintf(stderr, "Error closing socket %d (errno %d: %s)\n", session->sock, errno, strerror(errno));
+		exit_code = 1;
+	}
+	session->sock = -1;
+
+	return exit_code;
+}
+
+int execute_request(const int uid_dir_fd, const enum request_command cmd, const char *const sbj, const uint32_t extra_data_len, const char *const extra_data, const int64_t expires_ns, const int64_t now_ns, struct Response *const data_resp)
+{
+	if (cmd == ADD) { /* based on command, execute different paths */
+		const mode_t mode = (expires_ns != 0 ? STORE_EXPIRING_NOTE_PERMISSIONS : STORE_NOTE_PERMISSIONS);
+		int new_file = openat(uid_dir_fd, sbj, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, mode); /* O_EXCL does the existence check & creation in one go */
+		if (new_file == -1 && errno == EEXIST && note_expired(uid_dir_fd, sbj, -1, now_ns)) { /* an expired note's subject is free again */
+			new_file = openat(uid_dir_fd, sbj, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, mode);
+		}
+		if (new_file == -1) {
+			if (errno == EEXIST) {
+				fprintf(stderr, "Cannot overwrite existing note of same name\n");
+			} else {
+				fprintf(stderr, "Error opening '%s' as write-file (errno %d: %s)\n", sbj, errno, strerror(errno));
+			}
+			return 1;
+		}
+
+		if (write(new_file, extra_data, extra_data_len) != (ssize_t)extra_data_len) {
 			fprintf(stderr, "Error writing to file %s\n", sbj);
-			fclose(new_file);
+			close(new_file);
+			unlinkat(uid_dir_fd, sbj, 0); /* don't leave a truncated note behind */
 			return 1;
 		}
 
-		if (fclose(new_file) == EOF) {
+		if (expires_ns != 0) {
+			const uint64_t expires_le = htole64((uint64_t)expires_ns);
+			if (fsetxattr(new_file, STORE_EXPIRY_XATTR, &expires_le, sizeof(expires_le), 0) != 0) { /* the index (& its snapshot) still has it - only a full rescan would lose it */
+				fprintf(stderr, "Error recording expiry of '%s' (errno %d: %s)\n", sbj, errno, strerror(errno));
+			}
+		}
+
+		if (close(new_file) != 0) {
 			fprintf(stderr, "Error closing '%s' as write-file (errno %d: %s)\n", sbj, errno, strerror(errno));
 		}
 
 		fprintf(stdout, "Created note titled %s\n", sbj);
 	} else if (cmd == GET) {
-		if (check_file_exists(sbj) == 0) {
-			fprintf(stderr, "Cannot get contents of non-existant note\n");
+		const int new_file = openat(uid_dir_fd, sbj, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+		if (new_file == -1) {
+			if (errno == ENOENT) {
+				fprintf(stderr, "Cannot get contents of non-existant note\n");
+			} else {
+				fprintf(stderr, "Error opening '%s' as read-file (errno %d: %s)\n", sbj, errno, strerror(errno));
+			}
 			return 1;
 		}
-
-		FILE *new_file = fopen(sbj, "r");
-		if (new_file == NULL) {
-			fprintf(stderr, "Error opening '%s' as read-file (errno %d: %s)\n", sbj, errno, strerror(errno));
+		if (note_expired(uid_dir_fd, sbj, new_file, now_ns)) {
+			close(new_file);
 			return 1;
 		}
 
-		char file_content[MAX_EXTRA_DATA_LEN];
-		const size_t bytes_read = fread(file_content, sizeof(uint8_t), MAX_EXTRA_DATA_LEN, new_file);
-		if (bytes_read == 0) {
+		const ssize_t bytes_read = read(new_file, data_resp->extra_data_content, MAX_EXTRA_DATA_LEN); /* straight into the response buffer */
+		if (bytes_read <= 0) {
 			fprintf(stderr, "Error reading anything from file %s\n", sbj);
-			fclose(new_file);
+			close(new_file);
 			return 1;
 		}
 
-		if (fclose(new_file) == EOF) {
-			fprintf(stderr, "Error closing '%s' as write-file (errno %d: %s)\n", sbj, errno, strerror(errno));
+		if (close(new_file) != 0) {
+			fprintf(stderr, "Error closing '%s' as read-file (errno %d: %s)\n", sbj, errno, strerror(errno));
 		}
 
-		struct Response resp;
-		resp.status = DATA;
-		resp.extra_data_len = (uint32_t)bytes_read; /* wouldn't cause overflow or crunching from 8 -> 4 bytes as the upper count of readable bytes is MAX_EXTRA_DATA_LEN which is tiny. But leaving as an explicit comment as this could be an issue if it was significantly higher */
-		resp.extra_data_content = file_content;
+		data_resp->status = DATA;
+		data_resp->extra_data_len = (uint32_t)bytes_read; /* wouldn't cause overflow or crunching from 8 -> 4 bytes as the upper count of readable bytes is MAX_EXTRA_DATA_LEN which is tiny. But leaving as an explicit comment as this could be an issue if it was significantly higher */
 
-		if (response_send(&resp, client_sock) != 0) {
-			fprintf(stderr, "Error sending response to GET request\n");
+		fprintf(stdout, "Retrieved note titled %s\n", sbj);
+	} else if (cmd == GET_RANGE) {
+		uint64_t offset;
+		uint32_t length;
+		if (range_parse(extra_data_len, extra_data, &offset, &length) != 0) {
 			return 1;
 		}
 
-		fprintf(stdout, "Retrieved note titled %s\n", sbj);
+		const int new_file = openat(uid_dir_fd, sbj, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+		if (new_file == -1) {
+			if (errno == ENOENT) {
+				fprintf(stderr, "Cannot get contents of non-existant note\n");
+			} else {
+				fprintf(stderr, "Error opening '%s' as read-file (errno %d: %s)\n", sbj, errno, strerror(errno));
+			}
+			return 1;
+		}
+		if (note_expired(uid_dir_fd, sbj, new_file, now_ns)) {
+			close(new_file);
+			return 1;
+		}
+
+		const ssize_t bytes_read = pread(new_file, data_resp->extra_data_content, length, (off_t)offset); /* only the slice asked for is touched. reading past the end gets nothing, not an error - that's how a tailing reader learns it's caught up */
+		if (bytes_read < 0) {
+			fprintf(stderr, "Error reading range of file %s (errno %d: %s)\n", sbj, errno, strerror(errno));
+			close(new_file);
+			return 1;
+		}
+
+		if (close(new_file) != 0) {
+			fprintf(stderr, "Error closing '%s' as read-file (errno %d: %s)\n", sbj, errno, strerror(errno));
+		}
+
+		data_resp->status = DATA;
+		data_resp->extra_data_len = (uint32_t)bytes_read;
+
+		fprintf(stdout, "Retrieved %u byte(s) at offset %llu of note titled %s\n", (unsigned int)bytes_read, (unsigned long long)offset, sbj);
+	} else if (cmd == APPEND) {
+		const int new_file = openat(uid_dir_fd, sbj, O_WRONLY | O_APPEND | O_NOFOLLOW | O_CLOEXEC); /* no O_CREAT - appending never makes a note */
+		if (new_file == -1) {
+			if (errno == ENOENT) {
+				fprintf(stderr, "Cannot append to non-existant note\n");
+			} else {
+				fprintf(stderr, "Error opening '%s' as append-file (errno %d: %s)\n", sbj, errno, strerror(errno));
+			}
+			return 1;
+		}
+		if (note_expired(uid_dir_fd, sbj, new_file, now_ns)) {
+			close(new_file);
+			return 1;
+		}
+
+		struct stat statbuf;
+		if (fstat(new_file, &statbuf) != 0) {
+			fprintf(stderr, "Error inspecting file %s (errno %d: %s)\n", sbj, errno, strerror(errno));
+			close(new_file);
+			return 1;
+		}
+		if ((uint64_t)statbuf.st_size + extra_data_len > NOTICEBOARD_MAX_NOTE_LEN) {
+			fprintf(stderr, "Cannot grow note %s beyond %lu bytes\n", sbj, (unsigned long)NOTICEBOARD_MAX_NOTE_LEN);
+			close(new_file);
+			return 1;
+		}
+
+		if (extra_data_len > 0 && write(new_file, extra_data, extra_data_len) != (ssize_t)extra_data_len) { /* O_APPEND makes seeking to the end & writing one atomic step */
+			fprintf(stderr, "Error appending to file %s\n", sbj);
+			if (ftruncate(new_file, statbuf.st_size) != 0) { /* don't leave half an append behind */
+				fprintf(stderr, "Error restoring length of file %s (errno %d: %s)\n", sbj, errno, strerror(errno));
+			}
+			close(new_file);
+			return 1;
+		}
+
+		if (close(new_file) != 0) {
+			fprintf(stderr, "Error closing '%s' as append-file (errno %d: %s)\n", sbj, errno, strerror(errno));
+		}
+
+		const struct timespec dir_times[2] = { { .tv_sec = 0, .tv_nsec = UTIME_OMIT }, { .tv_sec = 0, .tv_nsec = UTIME_NOW } };
+		if (futimens(uid_dir_fd, dir_times) != 0) { /* growing a note in place leaves its directory untouched - without this, a snapshot would go on vouching for the old length */
+			fprintf(stderr, "Error marking notes directory of %s as changed (errno %d: %s)\n", sbj, errno, strerror(errno));
+		}
+
+		const uint64_t note_len = htole64((uint64_t)statbuf.st_size + extra_data_len);
+		memcpy(data_resp->extra_data_content, &note_len, sizeof(note_len));
+		data_resp->status = DATA;
+		data_resp->extra_data_len = sizeof(note_len);
+
+		fprintf(stdout, "Appended %u byte(s) to note titled %s\n", extra_data_len, sbj);
 	} else if (cmd == REMOVE) {
-		if (check_file_exists(sbj) == 0) {
-			fprintf(stderr, "Cannot delete non-existant note\n");
+		if (note_expired(uid_dir_fd, sbj, -1, now_ns)) { /* it's gone either way, but the client asked to remove a note that no longer existed */
 			return 1;
 		}
 
-		if (unlink(sbj) != 0) {
-			fprintf(stderr, "Unable to delete file %s (errno %d: %s)\n", sbj, errno, strerror(errno));
+		if (unlinkat(uid_dir_fd, sbj, 0) != 0) { /* unlinkat reports a missing note itself, no need to check first */
+			if (errno == ENOENT) {
+				fprintf(stderr, "Cannot delete non-existant note\n");
+			} else {
+				fprintf(stderr, "Unable to delete file %s (errno %d: %s)\n", sbj, errno, strerror(errno));
+			}
 			return 1;
 		}
 
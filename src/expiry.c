@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+
+#include "store.h"
+#include "index.h"
+#include "tier.h"
+#include "expiry.h"
+
+/**
+ * @brief Definitions of note expiry
+ */
+
+#define NS_PER_TICK 1000000000
+
+/**
+ * @brief expiry_tick - converts a time to the last whole tick at or before it
+ * @param const int64_t ns - nanoseconds since the epoch
+ * @return uint64_t - ticks
+ */
+static inline uint64_t expiry_tick(const int64_t ns)
+{
+	return (ns <= 0 ? 0 : (uint64_t)(ns / NS_PER_TICK));
+}
+
+void expiry_init(struct Expiry *const expiry, const int64_t now_ns)
+{
+	timer_wheel_init(&expiry->wheel, expiry_tick(now_ns));
+	timer_list_init(&expiry->due);
+	expiry->due_count = 0;
+	expiry->deleted = 0;
+}
+
+void expiry_free(struct Expiry *const expiry)
+{
+	for (struct TimerLink *link; (link = timer_list_pop(&expiry->due)) != NULL;) {
+		free(link);
+	}
+	for (unsigned int level = 0; level < TIMER_LEVELS; ++level) {
+		for (unsigned int slot = 0; slot < TIMER_SLOTS; ++slot) {
+			for (struct TimerLink *link; (link = timer_list_pop(&expiry->wheel.slots[level][slot])) != NULL;) {
+				free(link);
+			}
+		}
+	}
+	expiry->wheel.count = 0;
+	expiry->due_count = 0;
+}
+
+int expiry_schedule(struct Expiry *const expiry, struct IndexEntry *const entry)
+{
+	expiry_cancel(expiry, entry);
+
+	struct NoteExpiry *const note = malloc(sizeof(*note));
+	if (note == NULL) {
+		fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+	timer_link_init(&note->link);
+	note->due = 0;
+	note->uid = entry->uid;
+	memcpy(note->sbj, entry->sbj, entry->sbj_len);
+	note->sbj[entry->sbj_len] = '\0';
+
+	timer_schedule(&expiry->wheel, &note->link, expiry_tick(entry->expires_ns + NS_PER_TICK - 1)); /* rounded up - fires no earlier than the note expires */
+	entry->timer = note;
+
+	return 0;
+}
+
+void expiry_cancel(struct Expiry *const expiry, struct IndexEntry *const entry)
+{
+	struct NoteExpiry *const note = entry->timer;
+	if (note == NULL) {
+		return;
+	}
+
+	entry->timer = NULL;
+	if (!note->due) { /* a fired one is left on the due list - expiry_reap finds it no longer belongs to its note & frees it */
+		timer_cancel(&expiry->wheel, &note->link);
+		free(note);
+	}
+}
+
+int expiry_load(struct Expiry *const expiry, struct Index *const index)
+{
+	int exit_code = 0;
+	size_t scheduled = 0;
+	for (size_t i = 0; i < index->cap; ++i) {
+		struct IndexEntry *const entry = &index->slots[i];
+		if (entry->sbj_len == 0 || entry->sbj_len == INDEX_TOMBSTONE || entry->expires_ns == 0) {
+			continue;
+		}
+
+		if (expiry_schedule(expiry, entry) == 1) {
+			exit_code = 1;
+			break;
+		}
+		++scheduled;
+	}
+	index->expiry = expiry;
+
+	if (scheduled > 0) {
+		fprintf(stdout, "Scheduled expiry of %lu note(s)\n", (unsigned long)scheduled);
+	}
+
+	return exit_code;
+}
+
+int64_t expiry_next_ms(const struct Expiry *const expiry, const int64_t now_ns)
+{
+	if (expiry->due_count > 0) {
+		return 0;
+	}
+
+	const int64_t ticks = timer_next(&expiry->wheel);
+	if (ticks < 0) {
+		return -1;
+	}
+
+	const int64_t due_ms = ((int64_t)expiry->wheel.current + ticks) * (NS_PER_TICK / 1000000);
+	const int64_t now_ms = now_ns / 1000000;
+
+	return (due_ms > now_ms ? due_ms - now_ms : 0);
+}
+
+int expiry_delete(const struct Store *const store, const int uid_dir_fd, const uid_t uid, const char *const sbj)
+{
+	if (unlinkat(uid_dir_fd, sbj, 0) != 0 && errno != ENOENT) {
+		fprintf(stderr, "Unable to delete expired note %u/%s (errno %d: %s)\n", (unsigned int)uid, sbj, errno, strerror(errno));
+		return 1;
+	}
+
+	if (store->index != NULL) {
+		index_remove(store->index, uid, sbj);
+	}
+	if (store->tiers != NULL) {
+		tier_forget(store->tiers, uid, sbj);
+	}
+	fprintf(stdout, "Expired note titled %s of uid %u\n", sbj, (unsigned int)uid);
+
+	return 0;
+}
+
+size_t expiry_reap(struct Expiry *const expiry, const struct Store *const store, const int64_t now_ns)
+{
+	const struct TimerLink *const last_due = expiry->due.prev; /* everything after this has just fired */
+	expiry->due_count += timer_expire(&expiry->wheel, expiry_tick(now_ns), &expiry->due);
+	for (struct TimerLink *link = last_due->next; link != &expiry->due; link = link->next) {
+		((struct NoteExpiry *)link)->due = 1;
+	}
+
+	size_t deleted = 0;
+	int dir_fd = -1; /* kept open across the batch - expiries of one user tend to come together */
+	uid_t dir_uid = 0;
+
+	for (size_t i = 0; i < NOTICEBOARD_EXPIRY_BATCH && expiry->due_count > 0; ++i) {
+		struct NoteExpiry *const note = (struct NoteExpiry *)timer_list_pop(&expiry->due);
+		--expiry->due_count;
+
+		const struct IndexEntry *const entry = (store->index != NULL ? index_find(store->index, note->uid, note->sbj) : NULL);
+		if (entry == NULL || entry->timer != note) { /* cancelled after it fired */
+			free(note);
+			continue;
+		}
+
+		if (dir_fd == -1 || dir_uid != (uid_t)note->uid) {
+			if (dir_fd != -1) {
+				close(dir_fd);
+			}
+			dir_uid = (uid_t)note->uid;
+			dir_fd = store_uid_dir(store, dir_uid, 0);
+		}
+
+		int failed = 0;
+		if (dir_fd == -1) {
+			if (errno == ENOENT) { /* whole directory gone - so is the note */
+				index_remove(store->index, note->uid, note->sbj);
+				if (store->tiers != NULL) {
+					tier_forget(store->tiers, (uid_t)note->uid, note->sbj);
+				}
+			} else {
+				fprintf(stderr, "Error opening notes directory of uid %u (errno %d: %s)\n", note->uid, errno, strerror(errno));
+				failed = 1;
+			}
+		} else if (expiry_delete(store, dir_fd, (uid_t)note->uid, note->sbj) == 0) {
+			++deleted;
+		} else {
+			failed = 1;
+		}
+
+		if (failed) { /* still its note's timer - try again later rather than forget it */
+			note->due = 0;
+			timer_schedule(&expiry->wheel, &note->link, expiry_tick(now_ns) + NOTICEBOARD_EXPIRY_RETRY_S);
+		} else {
+			free(note);
+		}
+	}
+
+	if (dir_fd != -1) {
+		close(dir_fd);
+	}
+	expiry->deleted += deleted;
+
+	return deleted;
+}
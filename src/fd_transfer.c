@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "fd_transfer.h"
+
+/**
+ * @brief Definitions of functionality to hand file descriptors between processes
+ */
+
+int fd_send(const int sock, const int *const fds, const size_t fd_count)
+{
+	if (fds == NULL || fd_count < 1 || fd_count > MAX_TRANSFER_FDS) {
+		fprintf(stderr, "Invalid number of handles to send (%lu)\n", (unsigned long)fd_count);
+		return 1;
+	}
+
+	union { /* union guarantees the control buffer is suitably aligned for struct cmsghdr */
+		char buf[CMSG_SPACE(sizeof(int) * MAX_TRANSFER_FDS)];
+		struct cmsghdr align;
+	} control;
+	memset(&control, '\0', sizeof(control));
+
+	uint8_t marker = 0;
+	struct iovec iov = { .iov_base = &marker, .iov_len = sizeof(marker) };
+	struct msghdr msg;
+	memset(&msg, '\0', sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+
+	struct cmsghdr *const cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+
+	if (sendmsg(sock, &msg, 0) != sizeof(marker)) {
+		fprintf(stderr, "Error sending handles (errno %d: %s)\n", errno, strerror(errno));
+		return 2;
+	}
+
+	return 0;
+}
+
+int fd_recv(const int sock, int *const fds, const size_t fd_count)
+{
+	if (fds == NULL || fd_count < 1 || fd_count > MAX_TRANSFER_FDS) {
+		fprintf(stderr, "Invalid number of handles to receive (%lu)\n", (unsigned long)fd_count);
+		return 2;
+	}
+
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * MAX_TRANSFER_FDS)];
+		struct cmsghdr align;
+	} control;
+	memset(&control, '\0', sizeof(control));
+
+	uint8_t marker;
+	struct iovec iov = { .iov_base = &marker, .iov_len = sizeof(marker) };
+	struct msghdr msg;
+	memset(&msg, '\0', sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	ssize_t bytes_read;
+	do {
+		bytes_read = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (bytes_read == -1 && errno == EINTR);
+
+	if (bytes_read != sizeof(marker)) {
+		fprintf(stderr, "Error receiving handles (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	size_t received = 0;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+			continue;
+		}
+
+		const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < count; ++i) {
+			int fd;
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			if (received < fd_count) {
+				fds[received] = fd;
+			} else {
+				close(fd); /* sender passed more than we asked for - don't leak them */
+			}
+			++received;
+		}
+	}
+
+	if (received != fd_count || (msg.msg_flags & MSG_CTRUNC)) {
+		fprintf(stderr, "Expected %lu handle(s) but received %lu\n", (unsigned long)fd_count, (unsigned long)received);
+		for (size_t i = 0; i < received && i < fd_count; ++i) {
+			close(fds[i]);
+		}
+		return 2;
+	}
+
+	return 0;
+}
+
+ssize_t fd_recv_stream(const int sock, void *const buf, const size_t buf_len, int *const fds, size_t *const fd_count, const size_t fd_cap)
+{
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * MAX_TRANSFER_FDS)];
+		struct cmsghdr align;
+	} control;
+
+	struct iovec iov = { .iov_base = buf, .iov_len = buf_len };
+	struct msghdr msg;
+	memset(&msg, '\0', sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	ssize_t bytes_read;
+	do {
+		bytes_read = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+	} while (bytes_read == -1 && errno == EINTR);
+
+	if (bytes_read <= 0) {
+		return bytes_read;
+	}
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+			continue;
+		}
+
+		const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < count; ++i) {
+			int fd;
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			if (*fd_count < fd_cap) {
+				fds[(*fd_count)++] = fd;
+			} else {
+				close(fd); /* more than anything we're expecting - don't leak them */
+			}
+		}
+	}
+
+	return bytes_read;
+}
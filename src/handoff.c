@@ -0,0 +1,291 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "fd_transfer.h"
+#include "handoff.h"
+
+/**
+ * @brief Definitions of listening-socket handoff
+ */
+
+#define HANDOFF_PERMISSIONS 0600 /* only the server's own user may take it over */
+
+/**
+ * @brief control_address - fills in a socket address for the control socketfile
+ * @param struct sockaddr_un *const address - address to fill
+ * @param const char *const name - socketfile
+ * @return int - zero is success, non-zero is failure
+ * 1 is name too long
+ */
+static int control_address(struct sockaddr_un *const address, const char *const name)
+{
+	memset(address, '\0', sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if (strlen(name) + 1 > sizeof(address->sun_path)) {
+		fprintf(stderr, "(Internal error) Somehow the control socket's name is too long. Review source code\n");
+		return 1;
+	}
+	memcpy(address->sun_path, name, strlen(name));
+
+	return 0;
+}
+
+/**
+ * @brief exchange - sends or receives a whole buffer over a blocking socket, carrying on after short transfers
+ * @param const int sock - connected socket
+ * @param void *const buf - bytes to send, or buffer to fill
+ * @param const size_t len - length of buf
+ * @param const int sending - boolean. send rather than receive
+ * @return int - zero is success, non-zero is failure
+ * 1 is error (or peer hung up)
+ */
+static int exchange(const int sock, void *const buf, const size_t len, const int sending)
+{
+	size_t done = 0;
+	while (done < len) {
+		const ssize_t ret = (sending ? send(sock, (uint8_t *)buf + done, len - done, MSG_NOSIGNAL) : recv(sock, (uint8_t *)buf + done, len - done, 0));
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			return 1;
+		}
+		done += (size_t)ret;
+	}
+
+	return 0;
+}
+
+int handoff_listen(const char *const name)
+{
+	struct sockaddr_un address;
+	if (control_address(&address, name) != 0) {
+		return -1;
+	}
+
+	const int control = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (control == -1) {
+		fprintf(stderr, "Failure to create control socket (errno %d: %s)\n", errno, strerror(errno));
+		return -1;
+	}
+
+	if (unlink(name) != 0 && errno != ENOENT) { /* only called once the main socket is bound - so no server is still behind any left over */
+		fprintf(stderr, "Failure to replace old control socketfile (errno %d: %s)\n", errno, strerror(errno));
+		close(control);
+		return -1;
+	}
+
+	const mode_t old_mask = umask(0777 & ~HANDOFF_PERMISSIONS); /* never reachable by anyone else, even briefly */
+	const int bound = bind(control, (struct sockaddr *)&address, sizeof(address));
+	umask(old_mask);
+	if (bound != 0 || listen(control, 4) != 0) {
+		fprintf(stderr, "Failure to set up control socket (errno %d: %s)\n", errno, strerror(errno));
+		close(control);
+		return -1;
+	}
+
+	return control;
+}
+
+int handoff_accept(const int control, struct HandoffRequest *const request)
+{
+	request->peer = -1;
+	request->received = 0;
+
+	const int peer = accept4(control, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC); /* read from the event loop like any session, so a peer that never speaks holds nobody up */
+	if (peer == -1) {
+		fprintf(stderr, "Unexpected issue accepting control connection (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	struct ucred peer_cred;
+	socklen_t cred_len = sizeof(peer_cred);
+	if (getsockopt(peer, SOL_SOCKET, SO_PEERCRED, &peer_cred, &cred_len) != 0 || peer_cred.uid != geteuid()) {
+		fprintf(stderr, "Refusing takeover from uid %u - not our own\n", (unsigned int)peer_cred.uid);
+		close(peer);
+		return 1;
+	}
+
+	request->peer = peer;
+	request->pid = peer_cred.pid;
+
+	return 0;
+}
+
+int handoff_read(struct HandoffRequest *const request)
+{
+	while (request->received < sizeof(request->header)) {
+		const ssize_t ret = recv(request->peer, (uint8_t *)&request->header + request->received, sizeof(request->header) - request->received, 0);
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		} else if (ret == -1 && errno == EAGAIN) {
+			return 1;
+		} else if (ret <= 0) {
+			break;
+		}
+		request->received += (size_t)ret;
+	}
+
+	const int flags = fcntl(request->peer, F_GETFL);
+	if (request->received < sizeof(request->header) || request->header.magic != HANDOFF_MAGIC || request->header.version != HANDOFF_VERSION || flags == -1 || fcntl(request->peer, F_SETFL, flags & ~O_NONBLOCK) != 0) { /* the handoff itself is sent blocking, as the new server is waiting on every part of it */
+		fprintf(stderr, "Refusing takeover from pid %d - not a request we understand\n", (int)request->pid);
+		close(request->peer);
+		request->peer = -1;
+		return 2;
+	}
+
+	fprintf(stdout, "Handing over to pid %d\n", (int)request->pid);
+
+	return 0;
+}
+
+int handoff_send(const int peer, const int listener, const int control, const int tier_state, const struct Session *const sessions, const size_t session_cap)
+{
+	struct HandoffHeader header = { .magic = HANDOFF_MAGIC, .version = HANDOFF_VERSION, .session_count = 0, .flags = (tier_state != -1 ? HANDOFF_FLAG_TIER_STATE : 0) };
+	for (size_t i = 0; i < session_cap; ++i) {
+		header.session_count += (sessions[i].sock != -1);
+	}
+
+	if (exchange(peer, &header, sizeof(header), 1) != 0 || fd_send(peer, (const int[]){ listener, control, tier_state }, (tier_state != -1 ? 3 : 2)) != 0) {
+		fprintf(stderr, "Error handing over listening sockets (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	for (size_t i = 0; i < session_cap; ++i) {
+		const struct Session *const session = &sessions[i];
+		if (session->sock == -1) {
+			continue;
+		}
+
+		uint32_t fd_count = 1;
+		int fds[MAX_TRANSFER_FDS] = { session->sock };
+		if (session->has_ring) {
+			fds[fd_count++] = session->ring.memfd;
+			fds[fd_count++] = session->ring.doorbells[RING_REQUESTS];
+			fds[fd_count++] = session->ring.doorbells[RING_RESPONSES];
+		}
+
+		if (exchange(peer, &fd_count, sizeof(fd_count), 1) != 0 || fd_send(peer, fds, fd_count) != 0) {
+			fprintf(stderr, "Error handing over session on socket %d (errno %d: %s)\n", session->sock, errno, strerror(errno));
+			return 2;
+		}
+	}
+
+	fprintf(stdout, "Handed over %llu session(s)\n", (unsigned long long)header.session_count);
+
+	return 0;
+}
+
+int handoff_receive(const char *const name, struct Handoff *const handoff)
+{
+	handoff->listener = -1;
+	handoff->control = -1;
+	handoff->tier_state = -1;
+	handoff->sessions = NULL;
+	handoff->session_count = 0;
+
+	struct sockaddr_un address;
+	if (control_address(&address, name) != 0) {
+		return 1;
+	}
+
+	const int peer = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (peer == -1 || connect(peer, (struct sockaddr *)&address, sizeof(address)) != 0) {
+		fprintf(stderr, "Failure to reach running server to take over from (errno %d: %s)\n", errno, strerror(errno));
+		if (peer != -1) {
+			close(peer);
+		}
+		return 1;
+	}
+
+	/* it may take the whole drain to answer - allow for that, & a little over */
+	const int64_t timeout_ms = NOTICEBOARD_HANDOFF_DRAIN_MS + 10000;
+	const struct timeval timeout = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+	struct HandoffHeader header = { .magic = HANDOFF_MAGIC, .version = HANDOFF_VERSION, .session_count = 0, .flags = 0 };
+	fprintf(stdout, "Asking running server to hand over\n");
+	if (setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 || exchange(peer, &header, sizeof(header), 1) != 0 || exchange(peer, &header, sizeof(header), 0) != 0) {
+		fprintf(stderr, "Error requesting handoff (errno %d: %s)\n", errno, strerror(errno));
+		close(peer);
+		return 2;
+	}
+	if (header.magic != HANDOFF_MAGIC || header.version != HANDOFF_VERSION) {
+		fprintf(stderr, "Running server answered handoff with something we don't understand\n");
+		close(peer);
+		return 2;
+	}
+
+	int sockets[3];
+	if (fd_recv(peer, sockets, (header.flags & HANDOFF_FLAG_TIER_STATE ? 3 : 2)) != 0) {
+		close(peer);
+		return 2;
+	}
+	handoff->listener = sockets[0];
+	handoff->control = sockets[1];
+	handoff->tier_state = (header.flags & HANDOFF_FLAG_TIER_STATE ? sockets[2] : -1);
+
+	handoff->sessions = calloc(header.session_count > 0 ? header.session_count : 1, sizeof(*handoff->sessions));
+	if (handoff->sessions == NULL) {
+		fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+		close(peer);
+		return 2;
+	}
+
+	int exit_code = 0;
+	for (uint64_t s = 0; s < header.session_count; ++s) {
+		struct HandoffSession *const session = &handoff->sessions[handoff->session_count];
+		uint32_t fd_count;
+		if (exchange(peer, &fd_count, sizeof(fd_count), 0) != 0 || (fd_count != 1 && fd_count != 4) || fd_recv(peer, session->fds, fd_count) != 0) {
+			fprintf(stderr, "Error receiving session %llu of %llu (errno %d: %s)\n", (unsigned long long)s + 1, (unsigned long long)header.session_count, errno, strerror(errno));
+			exit_code = 2;
+			break;
+		}
+		for (uint32_t f = fd_count; f < MAX_TRANSFER_FDS; ++f) {
+			session->fds[f] = -1;
+		}
+		session->has_ring = (fd_count == 4);
+		++handoff->session_count;
+	}
+	close(peer);
+
+	fprintf(stdout, "Took over listening socket & %lu session(s)\n", (unsigned long)handoff->session_count);
+
+	return exit_code;
+}
+
+void handoff_free(struct Handoff *const handoff)
+{
+	if (handoff->listener != -1) {
+		close(handoff->listener);
+		handoff->listener = -1;
+	}
+	if (handoff->control != -1) {
+		close(handoff->control);
+		handoff->control = -1;
+	}
+	if (handoff->tier_state != -1) {
+		close(handoff->tier_state);
+		handoff->tier_state = -1;
+	}
+
+	for (size_t s = 0; s < handoff->session_count; ++s) {
+		for (size_t f = 0; f < MAX_TRANSFER_FDS; ++f) {
+			if (handoff->sessions[s].fds[f] != -1) {
+				close(handoff->sessions[s].fds[f]);
+			}
+		}
+	}
+	free(handoff->sessions);
+	handoff->sessions = NULL;
+	handoff->session_count = 0;
+}
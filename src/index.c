@@ -0,0 +1,1032 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/xattr.h>
+#include <endian.h>
+
+#include "store.h"
+#include "util.h"
+#include "pack.h"
+#include "index.h"
+#include "expiry.h"
+
+/**
+ * @brief Definitions of the in-memory index of every note in the store
+ */
+
+#define INDEX_MIN_CAP 1024
+
+/**
+ * @brief SnapshotHeader (struct) - start of a snapshot file. a table of SnapshotUid (ascending uid) follows, then every SnapshotNote grouped in that same order
+ */
+struct SnapshotHeader {
+	uint32_t magic; /* INDEX_SNAPSHOT_MAGIC */
+
+	uint32_t version; /* INDEX_SNAPSHOT_VERSION */
+
+	uint64_t payload_len; /* bytes following this header */
+
+	uint64_t checksum; /* of the payload, see checksum() */
+
+	uint64_t uid_count;
+
+	uint64_t note_count;
+};
+
+/**
+ * @brief SnapshotUid (struct) - one user's directory, as it was when the snapshot was taken
+ */
+struct SnapshotUid {
+	uint32_t uid;
+
+	uint32_t note_count; /* number of SnapshotNote belonging to this user */
+
+	int64_t mtime_sec; /* uid directory's mtime */
+
+	int64_t mtime_nsec;
+};
+
+/**
+ * @brief SnapshotNote (struct) - one note. fixed size so every record can be bounds checked up front
+ */
+struct SnapshotNote {
+	int64_t created_ns;
+
+	int64_t expires_ns;
+
+	uint64_t pack_offset;
+
+	int64_t read_ns;
+
+	uint32_t size;
+
+	uint8_t sbj_len;
+
+	char sbj[MAX_SBJ_LEN];
+
+	uint8_t pad[5];
+};
+
+/**
+ * @brief ScanContext (struct) - state carried across store_for_each_uid's calls to build_uid
+ */
+struct ScanContext {
+	struct Index *index;
+
+	const uint8_t *snapshot; /* mapped snapshot, NULL if unusable */
+
+	const uint64_t *note_offsets; /* per SnapshotUid, byte offset of its first SnapshotNote */
+
+	uint64_t uid_count;
+
+	struct timespec snapshot_mtime;
+
+	size_t reused_uids, rescanned_uids;
+};
+
+/**
+ * @brief hash_key - FNV-1a over the uid & subject
+ * @param const uint32_t uid - owner
+ * @param const char *const sbj - subject
+ * @param const size_t sbj_len - length of sbj
+ * @return uint64_t - hash
+ */
+static uint64_t hash_key(const uint32_t uid, const char *const sbj, const size_t sbj_len)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < sizeof(uid); ++i) {
+		hash = (hash ^ ((uid >> (8 * i)) & 0xFF)) * 1099511628211ull;
+	}
+	for (size_t i = 0; i < sbj_len; ++i) {
+		hash = (hash ^ (uint8_t)sbj[i]) * 1099511628211ull;
+	}
+
+	return hash;
+}
+
+/**
+ * @brief checksum - word-at-a-time FNV-1a variant over a snapshot payload. catches torn or corrupted files, not tampering
+ * @param const uint8_t *const buf - payload
+ * @param const size_t len - length of buf
+ * @return uint64_t - checksum
+ */
+static uint64_t checksum(const uint8_t *const buf, const size_t len)
+{
+	uint64_t sum = 14695981039346656037ull;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, buf + i, sizeof(word));
+		sum = (sum ^ word) * 1099511628211ull;
+	}
+	for (; i < len; ++i) {
+		sum = (sum ^ buf[i]) * 1099511628211ull;
+	}
+
+	return sum;
+}
+
+/**
+ * @brief index_probe - finds a key's slot, or where it would go
+ * @param const struct Index *const index - index
+ * @param const uint32_t uid - owner
+ * @param const char *const sbj - subject
+ * @param const size_t sbj_len - length of sbj
+ * @param size_t *const insert_at - filled with the first free (empty or tombstone) slot seen. may be NULL
+ * @return struct IndexEntry* - matching entry, NULL if absent
+ */
+static struct IndexEntry *index_probe(const struct Index *const index, const uint32_t uid, const char *const sbj, const size_t sbj_len, size_t *const insert_at)
+{
+	const size_t mask = index->cap - 1;
+	size_t slot = (size_t)hash_key(uid, sbj, sbj_len) & mask;
+	int free_seen = 0;
+
+	while (1) { /* load factor is kept at or below a half, so there's always an empty slot to stop at */
+		struct IndexEntry *const entry = &index->slots[slot];
+		if (entry->sbj_len == 0 || entry->sbj_len == INDEX_TOMBSTONE) {
+			if (!free_seen && insert_at != NULL) {
+				*insert_at = slot;
+				free_seen = 1;
+			}
+			if (entry->sbj_len == 0) {
+				return NULL;
+			}
+		} else if (entry->uid == uid && entry->sbj_len == sbj_len && memcmp(entry->sbj, sbj, sbj_len) == 0) {
+			return entry;
+		}
+		slot = (slot + 1) & mask;
+	}
+}
+
+/**
+ * @brief order_cmp - compares a key against a node of one of the index's views
+ * @param const int by_time - boolean. compare as the time view does (uid, creation time, then subject), else as the ordered view does (uid then subject)
+ * @param const uint32_t uid - owner
+ * @param const int64_t created_ns - creation time. ignored unless by_time
+ * @param const char *const sbj - subject
+ * @param const size_t sbj_len - length of sbj
+ * @param const struct IndexOrderNode *const node - node to compare against
+ * @return int - negative, zero or positive as the key sorts before, the same as or after node
+ */
+static int order_cmp(const int by_time, const uint32_t uid, const int64_t created_ns, const char *const sbj, const size_t sbj_len, const struct IndexOrderNode *const node)
+{
+	if (uid != node->uid) {
+		return (uid < node->uid ? -1 : 1);
+	}
+
+	if (by_time && created_ns != node->created_ns) {
+		return (created_ns < node->created_ns ? -1 : 1);
+	}
+
+	const int cmp = memcmp(sbj, node->sbj, (sbj_len < node->sbj_len ? sbj_len : node->sbj_len));
+	if (cmp != 0) {
+		return cmp;
+	}
+
+	return (sbj_len > node->sbj_len) - (sbj_len < node->sbj_len);
+}
+
+/**
+ * @brief order_seek - finds, at every level of a view, the last node ordered before a key
+ * @param struct IndexOrderNode *const head - view to search (Index::order or Index::by_time)
+ * @param const int by_time - boolean. head is the time view
+ * @param const uint32_t uid - owner
+ * @param const int64_t created_ns - creation time. ignored unless by_time
+ * @param const char *const sbj - subject
+ * @param const size_t sbj_len - length of sbj
+ * @param const int inclusive - boolean. if set, nodes equal to the key count as before it
+ * @param struct IndexOrderNode **const preceding - filled with INDEX_ORDER_LEVELS nodes (the head where nothing precedes)
+ */
+static void order_seek(struct IndexOrderNode *const head, const int by_time, const uint32_t uid, const int64_t created_ns, const char *const sbj, const size_t sbj_len, const int inclusive, struct IndexOrderNode **const preceding)
+{
+	struct IndexOrderNode *node = head;
+	for (int level = INDEX_ORDER_LEVELS - 1; level >= 0; --level) {
+		while (node->next[level] != NULL && order_cmp(by_time, uid, created_ns, sbj, sbj_len, node->next[level]) > -inclusive) {
+			node = node->next[level];
+		}
+		preceding[level] = node;
+	}
+}
+
+/**
+ * @brief order_insert - links a new note into one of the index's views
+ * @param struct Index *const index - index
+ * @param const int by_time - boolean. link into the time view, else the ordered view
+ * @param const uint32_t uid - owner
+ * @param const int64_t created_ns - creation time
+ * @param const char *const sbj - subject
+ * @param const size_t sbj_len - length of sbj. 1 to MAX_SBJ_LEN
+ * @return int - zero is success, non-zero is failure
+ * 1 is error allocating
+ */
+static int order_insert(struct Index *const index, const int by_time, const uint32_t uid, const int64_t created_ns, const char *const sbj, const size_t sbj_len)
+{
+	uint64_t seed = index->order_seed; /* xorshift64 */
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	index->order_seed = seed;
+
+	unsigned int height = 1;
+	while (height < INDEX_ORDER_LEVELS && (seed & 3) == 0) { /* each level up holds a quarter as many nodes */
+		++height;
+		seed >>= 2;
+	}
+
+	struct IndexOrderNode *const node = malloc(sizeof(*node) + height * sizeof(node->next[0]));
+	if (node == NULL) {
+		fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+	node->created_ns = created_ns;
+	node->uid = uid;
+	node->sbj_len = (uint8_t)sbj_len;
+	memcpy(node->sbj, sbj, sbj_len);
+	node->height = (uint8_t)height;
+
+	struct IndexOrderNode *preceding[INDEX_ORDER_LEVELS];
+	order_seek((by_time ? index->by_time : index->order), by_time, uid, created_ns, sbj, sbj_len, 0, preceding);
+	for (unsigned int level = 0; level < height; ++level) {
+		node->next[level] = preceding[level]->next[level];
+		preceding[level]->next[level] = node;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief order_remove - unlinks a note from one of the index's views & frees its node
+ * @param struct Index *const index - index
+ * @param const int by_time - boolean. unlink from the time view, else the ordered view
+ * @param const uint32_t uid - owner
+ * @param const int64_t created_ns - creation time it was linked in with
+ * @param const char *const sbj - subject
+ * @param const size_t sbj_len - length of sbj
+ */
+static void order_remove(struct Index *const index, const int by_time, const uint32_t uid, const int64_t created_ns, const char *const sbj, const size_t sbj_len)
+{
+	struct IndexOrderNode *preceding[INDEX_ORDER_LEVELS];
+	order_seek((by_time ? index->by_time : index->order), by_time, uid, created_ns, sbj, sbj_len, 0, preceding);
+
+	struct IndexOrderNode *const node = preceding[0]->next[0];
+	if (node == NULL || order_cmp(by_time, uid, created_ns, sbj, sbj_len, node) != 0) {
+		return;
+	}
+
+	for (unsigned int level = 0; level < node->height; ++level) {
+		preceding[level]->next[level] = node->next[level];
+	}
+	free(node);
+}
+
+/**
+ * @brief order_free - frees every node of one of the index's views, & its head
+ * @param struct IndexOrderNode *const head - view to free. may be NULL
+ */
+static void order_free(struct IndexOrderNode *const head)
+{
+	if (head == NULL) {
+		return;
+	}
+
+	for (struct IndexOrderNode *node = head->next[0]; node != NULL;) {
+		struct IndexOrderNode *const next = node->next[0];
+		free(node);
+		node = next;
+	}
+	free(head);
+}
+
+/**
+ * @brief index_resize - rehashes every live entry into a table of new_cap slots, dropping tombstones
+ * @param struct Index *const index - index
+ * @param const size_t new_cap - new number of slots. power of two, more than twice count
+ * @return int - zero is success, non-zero is failure
+ * 1 is error allocating (index left as it was)
+ */
+static int index_resize(struct Index *const index, const size_t new_cap)
+{
+	struct IndexEntry *const slots = calloc(new_cap, sizeof(*slots));
+	if (slots == NULL) {
+		fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	struct Index resized = { .slots = slots, .order = index->order, .by_time = index->by_time, .order_seed = index->order_seed, .cap = new_cap, .count = index->count, .used = index->count, .packed = index->packed, .generation = index->generation, .expiry = index->expiry, .complete = index->complete }; /* neither view holds slot positions, so both carry straight over */
+	for (size_t i = 0; i < index->cap; ++i) {
+		const struct IndexEntry *const entry = &index->slots[i];
+		if (entry->sbj_len == 0 || entry->sbj_len == INDEX_TOMBSTONE) {
+			continue;
+		}
+
+		size_t slot = 0;
+		index_probe(&resized, entry->uid, entry->sbj, entry->sbj_len, &slot);
+		slots[slot] = *entry;
+	}
+
+	free(index->slots);
+	*index = resized;
+
+	return 0;
+}
+
+int index_init(struct Index *const index, const size_t expected)
+{
+	size_t cap = INDEX_MIN_CAP;
+	while (cap < expected * 2) {
+		cap *= 2;
+	}
+
+	index->slots = calloc(cap, sizeof(*index->slots));
+	index->order = calloc(1, sizeof(*index->order) + INDEX_ORDER_LEVELS * sizeof(index->order->next[0]));
+	index->by_time = calloc(1, sizeof(*index->by_time) + INDEX_ORDER_LEVELS * sizeof(index->by_time->next[0]));
+	if (index->slots == NULL || index->order == NULL || index->by_time == NULL) {
+		fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+		free(index->slots);
+		free(index->order);
+		free(index->by_time);
+		return 1;
+	}
+	index->order->height = INDEX_ORDER_LEVELS;
+	index->by_time->height = INDEX_ORDER_LEVELS;
+	index->order_seed = 0x9E3779B97F4A7C15ull; /* any non-zero value - heights only need to look random, not be unpredictable */
+	index->cap = cap;
+	index->count = 0;
+	index->used = 0;
+	index->packed = 0;
+	index->generation = 0;
+	index->expiry = NULL;
+	index->complete = 1;
+
+	return 0;
+}
+
+void index_free(struct Index *const index)
+{
+	order_free(index->order);
+	index->order = NULL;
+	order_free(index->by_time);
+	index->by_time = NULL;
+	free(index->slots);
+	index->slots = NULL;
+	index->cap = 0;
+	index->count = 0;
+	index->used = 0;
+	index->packed = 0;
+}
+
+const struct IndexEntry *index_find(const struct Index *const index, const uid_t uid, const char *const sbj)
+{
+	const size_t sbj_len = strlen(sbj);
+	if (sbj_len < 1 || sbj_len > MAX_SBJ_LEN) {
+		return NULL;
+	}
+
+	return index_probe(index, (uint32_t)uid, sbj, sbj_len, NULL);
+}
+
+/**
+ * @brief index_insert_len - index_insert, for a subject which isn't null terminated
+ * @param struct IndexEntry **const inserted - filled with the entry, for the caller to fill in the rest of. may be NULL
+ */
+static int index_insert_len(struct Index *const index, const uint32_t uid, const char *const sbj, const size_t sbj_len, const uint32_t size, const int64_t created_ns, const int64_t expires_ns, struct IndexEntry **const inserted)
+{
+	if (sbj_len < 1 || sbj_len > MAX_SBJ_LEN) {
+		return 2;
+	}
+
+	if ((index->used + 1) * 2 > index->cap) { /* mostly tombstones? rehash in place. else grow */
+		if (index_resize(index, ((index->count + 1) * 4 > index->cap ? index->cap * 2 : index->cap)) != 0) {
+			index->complete = 0;
+			return 1;
+		}
+	}
+
+	size_t slot = 0;
+	struct IndexEntry *entry = index_probe(index, uid, sbj, sbj_len, &slot);
+	if (entry == NULL) {
+		if (order_insert(index, 0, uid, 0, sbj, sbj_len) != 0) {
+			index->complete = 0;
+			return 1;
+		}
+		if (order_insert(index, 1, uid, created_ns, sbj, sbj_len) != 0) {
+			order_remove(index, 0, uid, 0, sbj, sbj_len);
+			index->complete = 0;
+			return 1;
+		}
+
+		entry = &index->slots[slot];
+		if (entry->sbj_len == 0) { /* reusing a tombstone doesn't change how full the table is */
+			++index->used;
+		}
+		++index->count;
+		entry->uid = uid;
+		entry->sbj_len = (uint8_t)sbj_len;
+		memcpy(entry->sbj, sbj, sbj_len);
+		entry->pack_offset = 0;
+		entry->read_ns = created_ns;
+		entry->timer = NULL;
+	} else {
+		if (entry->created_ns != created_ns) { /* moves within the time view */
+			if (order_insert(index, 1, uid, created_ns, sbj, sbj_len) != 0) {
+				index->complete = 0;
+				return 1;
+			}
+			order_remove(index, 1, uid, entry->created_ns, sbj, sbj_len);
+		}
+		if (entry->pack_offset != 0) { /* replaced by a plain file */
+			entry->pack_offset = 0;
+			--index->packed;
+		}
+		if (entry->expires_ns != expires_ns && index->expiry != NULL) { /* replaced - its old timer no longer applies */
+			expiry_cancel(index->expiry, entry);
+		}
+	}
+	entry->size = size;
+	entry->created_ns = created_ns;
+	entry->expires_ns = expires_ns;
+	++index->generation;
+
+	if (expires_ns != 0 && entry->timer == NULL && index->expiry != NULL) {
+		expiry_schedule(index->expiry, entry); /* on failure the note is still hidden once expired, only deleted by a later run */
+	}
+
+	if (inserted != NULL) {
+		*inserted = entry;
+	}
+
+	return 0;
+}
+
+int index_insert(struct Index *const index, const uid_t uid, const char *const sbj, const uint32_t size, const int64_t created_ns, const int64_t expires_ns)
+{
+	return index_insert_len(index, (uint32_t)uid, sbj, strlen(sbj), size, created_ns, expires_ns, NULL);
+}
+
+int index_remove(struct Index *const index, const uid_t uid, const char *const sbj)
+{
+	const size_t sbj_len = strlen(sbj);
+	if (sbj_len < 1 || sbj_len > MAX_SBJ_LEN) {
+		return 1;
+	}
+
+	struct IndexEntry *const entry = index_probe(index, (uint32_t)uid, sbj, sbj_len, NULL);
+	if (entry == NULL) {
+		return 1;
+	}
+
+	if (index->expiry != NULL) {
+		expiry_cancel(index->expiry, entry);
+	}
+	entry->sbj_len = INDEX_TOMBSTONE;
+	--index->count;
+	if (entry->pack_offset != 0) {
+		--index->packed;
+	}
+	++index->generation;
+	order_remove(index, 0, (uint32_t)uid, 0, sbj, sbj_len);
+	order_remove(index, 1, (uint32_t)uid, entry->created_ns, sbj, sbj_len);
+
+	return 0;
+}
+
+int index_set_pack(struct Index *const index, const uid_t uid, const char *const sbj, const uint64_t pack_offset)
+{
+	const size_t sbj_len = strlen(sbj);
+	struct IndexEntry *const entry = (sbj_len < 1 || sbj_len > MAX_SBJ_LEN ? NULL : index_probe(index, (uint32_t)uid, sbj, sbj_len, NULL));
+	if (entry == NULL) {
+		return 1;
+	}
+
+	index->packed += (pack_offset != 0) - (entry->pack_offset != 0);
+	entry->pack_offset = pack_offset;
+	++index->generation;
+
+	return 0;
+}
+
+const struct IndexEntry *index_touch(struct Index *const index, const uid_t uid, const char *const sbj, const int64_t now_ns)
+{
+	const size_t sbj_len = strlen(sbj);
+	struct IndexEntry *const entry = (sbj_len < 1 || sbj_len > MAX_SBJ_LEN ? NULL : index_probe(index, (uint32_t)uid, sbj, sbj_len, NULL));
+	if (entry != NULL) {
+		entry->read_ns = now_ns; /* generation left alone - a snapshot just for this would be written after every read */
+	}
+
+	return entry;
+}
+
+const struct IndexEntry *index_next(const struct Index *const index, const uid_t uid, const char *const after, const size_t after_len)
+{
+	struct IndexOrderNode *preceding[INDEX_ORDER_LEVELS];
+	order_seek(index->order, 0, (uint32_t)uid, 0, after, (after_len > MAX_SBJ_LEN ? MAX_SBJ_LEN : after_len), 1, preceding);
+
+	const struct IndexOrderNode *const node = preceding[0]->next[0];
+
+	return (node == NULL ? NULL : index_probe(index, node->uid, node->sbj, node->sbj_len, NULL));
+}
+
+size_t index_list(const struct Index *const index, const uid_t uid, const char *const after, const size_t after_len, const int64_t now_ns, char (*const sbjs)[MAX_SBJ_LEN + 1], const size_t max)
+{
+	struct IndexOrderNode *preceding[INDEX_ORDER_LEVELS];
+	order_seek(index->order, 0, (uint32_t)uid, 0, after, (after_len > MAX_SBJ_LEN ? MAX_SBJ_LEN : after_len), 1, preceding); /* just past after - everything from here on sorts after it */
+
+	size_t listed = 0;
+	for (const struct IndexOrderNode *node = preceding[0]->next[0]; node != NULL && node->uid == (uint32_t)uid && listed < max; node = node->next[0]) {
+		const struct IndexEntry *const entry = index_probe(index, node->uid, node->sbj, node->sbj_len, NULL);
+		if (entry == NULL || (entry->expires_ns != 0 && entry->expires_ns <= now_ns)) {
+			continue;
+		}
+
+		memcpy(sbjs[listed], node->sbj, node->sbj_len);
+		sbjs[listed][node->sbj_len] = '\0';
+		++listed;
+	}
+
+	return listed;
+}
+
+size_t index_since(const struct Index *const index, const uid_t uid, const int64_t from_ns, const int64_t until_ns, const int64_t after_ns, const char *const after, const size_t after_len, const int64_t now_ns, struct IndexEntry *const found, const size_t max)
+{
+	struct IndexOrderNode *preceding[INDEX_ORDER_LEVELS];
+	if (after_len > 0 && after_ns >= from_ns) { /* just past the cursor */
+		order_seek(index->by_time, 1, (uint32_t)uid, after_ns, after, (after_len > MAX_SBJ_LEN ? MAX_SBJ_LEN : after_len), 1, preceding);
+	} else { /* just before the window - no subject is empty, so nothing created at from_ns sorts before this */
+		order_seek(index->by_time, 1, (uint32_t)uid, from_ns, "", 0, 0, preceding);
+	}
+
+	size_t listed = 0;
+	for (const struct IndexOrderNode *node = preceding[0]->next[0]; node != NULL && node->uid == (uint32_t)uid && (until_ns == 0 || node->created_ns < until_ns) && listed < max; node = node->next[0]) {
+		const struct IndexEntry *const entry = index_probe(index, node->uid, node->sbj, node->sbj_len, NULL);
+		if (entry == NULL || (entry->expires_ns != 0 && entry->expires_ns <= now_ns)) {
+			continue;
+		}
+
+		found[listed++] = *entry;
+	}
+
+	return listed;
+}
+
+/**
+ * @brief snapshot_uid - binary searches the snapshot's uid table
+ * @param const struct ScanContext *const scan - context holding the mapped snapshot
+ * @param const uint32_t uid - uid to look for
+ * @param struct SnapshotUid *const found - filled with the matching record
+ * @return size_t - position in the uid table, or uid_count if absent
+ */
+static size_t snapshot_uid(const struct ScanContext *const scan, const uint32_t uid, struct SnapshotUid *const found)
+{
+	const uint8_t *const table = scan->snapshot + sizeof(struct SnapshotHeader);
+	size_t low = 0, high = (size_t)scan->uid_count;
+
+	while (low < high) {
+		const size_t mid = low + (high - low) / 2;
+		memcpy(found, table + mid * sizeof(*found), sizeof(*found)); /* copied out, the mapping carries no alignment promises */
+		if (found->uid == uid) {
+			return mid;
+		} else if (found->uid < uid) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return (size_t)scan->uid_count;
+}
+
+/**
+ * @brief PackScan (struct) - state carried across pack_for_each's calls to scan_pack_record
+ */
+struct PackScan {
+	struct Index *index;
+
+	uint32_t uid;
+
+	int uid_dir_fd;
+};
+
+/**
+ * @brief scan_pack_record - pack_for_each visitor. indexes one packed note, unless a plain file (or a later record) has it already
+ * @return int - zero is success, non-zero is failure
+ * 1 is error allocating
+ */
+static int scan_pack_record(const struct PackRecord *const record, void *const ctx)
+{
+	struct PackScan *const scan = ctx;
+
+	struct IndexEntry *entry = index_probe(scan->index, scan->uid, record->sbj, record->sbj_len, NULL);
+	if (entry != NULL && entry->pack_offset == 0) { /* the file wins - this record is left over from a crash part way through packing or unpacking */
+		pack_kill(scan->uid_dir_fd, record->offset);
+		return 0;
+	} else if (entry != NULL) { /* records are visited oldest first, so the earlier one is the stale one */
+		pack_kill(scan->uid_dir_fd, entry->pack_offset);
+	}
+
+	if (index_insert_len(scan->index, scan->uid, record->sbj, record->sbj_len, record->raw_len, record->created_ns, 0, &entry) == 1) {
+		return 1;
+	}
+	entry->pack_offset = record->offset;
+	++scan->index->packed;
+
+	return 0;
+}
+
+/**
+ * @brief scan_uid_dir - indexes one user's notes from disk (readdir & stat each)
+ * @param struct Index *const index - index to fill
+ * @param const uint32_t uid - owner
+ * @param const int uid_dir_fd - directory handle of that user's notes
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading directory or allocating
+ */
+static int scan_uid_dir(struct Index *const index, const uint32_t uid, const int uid_dir_fd)
+{
+	const int scan_fd = dup(uid_dir_fd); /* closedir will close the handle it's given, so give it its own */
+	DIR *const dir = (scan_fd == -1 ? NULL : fdopendir(scan_fd));
+	if (dir == NULL) {
+		fprintf(stderr, "Error reading notes directory of uid %u (errno %d: %s)\n", uid, errno, strerror(errno));
+		if (scan_fd != -1) {
+			close(scan_fd);
+		}
+		return 1;
+	}
+	rewinddir(dir);
+
+	int exit_code = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		const size_t name_len = strlen(entry->d_name);
+		if (entry->d_name[0] == '.' || name_len > MAX_SBJ_LEN || (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN)) { /* subjects can't contain '.', so that covers "." & ".." too */
+			continue;
+		}
+
+		struct stat statbuf;
+		if (fstatat(uid_dir_fd, entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(statbuf.st_mode)) {
+			continue;
+		}
+
+		int64_t expires_ns = 0;
+		if (statbuf.st_mode & S_ISVTX) { /* marks a note carrying an expiry - only those are worth opening */
+			const int note_fd = openat(uid_dir_fd, entry->d_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+			if (note_fd != -1) {
+				if (fgetxattr(note_fd, STORE_EXPIRY_XATTR, &expires_ns, sizeof(expires_ns)) == sizeof(expires_ns)) {
+					expires_ns = (int64_t)le64toh((uint64_t)expires_ns);
+				} else {
+					expires_ns = 0;
+				}
+				close(note_fd);
+			}
+		}
+
+		const int64_t mtime_ns = (int64_t)statbuf.st_mtim.tv_sec * 1000000000 + statbuf.st_mtim.tv_nsec;
+		const int64_t atime_ns = (int64_t)statbuf.st_atim.tv_sec * 1000000000 + statbuf.st_atim.tv_nsec;
+		struct IndexEntry *inserted;
+		if (index_insert_len(index, uid, entry->d_name, name_len, (uint32_t)statbuf.st_size, mtime_ns, expires_ns, &inserted) == 1) {
+			exit_code = 1;
+			break;
+		}
+		inserted->read_ns = (atime_ns > mtime_ns ? atime_ns : mtime_ns); /* as good a guess as any - atime may well not be kept up to date */
+	}
+	closedir(dir);
+
+	if (exit_code == 0) { /* plain files first, so they can shadow any record left over from a crash */
+		struct PackScan pack_scan = { .index = index, .uid = uid, .uid_dir_fd = uid_dir_fd };
+		const int walked = pack_for_each(uid_dir_fd, scan_pack_record, &pack_scan);
+		if (walked == 1) {
+			exit_code = 1;
+		} else if (walked == -1) { /* notes after the damage can't be reached, so the index can't claim to know them all */
+			index->complete = 0;
+		}
+	}
+
+	return exit_code;
+}
+
+/**
+ * @brief build_uid - store_for_each_uid visitor. indexes one user, from the snapshot if it's still valid for them, else from disk
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the store or allocating
+ */
+static int build_uid(const uid_t uid, const int uid_dir_fd, void *const ctx)
+{
+	struct ScanContext *const scan = ctx;
+
+	struct stat statbuf;
+	if (fstat(uid_dir_fd, &statbuf) != 0) {
+		fprintf(stderr, "Error inspecting notes directory of uid %u (errno %d: %s)\n", (unsigned int)uid, errno, strerror(errno));
+		return 1;
+	}
+
+	struct SnapshotUid record;
+	const size_t pos = (scan->snapshot != NULL ? snapshot_uid(scan, (uint32_t)uid, &record) : 0);
+	const int reusable = (
+		scan->snapshot != NULL && pos < scan->uid_count
+		&&
+		record.mtime_sec == (int64_t)statbuf.st_mtim.tv_sec && record.mtime_nsec == (int64_t)statbuf.st_mtim.tv_nsec /* nothing added or removed since */
+		&&
+		(statbuf.st_mtim.tv_sec < scan->snapshot_mtime.tv_sec || (statbuf.st_mtim.tv_sec == scan->snapshot_mtime.tv_sec && statbuf.st_mtim.tv_nsec < scan->snapshot_mtime.tv_nsec)) /* a change in the snapshot's own tick could share its mtime */
+	);
+
+	if (!reusable) {
+		++scan->rescanned_uids;
+		return scan_uid_dir(scan->index, (uint32_t)uid, uid_dir_fd);
+	}
+
+	++scan->reused_uids;
+	const uint8_t *note_pos = scan->snapshot + scan->note_offsets[pos];
+	for (uint32_t i = 0; i < record.note_count; ++i, note_pos += sizeof(struct SnapshotNote)) {
+		struct SnapshotNote note;
+		memcpy(&note, note_pos, sizeof(note));
+		struct IndexEntry *inserted;
+		const int ret = index_insert_len(scan->index, (uint32_t)uid, note.sbj, note.sbj_len, note.size, note.created_ns, note.expires_ns, &inserted);
+		if (ret == 1) {
+			return 1;
+		} else if (ret == 2) { /* a bad subject is just skipped */
+			continue;
+		}
+		inserted->read_ns = note.read_ns;
+		inserted->pack_offset = note.pack_offset;
+		scan->index->packed += (note.pack_offset != 0);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief snapshot_map - maps & validates a snapshot
+ * @param const struct Store *const store - opened store
+ * @param const char *const snapshot_name - snapshot filename
+ * @param struct ScanContext *const scan - snapshot, uid_count, note_offsets & snapshot_mtime are filled in
+ * @param size_t *const map_len - filled with length of mapping
+ * @return int - zero is success, non-zero is failure
+ * 1 is no snapshot, 2 is snapshot unusable (corrupt, wrong version, etc.)
+ */
+static int snapshot_map(const struct Store *const store, const char *const snapshot_name, struct ScanContext *const scan, size_t *const map_len)
+{
+	const int fd = openat(store->dir_fd, snapshot_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1) {
+		return 1;
+	}
+
+	struct stat statbuf;
+	if (fstat(fd, &statbuf) != 0 || !S_ISREG(statbuf.st_mode) || (size_t)statbuf.st_size < sizeof(struct SnapshotHeader)) {
+		close(fd);
+		return 2;
+	}
+
+	*map_len = (size_t)statbuf.st_size;
+	void *const map = mmap(NULL, *map_len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0); /* populated up front - every byte is about to be checksummed anyway */
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Error mapping index snapshot (errno %d: %s)\n", errno, strerror(errno));
+		return 2;
+	}
+	scan->snapshot = map;
+	scan->snapshot_mtime = statbuf.st_mtim;
+
+	struct SnapshotHeader header;
+	memcpy(&header, map, sizeof(header));
+	const uint64_t payload_len = *map_len - sizeof(header);
+	if (
+		header.magic != INDEX_SNAPSHOT_MAGIC || header.version != INDEX_SNAPSHOT_VERSION || header.payload_len != payload_len
+		||
+		header.uid_count > payload_len / sizeof(struct SnapshotUid) || header.note_count > payload_len / sizeof(struct SnapshotNote)
+		||
+		header.uid_count * sizeof(struct SnapshotUid) + header.note_count * sizeof(struct SnapshotNote) != payload_len
+		||
+		checksum(scan->snapshot + sizeof(header), payload_len) != header.checksum
+	) {
+		fprintf(stderr, "Index snapshot is corrupt or from another version - ignoring it\n");
+		goto unusable;
+	}
+
+	uint64_t *const offsets = malloc((header.uid_count > 0 ? header.uid_count : 1) * sizeof(*offsets));
+	if (offsets == NULL) {
+		fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+		goto unusable;
+	}
+
+	/* work out where each user's notes start, checking the uid table is sorted & its counts add up */
+	uint64_t offset = sizeof(header) + header.uid_count * sizeof(struct SnapshotUid);
+	uint64_t notes_seen = 0;
+	for (uint64_t i = 0; i < header.uid_count; ++i) {
+		struct SnapshotUid record;
+		memcpy(&record, scan->snapshot + sizeof(header) + i * sizeof(record), sizeof(record));
+
+		struct SnapshotUid previous;
+		if (i > 0) {
+			memcpy(&previous, scan->snapshot + sizeof(header) + (i - 1) * sizeof(previous), sizeof(previous));
+		}
+		if ((i > 0 && previous.uid >= record.uid) || record.note_count > header.note_count - notes_seen) {
+			fprintf(stderr, "Index snapshot's uid table is inconsistent - ignoring it\n");
+			free(offsets);
+			goto unusable;
+		}
+
+		offsets[i] = offset;
+		offset += (uint64_t)record.note_count * sizeof(struct SnapshotNote);
+		notes_seen += record.note_count;
+	}
+
+	scan->note_offsets = offsets;
+	scan->uid_count = header.uid_count;
+	return 0;
+
+unusable:
+	munmap(map, *map_len);
+	scan->snapshot = NULL;
+	return 2;
+}
+
+int index_build(struct Index *const index, const struct Store *const store, const char *const snapshot_name)
+{
+	struct ScanContext scan = { .index = index, .snapshot = NULL, .note_offsets = NULL, .uid_count = 0, .reused_uids = 0, .rescanned_uids = 0 };
+	size_t map_len = 0;
+
+	const int mapped = snapshot_map(store, snapshot_name, &scan, &map_len);
+	if (mapped == 0) {
+		struct SnapshotHeader header;
+		memcpy(&header, scan.snapshot, sizeof(header));
+		size_t cap = index->cap;
+		while (cap < header.note_count * 2) {
+			cap *= 2;
+		}
+		if (cap != index->cap) {
+			index_resize(index, cap); /* size for the snapshot up front rather than doubling all the way there. failure just means growing later */
+		}
+	} else if (mapped == 1) {
+		fprintf(stdout, "No index snapshot - scanning every note\n");
+	}
+
+	const int walked = store_for_each_uid(store, build_uid, &scan);
+
+	if (scan.snapshot != NULL) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-qual"
+		munmap((void*)scan.snapshot, map_len);
+		free((void*)scan.note_offsets);
+#pragma GCC diagnostic pop
+	}
+
+	if (walked != 0) {
+		fprintf(stderr, "Error building index of notes\n");
+		return 1;
+	}
+
+	fprintf(stdout, "Indexed %lu note(s) - %lu user(s) from snapshot, %lu rescanned\n", (unsigned long)index->count, (unsigned long)scan.reused_uids, (unsigned long)scan.rescanned_uids);
+	return 0;
+}
+
+/**
+ * @brief compare_entries - qsort comparator, ordering IndexEntry pointers by uid
+ */
+static int compare_entries(const void *const a, const void *const b)
+{
+	const uint32_t uid_a = (*(const struct IndexEntry *const *)a)->uid;
+	const uint32_t uid_b = (*(const struct IndexEntry *const *)b)->uid;
+
+	return (uid_a > uid_b) - (uid_a < uid_b);
+}
+
+int index_snapshot(const struct Index *const index, const struct Store *const store, const char *const snapshot_name)
+{
+	if (!index->complete) {
+		fprintf(stderr, "Index is incomplete - not writing a snapshot\n");
+		return 1;
+	}
+
+	/* group entries by owner */
+	const struct IndexEntry **const sorted = malloc((index->count > 0 ? index->count : 1) * sizeof(*sorted));
+	if (sorted == NULL) {
+		fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	size_t sorted_count = 0;
+	for (size_t i = 0; i < index->cap; ++i) {
+		if (index->slots[i].sbj_len != 0 && index->slots[i].sbj_len != INDEX_TOMBSTONE) {
+			sorted[sorted_count++] = &index->slots[i];
+		}
+	}
+	qsort(sorted, sorted_count, sizeof(*sorted), compare_entries);
+
+	size_t uid_count = 0;
+	for (size_t i = 0; i < sorted_count; ++i) {
+		if (i == 0 || sorted[i]->uid != sorted[i - 1]->uid) {
+			++uid_count;
+		}
+	}
+
+	const size_t buf_len = sizeof(struct SnapshotHeader) + uid_count * sizeof(struct SnapshotUid) + sorted_count * sizeof(struct SnapshotNote);
+	uint8_t *const buf = calloc(1, buf_len); /* zeroed, so padding is deterministic for the checksum */
+	if (buf == NULL) {
+		fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+		free(sorted);
+		return 1;
+	}
+
+	int exit_code = 0;
+	uint8_t *uid_pos = buf + sizeof(struct SnapshotHeader);
+	uint8_t *note_pos = uid_pos + uid_count * sizeof(struct SnapshotUid);
+	size_t uids_written = 0, notes_written = 0;
+
+	for (size_t start = 0; start < sorted_count;) {
+		const uint32_t uid = sorted[start]->uid;
+		size_t end = start;
+		while (end < sorted_count && sorted[end]->uid == uid) {
+			++end;
+		}
+
+		/* the directory's mtime is what decides whether these entries are trusted next startup */
+		struct stat statbuf;
+		const int uid_dir_fd = store_uid_dir(store, (uid_t)uid, 0);
+		const int have_mtime = (uid_dir_fd != -1 && fstat(uid_dir_fd, &statbuf) == 0);
+		if (uid_dir_fd != -1) {
+			close(uid_dir_fd);
+		}
+
+		if (have_mtime) { /* else leave this user out - they'll just be rescanned */
+			struct SnapshotUid record = { .uid = uid, .note_count = (uint32_t)(end - start), .mtime_sec = (int64_t)statbuf.st_mtim.tv_sec, .mtime_nsec = (int64_t)statbuf.st_mtim.tv_nsec };
+			memcpy(uid_pos, &record, sizeof(record));
+			uid_pos += sizeof(record);
+			++uids_written;
+
+			for (size_t i = start; i < end; ++i) {
+				struct SnapshotNote note;
+				memset(&note, '\0', sizeof(note));
+				note.created_ns = sorted[i]->created_ns;
+				note.expires_ns = sorted[i]->expires_ns;
+				note.pack_offset = sorted[i]->pack_offset;
+				note.read_ns = sorted[i]->read_ns;
+				note.size = sorted[i]->size;
+				note.sbj_len = sorted[i]->sbj_len;
+				memcpy(note.sbj, sorted[i]->sbj, sorted[i]->sbj_len);
+				memcpy(note_pos, &note, sizeof(note));
+				note_pos += sizeof(note);
+				++notes_written;
+			}
+		}
+
+		start = end;
+	}
+
+	if (uids_written != uid_count) { /* some users left out - close the gap between the uid table & the notes */
+		uint8_t *const notes_start = buf + sizeof(struct SnapshotHeader) + uids_written * sizeof(struct SnapshotUid);
+		memmove(notes_start, buf + sizeof(struct SnapshotHeader) + uid_count * sizeof(struct SnapshotUid), notes_written * sizeof(struct SnapshotNote));
+	}
+
+	const size_t payload_len = uids_written * sizeof(struct SnapshotUid) + notes_written * sizeof(struct SnapshotNote);
+	struct SnapshotHeader header = { .magic = INDEX_SNAPSHOT_MAGIC, .version = INDEX_SNAPSHOT_VERSION, .payload_len = payload_len, .checksum = checksum(buf + sizeof(header), payload_len), .uid_count = uids_written, .note_count = notes_written };
+	memcpy(buf, &header, sizeof(header));
+
+	/* write alongside, then rename over - a crash mid-write leaves the old snapshot (or none), never a torn one */
+	char tmp_name[NAME_MAX + 1];
+	if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", snapshot_name) >= (int)sizeof(tmp_name)) {
+		fprintf(stderr, "Index snapshot name is too long\n");
+		exit_code = 2;
+		goto end;
+	}
+
+	const int fd = openat(store->dir_fd, tmp_name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, STORE_NOTE_PERMISSIONS);
+	if (fd == -1) {
+		fprintf(stderr, "Error creating index snapshot (errno %d: %s)\n", errno, strerror(errno));
+		exit_code = 2;
+		goto end;
+	}
+
+	if (write_all(fd, buf, sizeof(header) + payload_len) != 0 || fsync(fd) != 0) {
+		fprintf(stderr, "Error writing index snapshot (errno %d: %s)\n", errno, strerror(errno));
+		close(fd);
+		unlinkat(store->dir_fd, tmp_name, 0);
+		exit_code = 2;
+		goto end;
+	}
+	close(fd);
+
+	if (renameat(store->dir_fd, tmp_name, store->dir_fd, snapshot_name) != 0) {
+		fprintf(stderr, "Error replacing index snapshot (errno %d: %s)\n", errno, strerror(errno));
+		unlinkat(store->dir_fd, tmp_name, 0);
+		exit_code = 2;
+		goto end;
+	}
+
+	fprintf(stdout, "Wrote index snapshot of %lu note(s)\n", (unsigned long)notes_written);
+
+end:
+	free(buf);
+	free(sorted);
+
+	return exit_code;
+}
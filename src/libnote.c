@@ -0,0 +1,719 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <endian.h>
+#include <sys/un.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "request.h"
+#include "subject.h"
+#include "response.h"
+#include "ring.h"
+#include "fd_transfer.h"
+#include "libnote.h"
+
+/**
+ * @brief Definitions of the embeddable client library (libnote)
+ */
+
+#define RING_LIVENESS_CHECK_MS 1000 /* whilst waiting on the ring, how often to check the server hasn't gone away */
+
+struct NoteHandle {
+	int sock; /* connection to server. also carries ring negotiation */
+
+	int has_ring; /* boolean. packets travel through ring rather than sock */
+
+	struct Ring ring;
+
+	uint64_t next_id; /* id of the next request sent. responses are matched back to requests by it, not by order */
+};
+
+/**
+ * @brief handle_request - starts a v2 request with the handle's next id
+ * @param struct NoteHandle *const handle - open handle
+ * @param struct Request *const req - request to fill. cmd, subject, extra data & any time to live are the caller's to set
+ */
+static void handle_request(struct NoteHandle *const handle, struct Request *const req)
+{
+	req->version = PROTOCOL_V2;
+	req->flags = 0;
+	req->ttl_s = 0;
+	req->id = handle->next_id++;
+}
+
+/**
+ * @brief handle_negotiate_ring - sets up a shared-memory ring with the server over the handle's socket
+ * @param struct NoteHandle *const handle - connected handle
+ * @return int - zero is success, non-zero is failure
+ * 1 is error creating ring, 2 is error negotiating it
+ */
+static int handle_negotiate_ring(struct NoteHandle *const handle)
+{
+	if (ring_create(&handle->ring, RING_DEFAULT_CAPACITY) != 0) {
+		return 1;
+	}
+
+	struct Request negotiation;
+	handle_request(handle, &negotiation);
+	negotiation.cmd = RING;
+	negotiation.sbj_len = sizeof("ring") - 1; /* subject is mandatory, but meaningless here */
+	memcpy(negotiation.sbj_content, "ring", negotiation.sbj_len);
+	negotiation.extra_data_len = 0;
+	negotiation.extra_data_content = NULL;
+
+	const int fds[] = { handle->ring.memfd, handle->ring.doorbells[RING_REQUESTS], handle->ring.doorbells[RING_RESPONSES] };
+	struct Response ack;
+	ack.extra_data_content = NULL;
+
+	if (request_send(&negotiation, handle->sock) != 0 || fd_send(handle->sock, fds, sizeof(fds) / sizeof(fds[0])) != 0 || response_recv(&ack, handle->sock) != 0 || ack.id != negotiation.id || ack.status != OK) {
+		fprintf(stderr, "Server refused shared-memory ring\n");
+		ring_destroy(&handle->ring);
+		return 2;
+	}
+
+	handle->has_ring = 1;
+	return 0;
+}
+
+struct NoteHandle *note_open(const char *const socket_path, const int flags)
+{
+	if (socket_path == NULL) {
+		fprintf(stderr, "Socket path cannot be NULL\n");
+		return NULL;
+	}
+
+	struct sockaddr_un address; /* unix-derived domain sockets address */
+	address.sun_family = AF_UNIX;
+
+	if (sizeof(address.sun_path) < strlen(socket_path) + 1) { /* different OSs differ for this val. linux is 108. +1 is because strlen is len - null terminator */
+		fprintf(stderr, "IPC socket's name is too long (%s)\n", socket_path);
+		return NULL;
+	}
+	memset(address.sun_path, '\0', sizeof(address.sun_path));
+	strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+
+	struct NoteHandle *const handle = malloc(sizeof(*handle));
+	if (handle == NULL) {
+		fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+		return NULL;
+	}
+	handle->has_ring = 0;
+	handle->next_id = 1;
+
+	handle->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (handle->sock == -1) {
+		fprintf(stderr, "Failure to create socket (errno %d: %s)\n", errno, strerror(errno));
+		free(handle);
+		return NULL;
+	}
+
+	if (connect(handle->sock, (struct sockaddr*)&address, sizeof(address)) != 0) {
+		fprintf(stderr, "Failure to connect socket to end-point (errno %d: %s)\n", errno, strerror(errno));
+		note_close(handle);
+		return NULL;
+	}
+
+	if ((flags & NOTE_OPEN_RING) && handle_negotiate_ring(handle) != 0) {
+		note_close(handle);
+		return NULL;
+	}
+
+	return handle;
+}
+
+int note_close(struct NoteHandle *const handle)
+{
+	if (handle == NULL) {
+		return 0;
+	}
+
+	int exit_code = 0;
+	if (handle->has_ring && ring_destroy(&handle->ring) != 0) {
+		exit_code = 1;
+	}
+
+	if (handle->sock != -1 && close(handle->sock) != 0) { /* server ends our session (& ring) when it sees this */
+		fprintf(stderr, "Error closing socket %d (errno %d: %s)\n", handle->sock, errno, strerror(errno));
+		exit_code = 1;
+	}
+
+	free(handle);
+	return exit_code;
+}
+
+/**
+ * @brief handle_send - queues a request through whichever transport the handle uses
+ * over the ring, the consumer isn't woken until handle_flush
+ * @param struct NoteHandle *const handle - open handle
+ * @param const struct Request *const req - populated request
+ * @return int - zero is success, non-zero is failure
+ * 1 is error sending
+ */
+static int handle_send(struct NoteHandle *const handle, const struct Request *const req)
+{
+	if (!handle->has_ring) {
+		return (request_send(req, handle->sock) != 0 ? 1 : 0);
+	}
+
+	uint8_t encoded[MAX_REQUEST_LEN];
+	size_t encoded_len;
+	if (request_encode(req, encoded, sizeof(encoded), &encoded_len) != 0 || ring_push(&handle->ring, RING_REQUESTS, encoded, (uint32_t)encoded_len) != 0) { /* batch windows are sized so the queue can't be full */
+		fprintf(stderr, "Error pushing request into ring\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief handle_flush - wakes the server for everything queued by handle_send
+ * @param struct NoteHandle *const handle - open handle
+ * @return int - zero is success, non-zero is failure
+ * 1 is error signalling
+ */
+static int handle_flush(struct NoteHandle *const handle)
+{
+	return (handle->has_ring ? ring_notify(&handle->ring, RING_REQUESTS) : 0);
+}
+
+/**
+ * @brief handle_recv - receives one response, whichever of a window's requests it answers, & fills in that operation's result
+ * Responses may come back in any order - each is matched to its operation by id, & only then is its data read into that operation's buffer
+ * @param struct NoteHandle *const handle - open handle
+ * @param struct NoteOp *const ops - operations of the window. those awaiting a response have result -1
+ * @param const size_t op_count - number of operations in window
+ * @param const uint64_t base_id - id the window's first operation was sent with. the rest follow on consecutively
+ * @return int - zero is success, non-zero is failure
+ * 1 is error receiving or a response answering nothing awaited (handle unusable), 4 is the server turned the whole connection away (too many open - handle unusable)
+ */
+static int handle_recv(struct NoteHandle *const handle, struct NoteOp *const ops, const size_t op_count, const uint64_t base_id)
+{
+	struct Response resp;
+	resp.extra_data_content = NULL;
+	uint8_t bounce[MAX_EXTRA_DATA_LEN]; /* ring only - which buffer the data belongs in isn't known until the header has been looked at */
+
+	if (!handle->has_ring) {
+		if (response_recv_header(&resp, handle->sock) != 0) {
+			return 1;
+		}
+	} else {
+		uint8_t header[RESPONSE_V2_HEADER_LEN];
+		uint32_t msg_len;
+		int popped;
+
+		while ((popped = ring_pop_split(&handle->ring, RING_RESPONSES, header, sizeof(header), bounce, sizeof(bounce), &msg_len)) == 1) { /* nothing yet - sleep on the doorbell */
+			const int waited = ring_wait(&handle->ring, RING_RESPONSES, RING_LIVENESS_CHECK_MS);
+			if (waited == 1) {
+				return 1;
+			} else if (waited == 2) { /* quiet for a while - make sure there's still someone at the other end */
+				struct pollfd pfd = { .fd = handle->sock, .events = POLLIN, .revents = 0 };
+				if (poll(&pfd, 1, 0) != 0) { /* server never writes to the socket mid-session, so anything here means it has hung up */
+					fprintf(stderr, "Server closed connection whilst awaiting ring response\n");
+					return 1;
+				}
+			}
+		}
+
+		if (popped != 0 || msg_len < RESPONSE_V2_HEADER_LEN || response_decode_header(&resp, header) != 0 || msg_len - RESPONSE_V2_HEADER_LEN != resp.extra_data_len) {
+			return 1;
+		}
+	}
+
+	if (resp.version != PROTOCOL_V2) { /* only ever sent before the server knows what we speak - when it has no room for us */
+		if (resp.status == BUSY) {
+			fprintf(stderr, "Server has too many connections open\n");
+			return 4;
+		}
+		return 1;
+	}
+
+	if (resp.id < base_id || resp.id - base_id >= op_count || ops[resp.id - base_id].result != -1 || resp.status == DATA) {
+		fprintf(stderr, "Response (id %llu) answers no request awaiting one\n", (unsigned long long)resp.id);
+		return 1;
+	}
+	struct NoteOp *const op = &ops[resp.id - base_id];
+
+	uint64_t note_len = 0;
+	void *dest = NULL; /* where the response's data belongs */
+	uint32_t dest_len = 0;
+	if (op->cmd == GET || op->cmd == GET_RANGE || op->cmd == LIST || op->cmd == SINCE) {
+		dest = op->buf;
+		dest_len = op->buf_len;
+	} else if (op->cmd == APPEND) {
+		dest = &note_len;
+		dest_len = sizeof(note_len);
+	}
+
+	int too_small = 0;
+	if (!handle->has_ring) {
+		resp.extra_data_content = dest;
+		const int ret = response_recv_extra(&resp, dest_len, handle->sock); /* straight into the caller's buffer */
+		if (ret == 1) {
+			return 1;
+		}
+		too_small = (ret == 2);
+	} else if (resp.extra_data_len > 0) {
+		too_small = (resp.extra_data_len > dest_len);
+		if (!too_small) {
+			memcpy(dest, bounce, resp.extra_data_len);
+		}
+	}
+
+	if (resp.status == BUSY) {
+		op->result = 4;
+	} else if (resp.status != OK) {
+		op->result = 2;
+	} else if (op->cmd == APPEND) {
+		op->note_len = le64toh(note_len);
+		op->result = (resp.extra_data_len == sizeof(note_len) ? 0 : 1);
+	} else {
+		if (op->cmd == GET || op->cmd == GET_RANGE || op->cmd == LIST || op->cmd == SINCE) {
+			op->result_len = resp.extra_data_len;
+		}
+		op->result = (too_small ? 3 : 0);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief op_request - builds the request packet for an operation
+ * @param const struct NoteOp *const op - operation
+ * @param struct Request *const req - request to fill
+ * @param uint8_t *const range - REQUEST_RANGE_LEN bytes to encode a GET_RANGE's range into. must outlive req
+ * @return int - zero is success, non-zero is failure
+ * 3 is invalid arguments
+ */
+static int op_request(const struct NoteOp *const op, struct Request *const req, uint8_t *const range)
+{
+	if (op->sbj == NULL || (op->cmd != ADD && op->cmd != GET && op->cmd != REMOVE && op->cmd != GET_RANGE && op->cmd != APPEND && op->cmd != LIST && op->cmd != SINCE)) {
+		fprintf(stderr, "Operation needs a subject & one of ADD, GET, REMOVE, GET_RANGE, APPEND, LIST or SINCE\n");
+		return 3;
+	}
+
+	const size_t sbj_len = strlen(op->sbj);
+	if (sbj_len < 1 || sbj_len > MAX_SBJ_LEN) {
+		fprintf(stderr, "Subject exceeds acceptable length (maximum %d, was given %lu)\n", MAX_SBJ_LEN, (unsigned long)sbj_len);
+		return 3;
+	}
+
+	size_t sbj_offset, sbj_trimmed_len;
+	if (subject_check((const uint8_t*)op->sbj, sbj_len, &sbj_offset, &sbj_trimmed_len) != 0) { /* the server would only refuse it - sent as given all the same, as the server does its own trimming */
+		return 3;
+	}
+
+	const uint32_t max_content_len = (op->cmd == ADD && op->ttl_s != 0 ? MAX_EXTRA_DATA_LEN - REQUEST_TTL_LEN : MAX_EXTRA_DATA_LEN); /* the time to live shares the extra data */
+	if ((op->cmd == ADD || op->cmd == APPEND) && (op->content_len > max_content_len || (op->content_len > 0 && op->content == NULL))) {
+		fprintf(stderr, "Note content must be 0 to %u bytes\n", (unsigned int)max_content_len);
+		return 3;
+	}
+
+	if (op->cmd == LIST && (op->content_len > LIST_CURSOR_MAX_LEN || (op->content_len > 0 && op->content == NULL))) {
+		fprintf(stderr, "Listing cursor must be 0 to %d bytes\n", LIST_CURSOR_MAX_LEN);
+		return 3;
+	}
+
+	if (op->cmd == SINCE && (op->content_len < REQUEST_SINCE_LEN || op->content_len > REQUEST_SINCE_LEN + SINCE_CURSOR_MAX_LEN || op->content == NULL)) {
+		fprintf(stderr, "Time window & cursor must be %d to %d bytes\n", REQUEST_SINCE_LEN, REQUEST_SINCE_LEN + SINCE_CURSOR_MAX_LEN);
+		return 3;
+	}
+
+	if ((op->cmd == GET || op->cmd == GET_RANGE || op->cmd == LIST || op->cmd == SINCE) && op->buf == NULL) {
+		fprintf(stderr, "Reading a note needs a buffer\n");
+		return 3;
+	}
+
+	req->cmd = op->cmd;
+	req->sbj_len = (uint32_t)sbj_len;
+	memcpy(req->sbj_content, op->sbj, sbj_len);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-qual"
+	req->extra_data_content = (op->cmd == ADD || op->cmd == APPEND || op->cmd == LIST || op->cmd == SINCE ? (void*)op->content : NULL); /* request_send only ever reads through this */
+#pragma GCC diagnostic pop
+	req->extra_data_len = (op->cmd == ADD || op->cmd == APPEND || op->cmd == LIST || op->cmd == SINCE ? op->content_len : 0);
+	req->ttl_s = (op->cmd == ADD ? op->ttl_s : 0);
+
+	if (op->cmd == GET_RANGE) {
+		const uint64_t offset = htole64(op->offset);
+		const uint32_t length = htole32(op->buf_len);
+		memcpy(range, &offset, sizeof(offset));
+		memcpy(range + sizeof(offset), &length, sizeof(length));
+		req->extra_data_content = range;
+		req->extra_data_len = REQUEST_RANGE_LEN;
+	}
+
+	return 0;
+}
+
+int note_batch(struct NoteHandle *const handle, struct NoteOp *const ops, const size_t op_count)
+{
+	if (handle == NULL || (ops == NULL && op_count > 0)) {
+		fprintf(stderr, "Handle & operations cannot be NULL\n");
+		return 3;
+	}
+
+	size_t window = NOTE_BATCH_WINDOW;
+	if (handle->has_ring) { /* every response in a window must fit in the response queue at once, else the server stalls */
+		const size_t ring_window = handle->ring.capacity / (2 * ring_message_space(MAX_RESPONSE_LEN));
+		window = (ring_window < window ? ring_window : window);
+	}
+
+	for (size_t i = 0; i < op_count; ++i) {
+		ops[i].result = 1;
+		ops[i].result_len = 0;
+		ops[i].note_len = 0;
+	}
+
+	int exit_code = 0;
+	int broken_code = 1;
+	for (size_t start = 0; start < op_count; start += window) {
+		const size_t end = (start + window < op_count ? start + window : op_count);
+		const uint64_t base_id = handle->next_id; /* op i of the window goes out as base_id + (i - start) */
+		size_t awaiting = 0;
+
+		for (size_t i = start; i < end; ++i) { /* send the whole window... */
+			struct Request req;
+			uint8_t range[REQUEST_RANGE_LEN];
+			handle_request(handle, &req);
+			ops[i].result = op_request(&ops[i], &req, range);
+			if (ops[i].result != 0) {
+				continue;
+			}
+
+			ops[i].result = -1; /* marks as awaiting response */
+			++awaiting;
+			if (handle_send(handle, &req) != 0) {
+				goto broken;
+			}
+		}
+
+		if (handle_flush(handle) != 0) {
+			goto broken;
+		}
+
+		for (; awaiting > 0; --awaiting) { /* ... then collect its responses, in whatever order they come back */
+			const int ret = handle_recv(handle, ops + start, end - start, base_id);
+			if (ret != 0) {
+				broken_code = ret;
+				goto broken;
+			}
+		}
+
+		for (size_t i = start; i < end && exit_code == 0; ++i) {
+			exit_code = ops[i].result;
+		}
+	}
+
+	return exit_code;
+
+broken: /* connection is out of step (or was turned away) - nothing more can be trusted from it */
+	for (size_t i = 0; i < op_count; ++i) {
+		if (ops[i].result == -1) {
+			ops[i].result = broken_code;
+		}
+	}
+	return broken_code;
+}
+
+int note_add(struct NoteHandle *const handle, const char *const sbj, const void *const content, const uint32_t content_len)
+{
+	struct NoteOp op;
+	memset(&op, '\0', sizeof(op));
+	op.cmd = ADD;
+	op.sbj = sbj;
+	op.content = content;
+	op.content_len = content_len;
+
+	return note_batch(handle, &op, 1);
+}
+
+int note_add_ttl(struct NoteHandle *const handle, const char *const sbj, const void *const content, const uint32_t content_len, const uint32_t ttl_s)
+{
+	struct NoteOp op;
+	memset(&op, '\0', sizeof(op));
+	op.cmd = ADD;
+	op.sbj = sbj;
+	op.content = content;
+	op.content_len = content_len;
+	op.ttl_s = ttl_s;
+
+	return note_batch(handle, &op, 1);
+}
+
+int note_get(struct NoteHandle *const handle, const char *const sbj, void *const buf, const uint32_t buf_len, uint32_t *const content_len)
+{
+	struct NoteOp op;
+	memset(&op, '\0', sizeof(op));
+	op.cmd = GET;
+	op.sbj = sbj;
+	op.buf = buf;
+	op.buf_len = buf_len;
+
+	int ret = note_batch(handle, &op, 1);
+	uint32_t got = op.result_len;
+	uint32_t page = MAX_EXTRA_DATA_LEN; /* most a response carries - a full page means there may be more */
+	while (ret == 0 && op.result_len == page) { /* a note grown past one response by APPEND - fetch the rest until a page comes back short */
+		uint8_t probe;
+		const int full = (got == buf_len); /* no room left - just find out whether there's more */
+		memset(&op, '\0', sizeof(op));
+		op.cmd = GET_RANGE;
+		op.sbj = sbj;
+		op.offset = got;
+		op.buf = (full ? (void*)&probe : (uint8_t*)buf + got);
+		op.buf_len = (full ? 1 : buf_len - got);
+		page = (op.buf_len < MAX_EXTRA_DATA_LEN ? op.buf_len : MAX_EXTRA_DATA_LEN);
+
+		ret = note_batch(handle, &op, 1);
+		if (ret == 0 && full) {
+			ret = (op.result_len > 0 ? 3 : 0);
+			break;
+		}
+		got += (ret == 0 ? op.result_len : 0);
+	}
+
+	if (content_len != NULL) {
+		*content_len = got;
+	}
+
+	return ret;
+}
+
+int note_get_range(struct NoteHandle *const handle, const char *const sbj, const uint64_t offset, void *const buf, const uint32_t buf_len, uint32_t *const content_len)
+{
+	struct NoteOp op;
+	memset(&op, '\0', sizeof(op));
+	op.cmd = GET_RANGE;
+	op.sbj = sbj;
+	op.buf = buf;
+	op.buf_len = buf_len;
+	op.offset = offset;
+
+	const int ret = note_batch(handle, &op, 1);
+	if (content_len != NULL) {
+		*content_len = op.result_len;
+	}
+
+	return ret;
+}
+
+int note_append(struct NoteHandle *const handle, const char *const sbj, const void *const content, const uint32_t content_len, uint64_t *const note_len)
+{
+	struct NoteOp op;
+	memset(&op, '\0', sizeof(op));
+	op.cmd = APPEND;
+	op.sbj = sbj;
+	op.content = content;
+	op.content_len = content_len;
+
+	const int ret = note_batch(handle, &op, 1);
+	if (note_len != NULL) {
+		*note_len = op.note_len;
+	}
+
+	return ret;
+}
+
+int note_remove(struct NoteHandle *const handle, const char *const sbj)
+{
+	struct NoteOp op;
+	memset(&op, '\0', sizeof(op));
+	op.cmd = REMOVE;
+	op.sbj = sbj;
+
+	return note_batch(handle, &op, 1);
+}
+
+/**
+ * @brief page_parse - unpacks a LIST or SINCE page (see LIST_*), checking each part against what actually arrived
+ * @param const uint8_t *const page - page as received
+ * @param const uint32_t page_len - length of page
+ * @param const size_t cursor_max_len - LIST_CURSOR_MAX_LEN or SINCE_CURSOR_MAX_LEN
+ * @param const size_t max - capacity of listings
+ * @param struct NoteCursor *const next - filled with the page's cursor
+ * @param struct NoteListing *const listings - filled with the page's notes
+ * @param size_t *const listing_count - filled with number of notes in the page
+ * @return int - zero is success, non-zero is failure
+ * 1 is malformed page
+ */
+static int page_parse(const uint8_t *const page, const uint32_t page_len, const size_t cursor_max_len, const size_t max, struct NoteCursor *const next, struct NoteListing *const listings, size_t *const listing_count)
+{
+	/* page is cursor length, cursor, then entries */
+	if (page_len < 1 || page[0] > cursor_max_len || 1u + page[0] > page_len) {
+		fprintf(stderr, "Malformed listing page\n");
+		return 1;
+	}
+	next->len = page[0];
+	memcpy(next->data, page + 1, next->len);
+
+	size_t pos = 1 + (size_t)next->len;
+	size_t count = 0;
+	while (pos < page_len) {
+		const size_t sbj_len = page[pos];
+		if (sbj_len < 1 || sbj_len > MAX_SBJ_LEN || pos + LIST_ENTRY_FIXED_LEN + sbj_len > page_len || count == max) {
+			fprintf(stderr, "Malformed listing page\n");
+			return 1;
+		}
+
+		uint64_t size, mtime_ns;
+		memcpy(listings[count].sbj, page + pos + 1, sbj_len);
+		listings[count].sbj[sbj_len] = '\0';
+		memcpy(&size, page + pos + 1 + sbj_len, sizeof(size));
+		memcpy(&mtime_ns, page + pos + 1 + sbj_len + sizeof(size), sizeof(mtime_ns));
+		listings[count].size = le64toh(size);
+		listings[count].mtime_ns = (int64_t)le64toh(mtime_ns);
+
+		pos += LIST_ENTRY_FIXED_LEN + sbj_len;
+		++count;
+	}
+	*listing_count = count;
+
+	return 0;
+}
+
+int note_list(struct NoteHandle *const handle, struct NoteCursor *const cursor, struct NoteListing *const listings, size_t *const listing_count)
+{
+	if (cursor == NULL || listings == NULL || listing_count == NULL || cursor->len > LIST_CURSOR_MAX_LEN) {
+		fprintf(stderr, "Listing needs a valid cursor, somewhere to list into & a count\n");
+		return 3;
+	}
+	*listing_count = 0;
+
+	uint8_t page[MAX_EXTRA_DATA_LEN];
+	struct NoteOp op;
+	memset(&op, '\0', sizeof(op));
+	op.cmd = LIST;
+	op.sbj = "list"; /* subject is mandatory, but meaningless here */
+	op.content = cursor->data;
+	op.content_len = cursor->len;
+	op.buf = page;
+	op.buf_len = sizeof(page);
+
+	const int ret = note_batch(handle, &op, 1);
+	if (ret != 0) {
+		return ret;
+	}
+
+	struct NoteCursor next;
+	size_t count = 0;
+	if (page_parse(page, op.result_len, LIST_CURSOR_MAX_LEN, LIST_PAGE_MAX_ENTRIES, &next, listings, &count) != 0) {
+		return 1;
+	}
+
+	*cursor = next;
+	*listing_count = count;
+
+	return 0;
+}
+
+int note_since(struct NoteHandle *const handle, const int64_t from_ns, const int64_t until_ns, struct NoteCursor *const cursor, struct NoteListing *const listings, size_t *const listing_count)
+{
+	if (cursor == NULL || listings == NULL || listing_count == NULL || cursor->len > SINCE_CURSOR_MAX_LEN) {
+		fprintf(stderr, "Listing needs a valid cursor, somewhere to list into & a count\n");
+		return 3;
+	}
+	*listing_count = 0;
+
+	uint8_t query[REQUEST_SINCE_LEN + SINCE_CURSOR_MAX_LEN]; /* window, then cursor */
+	const uint64_t from = htole64((uint64_t)from_ns);
+	const uint64_t until = htole64((uint64_t)until_ns);
+	memcpy(query, &from, sizeof(from));
+	memcpy(query + 8, &until, sizeof(until));
+	memcpy(query + REQUEST_SINCE_LEN, cursor->data, cursor->len);
+
+	uint8_t page[MAX_EXTRA_DATA_LEN];
+	struct NoteOp op;
+	memset(&op, '\0', sizeof(op));
+	op.cmd = SINCE;
+	op.sbj = "since"; /* subject is mandatory, but meaningless here */
+	op.content = query;
+	op.content_len = REQUEST_SINCE_LEN + cursor->len;
+	op.buf = page;
+	op.buf_len = sizeof(page);
+
+	const int ret = note_batch(handle, &op, 1);
+	if (ret != 0) {
+		return ret;
+	}
+
+	struct NoteCursor next;
+	size_t count = 0;
+	if (page_parse(page, op.result_len, SINCE_CURSOR_MAX_LEN, SINCE_PAGE_MAX_ENTRIES, &next, listings, &count) != 0) {
+		return 1;
+	}
+
+	*cursor = next;
+	*listing_count = count;
+
+	return 0;
+}
+
+/**
+ * @brief handle_transfer - sends an EXPORT or IMPORT request followed by the archive's handle, then awaits the outcome
+ * @param struct NoteHandle *const handle - open handle
+ * @param const uint8_t cmd - EXPORT or IMPORT
+ * @param const int archive_fd - archive handle
+ * @param uint64_t *const note_count - filled with number of notes transferred. may be NULL
+ * @return int - see return codes in libnote.h
+ */
+static int handle_transfer(struct NoteHandle *const handle, const uint8_t cmd, const int archive_fd, uint64_t *const note_count)
+{
+	if (handle == NULL || archive_fd < 0) {
+		fprintf(stderr, "Handle & archive handle must be valid\n");
+		return 3;
+	}
+
+	struct Request req;
+	handle_request(handle, &req);
+	req.cmd = cmd;
+	req.sbj_len = sizeof("archive") - 1; /* subject is mandatory, but meaningless here */
+	memcpy(req.sbj_content, "archive", req.sbj_len);
+	req.extra_data_len = 0;
+	req.extra_data_content = NULL;
+
+	if (request_send(&req, handle->sock) != 0 || fd_send(handle->sock, &archive_fd, 1) != 0) { /* socket, whatever the transport - only it can carry handles */
+		return 1;
+	}
+
+	uint64_t count = 0;
+	struct Response resp;
+	resp.extra_data_content = &count;
+	if (response_recv_into(&resp, sizeof(count), handle->sock) != 0) { /* may take a while - the server streams the whole store before answering */
+		return 1;
+	}
+
+	if (resp.version != PROTOCOL_V2) {
+		return (resp.status == BUSY ? 4 : 1);
+	} else if (resp.id != req.id || resp.status == DATA) {
+		return 1;
+	} else if (resp.status == BUSY) {
+		return 4;
+	} else if (resp.status != OK) {
+		return 2;
+	} else if (resp.extra_data_len != sizeof(count)) {
+		return 1;
+	}
+
+	if (note_count != NULL) {
+		*note_count = le64toh(count);
+	}
+
+	return 0;
+}
+
+int note_export(struct NoteHandle *const handle, const int archive_fd, uint64_t *const note_count)
+{
+	return handle_transfer(handle, EXPORT, archive_fd, note_count);
+}
+
+int note_import(struct NoteHandle *const handle, const int archive_fd, uint64_t *const note_count)
+{
+	return handle_transfer(handle, IMPORT, archive_fd, note_count);
+}
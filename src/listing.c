@@ -0,0 +1,390 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <endian.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "store.h"
+#include "index.h"
+#include "listing.h"
+
+/**
+ * @brief Definitions of note listing
+ */
+
+/**
+ * @brief scanned_expired - whether a note found by scanning (rather than through the index) has expired, going by the expiry recorded on it
+ * @param const int uid_dir_fd - directory handle of the owner's notes
+ * @param const char *const sbj - null terminated subject
+ * @param const struct stat *const statbuf - the note's stat. only sticky notes (see STORE_EXPIRING_NOTE_PERMISSIONS) are opened
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds)
+ * @return int - Boolean. 1 if expired, 0 if not or it can't be told
+ */
+static int scanned_expired(const int uid_dir_fd, const char *const sbj, const struct stat *const statbuf, const int64_t now_ns)
+{
+	if (!(statbuf->st_mode & S_ISVTX)) {
+		return 0;
+	}
+
+	const int note_fd = openat(uid_dir_fd, sbj, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (note_fd == -1) {
+		return 0;
+	}
+	const int64_t expires_ns = store_note_expiry(note_fd);
+	close(note_fd);
+
+	return (expires_ns != 0 && expires_ns <= now_ns);
+}
+
+/**
+ * @brief sbj_cmp - orders two subjects bytewise, a prefix before anything it's a prefix of (as the index's ordered view does)
+ * @param const char *const a - first subject
+ * @param const size_t a_len - length of a
+ * @param const char *const b - second subject
+ * @param const size_t b_len - length of b
+ * @return int - negative, zero or positive as a sorts before, the same as or after b
+ */
+static int sbj_cmp(const char *const a, const size_t a_len, const char *const b, const size_t b_len)
+{
+	const int cmp = memcmp(a, b, (a_len < b_len ? a_len : b_len));
+	if (cmp != 0) {
+		return cmp;
+	}
+
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+/**
+ * @brief scan_after - finds the first few subjects after a cursor by reading a user's directory
+ * Keeps a sorted array of at most max subjects as it goes, so memory stays bounded whatever the directory holds
+ * @param const int uid_dir_fd - directory handle of the user's notes (not closed)
+ * @param const char *const after - subject to resume after
+ * @param const size_t after_len - length of after. 0 starts from the beginning
+ * @param char (*const sbjs)[MAX_SBJ_LEN + 1] - filled with null terminated subjects, in order
+ * @param const size_t max - capacity of sbjs
+ * @param size_t *const count - filled with number of subjects found
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the directory
+ */
+static int scan_after(const int uid_dir_fd, const char *const after, const size_t after_len, char (*const sbjs)[MAX_SBJ_LEN + 1], const size_t max, size_t *const count)
+{
+	const int scan_fd = dup(uid_dir_fd); /* closedir will close the handle it's given, so give it its own */
+	DIR *const dir = (scan_fd == -1 ? NULL : fdopendir(scan_fd));
+	if (dir == NULL) {
+		fprintf(stderr, "Error reading notes directory (errno %d: %s)\n", errno, strerror(errno));
+		if (scan_fd != -1) {
+			close(scan_fd);
+		}
+		return 1;
+	}
+	rewinddir(dir);
+
+	size_t found = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		const size_t name_len = strlen(entry->d_name);
+		if ((entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN) || entry->d_name[0] == '.' || name_len > MAX_SBJ_LEN || sbj_cmp(entry->d_name, name_len, after, after_len) <= 0) { /* subjects can't start with '.', so dot-files (& "." / "..") are never notes */
+			continue;
+		}
+
+		size_t low = 0, high = found; /* binary search for where it belongs */
+		while (low < high) {
+			const size_t mid = low + (high - low) / 2;
+			if (sbj_cmp(sbjs[mid], strlen(sbjs[mid]), entry->d_name, name_len) < 0) {
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+		if (low >= max) { /* sorts after everything kept, & there's no room */
+			continue;
+		}
+
+		const size_t keep = (found < max ? found : max - 1); /* last one falls off the end if full */
+		memmove(sbjs[low + 1], sbjs[low], (keep - low) * sizeof(sbjs[0]));
+		memcpy(sbjs[low], entry->d_name, name_len + 1);
+		found = keep + 1;
+	}
+
+	closedir(dir);
+	*count = found;
+
+	return 0;
+}
+
+/**
+ * @brief since_cmp - orders two notes by creation time, then subject (as the index's time view does)
+ * @param const int64_t a_ns - creation time of first note
+ * @param const char *const a - subject of first note
+ * @param const size_t a_len - length of a
+ * @param const int64_t b_ns - creation time of second note
+ * @param const char *const b - subject of second note
+ * @param const size_t b_len - length of b
+ * @return int - negative, zero or positive as a sorts before, the same as or after b
+ */
+static int since_cmp(const int64_t a_ns, const char *const a, const size_t a_len, const int64_t b_ns, const char *const b, const size_t b_len)
+{
+	if (a_ns != b_ns) {
+		return (a_ns < b_ns ? -1 : 1);
+	}
+
+	return sbj_cmp(a, a_len, b, b_len);
+}
+
+/**
+ * @brief scan_since - finds the first few notes created within a window after a cursor by reading (& statting) a user's directory
+ * As scan_after, keeps a sorted array of at most max notes as it goes. creation time is taken to be mtime, as it is when the index rescans
+ * @param const int uid_dir_fd - directory handle of the user's notes (not closed)
+ * @param const int64_t from_ns - start of the window. inclusive
+ * @param const int64_t until_ns - end of the window. exclusive. 0 is no end
+ * @param const int64_t after_ns - creation time of the note to resume after. ignored if after_len is 0
+ * @param const char *const after - subject of the note to resume after
+ * @param const size_t after_len - length of after. 0 starts from the beginning of the window
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds). expired notes are skipped
+ * @param struct IndexEntry *const found - filled with the notes (size, created_ns, sbj_len & sbj), in order
+ * @param const size_t max - capacity of found
+ * @param size_t *const count - filled with number of notes found
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the directory
+ */
+static int scan_since(const int uid_dir_fd, const int64_t from_ns, const int64_t until_ns, const int64_t after_ns, const char *const after, const size_t after_len, const int64_t now_ns, struct IndexEntry *const found, const size_t max, size_t *const count)
+{
+	const int scan_fd = dup(uid_dir_fd); /* closedir will close the handle it's given, so give it its own */
+	DIR *const dir = (scan_fd == -1 ? NULL : fdopendir(scan_fd));
+	if (dir == NULL) {
+		fprintf(stderr, "Error reading notes directory (errno %d: %s)\n", errno, strerror(errno));
+		if (scan_fd != -1) {
+			close(scan_fd);
+		}
+		return 1;
+	}
+	rewinddir(dir);
+
+	size_t kept = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		const size_t name_len = strlen(entry->d_name);
+		if ((entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN) || entry->d_name[0] == '.' || name_len > MAX_SBJ_LEN) { /* subjects can't start with '.', so dot-files (& "." / "..") are never notes */
+			continue;
+		}
+
+		struct stat statbuf;
+		if (fstatat(uid_dir_fd, entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(statbuf.st_mode)) {
+			continue;
+		}
+		const int64_t created_ns = (int64_t)statbuf.st_mtim.tv_sec * 1000000000 + statbuf.st_mtim.tv_nsec;
+		if (created_ns < from_ns || (until_ns != 0 && created_ns >= until_ns) || (after_len > 0 && since_cmp(created_ns, entry->d_name, name_len, after_ns, after, after_len) <= 0) || scanned_expired(uid_dir_fd, entry->d_name, &statbuf, now_ns)) {
+			continue;
+		}
+
+		size_t low = 0, high = kept; /* binary search for where it belongs */
+		while (low < high) {
+			const size_t mid = low + (high - low) / 2;
+			if (since_cmp(found[mid].created_ns, found[mid].sbj, found[mid].sbj_len, created_ns, entry->d_name, name_len) < 0) {
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+		if (low >= max) { /* sorts after everything kept, & there's no room */
+			continue;
+		}
+
+		const size_t keep = (kept < max ? kept : max - 1); /* last one falls off the end if full */
+		memmove(&found[low + 1], &found[low], (keep - low) * sizeof(found[0]));
+		found[low].created_ns = created_ns;
+		found[low].size = (uint32_t)statbuf.st_size;
+		found[low].sbj_len = (uint8_t)name_len;
+		memcpy(found[low].sbj, entry->d_name, name_len);
+		kept = keep + 1;
+	}
+
+	closedir(dir);
+	*count = kept;
+
+	return 0;
+}
+
+/**
+ * @brief page_entry - adds an entry to a page being built, if there's room (see LIST_ENTRY_FIXED_LEN)
+ * @param uint8_t *const entries - entries so far. holds MAX_EXTRA_DATA_LEN bytes
+ * @param size_t *const entries_len - length of entries. updated
+ * @param const size_t cursor_max_len - longest cursor the page could end with, which must still fit in front of the entries
+ * @param const char *const sbj - subject
+ * @param const size_t sbj_len - length of sbj
+ * @param const uint64_t size - length of note
+ * @param const int64_t time_ns - mtime (LIST) or creation time (SINCE), nanoseconds since the epoch
+ * @return int - zero is success, non-zero is failure
+ * 1 is page full
+ */
+static int page_entry(uint8_t *const entries, size_t *const entries_len, const size_t cursor_max_len, const char *const sbj, const size_t sbj_len, const uint64_t size, const int64_t time_ns)
+{
+	if (1 + cursor_max_len + *entries_len + LIST_ENTRY_FIXED_LEN + sbj_len > MAX_EXTRA_DATA_LEN) {
+		return 1;
+	}
+
+	const uint64_t size_le = htole64(size);
+	const uint64_t time_le = htole64((uint64_t)time_ns);
+	uint8_t *pos = entries + *entries_len;
+	*pos++ = (uint8_t)sbj_len;
+	memcpy(pos, sbj, sbj_len);
+	pos += sbj_len;
+	memcpy(pos, &size_le, sizeof(size_le));
+	pos += sizeof(size_le);
+	memcpy(pos, &time_le, sizeof(time_le));
+	*entries_len += LIST_ENTRY_FIXED_LEN + sbj_len;
+
+	return 0;
+}
+
+int listing_page(const struct Store *const store, const uid_t uid, const uint8_t *const cursor, const uint32_t cursor_len, const int64_t now_ns, uint8_t *const page, uint32_t *const page_len)
+{
+	if (cursor_len > LIST_CURSOR_MAX_LEN) {
+		fprintf(stderr, "Listing cursor too long (maximum %d, was given %u)\n", LIST_CURSOR_MAX_LEN, cursor_len);
+		return 1;
+	}
+
+	char after[LIST_CURSOR_MAX_LEN + 1] = {0};
+	if (cursor_len > 0) {
+		memcpy(after, cursor, cursor_len);
+	}
+
+	page[0] = 0; /* no cursor - nothing more to come */
+	*page_len = 1;
+
+	const int uid_dir_fd = store_uid_dir(store, uid, 0);
+	if (uid_dir_fd == -1) {
+		if (errno == ENOENT) { /* no notes at all - an empty page, not a failure */
+			return 0;
+		}
+		fprintf(stderr, "Error opening notes directory of uid %u (errno %d: %s)\n", (unsigned int)uid, errno, strerror(errno));
+		return 2;
+	}
+
+	char sbjs[NOTICEBOARD_LIST_PAGE + 1][MAX_SBJ_LEN + 1]; /* one more than a page, to know whether there's another page after this */
+	size_t count = 0;
+	const int indexed = (store->index != NULL && store->index->complete);
+	if (indexed) {
+		count = index_list(store->index, uid, after, cursor_len, now_ns, sbjs, NOTICEBOARD_LIST_PAGE + 1);
+	} else if (scan_after(uid_dir_fd, after, cursor_len, sbjs, NOTICEBOARD_LIST_PAGE + 1, &count) != 0) {
+		close(uid_dir_fd);
+		return 2;
+	}
+
+	uint8_t entries[MAX_EXTRA_DATA_LEN];
+	size_t entries_len = 0;
+	size_t listed = 0;
+	size_t next = 0; /* position in sbjs of the next note to look at */
+	for (; next < count && listed < NOTICEBOARD_LIST_PAGE; ++next) {
+		const size_t sbj_len = strlen(sbjs[next]);
+		if (1 + LIST_CURSOR_MAX_LEN + entries_len + LIST_ENTRY_FIXED_LEN + sbj_len > MAX_EXTRA_DATA_LEN) { /* page full */
+			break;
+		}
+
+		struct stat statbuf;
+		const struct IndexEntry *const packed = (store->index != NULL ? index_find(store->index, uid, sbjs[next]) : NULL);
+		if (packed != NULL && packed->pack_offset != 0) { /* cold - no file to stat, but the index knows as much */
+			statbuf.st_size = (off_t)packed->size;
+			statbuf.st_mtim.tv_sec = (time_t)(packed->created_ns / 1000000000);
+			statbuf.st_mtim.tv_nsec = (long)(packed->created_ns % 1000000000);
+		} else if (fstatat(uid_dir_fd, sbjs[next], &statbuf, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(statbuf.st_mode)) { /* removed since it was listed */
+			continue;
+		}
+		if (!indexed && scanned_expired(uid_dir_fd, sbjs[next], &statbuf, now_ns)) { /* the index would have left it out */
+			continue;
+		}
+
+		page_entry(entries, &entries_len, LIST_CURSOR_MAX_LEN, sbjs[next], sbj_len, (uint64_t)statbuf.st_size, (int64_t)statbuf.st_mtim.tv_sec * 1000000000 + statbuf.st_mtim.tv_nsec); /* room was checked before the stat */
+		++listed;
+	}
+	close(uid_dir_fd);
+
+	if (next < count || count > NOTICEBOARD_LIST_PAGE) { /* more to come - resume after the last one looked at. never the first, as an empty page always has room for one */
+		const size_t last_len = strlen(sbjs[next - 1]);
+		page[0] = (uint8_t)last_len;
+		memcpy(page + 1, sbjs[next - 1], last_len);
+		*page_len += (uint32_t)last_len;
+	}
+	memcpy(page + *page_len, entries, entries_len);
+	*page_len += (uint32_t)entries_len;
+
+	fprintf(stdout, "Listed %lu note(s) of uid %u\n", (unsigned long)listed, (unsigned int)uid);
+
+	return 0;
+}
+
+int listing_since(const struct Store *const store, const uid_t uid, const uint8_t *const query, const uint32_t query_len, const int64_t now_ns, uint8_t *const page, uint32_t *const page_len)
+{
+	const uint32_t cursor_len = (query_len < REQUEST_SINCE_LEN ? 0 : query_len - REQUEST_SINCE_LEN);
+	if (query_len < REQUEST_SINCE_LEN || cursor_len > SINCE_CURSOR_MAX_LEN || (cursor_len > 0 && cursor_len <= 8)) {
+		fprintf(stderr, "Invalid time window or cursor (%u byte(s) given)\n", query_len);
+		return 1;
+	}
+
+	uint64_t from = 0, until = 0, after_time = 0;
+	memcpy(&from, query, sizeof(from));
+	memcpy(&until, query + 8, sizeof(until));
+	const int64_t from_ns = (int64_t)le64toh(from);
+	const int64_t until_ns = (int64_t)le64toh(until);
+	const char *const after = (cursor_len > 0 ? (const char*)query + REQUEST_SINCE_LEN + 8 : "");
+	const size_t after_len = (cursor_len > 0 ? cursor_len - 8 : 0);
+	if (cursor_len > 0) {
+		memcpy(&after_time, query + REQUEST_SINCE_LEN, sizeof(after_time));
+	}
+	const int64_t after_ns = (int64_t)le64toh(after_time);
+
+	page[0] = 0; /* no cursor - nothing more to come */
+	*page_len = 1;
+
+	struct IndexEntry found[NOTICEBOARD_LIST_PAGE + 1]; /* one more than a page, to know whether there's another page after this */
+	size_t count = 0;
+	if (store->index != NULL && store->index->complete) { /* straight to the window - only the notes listed are ever looked at */
+		count = index_since(store->index, uid, from_ns, until_ns, after_ns, after, after_len, now_ns, found, NOTICEBOARD_LIST_PAGE + 1);
+	} else {
+		const int uid_dir_fd = store_uid_dir(store, uid, 0);
+		if (uid_dir_fd == -1) {
+			if (errno == ENOENT) { /* no notes at all - an empty page, not a failure */
+				return 0;
+			}
+			fprintf(stderr, "Error opening notes directory of uid %u (errno %d: %s)\n", (unsigned int)uid, errno, strerror(errno));
+			return 2;
+		}
+		const int ret = scan_since(uid_dir_fd, from_ns, until_ns, after_ns, after, after_len, now_ns, found, NOTICEBOARD_LIST_PAGE + 1, &count);
+		close(uid_dir_fd);
+		if (ret != 0) {
+			return 2;
+		}
+	}
+
+	uint8_t entries[MAX_EXTRA_DATA_LEN];
+	size_t entries_len = 0;
+	size_t next = 0; /* position in found of the next note to look at */
+	for (; next < count && next < NOTICEBOARD_LIST_PAGE; ++next) {
+		if (page_entry(entries, &entries_len, SINCE_CURSOR_MAX_LEN, found[next].sbj, found[next].sbj_len, found[next].size, found[next].created_ns) != 0) { /* page full */
+			break;
+		}
+	}
+
+	if (next < count) { /* more to come - resume after the last one listed. never the first, as an empty page always has room for one */
+		const struct IndexEntry *const last = &found[next - 1];
+		const uint64_t last_time = htole64((uint64_t)last->created_ns);
+		page[0] = (uint8_t)(8 + last->sbj_len);
+		memcpy(page + 1, &last_time, sizeof(last_time));
+		memcpy(page + 1 + 8, last->sbj, last->sbj_len);
+		*page_len += 8 + (uint32_t)last->sbj_len;
+	}
+	memcpy(page + *page_len, entries, entries_len);
+	*page_len += (uint32_t)entries_len;
+
+	fprintf(stdout, "Listed %lu note(s) of uid %u by creation time\n", (unsigned long)next, (unsigned int)uid);
+
+	return 0;
+}
@@ -0,0 +1,504 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <argp.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "libnote.h"
+#include "util.h"
+#include "capture.h"
+
+#ifndef NOTICEBOARD_SOCK_NAME
+	#error "'NOTICEBOARD_SOCK_NAME' must be set to a UNIX IPC socketfile"
+#endif /* ifndef NOTICEBOARD_SOCK_NAME */
+
+/**
+ * @brief Traffic replayer, to be ran against a test server with a capture a live one recorded (see capture.h)
+ * Requests are spread over many connections by uid & subject, so each note's requests keep their order. Every request runs as whoever runs this - the captured uids only decide the spread
+ * Content which wasn't captured is replaced with filler of the same length
+ */
+
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#pragma GCC diagnostic push
+const char* argp_program_bug_address = "salih.msa@outlook.com" ;
+static const char args_doc[] = "CAPTURE" ; /* description of non-option specified command line arguments */
+static const char doc[] = "notereplay -- drives noticeboard with the requests of a capture, then reports throughput & latency" ; /* general program documentation */
+static struct argp_option options[] = { /* OPTIONS FOR ARGP. each entry stores: {NAME, KEY, ARG, FLAGS, DOC} */
+	{"connections", 'c', "COUNT", 0, "Replay over this many concurrent connections (default 16)"},
+	{"speed", 's', "FACTOR", 0, "Replay this many times faster than captured (default 1). 0 sends each request as soon as the last on its connection is answered"},
+	{"ring", 'r', 0, 0, "Send requests through shared-memory rings rather than the sockets"},
+	{0}
+};
+
+#define REPLAY_MAX_CONNECTIONS 1024
+
+/**
+ * @brief struct arguments - this structure is used to communicate with parse_opt (for it to store the values it parses within it)
+ */
+struct arguments {
+	const char *path; /* capture to replay */
+
+	unsigned int connections;
+
+	double speed; /* 0 for as fast as possible */
+
+	int ring; /* boolean. use shared-memory ring transport */
+};
+
+/**
+ * @brief parse_opt - deals with given arguments based on given argumentsK
+ * @param int key - int correlating to char storing argument key
+ * @param char *arg - argument string associated with argument key
+ * @param struct argp_state *state - pointer to argp_state struct storing information about the state of the option parsing
+ * @return error_t - number storing 0 upon successfully parsed values, non-zero exit code otherwise
+ */
+static error_t parse_opt(int key, char *arg, struct argp_state *state)
+{
+	struct arguments *arguments = state->input;
+
+	switch (key) {
+		case 'c': {
+			char *arg_end;
+			errno = 0;
+			const unsigned long value = strtoul(arg, &arg_end, 10);
+			if (errno != 0 || arg[0] < '0' || arg[0] > '9' || *arg_end != '\0' || value < 1 || value > REPLAY_MAX_CONNECTIONS) {
+				argp_error(state, "--connections should be a number (1 to %d)", REPLAY_MAX_CONNECTIONS);
+			}
+			arguments->connections = (unsigned int)value;
+			break;
+		}
+		case 's': {
+			char *arg_end;
+			errno = 0;
+			const double value = strtod(arg, &arg_end);
+			if (errno != 0 || arg_end == arg || *arg_end != '\0' || !(value >= 0)) {
+				argp_error(state, "--speed should be a factor (0 for as fast as possible)");
+			}
+			arguments->speed = value;
+			break;
+		}
+		case 'r':
+			arguments->ring = 1;
+			break;
+		case ARGP_KEY_ARG:
+			if (state->arg_num == 0) {
+				arguments->path = arg;
+			} else {
+				argp_usage(state);
+			}
+			break;
+		case ARGP_KEY_END:
+			if (state->arg_num < 1) {
+				argp_usage(state);
+			}
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+static struct argp argp = { /* argp - The ARGP structure itself */
+	options, /* list containing options */
+	parse_opt, /* callback function to process args */
+	args_doc, /* names of parameters */
+	doc, /* documentation containing general program description */
+};
+#pragma GCC diagnostic pop /* end of argp, so end of repressing weird messages */
+
+#define REPLAY_COMMANDS (SINCE + 1)
+
+/**
+ * @brief ReplayRequest (struct) - one captured request, ready to send
+ */
+struct ReplayRequest {
+	int64_t at_ns; /* since the capture started */
+
+	uint32_t uid;
+
+	uint32_t ttl_s;
+
+	uint32_t extra_data_len; /* as captured */
+
+	uint32_t stored_len; /* how much of the extra data was captured. all or nothing */
+
+	const uint8_t *stored;
+
+	uint8_t cmd;
+
+	char sbj[MAX_SBJ_LEN + 1]; /* null terminated */
+
+	int64_t latency_ns; /* filled in once replayed */
+
+	int result; /* libnote return code */
+};
+
+/**
+ * @brief ReplayConnection (struct) - one connection's share of the capture, & the thread replaying it
+ */
+struct ReplayConnection {
+	struct ReplayRequest **requests; /* in capture order */
+
+	size_t request_count;
+
+	const struct arguments *arguments;
+
+	int64_t start_ns; /* monotonic clock - the capture's start, as replayed */
+
+	int64_t behind_ns; /* furthest behind schedule a request was sent */
+
+	pthread_t thread;
+};
+
+static uint8_t filler[MAX_EXTRA_DATA_LEN]; /* content for requests whose content wasn't captured */
+
+/**
+ * @brief get_le - reads a little endian integer
+ * @param const uint8_t *const pos - where to read
+ * @param const size_t len - width in bytes (2, 4 or 8)
+ * @return uint64_t - value read
+ */
+static uint64_t get_le(const uint8_t *const pos, const size_t len)
+{
+	uint64_t value = 0;
+	for (size_t i = 0; i < len; ++i) {
+		value |= (uint64_t)pos[i] << (8 * i);
+	}
+
+	return value;
+}
+
+/**
+ * @brief ns_cmp - orders two durations, for qsort
+ * @param const void *a - first int64_t
+ * @param const void *b - second int64_t
+ * @return int - negative, zero or positive as a is less than, equal to or more than b
+ */
+static int ns_cmp(const void *a, const void *b)
+{
+	const int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief replay_parse - splits a capture into its requests
+ * @param const uint8_t *const capture - whole capture, header included
+ * @param const size_t capture_len - length of capture
+ * @param struct ReplayRequest *const requests - filled with the requests. NULL to just count them
+ * @param size_t *const request_count - filled with number of requests
+ * @return int - zero is success, non-zero is failure
+ * 1 is the capture isn't valid
+ */
+static int replay_parse(const uint8_t *const capture, const size_t capture_len, struct ReplayRequest *const requests, size_t *const request_count)
+{
+	size_t count = 0;
+	size_t pos = CAPTURE_HEADER_LEN;
+	while (pos < capture_len) {
+		if (capture_len - pos < CAPTURE_RECORD_FIXED_LEN) {
+			fprintf(stderr, "Capture is truncated after %lu request(s)\n", (unsigned long)count);
+			return 1;
+		}
+
+		const uint8_t *const record = capture + pos;
+		const uint32_t extra_data_len = (uint32_t)get_le(record + 16, 4);
+		const uint32_t stored_len = (uint32_t)get_le(record + 20, 4);
+		const uint8_t cmd = record[26];
+		const uint8_t sbj_len = record[27];
+		if (sbj_len < 1 || sbj_len > MAX_SBJ_LEN || extra_data_len > MAX_EXTRA_DATA_LEN || (stored_len != 0 && stored_len != extra_data_len) || cmd >= REPLAY_COMMANDS || cmd == RING || cmd == EXPORT || cmd == IMPORT) {
+			fprintf(stderr, "Capture's request #%lu is malformed\n", (unsigned long)count + 1);
+			return 1;
+		}
+		if (capture_len - pos - CAPTURE_RECORD_FIXED_LEN < (size_t)sbj_len + stored_len) {
+			fprintf(stderr, "Capture is truncated after %lu request(s)\n", (unsigned long)count);
+			return 1;
+		}
+
+		if (requests != NULL) {
+			struct ReplayRequest *const request = requests + count;
+			request->at_ns = (int64_t)get_le(record, 8);
+			request->uid = (uint32_t)get_le(record + 8, 4);
+			request->ttl_s = (uint32_t)get_le(record + 12, 4);
+			request->extra_data_len = extra_data_len;
+			request->stored_len = stored_len;
+			request->stored = record + CAPTURE_RECORD_FIXED_LEN + sbj_len;
+			request->cmd = cmd;
+			memcpy(request->sbj, record + CAPTURE_RECORD_FIXED_LEN, sbj_len);
+			request->sbj[sbj_len] = '\0';
+			request->latency_ns = 0;
+			request->result = 1;
+		}
+
+		pos += CAPTURE_RECORD_FIXED_LEN + sbj_len + stored_len;
+		++count;
+	}
+
+	*request_count = count;
+
+	return 0;
+}
+
+/**
+ * @brief replay_connection - replays one connection's share of the capture, in order. ran on its own thread
+ * Paced requests are timed from when they were due, not when they were sent, so a slow server can't hide its queueing by slowing us down
+ * @param void *arg - struct ReplayConnection *
+ * @return void * - NULL
+ */
+static void *replay_connection(void *arg)
+{
+	struct ReplayConnection *const connection = arg;
+	const struct arguments *const arguments = connection->arguments;
+	const char *const notes_socket = NOTICEBOARD_ROOT_DIR_NAME "/" NOTICEBOARD_SOCK_NAME;
+
+	uint8_t *const buf = malloc(MAX_EXTRA_DATA_LEN);
+	struct NoteHandle *handle = NULL;
+	for (size_t i = 0; buf != NULL && i < connection->request_count; ++i) {
+		struct ReplayRequest *const request = connection->requests[i];
+
+		int64_t due_ns = clock_ns(CLOCK_MONOTONIC);
+		if (arguments->speed > 0) {
+			due_ns = connection->start_ns + (int64_t)((double)request->at_ns / arguments->speed);
+			const struct timespec due = { .tv_sec = due_ns / 1000000000, .tv_nsec = due_ns % 1000000000 };
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+		}
+
+		if (handle == NULL && (handle = note_open(notes_socket, (arguments->ring ? NOTE_OPEN_RING : 0))) == NULL) { /* opened again after a communication error */
+			continue;
+		}
+
+		struct NoteOp op;
+		memset(&op, '\0', sizeof(op));
+		op.cmd = request->cmd;
+		op.sbj = request->sbj;
+		op.buf = buf;
+		op.buf_len = MAX_EXTRA_DATA_LEN;
+		if (request->cmd == ADD || request->cmd == APPEND) {
+			op.content = (request->stored_len > 0 ? request->stored : filler);
+			op.content_len = request->extra_data_len;
+			op.ttl_s = request->ttl_s;
+		} else if (request->cmd == GET_RANGE && request->stored_len == REQUEST_RANGE_LEN) {
+			const uint32_t length = (uint32_t)get_le(request->stored + 8, 4);
+			op.offset = get_le(request->stored, 8);
+			op.buf_len = (length < 1 || length > MAX_EXTRA_DATA_LEN ? MAX_EXTRA_DATA_LEN : length);
+		} else if (request->cmd == LIST || request->cmd == SINCE) {
+			op.content = request->stored;
+			op.content_len = request->stored_len;
+		}
+
+		const int64_t sent_ns = clock_ns(CLOCK_MONOTONIC);
+		if (sent_ns - due_ns > connection->behind_ns) {
+			connection->behind_ns = sent_ns - due_ns;
+		}
+		note_batch(handle, &op, 1);
+		request->latency_ns = clock_ns(CLOCK_MONOTONIC) - (arguments->speed > 0 ? due_ns : sent_ns);
+		request->result = op.result;
+
+		if (op.result == 1) {
+			note_close(handle);
+			handle = NULL;
+		}
+	}
+
+	if (handle != NULL) {
+		note_close(handle);
+	}
+	free(buf);
+
+	return NULL;
+}
+
+/**
+ * @brief main - driver of `notereplay`
+ * @param int argc - number of arguments
+ * @param char **argv - list of args as c-strings, null terminated
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the capture, 2 is the capture isn't valid, 3 is error starting the replay, 4 is requests failed to reach the server (refused & busy ones aren't failures)
+ */
+int main(int argc, char **argv)
+{
+	/** Initialisation **/
+	struct arguments arguments;
+	arguments.path = NULL;
+	arguments.connections = 16;
+	arguments.speed = 1;
+	arguments.ring = 0;
+	argp_parse(&argp, argc, argv, 0, 0, &arguments); /* number, content, etc. of cmd-line args checked here */
+
+	if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+		fprintf(stderr, "Failure to set signal to handle SIGPIPE (errno %d: %s)\n", errno, strerror(errno));
+		return 3;
+	}
+	memset(filler, 'x', sizeof(filler));
+
+	int exit_code = 0;
+	uint8_t *capture = NULL;
+	struct ReplayRequest *requests = NULL;
+	struct ReplayConnection *connections = NULL;
+	struct ReplayRequest **order = NULL;
+	int64_t *latencies = NULL;
+	size_t started = 0;
+
+	/* Number 1: read the capture in whole & split it into requests */
+	const int capture_fd = open(arguments.path, O_RDONLY | O_CLOEXEC);
+	struct stat statbuf;
+	if (capture_fd == -1 || fstat(capture_fd, &statbuf) != 0) {
+		fprintf(stderr, "Error opening capture %s (errno %d: %s)\n", arguments.path, errno, strerror(errno));
+		if (capture_fd != -1) {
+			close(capture_fd);
+		}
+		return 1;
+	}
+
+	const size_t capture_len = (size_t)statbuf.st_size;
+	capture = malloc(capture_len > 0 ? capture_len : 1);
+	if (capture == NULL) {
+		fprintf(stderr, "Allocating block failed\n");
+		close(capture_fd);
+		return 3;
+	}
+	size_t got = 0;
+	while (got < capture_len) {
+		const ssize_t ret = read(capture_fd, capture + got, capture_len - got);
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			fprintf(stderr, "Error reading capture %s (errno %d: %s)\n", arguments.path, errno, strerror(errno));
+			close(capture_fd);
+			exit_code = 1;
+			goto eop;
+		}
+		got += (size_t)ret;
+	}
+	close(capture_fd);
+
+	if (capture_len < CAPTURE_HEADER_LEN || get_le(capture, 4) != CAPTURE_MAGIC || get_le(capture + 4, 2) != CAPTURE_VERSION) {
+		fprintf(stderr, "%s isn't a capture this version understands\n", arguments.path);
+		exit_code = 2;
+		goto eop;
+	}
+
+	size_t request_count = 0;
+	if (replay_parse(capture, capture_len, NULL, &request_count) != 0) {
+		exit_code = 2;
+		goto eop;
+	}
+	requests = malloc((request_count > 0 ? request_count : 1) * sizeof(requests[0]));
+	order = malloc((request_count > 0 ? request_count : 1) * sizeof(order[0]));
+	latencies = malloc((request_count > 0 ? request_count : 1) * sizeof(latencies[0]));
+	connections = calloc(arguments.connections, sizeof(connections[0]));
+	if (requests == NULL || order == NULL || latencies == NULL || connections == NULL) {
+		fprintf(stderr, "Allocating block failed\n");
+		exit_code = 3;
+		goto eop;
+	}
+	replay_parse(capture, capture_len, requests, &request_count);
+
+	/* Number 2: share the requests out between connections
+	 * by uid & subject (FNV-1a), so requests for the same note stay in order on the one connection
+	 * each connection's share is a run of order, counted first then filled
+	 */
+	size_t *const assigned = malloc((request_count > 0 ? request_count : 1) * sizeof(size_t));
+	if (assigned == NULL) {
+		fprintf(stderr, "Allocating block failed\n");
+		exit_code = 3;
+		goto eop;
+	}
+	for (size_t i = 0; i < request_count; ++i) {
+		uint32_t hash = 2166136261u;
+		for (size_t b = 0; b < sizeof(requests[i].uid); ++b) {
+			hash = (hash ^ (uint8_t)(requests[i].uid >> (8 * b))) * 16777619u;
+		}
+		for (const char *c = requests[i].sbj; *c != '\0'; ++c) {
+			hash = (hash ^ (uint8_t)*c) * 16777619u;
+		}
+		assigned[i] = hash % arguments.connections;
+		++connections[assigned[i]].request_count;
+	}
+	size_t run = 0;
+	for (unsigned int c = 0; c < arguments.connections; ++c) {
+		connections[c].requests = order + run;
+		run += connections[c].request_count;
+		connections[c].request_count = 0;
+	}
+	for (size_t i = 0; i < request_count; ++i) {
+		struct ReplayConnection *const connection = &connections[assigned[i]];
+		connection->requests[connection->request_count++] = &requests[i];
+	}
+	free(assigned);
+
+	/** Main Program **/
+
+	/* Number 3: replay, one thread per connection, all sharing a start time */
+	fprintf(stdout, "Replaying %lu request(s) over %u connection(s) at %s\n", (unsigned long)request_count, arguments.connections, (arguments.speed > 0 ? "captured pace" : "full speed"));
+	if (arguments.speed > 1 || (arguments.speed > 0 && arguments.speed < 1)) {
+		fprintf(stdout, "(sped up %gx)\n", arguments.speed);
+	}
+	const int64_t start_ns = clock_ns(CLOCK_MONOTONIC);
+	for (; started < arguments.connections; ++started) {
+		connections[started].arguments = &arguments;
+		connections[started].start_ns = start_ns;
+		const int ret = pthread_create(&connections[started].thread, NULL, replay_connection, &connections[started]);
+		if (ret != 0) {
+			fprintf(stderr, "Failure to start connection thread (errno %d: %s)\n", ret, strerror(ret));
+			exit_code = 3;
+			break;
+		}
+	}
+	int64_t behind_ns = 0;
+	for (size_t c = 0; c < started; ++c) {
+		pthread_join(connections[c].thread, NULL);
+		if (connections[c].behind_ns > behind_ns) {
+			behind_ns = connections[c].behind_ns;
+		}
+	}
+	const int64_t elapsed_ns = clock_ns(CLOCK_MONOTONIC) - start_ns;
+	if (exit_code != 0) {
+		goto eop;
+	}
+
+	/* Number 4: report
+	 * throughput over the whole replay, then outcomes & latency per command, then overall
+	 */
+	static const char *const names[REPLAY_COMMANDS] = { "ADD", "GET", "REMOVE", "RING", "EXPORT", "IMPORT", "GET_RANGE", "APPEND", "LIST", "SINCE" };
+	fprintf(stdout, "%lu request(s) in %.3fs - %.0f requests/s. furthest behind schedule: %.3fms\n", (unsigned long)request_count, (double)elapsed_ns / 1e9, (elapsed_ns > 0 ? (double)request_count * 1e9 / (double)elapsed_ns : 0), (double)behind_ns / 1e6);
+	fprintf(stdout, "%-10s %9s %9s %9s %9s %11s %11s %11s %11s\n", "command", "count", "refused", "busy", "failed", "p50 us", "p99 us", "p99.9 us", "max us");
+	for (int cmd = 0; cmd <= REPLAY_COMMANDS; ++cmd) { /* REPLAY_COMMANDS itself is every command at once */
+		size_t n = 0, refused = 0, busy = 0, failed = 0;
+		for (size_t i = 0; i < request_count; ++i) {
+			if (cmd != REPLAY_COMMANDS && requests[i].cmd != cmd) {
+				continue;
+			}
+			latencies[n++] = requests[i].latency_ns;
+			refused += (requests[i].result == 2);
+			busy += (requests[i].result == 4);
+			failed += (requests[i].result == 1 || requests[i].result == 3);
+		}
+		if (n == 0) {
+			continue;
+		}
+
+		qsort(latencies, n, sizeof(latencies[0]), ns_cmp);
+		fprintf(stdout, "%-10s %9lu %9lu %9lu %9lu %11.1f %11.1f %11.1f %11.1f\n", (cmd == REPLAY_COMMANDS ? "all" : names[cmd]), (unsigned long)n, (unsigned long)refused, (unsigned long)busy, (unsigned long)failed, (double)latencies[(n - 1) / 2] / 1e3, (double)latencies[(n - 1) * 99 / 100] / 1e3, (double)latencies[(n - 1) * 999 / 1000] / 1e3, (double)latencies[n - 1] / 1e3);
+		if (cmd == REPLAY_COMMANDS && failed > 0) {
+			exit_code = 4;
+		}
+	}
+
+	/** Cleanup **/
+eop:
+	free(latencies);
+	free(order);
+	free(connections);
+	free(requests);
+	free(capture);
+
+	return exit_code;
+}
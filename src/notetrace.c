@@ -0,0 +1,234 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <argp.h>
+
+#include <errno.h>
+
+#include "trace.h"
+
+/**
+ * @brief Trace decoder, to be ran by the admin against a dump the server wrote on SIGUSR1
+ * Prints where requests' time went, phase by phase - how long connecting, receiving, being dispatched, executing & responding each took
+ */
+
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#pragma GCC diagnostic push
+const char* argp_program_bug_address = "salih.msa@outlook.com" ;
+static const char args_doc[] = "DUMP" ; /* description of non-option specified command line arguments */
+static const char doc[] = "notetrace -- prints per-phase latency breakdowns of the requests in a noticeboard trace dump (by default noticeboard_notes/.trace)" ; /* general program documentation */
+static struct argp_option options[] = { /* OPTIONS FOR ARGP. each entry stores: {NAME, KEY, ARG, FLAGS, DOC} */
+	{"records", 'r', 0, 0, "Also print every request, one per line, oldest first"},
+	{0}
+};
+
+/**
+ * @brief struct arguments - this structure is used to communicate with parse_opt (for it to store the values it parses within it)
+ */
+struct arguments {
+	const char *path; /* dump to decode */
+
+	int records; /* boolean. print each record too */
+};
+
+/**
+ * @brief parse_opt - deals with given arguments based on given argumentsK
+ * @param int key - int correlating to char storing argument key
+ * @param char *arg - argument string associated with argument key
+ * @param struct argp_state *state - pointer to argp_state struct storing information about the state of the option parsing
+ * @return error_t - number storing 0 upon successfully parsed values, non-zero exit code otherwise
+ */
+static error_t parse_opt(int key, char *arg, struct argp_state *state)
+{
+	struct arguments *arguments = state->input;
+
+	switch (key) {
+		case 'r':
+			arguments->records = 1;
+			break;
+		case ARGP_KEY_ARG:
+			if (state->arg_num == 0) {
+				arguments->path = arg;
+			} else {
+				argp_usage(state);
+			}
+			break;
+		case ARGP_KEY_END:
+			if (state->arg_num < 1) {
+				argp_usage(state);
+			}
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+static struct argp argp = { /* argp - The ARGP structure itself */
+	options, /* list containing options */
+	parse_opt, /* callback function to process args */
+	args_doc, /* names of parameters */
+	doc, /* documentation containing general program description */
+};
+#pragma GCC diagnostic pop /* end of argp, so end of repressing weird messages */
+
+/**
+ * @brief TraceSpan (struct) - a stretch between two phase boundaries, reported as one line of the breakdown
+ */
+struct TraceSpan {
+	const char *name;
+
+	enum trace_phase from;
+
+	enum trace_phase to;
+};
+
+static const struct TraceSpan spans[] = {
+	{ "connect", TRACE_ACCEPTED, TRACE_CREDENTIALED },
+	{ "receive", TRACE_RECV_START, TRACE_RECV_DONE },
+	{ "dispatch", TRACE_RECV_DONE, TRACE_EXEC_START }, /* decoded to picked up. admission is part of execute - shed requests execute quickly */
+	{ "execute", TRACE_EXEC_START, TRACE_EXEC_DONE },
+	{ "respond", TRACE_EXEC_DONE, TRACE_SEND_DONE },
+	{ "total", TRACE_RECV_START, TRACE_SEND_DONE }
+};
+
+/**
+ * @brief command_name - names a traced command
+ * @param const uint8_t cmd - (uint8_t)request_command::*, or UINT8_MAX if the request never decoded
+ * @return const char * - printable name
+ */
+static const char *command_name(const uint8_t cmd)
+{
+	static const char *const names[] = { "ADD", "GET", "REMOVE", "RING", "EXPORT", "IMPORT", "GET_RANGE", "APPEND", "LIST", "SINCE" };
+	if (cmd < sizeof(names) / sizeof(names[0])) {
+		return names[cmd];
+	}
+
+	return (cmd == UINT8_MAX ? "(invalid)" : "(unknown)");
+}
+
+/**
+ * @brief ns_cmp - orders two durations, for qsort
+ * @param const void *a - first int64_t
+ * @param const void *b - second int64_t
+ * @return int - negative, zero or positive as a is less than, equal to or more than b
+ */
+static int ns_cmp(const void *a, const void *b)
+{
+	const int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief main - driver of `notetrace`
+ * @param int argc - number of arguments. should be 2 or 3
+ * @param char **argv - list of args as c-strings, null terminated
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading the dump, 2 is the dump isn't valid, 3 is error allocating memory
+ */
+int main(int argc, char **argv)
+{
+	/** Initialisation **/
+	struct arguments arguments;
+	arguments.path = NULL;
+	arguments.records = 0;
+	argp_parse(&argp, argc, argv, 0, 0, &arguments); /* number, content, etc. of cmd-line args checked here */
+
+	int exit_code = 0;
+	struct TraceRecord *records = NULL;
+	int64_t *durations = NULL;
+
+	/* Number 1: read the dump in whole
+	 * the header says how many records follow - anything short of that (or a header we don't recognise) is refused outright
+	 */
+	FILE *const dump = fopen(arguments.path, "rb");
+	if (dump == NULL) {
+		fprintf(stderr, "Error opening trace dump %s (errno %d: %s)\n", arguments.path, errno, strerror(errno));
+		return 1;
+	}
+
+	struct TraceDumpHeader header;
+	if (fread(&header, sizeof(header), 1, dump) != 1) {
+		fprintf(stderr, "Trace dump %s is truncated\n", arguments.path);
+		exit_code = 2;
+		goto eop;
+	}
+	if (header.magic != TRACE_DUMP_MAGIC || header.version != TRACE_DUMP_VERSION) {
+		fprintf(stderr, "%s isn't a trace dump this version understands (magic %#x, version %u)\n", arguments.path, (unsigned int)header.magic, (unsigned int)header.version);
+		exit_code = 2;
+		goto eop;
+	}
+	if (header.record_count > TRACE_RING_MAX) {
+		fprintf(stderr, "Trace dump %s claims %llu records - more than any ring holds\n", arguments.path, (unsigned long long)header.record_count);
+		exit_code = 2;
+		goto eop;
+	}
+
+	const size_t count = (size_t)header.record_count;
+	records = malloc((count > 0 ? count : 1) * sizeof(records[0]));
+	durations = malloc((count > 0 ? count : 1) * sizeof(durations[0]));
+	if (records == NULL || durations == NULL) {
+		fprintf(stderr, "Allocating block failed\n");
+		exit_code = 3;
+		goto eop;
+	}
+	if (fread(records, sizeof(records[0]), count, dump) != count) {
+		fprintf(stderr, "Trace dump %s is truncated\n", arguments.path);
+		exit_code = 2;
+		goto eop;
+	}
+
+	/** Main Program **/
+
+	/* Number 2: print each record, if asked to
+	 * each span it passed, then its total
+	 */
+	fprintf(stdout, "%llu request(s) in dump, %llu traced since startup\n", (unsigned long long)count, (unsigned long long)header.recorded);
+	if (arguments.records) {
+		for (size_t r = 0; r < count; ++r) {
+			const struct TraceRecord *const record = records + r;
+			const int64_t start = record->at_ns[TRACE_RECV_START];
+			fprintf(stdout, "%-10s id %-10llu uid %-6u status %u%s", command_name(record->cmd), (unsigned long long)record->id, (unsigned int)record->uid, (unsigned int)record->status, (record->ring ? " ring" : ""));
+			for (size_t s = 1; s < sizeof(spans) / sizeof(spans[0]) - 1; ++s) { /* every span bar connect (before the start) & total (the sum) */
+				if (record->at_ns[spans[s].from] != 0 && record->at_ns[spans[s].to] != 0) {
+					fprintf(stdout, "  %s %lldns", spans[s].name, (long long)(record->at_ns[spans[s].to] - record->at_ns[spans[s].from]));
+				}
+			}
+			if (start != 0 && record->at_ns[TRACE_SEND_DONE] != 0) {
+				fprintf(stdout, "  = %lldns", (long long)(record->at_ns[TRACE_SEND_DONE] - start));
+			}
+			fprintf(stdout, "\n");
+		}
+	}
+
+	/* Number 3: summarise each span across every request which passed both its ends */
+	fprintf(stdout, "%-8s %10s %12s %12s %12s %12s\n", "phase", "count", "mean ns", "p50 ns", "p99 ns", "max ns");
+	for (size_t s = 0; s < sizeof(spans) / sizeof(spans[0]); ++s) {
+		size_t n = 0;
+		long double sum = 0;
+		for (size_t r = 0; r < count; ++r) {
+			const int64_t from = records[r].at_ns[spans[s].from], to = records[r].at_ns[spans[s].to];
+			if (from != 0 && to != 0) {
+				durations[n++] = to - from;
+				sum += to - from;
+			}
+		}
+
+		if (n == 0) {
+			fprintf(stdout, "%-8s %10d %12s %12s %12s %12s\n", spans[s].name, 0, "-", "-", "-", "-");
+			continue;
+		}
+		qsort(durations, n, sizeof(durations[0]), ns_cmp);
+		fprintf(stdout, "%-8s %10lu %12.0Lf %12lld %12lld %12lld\n", spans[s].name, (unsigned long)n, sum / n, (long long)durations[(n - 1) / 2], (long long)durations[(n - 1) * 99 / 100], (long long)durations[n - 1]);
+	}
+
+	/** Cleanup **/
+eop:
+	free(durations);
+	free(records);
+	fclose(dump);
+
+	return exit_code;
+}
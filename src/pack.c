@@ -0,0 +1,764 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "store.h"
+#include "util.h"
+#include "pack.h"
+
+/**
+ * @brief Definitions of pack files
+ */
+
+#define PACK_TMP_NAME NOTICEBOARD_PACK_NAME ".tmp" /* a compaction's new pack, until it's renamed over the old */
+
+#define LZ_MIN_MATCH 4 /* shortest match worth encoding - a token & offset cost 3 bytes */
+#define LZ_LAST_LITERALS 5 /* matches stop this far from the end, so every body finishes with a run of literals */
+#define LZ_MAX_OFFSET 65535 /* offsets are 16 bits */
+#define LZ_HASH_BITS 12
+
+static uint8_t stored_buf[NOTICEBOARD_COLD_MAX_LEN]; /* a body as stored. never longer than the note itself */
+static uint8_t note_buf[NOTICEBOARD_COLD_MAX_LEN]; /* a note being packed */
+
+/**
+ * @brief PackHeader (struct) - a pack's header, decoded
+ */
+struct PackHeader {
+	uint64_t end;
+
+	uint64_t dead;
+};
+
+/**
+ * @brief RecordHeader (struct) - a record's fixed part & subject, decoded
+ */
+struct RecordHeader {
+	uint8_t flags;
+
+	uint8_t sbj_len;
+
+	uint32_t raw_len;
+
+	uint32_t stored_len;
+
+	uint32_t checksum;
+
+	int64_t created_ns;
+
+	char sbj[MAX_SBJ_LEN + 1]; /* null terminated */
+};
+
+/**
+ * @brief fnv1a - FNV-1a (32 bit), carried on from an earlier hash
+ * @param uint32_t hash - hash so far (2166136261 to start)
+ * @param const uint8_t *const buf - bytes to hash
+ * @param const size_t len - length of buf
+ * @return uint32_t - hash
+ */
+static uint32_t fnv1a(uint32_t hash, const uint8_t *const buf, const size_t len)
+{
+	for (size_t i = 0; i < len; ++i) {
+		hash = (hash ^ buf[i]) * 16777619u;
+	}
+
+	return hash;
+}
+
+/**
+ * @brief lz_put_len - appends the extension bytes of a length too long for its token nibble
+ * @param uint8_t *const dst - output
+ * @param const size_t cap - capacity of dst
+ * @param size_t *const pos - position in dst. advanced
+ * @param size_t rem - length less the 15 its nibble holds
+ * @return int - zero is success, non-zero is failure
+ * 1 is out of room
+ */
+static int lz_put_len(uint8_t *const dst, const size_t cap, size_t *const pos, size_t rem)
+{
+	for (;; rem -= 255) {
+		if (*pos == cap) {
+			return 1;
+		}
+		dst[(*pos)++] = (uint8_t)(rem >= 255 ? 255 : rem);
+		if (rem < 255) {
+			return 0;
+		}
+	}
+}
+
+/**
+ * @brief lz_emit - appends one sequence - a run of literals, then (unless it's the last) a match
+ * @param uint8_t *const dst - output
+ * @param const size_t cap - capacity of dst
+ * @param size_t *const pos - position in dst. advanced
+ * @param const uint8_t *const literals - bytes to copy as they are
+ * @param const size_t literal_len - length of literals
+ * @param const size_t offset - how far back the match starts. ignored for the last sequence
+ * @param const size_t match_len - length of match. 0 for the last sequence
+ * @return int - zero is success, non-zero is failure
+ * 1 is out of room
+ */
+static int lz_emit(uint8_t *const dst, const size_t cap, size_t *const pos, const uint8_t *const literals, const size_t literal_len, const size_t offset, const size_t match_len)
+{
+	if (*pos == cap) {
+		return 1;
+	}
+	const size_t match_code = (match_len == 0 ? 0 : match_len - LZ_MIN_MATCH);
+	dst[(*pos)++] = (uint8_t)(((literal_len < 15 ? literal_len : 15) << 4) | (match_code < 15 ? match_code : 15));
+
+	if (literal_len >= 15 && lz_put_len(dst, cap, pos, literal_len - 15) != 0) {
+		return 1;
+	}
+	if (literal_len > cap - *pos) {
+		return 1;
+	}
+	memcpy(dst + *pos, literals, literal_len);
+	*pos += literal_len;
+
+	if (match_len == 0) {
+		return 0;
+	}
+	if (cap - *pos < 2) {
+		return 1;
+	}
+	dst[(*pos)++] = (uint8_t)(offset & 0xFF);
+	dst[(*pos)++] = (uint8_t)(offset >> 8);
+
+	return (match_code >= 15 ? lz_put_len(dst, cap, pos, match_code - 15) : 0);
+}
+
+/**
+ * @brief lz_compress - compresses a body, LZ4 style (greedy, one candidate per hash)
+ * @param const uint8_t *const src - body
+ * @param const size_t len - length of src
+ * @param uint8_t *const dst - output
+ * @param const size_t cap - capacity of dst. compressing stops (failing) as soon as this is reached
+ * @return size_t - compressed length, 0 if it didn't fit within cap
+ */
+static size_t lz_compress(const uint8_t *const src, const size_t len, uint8_t *const dst, const size_t cap)
+{
+	static uint32_t table[1 << LZ_HASH_BITS]; /* position + 1 of the last 4 bytes seen with each hash. 0 is none */
+	memset(table, '\0', sizeof(table));
+
+	size_t pos = 0, anchor = 0, at = 0;
+	while (at + LZ_MIN_MATCH + LZ_LAST_LITERALS <= len) {
+		uint32_t seq;
+		memcpy(&seq, src + at, sizeof(seq));
+		const uint32_t hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+		const size_t candidate = table[hash];
+		table[hash] = (uint32_t)(at + 1);
+
+		uint32_t candidate_seq;
+		if (candidate == 0 || at - (candidate - 1) > LZ_MAX_OFFSET || (memcpy(&candidate_seq, src + candidate - 1, sizeof(candidate_seq)), candidate_seq != seq)) {
+			++at;
+			continue;
+		}
+
+		const size_t match_at = candidate - 1;
+		size_t match_len = LZ_MIN_MATCH;
+		while (at + match_len < len - LZ_LAST_LITERALS && src[match_at + match_len] == src[at + match_len]) {
+			++match_len;
+		}
+
+		if (lz_emit(dst, cap, &pos, src + anchor, at - anchor, at - match_at, match_len) != 0) {
+			return 0;
+		}
+		at += match_len;
+		anchor = at;
+	}
+
+	if (lz_emit(dst, cap, &pos, src + anchor, len - anchor, 0, 0) != 0) {
+		return 0;
+	}
+
+	return pos;
+}
+
+/**
+ * @brief lz_get_len - reads the extension bytes of a length, adding them on
+ * @param const uint8_t *const src - input
+ * @param const size_t len - length of src
+ * @param size_t *const pos - position in src. advanced
+ * @param size_t *const value - length to add to
+ * @return int - zero is success, non-zero is failure
+ * 1 is input ran out
+ */
+static int lz_get_len(const uint8_t *const src, const size_t len, size_t *const pos, size_t *const value)
+{
+	uint8_t byte;
+	do {
+		if (*pos == len) {
+			return 1;
+		}
+		byte = src[(*pos)++];
+		*value += byte;
+	} while (byte == 255);
+
+	return 0;
+}
+
+/**
+ * @brief lz_decompress - reverses lz_compress, checking every length & offset against the buffers
+ * @param const uint8_t *const src - compressed body
+ * @param const size_t len - length of src
+ * @param uint8_t *const dst - output
+ * @param const size_t cap - capacity of dst
+ * @param size_t *const out_len - filled with decompressed length
+ * @return int - zero is success, non-zero is failure
+ * 1 is malformed (or too long for dst)
+ */
+static int lz_decompress(const uint8_t *const src, const size_t len, uint8_t *const dst, const size_t cap, size_t *const out_len)
+{
+	size_t pos = 0, out = 0;
+	while (pos < len) {
+		const uint8_t token = src[pos++];
+
+		size_t literal_len = token >> 4;
+		if (literal_len == 15 && lz_get_len(src, len, &pos, &literal_len) != 0) {
+			return 1;
+		}
+		if (literal_len > len - pos || literal_len > cap - out) {
+			return 1;
+		}
+		memcpy(dst + out, src + pos, literal_len);
+		pos += literal_len;
+		out += literal_len;
+
+		if (pos == len) { /* last sequence - literals only */
+			break;
+		}
+
+		if (len - pos < 2) {
+			return 1;
+		}
+		const size_t offset = (size_t)src[pos] | ((size_t)src[pos + 1] << 8);
+		pos += 2;
+
+		size_t match_len = token & 0x0F;
+		if (match_len == 15 && lz_get_len(src, len, &pos, &match_len) != 0) {
+			return 1;
+		}
+		match_len += LZ_MIN_MATCH;
+		if (offset == 0 || offset > out || match_len > cap - out) {
+			return 1;
+		}
+		for (size_t i = 0; i < match_len; ++i, ++out) { /* byte at a time - a match may overlap what it's copying */
+			dst[out] = dst[out - offset];
+		}
+	}
+
+	*out_len = out;
+	return 0;
+}
+
+/**
+ * @brief header_read - reads & checks a pack's header
+ * @param const int fd - pack
+ * @param struct PackHeader *const header - filled in
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading, 2 is not a pack (or not one we understand)
+ */
+static int header_read(const int fd, struct PackHeader *const header)
+{
+	uint8_t buf[PACK_HEADER_LEN];
+	if (pread_all(fd, buf, sizeof(buf), 0) != 0) {
+		return 1;
+	}
+
+	uint32_t magic, version;
+	memcpy(&magic, buf, sizeof(magic));
+	memcpy(&version, buf + 4, sizeof(version));
+	memcpy(&header->end, buf + 8, sizeof(header->end));
+	memcpy(&header->dead, buf + 16, sizeof(header->dead));
+	header->end = le64toh(header->end);
+	header->dead = le64toh(header->dead);
+	if (le32toh(magic) != PACK_MAGIC || le32toh(version) != PACK_VERSION || header->end < PACK_HEADER_LEN) {
+		return 2;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief header_write - writes a pack's header
+ * @param const int fd - pack
+ * @param const struct PackHeader *const header - header
+ * @return int - zero is success, non-zero is failure
+ * 1 is error writing
+ */
+static int header_write(const int fd, const struct PackHeader *const header)
+{
+	uint8_t buf[PACK_HEADER_LEN] = {0};
+	const uint32_t magic = htole32(PACK_MAGIC), version = htole32(PACK_VERSION);
+	const uint64_t end = htole64(header->end), dead = htole64(header->dead);
+	memcpy(buf, &magic, sizeof(magic));
+	memcpy(buf + 4, &version, sizeof(version));
+	memcpy(buf + 8, &end, sizeof(end));
+	memcpy(buf + 16, &dead, sizeof(dead));
+
+	return pwrite_all(fd, buf, sizeof(buf), 0);
+}
+
+/**
+ * @brief record_read - reads & checks a record's fixed part & subject
+ * @param const int fd - pack
+ * @param const uint64_t offset - record
+ * @param const uint64_t end - pack's end. the whole record must lie before it
+ * @param struct RecordHeader *const record - filled in
+ * @return int - zero is success, non-zero is failure
+ * 1 is error reading, 2 is corrupt
+ */
+static int record_read(const int fd, const uint64_t offset, const uint64_t end, struct RecordHeader *const record)
+{
+	uint8_t buf[PACK_RECORD_FIXED_LEN + MAX_SBJ_LEN];
+	if (offset < PACK_HEADER_LEN || offset + PACK_RECORD_FIXED_LEN > end) {
+		return 2;
+	}
+	if (pread_all(fd, buf, (end - offset < sizeof(buf) ? (size_t)(end - offset) : sizeof(buf)), offset) != 0) {
+		return 1;
+	}
+
+	record->flags = buf[0];
+	record->sbj_len = buf[1];
+	memcpy(&record->raw_len, buf + 4, sizeof(record->raw_len));
+	memcpy(&record->stored_len, buf + 8, sizeof(record->stored_len));
+	memcpy(&record->checksum, buf + 12, sizeof(record->checksum));
+	memcpy(&record->created_ns, buf + 16, sizeof(record->created_ns));
+	record->raw_len = le32toh(record->raw_len);
+	record->stored_len = le32toh(record->stored_len);
+	record->checksum = le32toh(record->checksum);
+	record->created_ns = (int64_t)le64toh((uint64_t)record->created_ns);
+
+	if (
+		record->sbj_len < 1 || record->sbj_len > MAX_SBJ_LEN
+		||
+		record->raw_len > NOTICEBOARD_COLD_MAX_LEN || record->stored_len > record->raw_len
+		||
+		offset + PACK_RECORD_FIXED_LEN + record->sbj_len + record->stored_len > end
+	) {
+		return 2;
+	}
+	memcpy(record->sbj, buf + PACK_RECORD_FIXED_LEN, record->sbj_len);
+	record->sbj[record->sbj_len] = '\0';
+
+	return 0;
+}
+
+/**
+ * @brief record_len - bytes a record takes up in its pack
+ * @param const struct RecordHeader *const record - record
+ * @return uint64_t - length
+ */
+static inline uint64_t record_len(const struct RecordHeader *const record)
+{
+	return PACK_RECORD_FIXED_LEN + record->sbj_len + record->stored_len;
+}
+
+/**
+ * @brief record_write - writes a record - fixed part, subject & stored body
+ * @param const int fd - pack
+ * @param const uint64_t offset - where
+ * @param const struct RecordHeader *const record - record
+ * @param const uint8_t *const stored - stored body, record->stored_len long
+ * @return int - zero is success, non-zero is failure
+ * 1 is error writing
+ */
+static int record_write(const int fd, const uint64_t offset, const struct RecordHeader *const record, const uint8_t *const stored)
+{
+	uint8_t buf[PACK_RECORD_FIXED_LEN + MAX_SBJ_LEN] = {0};
+	const uint32_t raw_len = htole32(record->raw_len), stored_len = htole32(record->stored_len), checksum = htole32(record->checksum);
+	const uint64_t created_ns = htole64((uint64_t)record->created_ns);
+	buf[0] = record->flags;
+	buf[1] = record->sbj_len;
+	memcpy(buf + 4, &raw_len, sizeof(raw_len));
+	memcpy(buf + 8, &stored_len, sizeof(stored_len));
+	memcpy(buf + 12, &checksum, sizeof(checksum));
+	memcpy(buf + 16, &created_ns, sizeof(created_ns));
+	memcpy(buf + PACK_RECORD_FIXED_LEN, record->sbj, record->sbj_len);
+
+	if (pwrite_all(fd, buf, PACK_RECORD_FIXED_LEN + record->sbj_len, offset) != 0) {
+		return 1;
+	}
+
+	return pwrite_all(fd, stored, record->stored_len, offset + PACK_RECORD_FIXED_LEN + record->sbj_len);
+}
+
+int pack_for_each(const int uid_dir_fd, const pack_visitor visitor, void *const ctx)
+{
+	const int fd = openat(uid_dir_fd, NOTICEBOARD_PACK_NAME, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno == ENOENT) {
+			return 0;
+		}
+		fprintf(stderr, "Error opening pack (errno %d: %s)\n", errno, strerror(errno));
+		return -1;
+	}
+
+	struct PackHeader header;
+	int exit_code = 0;
+	if (header_read(fd, &header) != 0) {
+		fprintf(stderr, "Pack is unreadable - its notes are unreachable until it's repaired\n");
+		exit_code = -1;
+	}
+
+	for (uint64_t offset = PACK_HEADER_LEN; exit_code == 0 && offset < header.end;) {
+		struct RecordHeader record;
+		if (record_read(fd, offset, header.end, &record) != 0) {
+			fprintf(stderr, "Pack record at offset %llu is unreadable - notes packed after it are unreachable\n", (unsigned long long)offset);
+			exit_code = -1;
+			break;
+		}
+
+		if (record.flags & PACK_FLAG_LIVE) {
+			struct PackRecord found = { .offset = offset, .created_ns = record.created_ns, .raw_len = record.raw_len, .sbj_len = record.sbj_len };
+			memcpy(found.sbj, record.sbj, (size_t)record.sbj_len + 1);
+			exit_code = visitor(&found, ctx);
+		}
+		offset += record_len(&record);
+	}
+	close(fd);
+
+	return exit_code;
+}
+
+int pack_read(const int uid_dir_fd, const uint64_t offset, const char *const sbj, uint8_t *const buf, uint32_t *const len)
+{
+	const int fd = openat(uid_dir_fd, NOTICEBOARD_PACK_NAME, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1) {
+		fprintf(stderr, "Error opening pack (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	int exit_code = 0;
+	struct PackHeader header;
+	struct RecordHeader record;
+	if ((exit_code = header_read(fd, &header)) != 0 || (exit_code = record_read(fd, offset, header.end, &record)) != 0) {
+		goto end;
+	}
+	if (!(record.flags & PACK_FLAG_LIVE) || strcmp(record.sbj, sbj) != 0) {
+		exit_code = 2;
+		goto end;
+	}
+
+	uint8_t *const stored = ((record.flags & PACK_FLAG_COMPRESSED) ? stored_buf : buf); /* uncompressed bodies go straight where they're wanted */
+	if (pread_all(fd, stored, record.stored_len, offset + PACK_RECORD_FIXED_LEN + record.sbj_len) != 0) {
+		exit_code = 1;
+		goto end;
+	}
+	if (fnv1a(fnv1a(2166136261u, (const uint8_t *)record.sbj, record.sbj_len), stored, record.stored_len) != record.checksum) {
+		exit_code = 2;
+		goto end;
+	}
+
+	size_t raw_len = record.stored_len;
+	if ((record.flags & PACK_FLAG_COMPRESSED) && (lz_decompress(stored, record.stored_len, buf, NOTICEBOARD_COLD_MAX_LEN, &raw_len) != 0 || raw_len != record.raw_len)) {
+		exit_code = 2;
+		goto end;
+	}
+	*len = (uint32_t)raw_len;
+
+end:
+	if (exit_code == 1) {
+		fprintf(stderr, "Error reading packed note %s (errno %d: %s)\n", sbj, errno, strerror(errno));
+	} else if (exit_code == 2) {
+		fprintf(stderr, "Packed note %s is corrupt\n", sbj);
+	}
+	close(fd);
+
+	return exit_code;
+}
+
+int pack_add(const int uid_dir_fd, struct PackNote *const notes, const size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		notes[i].offset = 0;
+	}
+
+	const int fd = openat(uid_dir_fd, NOTICEBOARD_PACK_NAME, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, STORE_NOTE_PERMISSIONS);
+	if (fd == -1) {
+		fprintf(stderr, "Error opening pack (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	struct PackHeader header = { .end = PACK_HEADER_LEN, .dead = 0 };
+	struct stat statbuf;
+	if (fstat(fd, &statbuf) != 0 || (statbuf.st_size >= PACK_HEADER_LEN && header_read(fd, &header) != 0)) { /* anything shorter is a pack whose creation never finished */
+		fprintf(stderr, "Pack is unreadable - not adding to it\n");
+		close(fd);
+		return 1;
+	}
+
+	if (futimens(uid_dir_fd, NULL) != 0) { /* before anything's written - a crash part way through then always has the user rescanned, not taken from a snapshot */
+		fprintf(stderr, "Error touching notes directory (errno %d: %s)\n", errno, strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	uint64_t pos = header.end; /* anything past the end is a torn append, so is written over */
+	for (size_t i = 0; i < count; ++i) {
+		struct PackNote *const note = &notes[i];
+		const int note_fd = openat(uid_dir_fd, note->sbj, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+		if (note_fd == -1) {
+			continue;
+		}
+		struct stat note_stat;
+		const int readable = (fstat(note_fd, &note_stat) == 0 && S_ISREG(note_stat.st_mode) && note_stat.st_size > 0 && note_stat.st_size <= NOTICEBOARD_COLD_MAX_LEN && pread_all(note_fd, note_buf, (size_t)note_stat.st_size, 0) == 0);
+		close(note_fd);
+		if (!readable) {
+			continue;
+		}
+
+		struct RecordHeader record = { .flags = PACK_FLAG_LIVE, .sbj_len = (uint8_t)strlen(note->sbj), .raw_len = (uint32_t)note_stat.st_size, .created_ns = note->created_ns };
+		memcpy(record.sbj, note->sbj, (size_t)record.sbj_len + 1);
+		const size_t compressed_len = lz_compress(note_buf, record.raw_len, stored_buf, record.raw_len - 1); /* only kept if it's smaller */
+		const uint8_t *const stored = (compressed_len > 0 ? stored_buf : note_buf);
+		record.stored_len = (compressed_len > 0 ? (uint32_t)compressed_len : record.raw_len);
+		record.flags |= (compressed_len > 0 ? PACK_FLAG_COMPRESSED : 0);
+		record.checksum = fnv1a(fnv1a(2166136261u, (const uint8_t *)record.sbj, record.sbj_len), stored, record.stored_len);
+
+		if (record_write(fd, pos, &record, stored) != 0) {
+			goto fail;
+		}
+		note->offset = pos;
+		pos += record_len(&record);
+	}
+
+	if (pos == header.end) { /* nothing to add after all */
+		if (statbuf.st_size < PACK_HEADER_LEN && unlinkat(uid_dir_fd, NOTICEBOARD_PACK_NAME, 0) != 0) { /* else an empty pack's left behind, which reads as unreadable */
+			fprintf(stderr, "Error deleting empty pack (errno %d: %s)\n", errno, strerror(errno));
+		}
+		close(fd);
+		return 0;
+	}
+
+	header.end = pos;
+	if (fdatasync(fd) != 0 || header_write(fd, &header) != 0 || fdatasync(fd) != 0) { /* records are on disk before the header owns up to them */
+		goto fail;
+	}
+	close(fd);
+
+	for (size_t i = 0; i < count; ++i) { /* packed - the record is the note now */
+		if (notes[i].offset != 0 && unlinkat(uid_dir_fd, notes[i].sbj, 0) != 0) {
+			fprintf(stderr, "Error deleting packed note's file %s (errno %d: %s)\n", notes[i].sbj, errno, strerror(errno));
+		}
+	}
+
+	return 0;
+
+fail:
+	fprintf(stderr, "Error writing pack (errno %d: %s)\n", errno, strerror(errno));
+	for (size_t i = 0; i < count; ++i) {
+		notes[i].offset = 0;
+	}
+	close(fd);
+	return 1;
+}
+
+int pack_compact_begin(const int uid_dir_fd, struct PackCompaction *const compaction)
+{
+	compaction->dir_fd = -1;
+	compaction->old_fd = -1;
+	compaction->fd = -1;
+
+	struct PackHeader old_header;
+	compaction->old_fd = openat(uid_dir_fd, NOTICEBOARD_PACK_NAME, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (compaction->old_fd == -1 || header_read(compaction->old_fd, &old_header) != 0) {
+		fprintf(stderr, "Error reading pack to compact (errno %d: %s)\n", errno, strerror(errno));
+		if (compaction->old_fd != -1) {
+			close(compaction->old_fd);
+			compaction->old_fd = -1;
+		}
+		return 1;
+	}
+
+	compaction->dir_fd = fcntl(uid_dir_fd, F_DUPFD_CLOEXEC, 0);
+	compaction->fd = (compaction->dir_fd == -1 ? -1 : openat(compaction->dir_fd, PACK_TMP_NAME, O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, STORE_NOTE_PERMISSIONS)); /* truncated - whatever's there is left from a compaction that never finished */
+	if (compaction->fd == -1) {
+		fprintf(stderr, "Error creating compacted pack (errno %d: %s)\n", errno, strerror(errno));
+		if (compaction->dir_fd != -1) {
+			close(compaction->dir_fd);
+			compaction->dir_fd = -1;
+		}
+		close(compaction->old_fd);
+		compaction->old_fd = -1;
+		return 2;
+	}
+
+	compaction->old_end = old_header.end;
+	compaction->end = PACK_HEADER_LEN;
+	compaction->dead = 0;
+
+	return 0;
+}
+
+int pack_compact_copy(struct PackCompaction *const compaction, struct PackNote *const notes, const size_t count)
+{
+	const uint64_t start = compaction->end;
+	for (size_t i = 0; i < count; ++i) {
+		const uint64_t offset = notes[i].offset;
+		notes[i].offset = 0;
+
+		struct RecordHeader record;
+		const int ret = record_read(compaction->old_fd, offset, compaction->old_end, &record);
+		if (ret == 1 || (ret == 0 && pread_all(compaction->old_fd, stored_buf, record.stored_len, offset + PACK_RECORD_FIXED_LEN + record.sbj_len) != 0)) {
+			fprintf(stderr, "Error reading pack to compact (errno %d: %s)\n", errno, strerror(errno));
+			pack_compact_abandon(compaction);
+			return 1;
+		}
+		if (ret == 2 || !(record.flags & PACK_FLAG_LIVE) || strcmp(record.sbj, notes[i].sbj) != 0) { /* not where it was said to be - left behind */
+			fprintf(stderr, "Packed note %s is corrupt - dropping it from the pack\n", notes[i].sbj);
+			continue;
+		}
+
+		if (record_write(compaction->fd, compaction->end, &record, stored_buf) != 0) {
+			fprintf(stderr, "Error writing compacted pack (errno %d: %s)\n", errno, strerror(errno));
+			pack_compact_abandon(compaction);
+			return 2;
+		}
+		notes[i].offset = compaction->end;
+		compaction->end += record_len(&record);
+	}
+
+	if (compaction->end > start && sync_file_range(compaction->fd, (off_t)start, (off_t)(compaction->end - start), SYNC_FILE_RANGE_WRITE) != 0) { /* only a head start for pack_compact_finish's sync, so not fatal */
+		fprintf(stderr, "Error starting writeback of compacted pack (errno %d: %s)\n", errno, strerror(errno));
+	}
+
+	return 0;
+}
+
+int pack_compact_drop(struct PackCompaction *const compaction, const uint64_t offset)
+{
+	struct RecordHeader record;
+	if (record_read(compaction->fd, offset, compaction->end, &record) != 0) {
+		fprintf(stderr, "Error reading compacted pack record at offset %llu (errno %d: %s)\n", (unsigned long long)offset, errno, strerror(errno));
+		pack_compact_abandon(compaction);
+		return 1;
+	}
+	if (!(record.flags & PACK_FLAG_LIVE)) { /* dropped already */
+		return 0;
+	}
+
+	const uint8_t flags = record.flags & (uint8_t)~PACK_FLAG_LIVE;
+	if (pwrite_all(compaction->fd, &flags, sizeof(flags), offset) != 0) {
+		fprintf(stderr, "Error marking compacted pack record at offset %llu dead (errno %d: %s)\n", (unsigned long long)offset, errno, strerror(errno));
+		pack_compact_abandon(compaction);
+		return 1;
+	}
+	compaction->dead += record_len(&record);
+
+	return 0;
+}
+
+int pack_compact_finish(struct PackCompaction *const compaction)
+{
+	if (compaction->end - PACK_HEADER_LEN == compaction->dead) { /* nothing live left to keep */
+		if (unlinkat(compaction->dir_fd, NOTICEBOARD_PACK_NAME, 0) != 0 && errno != ENOENT) {
+			fprintf(stderr, "Error deleting empty pack (errno %d: %s)\n", errno, strerror(errno));
+			pack_compact_abandon(compaction);
+			return 2;
+		}
+		pack_compact_abandon(compaction);
+		return 0;
+	}
+
+	const struct PackHeader header = { .end = compaction->end, .dead = compaction->dead };
+	if (header_write(compaction->fd, &header) != 0 || fdatasync(compaction->fd) != 0 || renameat(compaction->dir_fd, PACK_TMP_NAME, compaction->dir_fd, NOTICEBOARD_PACK_NAME) != 0) {
+		fprintf(stderr, "Error compacting pack (errno %d: %s)\n", errno, strerror(errno));
+		pack_compact_abandon(compaction);
+		return 2;
+	}
+
+	close(compaction->fd);
+	close(compaction->old_fd);
+	close(compaction->dir_fd);
+	compaction->fd = -1;
+	compaction->old_fd = -1;
+	compaction->dir_fd = -1;
+
+	return 0;
+}
+
+void pack_compact_abandon(struct PackCompaction *const compaction)
+{
+	if (compaction->dir_fd == -1) {
+		return;
+	}
+
+	close(compaction->fd);
+	close(compaction->old_fd);
+	unlinkat(compaction->dir_fd, PACK_TMP_NAME, 0);
+	close(compaction->dir_fd);
+	compaction->fd = -1;
+	compaction->old_fd = -1;
+	compaction->dir_fd = -1;
+}
+
+int pack_kill(const int uid_dir_fd, const uint64_t offset)
+{
+	const int fd = openat(uid_dir_fd, NOTICEBOARD_PACK_NAME, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1) {
+		fprintf(stderr, "Error opening pack (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	int exit_code = 0;
+	struct PackHeader header;
+	struct RecordHeader record;
+	if (header_read(fd, &header) != 0 || record_read(fd, offset, header.end, &record) != 0) {
+		exit_code = 1;
+		goto end;
+	}
+	if (!(record.flags & PACK_FLAG_LIVE)) { /* dead already */
+		goto end;
+	}
+
+	const uint8_t flags = record.flags & (uint8_t)~PACK_FLAG_LIVE;
+	header.dead += record_len(&record);
+	if (pwrite_all(fd, &flags, sizeof(flags), offset) != 0 || header_write(fd, &header) != 0) {
+		exit_code = 1;
+		goto end;
+	}
+
+	if (futimens(uid_dir_fd, NULL) != 0) {
+		fprintf(stderr, "Error touching notes directory (errno %d: %s)\n", errno, strerror(errno));
+	}
+
+end:
+	if (exit_code != 0) {
+		fprintf(stderr, "Error marking pack record at offset %llu dead (errno %d: %s)\n", (unsigned long long)offset, errno, strerror(errno));
+	}
+	close(fd);
+
+	return exit_code;
+}
+
+int pack_usage(const int uid_dir_fd, uint64_t *const end, uint64_t *const dead)
+{
+	*end = 0;
+	*dead = 0;
+
+	const int fd = openat(uid_dir_fd, NOTICEBOARD_PACK_NAME, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1) {
+		return (errno == ENOENT ? 0 : 1);
+	}
+
+	struct PackHeader header;
+	const int ret = header_read(fd, &header);
+	close(fd);
+	if (ret != 0) {
+		return 1;
+	}
+	*end = header.end;
+	*dead = header.dead;
+
+	return 0;
+}
@@ -1,8 +1,8 @@
 #include <stdint.h>
+#include <endian.h>
 #include <limits.h>
 #include <stdio.h>
 #include <string.h>
-#include <unistd.h>
 
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -11,11 +11,43 @@
 
 #include "response.h"
 #include "request.h"
+#include "subject.h"
 
 /**
  * @brief Definition of functionality to manage requests from client to server
  */
 
+/**
+ * @brief request_command_valid - checks command byte is one we understand
+ * @param const uint8_t cmd - command byte as received
+ * @return int - Boolean. 1 if valid, 0 if not
+ */
+static inline int request_command_valid(const uint8_t cmd)
+{
+	return (cmd == ADD || cmd == GET || cmd == REMOVE || cmd == RING || cmd == EXPORT || cmd == IMPORT || cmd == GET_RANGE || cmd == APPEND || cmd == LIST || cmd == SINCE);
+}
+
+/**
+ * @brief request_take_subject - validates a received subject & stores it, trimmed (see subject.h)
+ * @param struct Request *const client_request - request with sbj_len filled in. sbj_content & sbj_len are replaced with the trimmed subject
+ * @param const uint8_t *const sbj - subject as received
+ * @return int - zero is success, non-zero is failure
+ * 2 is invalid subject
+ */
+static int request_take_subject(struct Request *const client_request, const uint8_t *const sbj)
+{
+	size_t offset, len;
+	if (subject_check(sbj, client_request->sbj_len, &offset, &len) != 0) {
+		return 2;
+	}
+
+	memmove(client_request->sbj_content, sbj + offset, len); /* the one copy - the subject is taken from where it starts, rather than shifted there afterwards */
+	memset(client_request->sbj_content + len, '\0', MAX_SBJ_LEN - len);
+	client_request->sbj_len = (uint32_t)len;
+
+	return 0;
+}
+
 int request_send(const struct Request *const client_request, const int server_sock)
 {
 	if (client_request == NULL) {
@@ -23,128 +55,305 @@ int request_send(const struct Request *const client_request, const int server_so
 		return 1;
 	}
 
-	if (client_request->sbj_content == NULL) {
-		fprintf(stderr, "Mandatory subject content field points cannot be invalid - was given %p\n", client_request->sbj_content);
+	if (client_request->extra_data_len != 0 && client_request->extra_data_content == NULL) {
+		fprintf(stderr, "Extra data to be sent requested (%lu) but memory location invalid (%p)\n", (const uint64_t)client_request->extra_data_len, client_request->extra_data_content);
 		return 1;
 	}
 
-	if (client_request->extra_data_len != 0 && client_request->extra_data_content == NULL) {
-		fprintf(stderr, "Extra data to be sent requested (%lu) but memory location invalid (%p)\n", (const uint64_t)client_request->extra_data_len, client_request->extra_data_content);
+	uint8_t encoded[MAX_REQUEST_LEN];
+	size_t encoded_len;
+	if (request_encode(client_request, encoded, sizeof(encoded), &encoded_len) != 0) {
 		return 1;
 	}
 
-	if (
-		send(server_sock, &client_request->cmd, sizeof(client_request->cmd), 0) != sizeof(client_request->cmd)
-		||
-		send(server_sock, &client_request->sbj_len, sizeof(client_request->sbj_len), 0) != sizeof(client_request->sbj_len)
-		||
-		send(server_sock, client_request->sbj_content, client_request->sbj_len, 0) != (ssize_t)client_request->sbj_len
-		||
-		send(server_sock, &client_request->extra_data_len, sizeof(client_request->extra_data_len), 0) != sizeof(client_request->extra_data_len)
-	) { /* || is short circuit operator so once one fails it'll die (https://en.wikipedia.org/wiki/Short-circuit_evaluation) */
+	if (send(server_sock, encoded, encoded_len, 0) != (ssize_t)encoded_len) { /* one send per request, rather than one per field */
 		fprintf(stderr, "Error sending request (errno %d: %s)\n", errno, strerror(errno));
 		return 2;
 	}
 
-	if (client_request->extra_data_len > 0) { /* we've already verified whether extra_data_content is valid or not so we just check if we need to send anything at all */
-		if (send(server_sock, client_request->extra_data_content, client_request->extra_data_len, 0) != (ssize_t)client_request->extra_data_len) {
-			fprintf(stderr, "Error sending request (errno %d: %s)\n", errno, strerror(errno));
-			return 2;
-		}
+	return 0;
+}
+
+/**
+ * @brief frame_v2 - request_frame for a v2 request
+ * @param const uint8_t *const buf - bytes received so far, starting with PROTOCOL_MAGIC_BYTE
+ * @param const size_t buf_len - number of bytes in buf
+ * @param size_t *const frame_len - as per request_frame
+ * @param uint8_t *const cmd - as per request_frame
+ * @return int - as per request_frame
+ */
+static int frame_v2(const uint8_t *const buf, const size_t buf_len, size_t *const frame_len, uint8_t *const cmd)
+{
+	if (buf_len < REQUEST_V2_HEADER_LEN) {
+		return 1;
 	}
 
+	uint32_t magic, sbj_len, extra_data_len;
+	memcpy(&magic, buf, sizeof(magic));
+	memcpy(&sbj_len, buf + 16, sizeof(sbj_len));
+	memcpy(&extra_data_len, buf + 20, sizeof(extra_data_len));
+	sbj_len = le32toh(sbj_len);
+	extra_data_len = le32toh(extra_data_len);
+
+	if (le32toh(magic) != PROTOCOL_MAGIC || buf[4] != PROTOCOL_V2) {
+		fprintf(stderr, "Invalid request: unsupported protocol version\n");
+		return 2;
+	}
+	if (!request_command_valid(buf[5])) {
+		fprintf(stderr, "Invalid request: command unrecognised\n");
+		return 2;
+	}
+	if (sbj_len < 1 || sbj_len > MAX_SBJ_LEN) {
+		fprintf(stderr, "Invalid subject length: bad length (%u)\n", sbj_len);
+		return 2;
+	}
+	if (extra_data_len > MAX_EXTRA_DATA_LEN) {
+		fprintf(stderr, "Invalid extra data length: too long (maximum %d, given %u)\n", MAX_EXTRA_DATA_LEN, extra_data_len);
+		return 2;
+	}
+
+	*frame_len = REQUEST_V2_HEADER_LEN + sbj_len + extra_data_len;
+	*cmd = buf[5];
 	return 0;
 }
 
-int request_recv(struct Request *const client_request, const int client_sock)
+int request_frame(const uint8_t *const buf, const size_t buf_len, size_t *const frame_len, uint8_t *const cmd)
 {
-	if (client_request == NULL) {
-		fprintf(stderr, "Request struct to fill cannot be NULL\n");
+	if (buf_len < sizeof(uint8_t)) {
+		return 1;
+	}
+	if (buf[0] == PROTOCOL_MAGIC_BYTE) {
+		return frame_v2(buf, buf_len, frame_len, cmd);
+	}
+	if (!request_command_valid(buf[0])) {
+		fprintf(stderr, "Invalid request: command unrecognised\n");
 		return 2;
 	}
 
-	/* reading command */
-	if (read(client_sock, &client_request->cmd, sizeof(client_request->cmd)) != sizeof(client_request->cmd)) {
-		fprintf(stderr, "Error reading command component (errno %d: %s)\n", errno, strerror(errno));
+	if (buf_len < sizeof(uint8_t) + sizeof(uint32_t)) {
 		return 1;
 	}
+	uint32_t sbj_len;
+	memcpy(&sbj_len, buf + sizeof(uint8_t), sizeof(sbj_len));
+	if (sbj_len < 1 || sbj_len > MAX_SBJ_LEN) {
+		fprintf(stderr, "Invalid subject length: bad length (%u)\n", sbj_len);
+		return 2;
+	}
 
-	if (client_request->cmd != ADD && client_request->cmd != GET && client_request->cmd != REMOVE) {
-		fprintf(stderr, "Invalid request: command unrecognised\n");
+	const size_t header_len = sizeof(uint8_t) + sizeof(uint32_t) + sbj_len + sizeof(uint32_t);
+	if (buf_len < header_len) {
+		return 1;
+	}
+	uint32_t extra_data_len;
+	memcpy(&extra_data_len, buf + header_len - sizeof(uint32_t), sizeof(extra_data_len));
+	if (extra_data_len > MAX_EXTRA_DATA_LEN) {
+		fprintf(stderr, "Invalid extra data length: too long (maximum %d, given %u)\n", MAX_EXTRA_DATA_LEN, extra_data_len);
 		return 2;
 	}
 
-	/* reading sbj_len */
-	ssize_t those_read = read(client_sock, &client_request->sbj_len, sizeof(client_request->sbj_len));
-	if (those_read != sizeof(client_request->sbj_len)) {
-		fprintf(stderr, "Error reading subject length component (errno %d: %s) (given %ld, wanted %ld)\n", errno, strerror(errno), those_read, sizeof(client_request->sbj_len));
+	*frame_len = header_len + extra_data_len;
+	*cmd = buf[0];
+	return 0;
+}
+
+size_t request_handle_count(const uint8_t cmd)
+{
+	switch (cmd) {
+		case RING:
+			return 3; /* memfd, request doorbell, response doorbell */
+		case EXPORT:
+		case IMPORT:
+			return 1; /* archive */
+		default:
+			return 0;
+	}
+}
+
+int request_encode(const struct Request *const client_request, uint8_t *const buf, const size_t buf_len, size_t *const encoded_len)
+{
+	if (client_request == NULL || buf == NULL || encoded_len == NULL) {
+		fprintf(stderr, "Request struct & buffers cannot be NULL\n");
 		return 1;
 	}
 
-	if (client_request->sbj_len < 1 || client_request->sbj_len > MAX_SBJ_LEN) {
-		fprintf(stderr, "Invalid subject length: bad length (%u)\n", client_request->sbj_len);
-		return 2;
+	const int v2 = (client_request->version == PROTOCOL_V2);
+	const uint32_t ttl_len = (client_request->ttl_s != 0 ? REQUEST_TTL_LEN : 0); /* sent ahead of the extra data */
+	if (ttl_len > 0 && (!v2 || client_request->cmd != ADD)) {
+		fprintf(stderr, "Only v2 ADD requests can carry a time to live\n");
+		return 1;
 	}
 
-	/* reading sbj_content */
-	if (client_request->sbj_content == NULL) {
-		fprintf(stderr, "Subject content field cannot be NULL\n");
-		return 2;
+	if (client_request->sbj_len > MAX_SBJ_LEN || client_request->extra_data_len > MAX_EXTRA_DATA_LEN - ttl_len) {
+		fprintf(stderr, "Request fields exceed acceptable lengths (subject %u, extra data %u)\n", client_request->sbj_len, client_request->extra_data_len);
+		return 1;
 	}
 
-	if (read(client_sock, client_request->sbj_content, client_request->sbj_len) != (ssize_t)client_request->sbj_len) {
-		fprintf(stderr, "Error reading subject content component (errno %d: %s)\n", errno, strerror(errno));
+	if (client_request->extra_data_len != 0 && client_request->extra_data_content == NULL) {
+		fprintf(stderr, "Extra data to be sent requested (%lu) but memory location invalid (%p)\n", (const uint64_t)client_request->extra_data_len, client_request->extra_data_content);
 		return 1;
 	}
 
-	for (size_t i = 0; i < client_request->sbj_len; ++i) { /* sanitise input - subject forms filename plus generally has expectation to be reasonable */
-		const char current_chr = client_request->sbj_content[i];
-		switch (current_chr) {
-			case ';':
-			case '/':
-			case '.':
-			case '\\':
-				fprintf(stderr, "Subject content field contains '%c', which is an invalid character\n", current_chr);
-				return 2;
-		}
+	const size_t needed = (v2 ? REQUEST_V2_HEADER_LEN : sizeof(client_request->cmd) + sizeof(client_request->sbj_len) + sizeof(client_request->extra_data_len)) + client_request->sbj_len + ttl_len + client_request->extra_data_len;
+	if (needed > buf_len) {
+		fprintf(stderr, "Buffer too small to encode request (need %lu, have %lu)\n", (unsigned long)needed, (unsigned long)buf_len);
+		return 1;
 	}
 
-	size_t last_initial_whitespace; /* records where the last whitespace is */
-	for (last_initial_whitespace = 0; last_initial_whitespace < client_request->sbj_len; ++last_initial_whitespace) {
-		const char current_chr = client_request->sbj_content[last_initial_whitespace];
-		if (current_chr != '\t' && current_chr != '\n' && current_chr != ' ' && current_chr != '\r') {
-			break;
+	uint8_t *pos = buf;
+	if (v2) { /* fixed header, then subject, then extra data */
+		const uint32_t magic = htole32(PROTOCOL_MAGIC);
+		const uint16_t flags = htole16(client_request->flags | (ttl_len > 0 ? REQUEST_FLAG_TTL : 0));
+		const uint64_t id = htole64(client_request->id);
+		const uint32_t sbj_len = htole32(client_request->sbj_len);
+		const uint32_t extra_data_len = htole32(ttl_len + client_request->extra_data_len);
+		memcpy(pos, &magic, sizeof(magic));
+		pos[4] = PROTOCOL_V2;
+		pos[5] = client_request->cmd;
+		memcpy(pos + 6, &flags, sizeof(flags));
+		memcpy(pos + 8, &id, sizeof(id));
+		memcpy(pos + 16, &sbj_len, sizeof(sbj_len));
+		memcpy(pos + 20, &extra_data_len, sizeof(extra_data_len));
+		pos += REQUEST_V2_HEADER_LEN;
+		memcpy(pos, client_request->sbj_content, client_request->sbj_len);
+		pos += client_request->sbj_len;
+		if (ttl_len > 0) {
+			const uint32_t ttl_s = htole32(client_request->ttl_s);
+			memcpy(pos, &ttl_s, sizeof(ttl_s));
+			pos += sizeof(ttl_s);
+		}
+		if (client_request->extra_data_len > 0) {
+			memcpy(pos, client_request->extra_data_content, client_request->extra_data_len);
 		}
+
+		*encoded_len = needed;
+		return 0;
 	}
 
-	if (last_initial_whitespace >= MAX_SBJ_LEN) { /* we need at least one valid character to form a sbj / filename */
-		fprintf(stderr, "Subject must consist of one valid character excluding preceeding whitespace\n");
+	memcpy(pos, &client_request->cmd, sizeof(client_request->cmd));
+	pos += sizeof(client_request->cmd);
+	memcpy(pos, &client_request->sbj_len, sizeof(client_request->sbj_len));
+	pos += sizeof(client_request->sbj_len);
+	memcpy(pos, client_request->sbj_content, client_request->sbj_len);
+	pos += client_request->sbj_len;
+	memcpy(pos, &client_request->extra_data_len, sizeof(client_request->extra_data_len));
+	pos += sizeof(client_request->extra_data_len);
+	if (client_request->extra_data_len > 0) {
+		memcpy(pos, client_request->extra_data_content, client_request->extra_data_len);
+	}
+
+	*encoded_len = needed;
+	return 0;
+}
+
+int request_decode(struct Request *const client_request, const uint8_t *const buf, const size_t buf_len)
+{
+	if (client_request == NULL || buf == NULL) {
+		fprintf(stderr, "Request struct to fill & buffer cannot be NULL\n");
 		return 2;
-	} else if (last_initial_whitespace > 0) {
-		memcpy(client_request->sbj_content, client_request->sbj_content + last_initial_whitespace, MAX_SBJ_LEN - last_initial_whitespace);
 	}
 
-	uint8_t *const end_of_sbj = memchr(client_request->sbj_content, '\0', MAX_SBJ_LEN); /* we need to make sure that, if the null terminator was passed in with client_request.sbj_content, that we account for its length to the byte prior */
-	if (end_of_sbj != NULL) {
-		client_request->sbj_len = end_of_sbj - client_request->sbj_content;
+	client_request->version = (buf_len > 0 && buf[0] == PROTOCOL_MAGIC_BYTE ? PROTOCOL_V2 : PROTOCOL_V1); /* set before anything can fail, so even a bad request can be answered in kind */
+	client_request->flags = 0;
+	client_request->id = 0;
+	client_request->ttl_s = 0;
+
+	const uint8_t *sbj_pos, *extra_data_pos; /* where subject & extra data lie within buf */
+	if (client_request->version == PROTOCOL_V2) {
+		if (buf_len < REQUEST_V2_HEADER_LEN) {
+			fprintf(stderr, "Invalid request: truncated header\n");
+			return 2;
+		}
+
+		uint32_t magic;
+		uint16_t flags;
+		uint64_t id;
+		memcpy(&magic, buf, sizeof(magic));
+		memcpy(&flags, buf + 6, sizeof(flags));
+		memcpy(&id, buf + 8, sizeof(id));
+		memcpy(&client_request->sbj_len, buf + 16, sizeof(client_request->sbj_len));
+		memcpy(&client_request->extra_data_len, buf + 20, sizeof(client_request->extra_data_len));
+		client_request->id = le64toh(id);
+		client_request->cmd = buf[5];
+		client_request->flags = le16toh(flags);
+		client_request->sbj_len = le32toh(client_request->sbj_len);
+		client_request->extra_data_len = le32toh(client_request->extra_data_len);
+
+		if (le32toh(magic) != PROTOCOL_MAGIC || buf[4] != PROTOCOL_V2) {
+			fprintf(stderr, "Invalid request: unsupported protocol version\n");
+			return 2;
+		}
+
+		if ((client_request->flags & ~REQUEST_FLAGS_KNOWN) != 0) {
+			fprintf(stderr, "Invalid request: unknown flags (0x%x)\n", client_request->flags);
+			return 2;
+		}
+
+		if (client_request->sbj_len < 1 || client_request->sbj_len > MAX_SBJ_LEN || client_request->extra_data_len > MAX_EXTRA_DATA_LEN || buf_len != REQUEST_V2_HEADER_LEN + client_request->sbj_len + client_request->extra_data_len) {
+			fprintf(stderr, "Invalid request: bad lengths (subject %u, extra data %u)\n", client_request->sbj_len, client_request->extra_data_len);
+			return 2;
+		}
+		sbj_pos = buf + REQUEST_V2_HEADER_LEN;
+		extra_data_pos = sbj_pos + client_request->sbj_len;
+
+		if (client_request->flags & REQUEST_FLAG_TTL) { /* peel the time to live off the front of the extra data */
+			uint32_t ttl_s = 0;
+			if (client_request->cmd == ADD && client_request->extra_data_len >= REQUEST_TTL_LEN) {
+				memcpy(&ttl_s, extra_data_pos, sizeof(ttl_s));
+			}
+			client_request->ttl_s = le32toh(ttl_s);
+			if (client_request->ttl_s == 0) {
+				fprintf(stderr, "Invalid request: time to live must be a non-zero number of seconds on an ADD\n");
+				return 2;
+			}
+			extra_data_pos += REQUEST_TTL_LEN;
+			client_request->extra_data_len -= REQUEST_TTL_LEN;
+		}
+	} else {
+		const uint8_t *pos = buf;
+		const uint8_t *const end = buf + buf_len;
+
+		if ((size_t)(end - pos) < sizeof(client_request->cmd) + sizeof(client_request->sbj_len)) {
+			fprintf(stderr, "Invalid request: truncated header\n");
+			return 2;
+		}
+		memcpy(&client_request->cmd, pos, sizeof(client_request->cmd));
+		pos += sizeof(client_request->cmd);
+
+		memcpy(&client_request->sbj_len, pos, sizeof(client_request->sbj_len));
+		pos += sizeof(client_request->sbj_len);
+
+		if (client_request->sbj_len < 1 || client_request->sbj_len > MAX_SBJ_LEN || (size_t)(end - pos) < client_request->sbj_len + sizeof(client_request->extra_data_len)) {
+			fprintf(stderr, "Invalid subject length: bad length (%u)\n", client_request->sbj_len);
+			return 2;
+		}
+		sbj_pos = pos;
+		pos += client_request->sbj_len;
+
+		memcpy(&client_request->extra_data_len, pos, sizeof(client_request->extra_data_len));
+		pos += sizeof(client_request->extra_data_len);
+
+		if (client_request->extra_data_len > MAX_EXTRA_DATA_LEN || (size_t)(end - pos) != client_request->extra_data_len) {
+			fprintf(stderr, "Invalid extra data length: bad length (%u)\n", client_request->extra_data_len);
+			return 2;
+		}
+		extra_data_pos = pos;
 	}
 
-	/* reading extra_data_len */
-	if (read(client_sock, &client_request->extra_data_len, sizeof(client_request->extra_data_len)) != sizeof(client_request->extra_data_len)) {
-		fprintf(stderr, "Error reading extra data length component (errno %d: %s)\n", errno, strerror(errno));
-		return 1;
+	if (!request_command_valid(client_request->cmd)) {
+		fprintf(stderr, "Invalid request: command unrecognised\n");
+		return 2;
+	}
+
+	if (request_take_subject(client_request, sbj_pos) != 0) {
+		return 2;
 	}
 
-	if (client_request->extra_data_len > 0) { /* reading sbj_content conditionally */
+	if (client_request->extra_data_len > 0) {
 		if (!client_request->extra_data_content) {
 			fprintf(stderr, "Extra data content field cannot be NULL\n");
 			return 2;
 		}
-
-		if (read(client_sock, client_request->extra_data_content, client_request->extra_data_len) != (ssize_t)client_request->extra_data_len) {
-			fprintf(stderr, "Error reading extra data content component (errno %d: %s)\n", errno, strerror(errno));
-			return 1;
-		}
+		memcpy(client_request->extra_data_content, extra_data_pos, client_request->extra_data_len);
 	}
 
 	return 0;
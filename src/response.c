@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <endian.h>
 #include <limits.h>
 #include <stdio.h>
 #include <string.h>
@@ -13,6 +14,16 @@
  * @brief Definition of functionality to manages responses from server to client
  */
 
+/**
+ * @brief response_status_valid - checks status byte is one we understand
+ * @param const uint8_t status - status byte as received
+ * @return int - Boolean. 1 if valid, 0 if not
+ */
+static inline int response_status_valid(const uint8_t status)
+{
+	return (status == OK || status == DATA || status == FAIL || status == BUSY);
+}
+
 int response_send(const struct Response *const server_response, const int client_sock)
 {
 	if (server_response == NULL) {
@@ -20,73 +31,100 @@ int response_send(const struct Response *const server_response, const int client
 		return 1;
 	}
 
-	if (server_response->status != OK && server_response->status != DATA && server_response->status != FAIL) {
-		fprintf(stderr, "Invalid response type\n");
-		return 1;
-	}
-
-	if (server_response->extra_data_len != 0 && server_response->extra_data_content == NULL) {
-		fprintf(stderr, "Extra data to be sent requested (%lu) but memory location invalid (%p)\n", (const uint64_t)server_response->extra_data_len, server_response->extra_data_content);
-		return 1;
-	}
-
-	if (server_response->extra_data_len > MAX_EXTRA_DATA_LEN) {
-		fprintf(stderr, "Data requested to be sent is larger than maximum message length (maximum %d, given %u)\n", MAX_EXTRA_DATA_LEN, server_response->extra_data_len);
+	uint8_t encoded[MAX_RESPONSE_LEN];
+	size_t encoded_len;
+	if (response_encode(server_response, encoded, sizeof(encoded), &encoded_len) != 0) {
 		return 1;
 	}
 
-	if (
-		send(client_sock, &server_response->status, sizeof(server_response->status), 0) != sizeof(server_response->status)
-		||
-		send(client_sock, &server_response->extra_data_len, sizeof(server_response->extra_data_len), 0) != sizeof(server_response->extra_data_len)
-	) { /* || is short circuit operator so once one fails it'll die (https://en.wikipedia.org/wiki/Short-circuit_evaluation) */
+	if (send(client_sock, encoded, encoded_len, 0) != (ssize_t)encoded_len) { /* one send per response, rather than one per field */
 		fprintf(stderr, "Error sending response (errno %d: %s)\n", errno, strerror(errno));
 		return 2;
 	}
 
-	if (server_response->extra_data_len > 0) { /* we've already verified whether extra_data_content is valid or not so we just check if we need to send anything at all */
-		if (send(client_sock, server_response->extra_data_content, server_response->extra_data_len, 0) != (ssize_t)server_response->extra_data_len) {
-			fprintf(stderr, "Error sending response (errno %d: %s)\n", errno, strerror(errno));
-			return 2;
+	return 0;
+}
+
+/**
+ * @brief recv_all - reads exactly len bytes, riding out short reads
+ * @param const int sock - endpoint to read from
+ * @param void *const buf - buffer to fill. NULL discards the bytes instead
+ * @param const size_t len - number of bytes wanted
+ * @return int - zero is success, non-zero is failure
+ * 1 is error receiving (including connection closed part way)
+ */
+static int recv_all(const int sock, void *const buf, const size_t len)
+{
+	uint8_t discard[256];
+	size_t received = 0;
+
+	while (received < len) {
+		void *const dst = (buf != NULL ? (uint8_t*)buf + received : discard);
+		const size_t want = (buf != NULL ? len - received : (len - received < sizeof(discard) ? len - received : sizeof(discard)));
+
+		const ssize_t ret = read(sock, dst, want);
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			return 1;
 		}
+		received += (size_t)ret;
 	}
 
 	return 0;
 }
 
 int response_recv(struct Response *const server_response, const int client_sock)
+{
+	return response_recv_into(server_response, MAX_EXTRA_DATA_LEN, client_sock);
+}
+
+int response_recv_into(struct Response *const server_response, const uint32_t capacity, const int client_sock)
+{
+	const int ret = response_recv_header(server_response, client_sock);
+	if (ret != 0) {
+		return ret;
+	}
+
+	return response_recv_extra(server_response, capacity, client_sock);
+}
+
+int response_recv_header(struct Response *const server_response, const int client_sock)
 {
 	if (server_response == NULL) {
 		fprintf(stderr, "Response struct to fill cannot be NULL\n");
 		return 2;
 	}
 
-	/* reading command */
-	if (read(client_sock, &server_response->status, sizeof(server_response->status)) != sizeof(server_response->status)) {
-		fprintf(stderr, "Error reading command component (errno %d: %s)\n", errno, strerror(errno));
+	uint8_t header[RESPONSE_V2_HEADER_LEN];
+	if (recv_all(client_sock, header, 1) != 0) { /* first byte says which version, so how much header follows */
+		fprintf(stderr, "Error reading response header (errno %d: %s)\n", errno, strerror(errno));
 		return 1;
 	}
 
-	if (server_response->status != OK && server_response->status != DATA && server_response->status != FAIL) {
-		fprintf(stderr, "Unprocessable response: command unrecognised\n");
-		return 2;
-	}
-
-	/* reading extra_data_len */
-	if (read(client_sock, &server_response->extra_data_len, sizeof(server_response->extra_data_len)) != sizeof(server_response->extra_data_len)) {
-		fprintf(stderr, "Error reading extra data length component (errno %d: %s)\n", errno, strerror(errno));
+	const size_t header_len = (header[0] == PROTOCOL_MAGIC_BYTE ? RESPONSE_V2_HEADER_LEN : RESPONSE_HEADER_LEN);
+	if (recv_all(client_sock, header + 1, header_len - 1) != 0) {
+		fprintf(stderr, "Error reading response header (errno %d: %s)\n", errno, strerror(errno));
 		return 1;
 	}
 
+	return response_decode_header(server_response, header);
+}
+
+int response_recv_extra(struct Response *const server_response, const uint32_t capacity, const int client_sock)
+{
 	if (server_response->extra_data_len > 0) { /* reading sbj_content conditionally */
-		if (!server_response->extra_data_content) {
-			fprintf(stderr, "Extra data available but buffer is non-existant\n");
-			return 0; /* here's the thing - the client should know whether they expect or want extra data or not
-				   * therefore not providing a buffer doesn't cause an issue
-				   */
+		if (!server_response->extra_data_content || server_response->extra_data_len > capacity) {
+			fprintf(stderr, "Extra data available (%u bytes) but buffer is non-existant or too small (%u bytes) - discarding\n", server_response->extra_data_len, capacity);
+			if (recv_all(client_sock, NULL, server_response->extra_data_len) != 0) { /* still consumed, so the connection stays in step for whatever follows */
+				return 1;
+			}
+			return (server_response->extra_data_content == NULL ? 0 : 2); /* here's the thing - the client should know whether they expect or want extra data or not
+										   * therefore not providing a buffer doesn't cause an issue
+										   */
 		}
 
-		if (read(client_sock, server_response->extra_data_content, server_response->extra_data_len) != (ssize_t)server_response->extra_data_len) {
+		if (recv_all(client_sock, server_response->extra_data_content, server_response->extra_data_len) != 0) { /* straight into caller's buffer */
 			fprintf(stderr, "Error reading extra data content component (errno %d: %s)\n", errno, strerror(errno));
 			return 1;
 		}
@@ -94,3 +132,123 @@ int response_recv(struct Response *const server_response, const int client_sock)
 
 	return 0;
 }
+
+int response_encode(const struct Response *const server_response, uint8_t *const buf, const size_t buf_len, size_t *const encoded_len)
+{
+	if (server_response == NULL || buf == NULL || encoded_len == NULL) {
+		fprintf(stderr, "Response struct & buffers cannot be NULL\n");
+		return 1;
+	}
+
+	if (!response_status_valid(server_response->status)) {
+		fprintf(stderr, "Invalid response type\n");
+		return 1;
+	}
+
+	if (server_response->extra_data_len > MAX_EXTRA_DATA_LEN || (server_response->extra_data_len != 0 && server_response->extra_data_content == NULL)) {
+		fprintf(stderr, "Invalid extra data to be encoded (%u bytes @ %p)\n", server_response->extra_data_len, server_response->extra_data_content);
+		return 1;
+	}
+
+	const int v2 = (server_response->version == PROTOCOL_V2);
+	const size_t needed = (v2 ? RESPONSE_V2_HEADER_LEN : RESPONSE_HEADER_LEN) + server_response->extra_data_len;
+	if (needed > buf_len) {
+		fprintf(stderr, "Buffer too small to encode response (need %lu, have %lu)\n", (unsigned long)needed, (unsigned long)buf_len);
+		return 1;
+	}
+
+	uint8_t *pos = buf;
+	if (v2) {
+		const uint32_t magic = htole32(PROTOCOL_MAGIC);
+		const uint64_t id = htole64(server_response->id);
+		const uint32_t extra_data_len = htole32(server_response->extra_data_len);
+		memcpy(pos, &magic, sizeof(magic));
+		pos[4] = PROTOCOL_V2;
+		pos[5] = server_response->status;
+		pos[6] = pos[7] = 0; /* reserved */
+		memcpy(pos + 8, &id, sizeof(id));
+		memcpy(pos + 16, &extra_data_len, sizeof(extra_data_len));
+		if (server_response->extra_data_len > 0) {
+			memcpy(pos + RESPONSE_V2_HEADER_LEN, server_response->extra_data_content, server_response->extra_data_len);
+		}
+
+		*encoded_len = needed;
+		return 0;
+	}
+
+	memcpy(pos, &server_response->status, sizeof(server_response->status));
+	pos += sizeof(server_response->status);
+	memcpy(pos, &server_response->extra_data_len, sizeof(server_response->extra_data_len));
+	pos += sizeof(server_response->extra_data_len);
+	if (server_response->extra_data_len > 0) {
+		memcpy(pos, server_response->extra_data_content, server_response->extra_data_len);
+	}
+
+	*encoded_len = needed;
+	return 0;
+}
+
+int response_decode_header(struct Response *const server_response, const uint8_t *const buf)
+{
+	if (server_response == NULL || buf == NULL) {
+		fprintf(stderr, "Response struct to fill & buffer cannot be NULL\n");
+		return 2;
+	}
+
+	if (buf[0] == PROTOCOL_MAGIC_BYTE) {
+		uint32_t magic;
+		uint64_t id;
+		memcpy(&magic, buf, sizeof(magic));
+		memcpy(&id, buf + 8, sizeof(id));
+		memcpy(&server_response->extra_data_len, buf + 16, sizeof(server_response->extra_data_len));
+		if (le32toh(magic) != PROTOCOL_MAGIC || buf[4] != PROTOCOL_V2) {
+			fprintf(stderr, "Unprocessable response: unsupported protocol version\n");
+			return 2;
+		}
+		server_response->version = PROTOCOL_V2;
+		server_response->status = buf[5];
+		server_response->id = le64toh(id);
+		server_response->extra_data_len = le32toh(server_response->extra_data_len);
+	} else {
+		server_response->version = PROTOCOL_V1;
+		server_response->id = 0;
+		memcpy(&server_response->status, buf, sizeof(server_response->status));
+		memcpy(&server_response->extra_data_len, buf + sizeof(server_response->status), sizeof(server_response->extra_data_len));
+	}
+
+	if (!response_status_valid(server_response->status)) {
+		fprintf(stderr, "Unprocessable response: command unrecognised\n");
+		return 2;
+	}
+
+	if (server_response->extra_data_len > MAX_EXTRA_DATA_LEN) {
+		fprintf(stderr, "Unprocessable response: bad extra data length (%u)\n", server_response->extra_data_len);
+		return 2;
+	}
+
+	return 0;
+}
+
+int response_decode(struct Response *const server_response, const uint8_t *const buf, const size_t buf_len)
+{
+	const size_t header_len = (buf_len > 0 && buf[0] == PROTOCOL_MAGIC_BYTE ? RESPONSE_V2_HEADER_LEN : RESPONSE_HEADER_LEN);
+	if (buf_len < header_len) {
+		fprintf(stderr, "Unprocessable response: truncated header\n");
+		return 2;
+	}
+
+	if (response_decode_header(server_response, buf) != 0) {
+		return 2;
+	}
+
+	if (buf_len - header_len != server_response->extra_data_len) {
+		fprintf(stderr, "Unprocessable response: bad extra data length (%u)\n", server_response->extra_data_len);
+		return 2;
+	}
+
+	if (server_response->extra_data_len > 0 && server_response->extra_data_content != NULL) { /* as with response_recv, the client decides whether it wants the data */
+		memcpy(server_response->extra_data_content, buf + header_len, server_response->extra_data_len);
+	}
+
+	return 0;
+}
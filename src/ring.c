@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#include "ring.h"
+
+/**
+ * @brief Definitions of functionality for the shared-memory ring transport
+ */
+
+typedef uint32_t ring_frame_t; /* each message is prefixed by its length */
+
+size_t ring_message_space(const uint32_t msg_len)
+{
+	return sizeof(ring_frame_t) + (size_t)msg_len;
+}
+
+/**
+ * @brief ring_valid_capacity - checks a queue capacity is usable (power of two so positions wrap with a mask)
+ * @param const uint64_t capacity - bytes per queue
+ * @return int - Boolean. 1 if usable, 0 if not
+ */
+static inline int ring_valid_capacity(const uint64_t capacity)
+{
+	return (capacity >= RING_MIN_CAPACITY && capacity <= RING_MAX_CAPACITY && (capacity & (capacity - 1)) == 0);
+}
+
+/**
+ * @brief ring_map - maps shared memory & points a ring's fields into it
+ * @param struct Ring *const ring - ring with memfd & capacity set
+ * @return int - zero is success, non-zero is failure
+ * 2 is error mapping
+ */
+static int ring_map(struct Ring *const ring)
+{
+	ring->map_len = sizeof(struct RingHeader) + 2 * (size_t)ring->capacity;
+
+	void *const base = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "Error mapping ring (errno %d: %s)\n", errno, strerror(errno));
+		ring->header = NULL;
+		return 2;
+	}
+
+	ring->header = base;
+	ring->data[RING_REQUESTS] = (uint8_t*)base + sizeof(struct RingHeader);
+	ring->data[RING_RESPONSES] = ring->data[RING_REQUESTS] + ring->capacity;
+
+	return 0;
+}
+
+int ring_create(struct Ring *const ring, const uint32_t capacity)
+{
+	if (ring == NULL || !ring_valid_capacity(capacity)) {
+		fprintf(stderr, "Invalid ring capacity (%u) - must be a power of two between %u and %u\n", capacity, RING_MIN_CAPACITY, RING_MAX_CAPACITY);
+		return 1;
+	}
+
+	memset(ring, '\0', sizeof(*ring));
+	ring->doorbells[RING_REQUESTS] = ring->doorbells[RING_RESPONSES] = -1;
+	ring->capacity = capacity;
+
+	ring->memfd = memfd_create("noticeboard-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (ring->memfd == -1) {
+		fprintf(stderr, "Error creating ring memory (errno %d: %s)\n", errno, strerror(errno));
+		return 2;
+	}
+
+	if (
+		ftruncate(ring->memfd, sizeof(struct RingHeader) + 2 * (off_t)capacity) != 0
+		||
+		fcntl(ring->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0 /* server refuses rings it could be faulted through */
+	) {
+		fprintf(stderr, "Error sizing ring memory (errno %d: %s)\n", errno, strerror(errno));
+		ring_destroy(ring);
+		return 2;
+	}
+
+	if (ring_map(ring) != 0) {
+		ring_destroy(ring);
+		return 2;
+	}
+	ring->header->magic = RING_MAGIC;
+	ring->header->capacity = capacity;
+
+	ring->doorbells[RING_REQUESTS] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ring->doorbells[RING_RESPONSES] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ring->doorbells[RING_REQUESTS] == -1 || ring->doorbells[RING_RESPONSES] == -1) {
+		fprintf(stderr, "Error creating ring doorbells (errno %d: %s)\n", errno, strerror(errno));
+		ring_destroy(ring);
+		return 2;
+	}
+
+	return 0;
+}
+
+int ring_attach(struct Ring *const ring, const int memfd, const int request_doorbell, const int response_doorbell)
+{
+	memset(ring, '\0', sizeof(*ring));
+	ring->memfd = memfd;
+	ring->doorbells[RING_REQUESTS] = request_doorbell;
+	ring->doorbells[RING_RESPONSES] = response_doorbell;
+
+	const int seals = fcntl(memfd, F_GET_SEALS);
+	if (seals == -1 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW)) {
+		fprintf(stderr, "Refusing ring - memory isn't sealed against resizing\n");
+		ring_destroy(ring);
+		return 1;
+	}
+
+	struct stat statbuf;
+	if (fstat(memfd, &statbuf) != 0 || statbuf.st_size < (off_t)sizeof(struct RingHeader)) {
+		fprintf(stderr, "Refusing ring - unable to determine size\n");
+		ring_destroy(ring);
+		return 1;
+	}
+
+	const uint64_t data_len = (uint64_t)statbuf.st_size - sizeof(struct RingHeader);
+	if (data_len % 2 != 0 || !ring_valid_capacity(data_len / 2)) {
+		fprintf(stderr, "Refusing ring - invalid size (%ld)\n", (long)statbuf.st_size);
+		ring_destroy(ring);
+		return 1;
+	}
+	ring->capacity = (uint32_t)(data_len / 2); /* derived from the sealed size, never from the shared header */
+
+	/* doorbells must never block us, whatever the peer handed over */
+	if (
+		fcntl(request_doorbell, F_SETFL, fcntl(request_doorbell, F_GETFL) | O_NONBLOCK) != 0
+		||
+		fcntl(response_doorbell, F_SETFL, fcntl(response_doorbell, F_GETFL) | O_NONBLOCK) != 0
+	) {
+		fprintf(stderr, "Refusing ring - unusable doorbells (errno %d: %s)\n", errno, strerror(errno));
+		ring_destroy(ring);
+		return 1;
+	}
+
+	if (ring_map(ring) != 0) {
+		ring_destroy(ring);
+		return 2;
+	}
+
+	if (ring->header->magic != RING_MAGIC || ring->header->capacity != ring->capacity) {
+		fprintf(stderr, "Refusing ring - bad header\n");
+		ring_destroy(ring);
+		return 1;
+	}
+
+	ring->cursor[RING_REQUESTS] = __atomic_load_n(&ring->header->queues[RING_REQUESTS].tail, __ATOMIC_ACQUIRE);
+	ring->cursor[RING_RESPONSES] = __atomic_load_n(&ring->header->queues[RING_RESPONSES].head, __ATOMIC_ACQUIRE);
+
+	return 0;
+}
+
+int ring_destroy(struct Ring *const ring)
+{
+	if (ring == NULL) {
+		return 0;
+	}
+
+	int exit_code = 0;
+
+	if (ring->header != NULL && munmap(ring->header, ring->map_len) != 0) {
+		fprintf(stderr, "Error unmapping ring (errno %d: %s)\n", errno, strerror(errno));
+		exit_code = 1;
+	}
+	ring->header = NULL;
+
+	const int fds[] = { ring->memfd, ring->doorbells[RING_REQUESTS], ring->doorbells[RING_RESPONSES] };
+	for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i) {
+		if (fds[i] >= 0 && close(fds[i]) != 0) {
+			fprintf(stderr, "Error closing ring handle %d (errno %d: %s)\n", fds[i], errno, strerror(errno));
+			exit_code = 1;
+		}
+	}
+	ring->memfd = ring->doorbells[RING_REQUESTS] = ring->doorbells[RING_RESPONSES] = -1;
+
+	return exit_code;
+}
+
+/**
+ * @brief ring_copy_in - copies bytes into a queue, wrapping at its end
+ * @param const struct Ring *const ring - ring
+ * @param const enum ring_queue queue - queue to copy into
+ * @param const uint64_t pos - absolute position (masked down here)
+ * @param const void *const src - bytes to copy
+ * @param const size_t len - number of bytes
+ */
+static void ring_copy_in(const struct Ring *const ring, const enum ring_queue queue, const uint64_t pos, const void *const src, const size_t len)
+{
+	const size_t offset = pos & (ring->capacity - 1);
+	const size_t first = (len < ring->capacity - offset ? len : ring->capacity - offset);
+
+	memcpy(ring->data[queue] + offset, src, first);
+	memcpy(ring->data[queue], (const uint8_t*)src + first, len - first);
+}
+
+/**
+ * @brief ring_copy_out - copies bytes out of a queue, wrapping at its end
+ * @param const struct Ring *const ring - ring
+ * @param const enum ring_queue queue - queue to copy from
+ * @param const uint64_t pos - absolute position (masked down here)
+ * @param void *const dst - buffer to copy into
+ * @param const size_t len - number of bytes
+ */
+static void ring_copy_out(const struct Ring *const ring, const enum ring_queue queue, const uint64_t pos, void *const dst, const size_t len)
+{
+	const size_t offset = pos & (ring->capacity - 1);
+	const size_t first = (len < ring->capacity - offset ? len : ring->capacity - offset);
+
+	memcpy(dst, ring->data[queue] + offset, first);
+	memcpy((uint8_t*)dst + first, ring->data[queue], len - first);
+}
+
+size_t ring_space(const struct Ring *const ring, const enum ring_queue queue)
+{
+	const uint64_t tail = __atomic_load_n(&ring->header->queues[queue].tail, __ATOMIC_ACQUIRE);
+	const uint64_t used = ring->cursor[queue] - tail;
+
+	return (used > ring->capacity ? 0 : ring->capacity - used); /* a nonsense tail from the peer just looks like a full queue */
+}
+
+int ring_push(struct Ring *const ring, const enum ring_queue queue, const void *const msg, const uint32_t msg_len)
+{
+	const size_t needed = ring_message_space(msg_len);
+	if (needed > ring->capacity) {
+		fprintf(stderr, "Message of %u bytes can never fit in ring of %u bytes\n", msg_len, ring->capacity);
+		return 2;
+	}
+
+	if (needed > ring_space(ring, queue)) {
+		return 1;
+	}
+
+	const ring_frame_t frame = msg_len;
+	ring_copy_in(ring, queue, ring->cursor[queue], &frame, sizeof(frame));
+	ring_copy_in(ring, queue, ring->cursor[queue] + sizeof(frame), msg, msg_len);
+	ring->cursor[queue] += needed;
+
+	__atomic_store_n(&ring->header->queues[queue].head, ring->cursor[queue], __ATOMIC_RELEASE); /* publish only once bytes are in place */
+
+	return 0;
+}
+
+int ring_pop_split(struct Ring *const ring, const enum ring_queue queue, void *const head, const uint32_t head_len, void *const body, const uint32_t body_len, uint32_t *const msg_len)
+{
+	const uint64_t produced = __atomic_load_n(&ring->header->queues[queue].head, __ATOMIC_ACQUIRE);
+	const uint64_t available = produced - ring->cursor[queue];
+
+	if (available == 0) {
+		return 1;
+	}
+
+	if (available > ring->capacity || available < sizeof(ring_frame_t)) {
+		fprintf(stderr, "Ring corrupt - %lu bytes claimed available\n", (unsigned long)available);
+		return 2;
+	}
+
+	ring_frame_t frame;
+	ring_copy_out(ring, queue, ring->cursor[queue], &frame, sizeof(frame));
+	if (ring_message_space(frame) > available || frame < head_len || frame - head_len > body_len) {
+		fprintf(stderr, "Ring corrupt - message of %u bytes (buffers %u + %u, available %lu)\n", frame, head_len, body_len, (unsigned long)available);
+		return 2;
+	}
+
+	if (head_len > 0) {
+		ring_copy_out(ring, queue, ring->cursor[queue] + sizeof(frame), head, head_len);
+	}
+	ring_copy_out(ring, queue, ring->cursor[queue] + sizeof(frame) + head_len, body, frame - head_len);
+	ring->cursor[queue] += ring_message_space(frame);
+	*msg_len = frame;
+
+	__atomic_store_n(&ring->header->queues[queue].tail, ring->cursor[queue], __ATOMIC_RELEASE); /* bytes copied out, producer may now reuse them */
+
+	return 0;
+}
+
+int ring_pop(struct Ring *const ring, const enum ring_queue queue, void *const buf, const uint32_t buf_len, uint32_t *const msg_len)
+{
+	return ring_pop_split(ring, queue, NULL, 0, buf, buf_len, msg_len);
+}
+
+int ring_notify(const struct Ring *const ring, const enum ring_queue queue)
+{
+	const uint64_t one = 1;
+	if (write(ring->doorbells[queue], &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) { /* EAGAIN means counter is saturated - consumer is going to wake regardless */
+		fprintf(stderr, "Error ringing doorbell (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+int ring_wait(const struct Ring *const ring, const enum ring_queue queue, const int timeout_ms)
+{
+	struct pollfd pfd = { .fd = ring->doorbells[queue], .events = POLLIN, .revents = 0 };
+
+	int ret;
+	do {
+		ret = poll(&pfd, 1, timeout_ms);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret == -1) {
+		fprintf(stderr, "Error waiting on doorbell (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	} else if (ret == 0) {
+		return 2;
+	}
+
+	uint64_t count;
+	if (read(ring->doorbells[queue], &count, sizeof(count)) != sizeof(count) && errno != EAGAIN) { /* reset counter. EAGAIN is a harmless race with another reader */
+		fprintf(stderr, "Error reading doorbell (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
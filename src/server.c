@@ -1,4 +1,6 @@
 #define _GNU_SOURCE
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -12,7 +14,24 @@
 #include <sys/un.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <pwd.h>
 
+#include "store.h"
+#include "index.h"
+#include "admission.h"
+#include "ring.h"
+#include "timer_wheel.h"
+#include "expiry.h"
+#include "tier.h"
+#include "trace.h"
+#include "util.h"
+#include "capture.h"
+#include "handoff.h"
+#include "transfer.h"
 #include "client_handling.h"
 
 #ifndef NOTICEBOARD_ROOT_DIR_NAME
@@ -33,22 +52,398 @@
  * To make this program actually useful, you'd probably want to multithread it (which wouldn't be hard, but you'd need to add a (shared) mutex)
  */
 
+#ifndef NOTICEBOARD_CONTROL_NAME
+	#define NOTICEBOARD_CONTROL_NAME NOTICEBOARD_SOCK_NAME ".ctl" /* control socket a newer server takes over through (see handoff.h). alongside the main one */
+#endif /* ifndef NOTICEBOARD_CONTROL_NAME */
+
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#pragma GCC diagnostic push
+const char* argp_program_bug_address = "salih.msa@outlook.com" ;
+static const char doc[] = "noticeboard -- server maintaining every user's notes. with --takeover, replaces the one already running without refusing any of its clients" ; /* general program documentation */
+static struct argp_option options[] = { /* OPTIONS FOR ARGP. each entry stores: {NAME, KEY, ARG, FLAGS, DOC} */
+	{"takeover", 't', 0, 0, "Take the listening socket, sessions & warm index over from the server already running, which then exits"},
+	{0}
+};
+
+/**
+ * @brief struct arguments - this structure is used to communicate with parse_opt (for it to store the values it parses within it)
+ */
+struct arguments {
+	int takeover; /* boolean. take over from the running server, rather than starting afresh */
+};
+
+/**
+ * @brief parse_opt - deals with given arguments based on given argumentsK
+ * @param int key - int correlating to char storing argument key
+ * @param char *arg - argument string associated with argument key
+ * @param struct argp_state *state - pointer to argp_state struct storing information about the state of the option parsing
+ * @return error_t - number storing 0 upon successfully parsed values, non-zero exit code otherwise
+ */
+static error_t parse_opt(int key, char *arg, struct argp_state *state)
+{
+	struct arguments *arguments = state->input;
+	(void)arg;
+
+	switch (key) {
+		case 't':
+			arguments->takeover = 1;
+			break;
+		case ARGP_KEY_ARG:
+			argp_usage(state);
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+static struct argp argp = { /* argp - The ARGP structure itself */
+	options, /* list containing options */
+	parse_opt, /* callback function to process args */
+	NULL, /* no non-option arguments */
+	doc, /* documentation containing general program description */
+};
+#pragma GCC diagnostic pop /* end of argp, so end of repressing weird messages */
+
 #define SOCKET_PERMISSIONS 766 /* read write execute by us, rw for else */
 #define NOTE_PERMISSIONS 700 /* read write by us, not by anyone else */
 
+#ifndef NOTICEBOARD_MAX_SESSIONS
+	#define NOTICEBOARD_MAX_SESSIONS 4096 /* most client connections open at once. beyond this, new connections are answered BUSY & closed */
+#endif /* ifndef NOTICEBOARD_MAX_SESSIONS */
+
+/* deadlines, in milliseconds, for each phase of a session's socket (see client_handling.h). a session which doesn't get through a phase in time is aborted. 0 disables that deadline */
+#ifndef NOTICEBOARD_HEADER_TIMEOUT_MS
+	#define NOTICEBOARD_HEADER_TIMEOUT_MS 5000 /* from the first byte of a request to the end of its header */
+#endif /* ifndef NOTICEBOARD_HEADER_TIMEOUT_MS */
+
+#ifndef NOTICEBOARD_PAYLOAD_TIMEOUT_MS
+	#define NOTICEBOARD_PAYLOAD_TIMEOUT_MS 10000 /* from the end of a request's header to the end of the request (& any handles following it) */
+#endif /* ifndef NOTICEBOARD_PAYLOAD_TIMEOUT_MS */
+
+#ifndef NOTICEBOARD_WRITE_TIMEOUT_MS
+	#define NOTICEBOARD_WRITE_TIMEOUT_MS 10000 /* from a response being held up by a full socket to the client taking all of it */
+#endif /* ifndef NOTICEBOARD_WRITE_TIMEOUT_MS */
+
+#ifndef NOTICEBOARD_IDLE_TIMEOUT_MS
+	#define NOTICEBOARD_IDLE_TIMEOUT_MS 0 /* between requests. off by default - library clients hold connections open indefinitely */
+#endif /* ifndef NOTICEBOARD_IDLE_TIMEOUT_MS */
+
+#ifndef NOTICEBOARD_TIMER_TICK_MS
+	#define NOTICEBOARD_TIMER_TICK_MS 10 /* granularity of deadlines */
+#endif /* ifndef NOTICEBOARD_TIMER_TICK_MS */
+
+#if NOTICEBOARD_HEADER_TIMEOUT_MS < 0 || NOTICEBOARD_PAYLOAD_TIMEOUT_MS < 0 || NOTICEBOARD_WRITE_TIMEOUT_MS < 0 || NOTICEBOARD_IDLE_TIMEOUT_MS < 0 || NOTICEBOARD_TIMER_TICK_MS < 1
+	#error "Session deadlines mustn't be negative, & 'NOTICEBOARD_TIMER_TICK_MS' must be positive"
+#endif /* if NOTICEBOARD_HEADER_TIMEOUT_MS < 0 || ... */
+
+static const int64_t phase_timeouts_ms[] = {
+	[SESSION_IDLE] = NOTICEBOARD_IDLE_TIMEOUT_MS,
+	[SESSION_HEADER] = NOTICEBOARD_HEADER_TIMEOUT_MS,
+	[SESSION_PAYLOAD] = NOTICEBOARD_PAYLOAD_TIMEOUT_MS,
+	[SESSION_WRITE] = NOTICEBOARD_WRITE_TIMEOUT_MS,
+	[SESSION_TRANSFER] = 0 /* as long as the archive takes - the transfer is in the background, holding nobody else up */
+};
+
+static const char *const phase_names[] = {
+	[SESSION_IDLE] = "idle",
+	[SESSION_HEADER] = "header read",
+	[SESSION_PAYLOAD] = "payload read",
+	[SESSION_WRITE] = "response write",
+	[SESSION_TRANSFER] = "transfer"
+};
+
+#ifndef NOTICEBOARD_SNAPSHOT_NAME
+	#define NOTICEBOARD_SNAPSHOT_NAME ".index_snapshot" /* within the notes directory. leading '.' keeps it clear of uid directories & subjects */
+#endif /* ifndef NOTICEBOARD_SNAPSHOT_NAME */
+
+#ifndef NOTICEBOARD_SNAPSHOT_INTERVAL
+	#define NOTICEBOARD_SNAPSHOT_INTERVAL 300 /* seconds between index snapshots whilst running (only taken if something changed). one is always taken on clean shutdown */
+#endif /* ifndef NOTICEBOARD_SNAPSHOT_INTERVAL */
+
+#define EVENTS_PER_WAIT 32
+
+/* epoll tags - the listening socket, shutdown signals, control socket, a takeover request on it & a background transfer's reports get their own, each session slot gets two (its socket & its ring's request doorbell) */
+#define LISTENER_TAG UINT64_MAX
+#define SIGNAL_TAG (UINT64_MAX - 1)
+#define CONTROL_TAG (UINT64_MAX - 2)
+#define CONTROL_PEER_TAG (UINT64_MAX - 3)
+#define TRANSFER_TAG (UINT64_MAX - 4)
+#define SESSION_SOCK_TAG(slot) ((uint64_t)(slot) * 2)
+#define SESSION_DOORBELL_TAG(slot) ((uint64_t)(slot) * 2 + 1)
+#define SESSION_SLOT(tag) ((tag) / 2)
+#define SESSION_IS_DOORBELL(tag) ((tag) % 2 == 1)
+
+/**
+ * @brief now_tick - reads the monotonic clock, in timer wheel ticks
+ * @return uint64_t - ticks
+ */
+static inline uint64_t now_tick(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000) / NOTICEBOARD_TIMER_TICK_MS;
+}
+
+/**
+ * @brief end_session - stops polling & timing a session, then releases it
+ * handles must be removed from the poller explicitly - the client holds its own references to the doorbells, so closing ours alone wouldn't remove them
+ * @param const int epoll_fd - poller session was registered with
+ * @param struct TimerWheel *const wheel - wheel session's deadline may be on
+ * @param struct Session *const session - session to end
+ */
+static void end_session(const int epoll_fd, struct TimerWheel *const wheel, struct Session *const session)
+{
+	fprintf(stdout, "Terminating client on socket %d\n", session->sock);
+	timer_cancel(wheel, &session->deadline);
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->sock, NULL);
+	if (session->has_ring) {
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->ring.doorbells[RING_REQUESTS], NULL);
+	}
+	session_close(session);
+}
+
+/**
+ * @brief phase_events - what a session's socket is polled for in each phase
+ * @param const enum session_phase phase - phase
+ * @return uint32_t - epoll events. during a transfer none are asked for, so only a hangup (or error) is ever reported
+ */
+static inline uint32_t phase_events(const enum session_phase phase)
+{
+	return (phase == SESSION_TRANSFER ? 0 : (phase == SESSION_WRITE ? EPOLLOUT : EPOLLIN) | EPOLLRDHUP);
+}
+
+/**
+ * @brief track_session - brings a session's polling & deadline in line with its phase, after client_connection has run
+ * whilst responses are backed up the socket is polled for writability instead of requests - so a client not reading can't make us buffer without limit. whilst a transfer runs, only for hangups
+ * @param const int epoll_fd - poller
+ * @param struct TimerWheel *const wheel - deadline wheel
+ * @param struct Session *const sessions - session table
+ * @param struct Session *const session - session
+ * @param const enum session_phase was - phase before client_connection ran
+ * @return int - 0 == success, non-zero is failure
+ * 1 = unable to poll the session (it should be ended)
+ */
+static int track_session(const int epoll_fd, struct TimerWheel *const wheel, struct Session *const sessions, struct Session *const session, const enum session_phase was)
+{
+	if (phase_events(was) != phase_events(session->phase)) {
+		struct epoll_event sock_event = { .events = phase_events(session->phase), .data.u64 = SESSION_SOCK_TAG(session - sessions) };
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session->sock, &sock_event) != 0) {
+			fprintf(stderr, "Failure to poll client socket (errno %d: %s)\n", errno, strerror(errno));
+			return 1;
+		}
+	}
+
+	if (session->phase_restarted) {
+		session->phase_restarted = 0;
+		const int64_t timeout_ms = phase_timeouts_ms[session->phase];
+		if (timeout_ms == 0) {
+			timer_cancel(wheel, &session->deadline);
+		} else { /* rounded up, so nobody gets less than they were promised */
+			timer_schedule(wheel, &session->deadline, now_tick() + (uint64_t)(timeout_ms + NOTICEBOARD_TIMER_TICK_MS - 1) / NOTICEBOARD_TIMER_TICK_MS);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief finish_transfer - answers the session which started a finished transfer, if it's still waiting on it
+ * @param const int epoll_fd - poller
+ * @param struct TimerWheel *const wheel - deadline wheel
+ * @param const struct Store *const store - opened store
+ * @param struct Admission *const admission - admission control
+ * @param struct Session *const sessions - session table
+ * @param const struct Transfer *const transfer - finished transfer
+ */
+static void finish_transfer(const int epoll_fd, struct TimerWheel *const wheel, const struct Store *const store, struct Admission *const admission, struct Session *const sessions, const struct Transfer *const transfer)
+{
+	struct Session *const session = transfer->session;
+	if (session == NULL || session->sock == -1 || session->phase != SESSION_TRANSFER) { /* client hung up - its slot may even be someone else's by now, but only one transfer runs at a time, so nobody else is waiting on one */
+		return;
+	}
+
+	if (session_transferred(store, admission, session, transfer) != 0 || track_session(epoll_fd, wheel, sessions, session, SESSION_TRANSFER) != 0) {
+		end_session(epoll_fd, wheel, session);
+	}
+}
+
+/**
+ * @brief accept_session - accepts a pending connection into a free session slot & starts polling it
+ * with no free slot, the connection is answered BUSY (as a request on it would have been) & closed
+ * @param const int epoll_fd - poller to register with
+ * @param struct TimerWheel *const wheel - deadline wheel
+ * @param const int server_sock - listening socket
+ * @param struct Session *const sessions - session table, NOTICEBOARD_MAX_SESSIONS long
+ */
+static void accept_session(const int epoll_fd, struct TimerWheel *const wheel, const int server_sock, struct Session *const sessions)
+{
+	const int client_sock = accept4(server_sock, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (client_sock < 0) { /* validly can be any non-negative so check for -1 which is error */
+		fprintf(stderr, "Unexpected issue when creating server-client dedicated socket (errno %d: %s)\n", errno, strerror(errno));
+		return;
+	}
+	const int64_t accepted_ns = trace_clock();
+	TRACE_PROBE1(accept, client_sock);
+	fprintf(stdout, "Established new client-server connection using socket %d\n", client_sock);
+
+	struct Session *session = NULL;
+	for (size_t i = 0; i < NOTICEBOARD_MAX_SESSIONS && session == NULL; ++i) {
+		if (sessions[i].sock == -1) {
+			session = &sessions[i];
+		}
+	}
+
+	if (session == NULL) { /* table full - shed it rather than let anyone wait on it */
+		fprintf(stderr, "Refusing client on socket %d - %d sessions already open\n", client_sock, NOTICEBOARD_MAX_SESSIONS); /* its protocol version isn't known yet - v1 is the one every client can parse */
+		uint8_t busy[RESPONSE_HEADER_LEN];
+		size_t busy_len;
+		const struct Response resp = { .version = PROTOCOL_V1, .id = 0, .status = BUSY, .extra_data_len = 0, .extra_data_content = NULL };
+		if (response_encode(&resp, busy, sizeof(busy), &busy_len) == 0) {
+			send(client_sock, busy, busy_len, MSG_DONTWAIT | MSG_NOSIGNAL); /* best effort - a fresh socket always has room */
+		}
+		close(client_sock);
+		return;
+	}
+
+	if (session_open(session, client_sock) != 0) {
+		close(client_sock);
+		return;
+	}
+	session->trace.at_ns[TRACE_ACCEPTED] = accepted_ns;
+
+	struct epoll_event sock_event = { .events = EPOLLIN | EPOLLRDHUP, .data.u64 = SESSION_SOCK_TAG(session - sessions) };
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_sock, &sock_event) != 0) {
+		fprintf(stderr, "Failure to poll client socket (errno %d: %s)\n", errno, strerror(errno));
+		session_close(session);
+		return;
+	}
+
+	track_session(epoll_fd, wheel, sessions, session, SESSION_IDLE); /* starts the idle deadline, if there is one */
+}
+
+/**
+ * @brief poll_session - starts polling (& timing) a session between requests - one handed over, or one a failed handoff had parked
+ * @param const int epoll_fd - poller to register with
+ * @param struct TimerWheel *const wheel - deadline wheel
+ * @param struct Session *const sessions - session table
+ * @param struct Session *const session - session
+ * @return int - 0 == success, non-zero is failure
+ * 1 = unable to poll the session (it should be ended)
+ */
+static int poll_session(const int epoll_fd, struct TimerWheel *const wheel, struct Session *const sessions, struct Session *const session)
+{
+	struct epoll_event sock_event = { .events = EPOLLIN | EPOLLRDHUP, .data.u64 = SESSION_SOCK_TAG(session - sessions) };
+	struct epoll_event doorbell_event = { .events = EPOLLIN, .data.u64 = SESSION_DOORBELL_TAG(session - sessions) };
+	if (
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, session->sock, &sock_event) != 0
+		||
+		(session->has_ring && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, session->ring.doorbells[RING_REQUESTS], &doorbell_event) != 0)
+	) {
+		fprintf(stderr, "Failure to poll client socket (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	session->parked = 0;
+	session->phase_restarted = 1;
+	return track_session(epoll_fd, wheel, sessions, session, SESSION_IDLE);
+}
+
+/**
+ * @brief park_session - stops polling (& timing) a session between requests, so it's left exactly as it is until handed over
+ * anything the client sends meanwhile waits in its socket (or ring) for whichever server picks it up
+ * @param const int epoll_fd - poller session was registered with
+ * @param struct TimerWheel *const wheel - wheel session's deadline may be on
+ * @param struct Session *const session - idle session (see session_idle)
+ */
+static void park_session(const int epoll_fd, struct TimerWheel *const wheel, struct Session *const session)
+{
+	timer_cancel(wheel, &session->deadline);
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->sock, NULL);
+	if (session->has_ring) {
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->ring.doorbells[RING_REQUESTS], NULL);
+	}
+	session->parked = 1;
+}
+
+/**
+ * @brief resume_sessions - picks up every session handed over by the server we took over from
+ * rings are served straight away, in case requests were pushed whilst neither server was looking
+ * @param const int epoll_fd - poller to register with
+ * @param struct TimerWheel *const wheel - deadline wheel
+ * @param const struct Store *const store - opened notes store
+ * @param struct Admission *const admission - admission control
+ * @param struct Session *const sessions - session table, NOTICEBOARD_MAX_SESSIONS long
+ * @param struct Handoff *const handoff - what was handed over. sessions resumed are taken out of it
+ */
+static void resume_sessions(const int epoll_fd, struct TimerWheel *const wheel, const struct Store *const store, struct Admission *const admission, struct Session *const sessions, struct Handoff *const handoff)
+{
+	size_t resumed = 0;
+	for (size_t s = 0; s < handoff->session_count && s < NOTICEBOARD_MAX_SESSIONS; ++s) { /* anything past our table is closed with the rest of the handoff */
+		struct HandoffSession *const handed = &handoff->sessions[s];
+		struct Session *const session = &sessions[s];
+		const int ret = session_resume(session, handed->fds[0], (handed->has_ring ? handed->fds + 1 : NULL));
+		for (size_t f = 0; f < MAX_TRANSFER_FDS; ++f) { /* taken either way */
+			handed->fds[f] = -1;
+		}
+
+		if (ret != 0) {
+			continue;
+		} else if (poll_session(epoll_fd, wheel, sessions, session) != 0 || (session->has_ring && session_serve(store, admission, session) != 0)) {
+			end_session(epoll_fd, wheel, session);
+			continue;
+		}
+		++resumed;
+	}
+
+	fprintf(stdout, "Resumed %lu of %lu session(s) handed over\n", (unsigned long)resumed, (unsigned long)handoff->session_count);
+}
+
 /**
  * @brief main - driver of `noticeboard`
+ * @param int argc - number of arguments. 1, or 2 with --takeover
+ * @param char **argv - list of args as c-strings, null terminated
  * @return int - zero is success, non-zero is failure
- * 1 is error in initialisation stage (be that chroot'ing, forming notes directory, forming notes socket), 2 is error in main functionality (be that accepting requests, reading messages), 3 is issues in cleanup
+ * 1 is error in initialisation stage (be that chroot'ing, forming notes directory, forming notes socket, taking over), 2 is error in main functionality (be that accepting requests, reading messages), 3 is issues in cleanup
  */
-int main(void)
+int main(int argc, char **argv)
 {
 	/** Initialisation **/
+	struct arguments arguments;
+	arguments.takeover = 0;
+	argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
 	const char *const root_dir = NOTICEBOARD_ROOT_DIR_NAME; /* extracting args from argp struct */
 	const char *const notes_folder = NOTICEBOARD_DIR_NAME; /* set actual variables to be content of macros */
 	const char *const notes_socket = NOTICEBOARD_SOCK_NAME;
+	const char *const control_socket = NOTICEBOARD_CONTROL_NAME;
 
-	/* Number 1: chroot to the note directory
+	/* Number 1: note down every known uid
+	 * the password database won't be reachable once we've chroot'ed, and it's needed to migrate notes stored in the old flat layout
+	 */
+	uid_t *known_uids = NULL;
+	size_t known_uid_count = 0, known_uid_cap = 0;
+	struct passwd *pw_entry;
+	setpwent();
+	while ((pw_entry = getpwent()) != NULL) {
+		if (known_uid_count == known_uid_cap) {
+			known_uid_cap = (known_uid_cap == 0 ? 64 : known_uid_cap * 2);
+			uid_t *const grown = realloc(known_uids, known_uid_cap * sizeof(*known_uids));
+			if (grown == NULL) {
+				fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+				free(known_uids);
+				endpwent();
+				return 1;
+			}
+			known_uids = grown;
+		}
+		known_uids[known_uid_count++] = pw_entry->pw_uid;
+	}
+	endpwent();
+
+	/* Number 2: chroot to the note directory
 	 * There's absolutely no need for this program to have access to any other file
 	 * Here's the issue: chroot'ing is a privileged operations
 	 * It's also bad practise to check if your a superuser (e.g. root) as there can be multiple
@@ -56,10 +451,11 @@ int main(void)
 	 */
 	if (chroot(root_dir) != 0 && errno != EPERM) {
 		fprintf(stderr, "Failure to chroot into '%s' (even though we are running as superuser) (errno %d: %s)\n", root_dir, errno, strerror(errno));
+		free(known_uids);
 		return 1;
 	}
 
-	/* Number 2: create subdirectory with very restricted permissions
+	/* Number 3: create subdirectory with very restricted permissions
 	 * this is where given notes are written out to as files
 	 */
 	fprintf(stdout, "Creating restricted folder for notes @ (%s/)%s\n", root_dir, notes_folder);
@@ -70,35 +466,133 @@ int main(void)
 			fprintf(stdout, "Attempting to figure out permissions of existing folder to see if it's ours\n");
 			if (stat(notes_folder, &statbuf) != 0) {
 				fprintf(stderr, "Unable to get permissions of existing directory (errno %d: %s)\n", errno, strerror(errno));
+				free(known_uids);
 				return 1;
 			}
 
 			if (statbuf.st_mode != 17068) { /* TODO mask out the other bytes so we're just left with permission bytes, then compare. for now we now what value it should be though */
 				fprintf(stderr, "Failure to create notes directory - directory exists BUT wrong permissions so not ours (ours: %d, theirs: %d) (errno %d: %s)\n", NOTE_PERMISSIONS, statbuf.st_mode, errno, strerror(errno));
+				free(known_uids);
 				return 1;
 			}
 		} else {
 			fprintf(stderr, "Failure to create notes directory (errno %d: %s)\n", errno, strerror(errno));
+			free(known_uids);
 			return 1;
 		}
 	}
 
-	/* Number 3: create UNIX (IPC) socket
+	/* Number 4: open the notes store
+	 * notes live in per-uid (optionally hashed fan-out) sub-directories, all resolved relative to this handle
+	 * anything left over from the old flat layout gets moved into place now
+	 */
+	struct Store store;
+	if (store_open(&store, notes_folder) != 0) {
+		free(known_uids);
+		return 1;
+	}
+
+	if (store_migrate(&store, known_uids, known_uid_count) != 0) { /* not fatal - unmigrated notes are simply left where they were */
+		fprintf(stderr, "Some notes could not be migrated to the per-uid layout\n");
+	}
+	free(known_uids);
+	known_uids = NULL;
+
+	/* Number 5: take over from the server already running, if asked to
+	 * it stops accepting, drains, snapshots its index & hands over its listening socket, hot tier & sessions - so there's nothing to bind, & the index & hot tier built next are as warm as its were
+	 * once the listening socket has arrived, it's ours whatever else goes wrong - the old server has let go of it
+	 */
+	struct Handoff handoff = { .listener = -1, .control = -1, .tier_state = -1, .sessions = NULL, .session_count = 0 };
+	if (arguments.takeover && handoff_receive(control_socket, &handoff) != 0 && handoff.listener == -1) {
+		handoff_free(&handoff);
+		store_close(&store);
+		return 1;
+	}
+	const int taken_over = (handoff.listener != -1);
+
+	/* Number 6: build the in-memory index of every note
+	 * restored from the snapshot left by the last run where still valid, so startup doesn't have to stat every note
+	 * not fatal - without it, every request simply goes to the filesystem
+	 */
+	struct Index index;
+	if (index_init(&index, 0) == 0) {
+		if (index_build(&index, &store, NOTICEBOARD_SNAPSHOT_NAME) == 0) {
+			store.index = &index;
+		} else {
+			fprintf(stderr, "Continuing without an index\n");
+			index_free(&index);
+		}
+	}
+
+	const int64_t started_ns = clock_ns(CLOCK_REALTIME);
+	struct Expiry expiry; /* deletes notes added with a time to live, once it runs out. needs the index to know which those are */
+	expiry_init(&expiry, started_ns);
+	if (store.index != NULL) {
+		if (expiry_load(&expiry, store.index) != 0) {
+			fprintf(stderr, "Some expiring notes will only be deleted by a later run\n");
+		}
+	}
+
+	struct Tiers tiers; /* hot tier & packer. needs the index too - it's the only record of which notes are packed */
+	if (store.index != NULL) {
+		if (tier_init(&tiers, started_ns) == 0) {
+			store.tiers = &tiers;
+			if (handoff.tier_state != -1) { /* not fatal - notes are simply read back in as they're wanted */
+				tier_restore(&tiers, &store, handoff.tier_state, started_ns);
+			}
+		} else {
+			fprintf(stderr, "Continuing with every note a plain file - packed notes are unreachable until a later run\n");
+		}
+	}
+
+	capture_open(store.dir_fd, NOTICEBOARD_CAPTURE_NAME, taken_over); /* not fatal - a server that can't capture still serves. one that took over carries on the old server's capture */
+
+	struct Transfer transfer; /* export or import running in the background, whilst everyone else is served */
+	transfer_init(&transfer);
+	store.transfer = &transfer;
+
+	/* Number 7: create UNIX (IPC) socket
 	 * AF_UNIX / AF_LOCAL (as opposed to AF_INET)
 	 * 0 just selects first protocol which implements what's requested
 	 * we configure options to make our sockets work reliably by diabling signal issues & enabling port re-use
+	 * if we took over, the socket came already bound & listening, so none of that is redone
 	 * (from this point on, we jump to a cleanup section)
 	 */
 	fprintf(stdout, "Creating socket handle\n");
 	int exit_code = 0;
 
-	const int server_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct rlimit fd_limit; /* every session needs its socket, plus three handles if it has a ring - make sure the default soft limit doesn't cap us well short of NOTICEBOARD_MAX_SESSIONS */
+	if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0) {
+		const rlim_t wanted = (rlim_t)NOTICEBOARD_MAX_SESSIONS * 4 + 64;
+		if (fd_limit.rlim_cur < wanted) {
+			fd_limit.rlim_cur = (fd_limit.rlim_max < wanted ? fd_limit.rlim_max : wanted);
+			if (setrlimit(RLIMIT_NOFILE, &fd_limit) != 0) { /* not fatal - connections past the limit just fail to be accepted */
+				fprintf(stderr, "Failure to raise open file limit (errno %d: %s)\n", errno, strerror(errno));
+			}
+		}
+	}
+
+	const int server_sock = (taken_over ? handoff.listener : socket(AF_UNIX, SOCK_STREAM, 0));
+	handoff.listener = -1; /* ours now */
+	int control_sock = -1;
 	if (server_sock == -1) {  /* validly can be any non-negative so check for -1 which is error */
 		fprintf(stderr, "Failure to create socket (errno %d: %s)\n", errno, strerror(errno));
+		if (store.index != NULL) {
+			index_free(store.index);
+		}
+		if (store.tiers != NULL) {
+			tier_free(store.tiers);
+		}
+		expiry_free(&expiry);
+		capture_close();
+		handoff_free(&handoff);
+		store_close(&store);
 		return 1;
 	}
 
 	if (
+		!taken_over
+		&&
 		setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) != 0
 		&&
 		setsockopt(server_sock, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int)) != 0
@@ -135,26 +629,32 @@ int main(void)
 	 	* else (it exists but not right permissions), kill program
 	 */
 
-	fprintf(stdout, "Creating UNIX domain socket @ (%s/)%s\n", root_dir, notes_socket);
-	if (bind(server_sock, (struct sockaddr*)&address, addrlen) != 0) {
+	fprintf(stdout, "%s UNIX domain socket @ (%s/)%s\n", (taken_over ? "Took over" : "Creating"), root_dir, notes_socket);
+	if (!taken_over && bind(server_sock, (struct sockaddr*)&address, addrlen) != 0) {
 		fprintf(stderr, "Failure to bind socket to socketfile (errno %d: %s)\n", errno, strerror(errno));
 		exit_code = 1;
 		goto eop;
 	}
 
-	if (chmod(notes_socket, SOCKET_PERMISSIONS) != 0) {
+	if (!taken_over && chmod(notes_socket, SOCKET_PERMISSIONS) != 0) {
 		fprintf(stderr, "Failure to set permissions for socketfile (errno %d: %s)\n", errno, strerror(errno));
 		exit_code = 1;
 		goto eop;
 	}
 
 	fprintf(stdout, "Setting listener to socket\n");
-	if (listen(server_sock, 100) != 0) { /* set socket up to serve as a server, 3 define the maximum length to which the queue of pending connections */
+	if (!taken_over && listen(server_sock, 100) != 0) { /* set socket up to serve as a server, 3 define the maximum length to which the queue of pending connections */
 		fprintf(stderr, "Failure to set socket as listener (i.e. a server) (errno %d: %s)\n", errno, strerror(errno));
 		exit_code = 1;
 		goto eop;
 	}
 
+	control_sock = (taken_over ? handoff.control : handoff_listen(control_socket)); /* not fatal - only means nothing can take over from us */
+	handoff.control = -1;
+	if (control_sock == -1) {
+		fprintf(stderr, "Continuing without a control socket - this server can't be taken over\n");
+	}
+
 	if (chdir(notes_folder) != 0) { /* now that we've set everything up, we'll chdir again to the notes_folder. socket exists already so we're fine */
 		fprintf(stderr, "Failure to chdir into sub-directory of notes '%s' (errno %d: %s)\n", notes_folder, errno, strerror(errno));
 		exit_code = 1;
@@ -162,25 +662,345 @@ int main(void)
 	}
 
 	/** Main Program **/
-	/* Number 4: accept one connection at a time */
-	while (1) {
-		const int client_sock = accept(server_sock, NULL, NULL);
-		if (client_sock < 0) { /* validly can be any non-negative so check for -1 which is error */
-			fprintf(stderr, "Unexpected issue when creating server-client dedicated socket (errno %d: %s)\n", errno, strerror(errno));
+	/* Number 8: wait on the listening socket & every open session at once
+	 * sessions stay open across requests until the client hangs up, so library clients can reuse one connection
+	 * session sockets are non-blocking - a ready socket means more of a request has arrived (or the client has gone, or is taking its responses); a rung doorbell means its ring has requests waiting
+	 * nobody can hold us up by stalling part way through a request: each phase of a session has a deadline, tracked on a timer wheel, & a session missing one is aborted
+	 * SIGINT & SIGTERM arrive as events too, so we can stop cleanly (& snapshot the index) rather than being killed mid-request. so does SIGUSR1, which dumps the trace ring (see trace.h) & flushes the capture
+	 * a connection to the control socket is a newer server taking over (see handoff.h) - we stop accepting, park sessions as they fall idle, then hand everything over & exit
+	 * expired notes are deleted a batch per pass, & idle notes are packed into the cold tier a few at a time (see tier.h), so the wait times out whenever the next periodic index snapshot, deadline, expiry or packing pass is due
+	 */
+	struct Session *const sessions = calloc(NOTICEBOARD_MAX_SESSIONS, sizeof(*sessions));
+	if (sessions == NULL) {
+		fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+		exit_code = 1;
+		goto eop;
+	}
+	for (size_t i = 0; i < NOTICEBOARD_MAX_SESSIONS; ++i) {
+		sessions[i].sock = -1;
+	}
+
+	const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		fprintf(stderr, "Failure to create event poller (errno %d: %s)\n", errno, strerror(errno));
+		free(sessions);
+		exit_code = 1;
+		goto eop;
+	}
+
+	struct epoll_event listener_event = { .events = EPOLLIN, .data.u64 = LISTENER_TAG };
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_sock, &listener_event) != 0) {
+		fprintf(stderr, "Failure to poll listening socket (errno %d: %s)\n", errno, strerror(errno));
+		close(epoll_fd);
+		free(sessions);
+		exit_code = 1;
+		goto eop;
+	}
+
+	sigset_t shutdown_signals;
+	sigemptyset(&shutdown_signals);
+	sigaddset(&shutdown_signals, SIGINT);
+	sigaddset(&shutdown_signals, SIGTERM);
+	sigaddset(&shutdown_signals, SIGUSR1); /* not a shutdown - dumps the trace ring */
+	const int signal_fd = (sigprocmask(SIG_BLOCK, &shutdown_signals, NULL) == 0 ? signalfd(-1, &shutdown_signals, SFD_NONBLOCK | SFD_CLOEXEC) : -1);
+	struct epoll_event signal_event = { .events = EPOLLIN, .data.u64 = SIGNAL_TAG };
+	if (signal_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &signal_event) != 0) {
+		fprintf(stderr, "Failure to watch for shutdown signals (errno %d: %s)\n", errno, strerror(errno));
+		if (signal_fd != -1) {
+			close(signal_fd);
+		}
+		close(epoll_fd);
+		free(sessions);
+		exit_code = 1;
+		goto eop;
+	}
+
+	struct epoll_event control_event = { .events = EPOLLIN, .data.u64 = CONTROL_TAG };
+	if (control_sock != -1 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, control_sock, &control_event) != 0) { /* not fatal - as above */
+		fprintf(stderr, "Failure to poll control socket (errno %d: %s)\n", errno, strerror(errno));
+	}
+
+	struct Admission admission; /* per-uid rate limits & a cap on work per pass, shedding the excess with BUSY */
+	admission_init(&admission);
+
+	struct TimerWheel wheel; /* deadlines of every session */
+	timer_wheel_init(&wheel, now_tick());
+	uint64_t deadline_aborts[SESSION_TRANSFER + 1] = {0}; /* running totals, by phase */
+
+	if (taken_over) {
+		resume_sessions(epoll_fd, &wheel, &store, &admission, sessions, &handoff);
+	}
+	handoff_free(&handoff);
+	int handoff_peer = -1; /* newer server we're handing over to, whilst draining */
+	uint64_t drain_until = 0; /* tick by which sessions still mid-request are given up on */
+	struct HandoffRequest takeover = { .peer = -1 }; /* takeover request still arriving, if any */
+	uint64_t takeover_until = 0; /* tick by which it has to have arrived */
+
+	uint64_t snapshot_generation = 0; /* index generation last persisted */
+	struct timespec next_snapshot;
+	clock_gettime(CLOCK_MONOTONIC, &next_snapshot);
+	next_snapshot.tv_sec += NOTICEBOARD_SNAPSHOT_INTERVAL;
+	struct timespec next_pack;
+	clock_gettime(CLOCK_MONOTONIC, &next_pack);
+
+	int transfer_polled = 0; /* boolean. transfer's report pipe is registered */
+
+	int running = 1;
+	while (running) {
+		if (transfer.report_fd != -1 && !transfer_polled) { /* started by a request last pass */
+			struct epoll_event transfer_event = { .events = EPOLLIN, .data.u64 = TRANSFER_TAG };
+			if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, transfer.report_fd, &transfer_event) != 0) { /* can't tell when it's done - so stop it now, rather than leave its session waiting forever */
+				fprintf(stderr, "Failure to poll transfer reports (errno %d: %s)\n", errno, strerror(errno));
+				transfer_abort(&transfer, &store);
+				finish_transfer(epoll_fd, &wheel, &store, &admission, sessions, &transfer);
+			} else {
+				transfer_polled = 1;
+			}
+		}
+
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > next_snapshot.tv_sec || (now.tv_sec == next_snapshot.tv_sec && now.tv_nsec >= next_snapshot.tv_nsec)) {
+			if (store.index != NULL && store.index->generation != snapshot_generation && index_snapshot(store.index, &store, NOTICEBOARD_SNAPSHOT_NAME) == 0) {
+				snapshot_generation = store.index->generation;
+			}
+			next_snapshot = now;
+			next_snapshot.tv_sec += NOTICEBOARD_SNAPSHOT_INTERVAL;
+		}
+		int timeout_ms = (int)((next_snapshot.tv_sec - now.tv_sec) * 1000 + (next_snapshot.tv_nsec - now.tv_nsec) / 1000000 + 1);
+
+		const uint64_t tick = now_tick();
+		struct TimerLink expired;
+		timer_list_init(&expired);
+		timer_expire(&wheel, tick, &expired);
+		for (struct TimerLink *link; (link = timer_list_pop(&expired)) != NULL;) {
+			struct Session *const session = (struct Session *)((char *)link - offsetof(struct Session, deadline));
+			++deadline_aborts[session->phase];
+			fprintf(stderr, "Aborting client on socket %d - missed its %s deadline (%llu aborted so far)\n", session->sock, phase_names[session->phase], (unsigned long long)deadline_aborts[session->phase]);
+			end_session(epoll_fd, &wheel, session);
+		}
+
+		const int64_t ticks_to_deadline = timer_next(&wheel);
+		if (ticks_to_deadline >= 0) {
+			const int64_t deadline_ms = ((int64_t)(wheel.current - tick) + ticks_to_deadline) * NOTICEBOARD_TIMER_TICK_MS;
+			if (deadline_ms < timeout_ms) {
+				timeout_ms = (int)deadline_ms;
+			}
+		}
+
+		const int64_t realtime_ns = clock_ns(CLOCK_REALTIME); /* expiry times are wall-clock times, as given to clients */
+		expiry_reap(&expiry, &store, realtime_ns);
+		const int64_t expiry_ms = expiry_next_ms(&expiry, realtime_ns);
+		if (expiry_ms >= 0 && expiry_ms < timeout_ms) {
+			timeout_ms = (int)expiry_ms;
+		}
+		if (store.tiers != NULL && NOTICEBOARD_PACK_INTERVAL_MS > 0) { /* a little packing at a time, so requests are never held up for long */
+			if (now.tv_sec > next_pack.tv_sec || (now.tv_sec == next_pack.tv_sec && now.tv_nsec >= next_pack.tv_nsec)) {
+				tier_pack(store.tiers, &store, realtime_ns);
+				next_pack = now;
+				next_pack.tv_sec += NOTICEBOARD_PACK_INTERVAL_MS / 1000;
+				next_pack.tv_nsec += (NOTICEBOARD_PACK_INTERVAL_MS % 1000) * 1000000;
+				if (next_pack.tv_nsec >= 1000000000) {
+					++next_pack.tv_sec;
+					next_pack.tv_nsec -= 1000000000;
+				}
+			}
+			const int pack_ms = (int)((next_pack.tv_sec - now.tv_sec) * 1000 + (next_pack.tv_nsec - now.tv_nsec) / 1000000 + 1);
+			if (pack_ms < timeout_ms) {
+				timeout_ms = pack_ms;
+			}
+		}
+		admission_settle(&admission); /* everything admitted last pass has been answered */
+
+		if (takeover.peer != -1) {
+			if (tick >= takeover_until) {
+				fprintf(stderr, "Refusing takeover from pid %d - no request within %dms\n", (int)takeover.pid, HANDOFF_REQUEST_TIMEOUT_MS);
+				close(takeover.peer); /* leaves epoll with it */
+				takeover.peer = -1;
+			} else if ((int64_t)(takeover_until - tick) * NOTICEBOARD_TIMER_TICK_MS < timeout_ms) {
+				timeout_ms = (int)((takeover_until - tick) * NOTICEBOARD_TIMER_TICK_MS);
+			}
+		}
+
+		if (handoff_peer != -1) { /* handing over - park sessions as they fall idle, then hand over once they all have (or time's up) */
+			size_t draining = 0;
+			for (size_t i = 0; i < NOTICEBOARD_MAX_SESSIONS; ++i) {
+				if (sessions[i].sock == -1 || sessions[i].parked) {
+					continue;
+				} else if (session_idle(&sessions[i])) {
+					park_session(epoll_fd, &wheel, &sessions[i]);
+				} else if (tick >= drain_until) {
+					fprintf(stderr, "Aborting client on socket %d - still mid-request after draining for %dms\n", sessions[i].sock, NOTICEBOARD_HANDOFF_DRAIN_MS);
+					end_session(epoll_fd, &wheel, &sessions[i]);
+				} else {
+					++draining;
+				}
+			}
+
+			if (draining == 0) {
+				if (transfer.pid != 0) { /* its session gave up (or was given up on) - whatever it imported must be in the index we hand over */
+					transfer_abort(&transfer, &store);
+					transfer_polled = 0;
+				}
+				if (store.index != NULL && store.index->generation != snapshot_generation && index_snapshot(store.index, &store, NOTICEBOARD_SNAPSHOT_NAME) == 0) { /* the new server's index is built from it */
+					snapshot_generation = store.index->generation;
+				}
+
+				capture_flush(); /* so the new server carries on after the last of ours */
+				const int tier_state = (store.tiers != NULL ? tier_save(store.tiers) : -1); /* not fatal - the new server's hot tier just starts cold */
+				const int handed = handoff_send(handoff_peer, server_sock, control_sock, tier_state, sessions, NOTICEBOARD_MAX_SESSIONS);
+				if (tier_state != -1) {
+					close(tier_state);
+				}
+				close(handoff_peer);
+				handoff_peer = -1;
+				if (handed != 1) { /* listening socket has gone - so has everything else, or it's lost. nothing is ended, just let go of */
+					for (size_t i = 0; i < NOTICEBOARD_MAX_SESSIONS; ++i) {
+						session_close(&sessions[i]);
+					}
+					running = 0;
+					continue;
+				}
+
+				fprintf(stderr, "Handoff failed - carrying on\n");
+				if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_sock, &listener_event) != 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, control_sock, &control_event) != 0) {
+					fprintf(stderr, "Failure to poll listening socket (errno %d: %s)\n", errno, strerror(errno));
+				}
+				for (size_t i = 0; i < NOTICEBOARD_MAX_SESSIONS; ++i) {
+					if (sessions[i].sock != -1 && poll_session(epoll_fd, &wheel, sessions, &sessions[i]) != 0) {
+						end_session(epoll_fd, &wheel, &sessions[i]);
+					}
+				}
+			} else if (timeout_ms > NOTICEBOARD_TIMER_TICK_MS) {
+				timeout_ms = NOTICEBOARD_TIMER_TICK_MS; /* sessions fall idle without any event of their own - look again soon */
+			}
+		}
+
+		struct epoll_event events[EVENTS_PER_WAIT];
+		const int event_count = epoll_wait(epoll_fd, events, EVENTS_PER_WAIT, timeout_ms);
+		if (event_count == -1) {
+			if (errno != EINTR) {
+				fprintf(stderr, "Unexpected issue when waiting for events (errno %d: %s)\n", errno, strerror(errno));
+			}
 			continue;
 		}
-		fprintf(stdout, "Established new client-server connection using socket %d\n", client_sock);
 
-		if (client_connection(client_sock) != 0) { /* handles getting connection, sending acknowledgements */
-			fprintf(stderr, "Issue when handling client (socket %d)\n", client_sock);
-			/* we don't exit - issue with one client cannot terminate system */
+		for (int e = 0; e < event_count; ++e) {
+			if (events[e].data.u64 == LISTENER_TAG) {
+				accept_session(epoll_fd, &wheel, server_sock, sessions);
+				continue;
+			} else if (events[e].data.u64 == SIGNAL_TAG) {
+				struct signalfd_siginfo siginfo;
+				if (read(signal_fd, &siginfo, sizeof(siginfo)) != sizeof(siginfo)) {
+					continue;
+				} else if (siginfo.ssi_signo == SIGUSR1) {
+					trace_dump(store.dir_fd, NOTICEBOARD_TRACE_NAME);
+					capture_flush(); /* so the capture can be copied off mid-run */
+				} else {
+					fprintf(stdout, "Received signal %u - shutting down\n", siginfo.ssi_signo);
+					running = 0;
+				}
+				continue;
+			} else if (events[e].data.u64 == CONTROL_TAG) {
+				struct HandoffRequest request;
+				if (handoff_accept(control_sock, &request) != 0) {
+					continue;
+				} else if (takeover.peer != -1) { /* one at a time - the first is given its HANDOFF_REQUEST_TIMEOUT_MS */
+					fprintf(stderr, "Refusing takeover from pid %d - another is already under way\n", (int)request.pid);
+					close(request.peer);
+					continue;
+				}
+
+				struct epoll_event peer_event = { .events = EPOLLIN | EPOLLRDHUP, .data.u64 = CONTROL_PEER_TAG };
+				if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, request.peer, &peer_event) != 0) {
+					fprintf(stderr, "Failure to poll control connection (errno %d: %s)\n", errno, strerror(errno));
+					close(request.peer);
+					continue;
+				}
+				takeover = request;
+				takeover_until = now_tick() + (uint64_t)(HANDOFF_REQUEST_TIMEOUT_MS + NOTICEBOARD_TIMER_TICK_MS - 1) / NOTICEBOARD_TIMER_TICK_MS;
+				continue;
+			} else if (events[e].data.u64 == TRANSFER_TAG) {
+				if (transfer_poll(&transfer, &store)) { /* report pipe's closed - & out of epoll with it */
+					transfer_polled = 0;
+					finish_transfer(epoll_fd, &wheel, &store, &admission, sessions, &transfer);
+				}
+				continue;
+			} else if (events[e].data.u64 == CONTROL_PEER_TAG) {
+				if (takeover.peer == -1) { /* given up on earlier in this batch of events */
+					continue;
+				}
+
+				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, takeover.peer, NULL); /* whatever happens next, it's done being polled - or it's put back below */
+				const int read_ret = handoff_read(&takeover);
+				if (read_ret == 1) {
+					struct epoll_event peer_event = { .events = EPOLLIN | EPOLLRDHUP, .data.u64 = CONTROL_PEER_TAG };
+					if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, takeover.peer, &peer_event) != 0) {
+						close(takeover.peer);
+						takeover.peer = -1;
+					}
+				} else if (read_ret == 0) { /* stop accepting - whatever connects from now on waits in the backlog for the new server */
+					handoff_peer = takeover.peer;
+					takeover.peer = -1;
+					epoll_ctl(epoll_fd, EPOLL_CTL_DEL, server_sock, NULL);
+					epoll_ctl(epoll_fd, EPOLL_CTL_DEL, control_sock, NULL);
+					drain_until = now_tick() + (uint64_t)(NOTICEBOARD_HANDOFF_DRAIN_MS + NOTICEBOARD_TIMER_TICK_MS - 1) / NOTICEBOARD_TIMER_TICK_MS;
+					fprintf(stdout, "Stopped accepting - draining sessions to hand over\n");
+				}
+				continue;
+			}
+
+			struct Session *const session = &sessions[SESSION_SLOT(events[e].data.u64)];
+			if (session->sock == -1) { /* ended earlier in this batch of events */
+				continue;
+			}
+
+			if (SESSION_IS_DOORBELL(events[e].data.u64)) {
+				if (session_serve(&store, &admission, session) != 0) {
+					end_session(epoll_fd, &wheel, session);
+				}
+				continue;
+			}
+
+			const int had_ring = session->has_ring;
+			const enum session_phase was = session->phase;
+			const int ret = client_connection(&store, &admission, session); /* handles getting requests, sending acknowledgements */
+			if (ret != 0 || track_session(epoll_fd, &wheel, sessions, session, was) != 0) { /* hung up, or out of step with us - either way, done. problems with individual requests were reported to the client */
+				end_session(epoll_fd, &wheel, session);
+				continue;
+			}
+
+			if (!had_ring && session->has_ring) { /* ring negotiated - start listening for its doorbell too */
+				struct epoll_event doorbell_event = { .events = EPOLLIN, .data.u64 = SESSION_DOORBELL_TAG(session - sessions) };
+				if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, session->ring.doorbells[RING_REQUESTS], &doorbell_event) != 0) {
+					fprintf(stderr, "Failure to poll ring session (errno %d: %s)\n", errno, strerror(errno));
+					end_session(epoll_fd, &wheel, session);
+				} else if (session_serve(&store, &admission, session) != 0) { /* client may well have pushed before we started listening for the doorbell */
+					end_session(epoll_fd, &wheel, session);
+				}
+			}
 		}
+	}
 
-		fprintf(stdout, "Terminating client on socket %d\n", client_sock);
-		if (close(client_sock) != 0) { /* attempt to close socket whilst reporting errors */
-			fprintf(stderr, "Error closing socket %d (errno %d: %s)\n", client_sock, errno, strerror(errno));
+	for (size_t i = 0; i < NOTICEBOARD_MAX_SESSIONS; ++i) {
+		if (sessions[i].sock != -1) {
+			end_session(epoll_fd, &wheel, &sessions[i]);
 		}
 	}
+	free(sessions);
+	transfer_abort(&transfer, &store); /* before the snapshot, so it has whatever was imported */
+	if (handoff_peer != -1) { /* stopped part way through a handoff - the new server will find we've gone */
+		close(handoff_peer);
+	}
+	if (takeover.peer != -1) {
+		close(takeover.peer);
+	}
+	close(signal_fd);
+	close(epoll_fd);
+
+	if (store.index != NULL && store.index->generation != snapshot_generation && index_snapshot(store.index, &store, NOTICEBOARD_SNAPSHOT_NAME) != 0) { /* lets the next start skip rescanning */
+		exit_code = 3;
+	}
 
 	/** End of Program (EOP) **/
 eop:
@@ -188,5 +1008,27 @@ eop:
 		fprintf(stderr, "Error closing socket %d (errno %d: %s)\n", server_sock, errno, strerror(errno));
 		exit_code = 3;
 	}
+	if (control_sock != -1) { /* its socketfile is left for whoever took over, if anyone did */
+		close(control_sock);
+	}
+	handoff_free(&handoff);
+
+	capture_close();
+	if (store.index != NULL) {
+		store.index->expiry = NULL;
+	}
+	expiry_free(&expiry);
+	if (store.tiers != NULL) {
+		tier_free(store.tiers);
+		store.tiers = NULL;
+	}
+	if (store.index != NULL) {
+		index_free(store.index);
+		store.index = NULL;
+	}
+
+	if (store_close(&store) != 0) {
+		exit_code = 3;
+	}
 	return exit_code;
 }
@@ -0,0 +1,329 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <endian.h>
+
+#include "store.h"
+
+/**
+ * @brief Definitions of functionality to lay notes out on disk
+ */
+
+int store_open(struct Store *const store, const char *const notes_dir)
+{
+	if (store == NULL || notes_dir == NULL) {
+		fprintf(stderr, "Store struct & notes directory cannot be NULL\n");
+		return 1;
+	}
+
+	store->dir_fd = open(notes_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (store->dir_fd == -1) {
+		fprintf(stderr, "Failure to open notes directory '%s' (errno %d: %s)\n", notes_dir, errno, strerror(errno));
+		return 1;
+	}
+	store->shard_levels = NOTICEBOARD_SHARD_LEVELS;
+	store->index = NULL;
+	store->tiers = NULL;
+	store->transfer = NULL;
+
+	return 0;
+}
+
+int store_close(struct Store *const store)
+{
+	if (store == NULL || store->dir_fd == -1) {
+		return 0;
+	}
+
+	const int ret = close(store->dir_fd);
+	store->dir_fd = -1;
+	if (ret != 0) {
+		fprintf(stderr, "Error closing notes directory (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief shard_hash - spreads uids over fan-out directories
+ * uids are handed out sequentially so they're run through a multiplicative (Knuth) hash first, else every user would land in the same few shards
+ * @param const uid_t uid - uid to hash
+ * @return uint32_t - hash, one byte of which is used per fan-out level
+ */
+static inline uint32_t shard_hash(const uid_t uid)
+{
+	return (uint32_t)uid * 2654435761u;
+}
+
+/**
+ * @brief open_subdir - opens (and optionally creates) a directory relative to another
+ * @param const int parent_fd - directory handle to resolve name against
+ * @param const char *const name - single path component
+ * @param const int create - boolean. create directory if it's missing
+ * @return int - directory handle on success, -1 on failure (errno preserved)
+ */
+static int open_subdir(const int parent_fd, const char *const name, const int create)
+{
+	int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1 && errno == ENOENT && create) {
+		if (mkdirat(parent_fd, name, STORE_DIR_PERMISSIONS) != 0 && errno != EEXIST) { /* EEXIST can only be a harmless race */
+			return -1;
+		}
+		fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	}
+
+	return fd;
+}
+
+int store_uid_dir(const struct Store *const store, const uid_t uid, const int create)
+{
+	if (store == NULL || store->dir_fd == -1) {
+		errno = EBADF;
+		return -1;
+	}
+
+	char name[sizeof("4294967295")]; /* big enough for either a fan-out level (2 hex digits) or any uid */
+	const uint32_t hash = shard_hash(uid);
+	int dir_fd = store->dir_fd;
+
+	for (unsigned int level = 0; level < store->shard_levels; ++level) { /* walk down fan-out levels, one handle at a time */
+		snprintf(name, sizeof(name), "%02x", (unsigned int)((hash >> (8 * level)) & 0xFF));
+
+		const int next_fd = open_subdir(dir_fd, name, create);
+		if (dir_fd != store->dir_fd) {
+			const int saved_errno = errno;
+			close(dir_fd);
+			errno = saved_errno;
+		}
+		if (next_fd == -1) {
+			return -1;
+		}
+		dir_fd = next_fd;
+	}
+
+	snprintf(name, sizeof(name), "%u", (unsigned int)uid);
+	const int uid_fd = open_subdir(dir_fd, name, create);
+	if (dir_fd != store->dir_fd) {
+		const int saved_errno = errno;
+		close(dir_fd);
+		errno = saved_errno;
+	}
+
+	return uid_fd;
+}
+
+int64_t store_note_expiry(const int note_fd)
+{
+	struct stat statbuf;
+	if (fstat(note_fd, &statbuf) != 0 || !(statbuf.st_mode & S_ISVTX)) { /* only expiring notes carry the sticky bit, so most notes cost just the fstat */
+		return 0;
+	}
+
+	uint64_t expires_le;
+	if (fgetxattr(note_fd, STORE_EXPIRY_XATTR, &expires_le, sizeof(expires_le)) != sizeof(expires_le)) {
+		return 0;
+	}
+
+	return (int64_t)le64toh(expires_le);
+}
+
+/**
+ * @brief walk_level - visits every uid directory beneath one directory of the store
+ * @param const int dir_fd - directory to scan (not closed)
+ * @param const unsigned int levels_left - fan-out levels between dir_fd and the uid directories
+ * @param const store_uid_visitor visitor - as per store_for_each_uid
+ * @param void *const ctx - as per store_for_each_uid
+ * @return int - as per store_for_each_uid
+ */
+static int walk_level(const int dir_fd, const unsigned int levels_left, const store_uid_visitor visitor, void *const ctx)
+{
+	const int scan_fd = dup(dir_fd); /* closedir will close the handle it's given, so give it its own */
+	if (scan_fd == -1) {
+		fprintf(stderr, "Error duplicating directory handle (errno %d: %s)\n", errno, strerror(errno));
+		return -1;
+	}
+
+	DIR *const dir = fdopendir(scan_fd);
+	if (dir == NULL) {
+		fprintf(stderr, "Error reading notes directory (errno %d: %s)\n", errno, strerror(errno));
+		close(scan_fd);
+		return -1;
+	}
+	rewinddir(dir);
+
+	int exit_code = 0;
+	struct dirent *entry;
+	while (exit_code == 0 && (entry = readdir(dir)) != NULL) {
+		if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN) { /* open_subdir refuses non-directories anyway, this just saves the syscall */
+			continue;
+		}
+
+		char *name_end;
+		const unsigned long value = strtoul(entry->d_name, &name_end, (levels_left > 0 ? 16 : 10));
+		if (entry->d_name[0] < '0' || *name_end != '\0' || (levels_left > 0 ? name_end - entry->d_name != 2 : value > UINT32_MAX)) { /* fan-out names are two hex digits, uid names are decimal. also rules out "." & ".." */
+			continue;
+		}
+
+		const int sub_fd = open_subdir(dir_fd, entry->d_name, 0);
+		if (sub_fd == -1) {
+			continue;
+		}
+
+		exit_code = (levels_left > 0 ? walk_level(sub_fd, levels_left - 1, visitor, ctx) : visitor((uid_t)value, sub_fd, ctx));
+		close(sub_fd);
+	}
+
+	closedir(dir);
+	return exit_code;
+}
+
+int store_for_each_uid(const struct Store *const store, const store_uid_visitor visitor, void *const ctx)
+{
+	if (store == NULL || store->dir_fd == -1 || visitor == NULL) {
+		fprintf(stderr, "Store must be opened & visitor given before walking\n");
+		return -1;
+	}
+
+	return walk_level(store->dir_fd, store->shard_levels, visitor, ctx);
+}
+
+/**
+ * @brief match_uid_suffix - works out which user a flat-layout filename belonged to
+ * @param const char *const filename - null-terminated legacy filename (<subject><uid>)
+ * @param const uid_t *const uids - known uids
+ * @param const size_t uid_count - number of known uids
+ * @param uid_t *const owner - filled with matched uid
+ * @return size_t - length of subject part of filename, 0 if no uid matched
+ */
+static size_t match_uid_suffix(const char *const filename, const uid_t *const uids, const size_t uid_count, uid_t *const owner)
+{
+	const size_t filename_len = strlen(filename);
+	size_t best_uid_len = 0;
+	char uid_str[sizeof("4294967295")];
+
+	for (size_t i = 0; i < uid_count; ++i) {
+		const int uid_len = snprintf(uid_str, sizeof(uid_str), "%u", (unsigned int)uids[i]);
+		if (uid_len <= 0 || (size_t)uid_len >= filename_len || (size_t)uid_len <= best_uid_len) { /* need at least one subject character left over, and prefer the longest match */
+			continue;
+		}
+
+		if (memcmp(filename + filename_len - uid_len, uid_str, uid_len) == 0) {
+			best_uid_len = uid_len;
+			*owner = uids[i];
+		}
+	}
+
+	return (best_uid_len == 0 ? 0 : filename_len - best_uid_len);
+}
+
+int store_migrate(const struct Store *const store, const uid_t *const uids, const size_t uid_count)
+{
+	if (store == NULL || store->dir_fd == -1) {
+		fprintf(stderr, "Store must be opened before migrating\n");
+		return 1;
+	}
+
+	const int scan_fd = dup(store->dir_fd); /* closedir will close the handle it's given, so give it its own */
+	if (scan_fd == -1) {
+		fprintf(stderr, "Error duplicating notes directory handle (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	DIR *const dir = fdopendir(scan_fd);
+	if (dir == NULL) {
+		fprintf(stderr, "Error reading notes directory (errno %d: %s)\n", errno, strerror(errno));
+		close(scan_fd);
+		return 1;
+	}
+	rewinddir(dir);
+
+	/* collect legacy names first - renaming entries out of a directory whilst iterating it can cause entries to be skipped or repeated */
+	char **legacy = NULL;
+	size_t legacy_count = 0, legacy_cap = 0;
+	int exit_code = 0;
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if ((entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN) || entry->d_name[0] == '.') { /* uid / fan-out directories are already in the new layout. subjects can't contain '.', so dot-files are the server's own (e.g. index snapshot) */
+			continue;
+		}
+
+		if (entry->d_type == DT_UNKNOWN) { /* some filesystems don't fill in d_type */
+			struct stat statbuf;
+			if (fstatat(store->dir_fd, entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(statbuf.st_mode)) {
+				continue;
+			}
+		}
+
+		if (legacy_count == legacy_cap) {
+			const size_t new_cap = (legacy_cap == 0 ? 64 : legacy_cap * 2);
+			char **const grown = realloc(legacy, new_cap * sizeof(*legacy));
+			if (grown == NULL) {
+				fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+				exit_code = 1;
+				goto end;
+			}
+			legacy = grown;
+			legacy_cap = new_cap;
+		}
+
+		legacy[legacy_count] = strdup(entry->d_name);
+		if (legacy[legacy_count] == NULL) {
+			fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+			exit_code = 1;
+			goto end;
+		}
+		++legacy_count;
+	}
+
+	if (legacy_count > 0) {
+		fprintf(stdout, "Migrating %lu note(s) from flat layout into per-uid directories\n", (unsigned long)legacy_count);
+	}
+
+	for (size_t i = 0; i < legacy_count; ++i) {
+		uid_t owner = 0;
+		const size_t sbj_len = match_uid_suffix(legacy[i], uids, uid_count, &owner);
+		if (sbj_len == 0) {
+			fprintf(stderr, "Unable to work out owner of legacy note '%s' - leaving it in place\n", legacy[i]);
+			exit_code = 2;
+			continue;
+		}
+
+		const int uid_fd = store_uid_dir(store, owner, 1);
+		if (uid_fd == -1) {
+			fprintf(stderr, "Error creating directory for uid %u (errno %d: %s)\n", (unsigned int)owner, errno, strerror(errno));
+			exit_code = 2;
+			continue;
+		}
+
+		char sbj[sizeof(entry->d_name)];
+		memcpy(sbj, legacy[i], sbj_len);
+		sbj[sbj_len] = '\0';
+
+		if (renameat2(store->dir_fd, legacy[i], uid_fd, sbj, RENAME_NOREPLACE) != 0) { /* never clobber a note which already exists in the new layout */
+			fprintf(stderr, "Error moving legacy note '%s' to %u/%s (errno %d: %s)\n", legacy[i], (unsigned int)owner, sbj, errno, strerror(errno));
+			exit_code = 2;
+		}
+		close(uid_fd);
+	}
+
+end:
+	for (size_t i = 0; i < legacy_count; ++i) {
+		free(legacy[i]);
+	}
+	free(legacy);
+	closedir(dir);
+
+	return exit_code;
+}
@@ -0,0 +1,129 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#endif /* if defined(__SSE2__) */
+
+#include "subject.h"
+
+/**
+ * @brief Definitions of subject validation
+ */
+
+/**
+ * @brief SubjectClasses (struct) - one bit per byte of a subject (bit i is byte i) for each class of character that matters. bits past the subject are clear
+ */
+struct SubjectClasses {
+	uint64_t invalid; /* ';', '/', '.' or '\\' */
+
+	uint64_t space; /* ' ', '\t', '\n' or '\r' */
+
+	uint64_t nul;
+};
+
+#if defined(__SSE2__)
+/**
+ * @brief subject_classify_vector - classifies 16 bytes at once, adding them to a subject's masks
+ * @param const __m128i chunk - bytes to classify
+ * @param const uint32_t keep - which of chunk's bytes count (bit i is byte i)
+ * @param const size_t at - where chunk's first byte sits in the subject
+ * @param struct SubjectClasses *const classes - masks to add to
+ */
+static void subject_classify_vector(const __m128i chunk, const uint32_t keep, const size_t at, struct SubjectClasses *const classes)
+{
+	const __m128i invalid = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(';')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('/'))), _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('.')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'))));
+	const __m128i space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t'))), _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r'))));
+	const __m128i nul = _mm_cmpeq_epi8(chunk, _mm_setzero_si128());
+	classes->invalid |= (uint64_t)((uint32_t)_mm_movemask_epi8(invalid) & keep) << at;
+	classes->space |= (uint64_t)((uint32_t)_mm_movemask_epi8(space) & keep) << at;
+	classes->nul |= (uint64_t)((uint32_t)_mm_movemask_epi8(nul) & keep) << at;
+}
+#endif /* if defined(__SSE2__) */
+
+/**
+ * @brief subject_classify - classifies every byte of a subject, without reading past its end
+ * With SSE2, whole 16 byte vectors, the last overlapping the one before it (a subject shorter than 16 bytes is loaded as two overlapping halves, or gathered into one if shorter still). classifying a byte twice changes nothing
+ * @param const uint8_t *const sbj - subject
+ * @param const size_t sbj_len - length of sbj. 1 to MAX_SBJ_LEN
+ * @param struct SubjectClasses *const classes - filled with each class's mask
+ */
+static void subject_classify(const uint8_t *const sbj, const size_t sbj_len, struct SubjectClasses *const classes)
+{
+	classes->invalid = 0;
+	classes->space = 0;
+	classes->nul = 0;
+
+#if defined(__SSE2__)
+	if (sbj_len >= 16) {
+		size_t at = 0;
+		for (; at + 16 <= sbj_len; at += 16) {
+			subject_classify_vector(_mm_loadu_si128((const __m128i*)(const void*)(sbj + at)), 0xFFFF, at, classes);
+		}
+		if (at < sbj_len) {
+			subject_classify_vector(_mm_loadu_si128((const __m128i*)(const void*)(sbj + sbj_len - 16)), 0xFFFF, sbj_len - 16, classes);
+		}
+	} else if (sbj_len >= 8) { /* first 8 bytes in the low half, last 8 in the high */
+		const __m128i chunk = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(const void*)sbj), _mm_loadl_epi64((const __m128i*)(const void*)(sbj + sbj_len - 8)));
+		subject_classify_vector(chunk, 0x00FF, 0, classes);
+		subject_classify_vector(_mm_srli_si128(chunk, 8), 0x00FF, sbj_len - 8, classes);
+	} else {
+		uint64_t word = 0; /* gathered in a register, so the load never waits on a partly overlapping store */
+		for (size_t i = 0; i < sbj_len; ++i) {
+			word |= (uint64_t)sbj[i] << (8 * i);
+		}
+		subject_classify_vector(_mm_set_epi64x(0, (long long)word), ((uint32_t)1 << sbj_len) - 1, 0, classes);
+	}
+#else
+	for (size_t i = 0; i < sbj_len; ++i) {
+		const uint64_t bit = (uint64_t)1 << i;
+		switch (sbj[i]) {
+			case ';':
+			case '/':
+			case '.':
+			case '\\':
+				classes->invalid |= bit;
+				break;
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r':
+				classes->space |= bit;
+				break;
+			case '\0':
+				classes->nul |= bit;
+				break;
+		}
+	}
+#endif /* if defined(__SSE2__) */
+}
+
+int subject_check(const uint8_t *const sbj, const size_t sbj_len, size_t *const offset, size_t *const len)
+{
+	if (sbj_len < 1 || sbj_len > MAX_SBJ_LEN) {
+		fprintf(stderr, "Invalid subject length: bad length (%lu)\n", (unsigned long)sbj_len);
+		return 1;
+	}
+
+	struct SubjectClasses classes;
+	subject_classify(sbj, sbj_len, &classes);
+
+	if (classes.invalid != 0) {
+		fprintf(stderr, "Subject content field contains '%c', which is an invalid character\n", sbj[__builtin_ctzll(classes.invalid)]);
+		return 2;
+	}
+
+	const uint64_t given = ((uint64_t)1 << sbj_len) - 1; /* sbj_len is at most 63 */
+	const uint64_t non_space = ~classes.space & given;
+	const size_t end = (classes.nul != 0 ? (size_t)__builtin_ctzll(classes.nul) : sbj_len);
+	const size_t start = (non_space != 0 ? (size_t)__builtin_ctzll(non_space) : sbj_len);
+	if (start >= end) { /* we need at least one valid character to form a sbj / filename */
+		fprintf(stderr, "Subject must consist of one valid character excluding preceeding whitespace\n");
+		return 3;
+	}
+
+	*offset = start;
+	*len = end - start;
+
+	return 0;
+}
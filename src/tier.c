@@ -0,0 +1,912 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "store.h"
+#include "util.h"
+#include "index.h"
+#include "pack.h"
+#include "tier.h"
+
+/**
+ * @brief Definitions of tiered note storage
+ */
+
+#define HOT_BLOCKS ((size_t)NOTICEBOARD_HOT_BYTES / NOTICEBOARD_HOT_BLOCK_LEN)
+#define HOT_SAMPLE 8 /* hot notes eviction picks the least read of */
+#define SKETCH_PERIOD ((size_t)NOTICEBOARD_TIER_SKETCH_WIDTH * 8) /* reads counted between halvings */
+#define TIER_STATE_MAGIC 0x5354424Eu /* "NBTS" */
+#define TIER_STATE_VERSION 1u
+
+static uint8_t cold_buf[NOTICEBOARD_COLD_MAX_LEN]; /* a packed note, read whole */
+
+/**
+ * @brief TierStateHeader (struct) - start of the state tier_save hands over. the sketch follows, then hot_count TierStateNote, each followed by its len bytes
+ */
+struct TierStateHeader {
+	uint32_t magic; /* TIER_STATE_MAGIC */
+
+	uint32_t version; /* TIER_STATE_VERSION */
+
+	uint32_t sketch_width; /* NOTICEBOARD_TIER_SKETCH_WIDTH of whoever saved it. the sketch is only of use at the same width */
+
+	uint32_t sketch_rows; /* TIER_SKETCH_ROWS */
+
+	uint64_t sketch_adds;
+
+	uint64_t hot_count;
+};
+
+/**
+ * @brief TierStateNote (struct) - one hot note, as handed over
+ */
+struct TierStateNote {
+	uint32_t uid;
+
+	uint32_t len; /* bytes following this record. 1 to MAX_EXTRA_DATA_LEN */
+
+	uint8_t whole; /* boolean */
+
+	uint8_t sbj_len; /* 1 to MAX_SBJ_LEN */
+
+	char sbj[MAX_SBJ_LEN];
+};
+
+/**
+ * @brief note_hash - FNV-1a over the uid & subject, then mixed (murmur3's finaliser) so both halves are usable on their own
+ * @param const uint32_t uid - owner
+ * @param const char *const sbj - subject
+ * @param const size_t sbj_len - length of sbj
+ * @return uint64_t - hash
+ */
+static uint64_t note_hash(const uint32_t uid, const char *const sbj, const size_t sbj_len)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < sizeof(uid); ++i) {
+		hash = (hash ^ ((uid >> (8 * i)) & 0xFF)) * 1099511628211ull;
+	}
+	for (size_t i = 0; i < sbj_len; ++i) {
+		hash = (hash ^ (uint8_t)sbj[i]) * 1099511628211ull;
+	}
+
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDull;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ull;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+/**
+ * @brief sketch_slot - a note's counter in one row of the sketch (double hashing - each row a different combination of the hash's halves)
+ * @param const uint64_t hash - from note_hash
+ * @param const size_t row - 0 to TIER_SKETCH_ROWS - 1
+ * @return size_t - position in the sketch
+ */
+static inline size_t sketch_slot(const uint64_t hash, const size_t row)
+{
+	const uint32_t low = (uint32_t)hash, high = (uint32_t)(hash >> 32) | 1;
+
+	return row * NOTICEBOARD_TIER_SKETCH_WIDTH + ((low + (uint32_t)row * high) & (NOTICEBOARD_TIER_SKETCH_WIDTH - 1));
+}
+
+/**
+ * @brief sketch_estimate - estimates how often a note's been read recently. never less than the truth, rarely much more
+ * @param const struct Tiers *const tiers - tiers
+ * @param const uint64_t hash - from note_hash
+ * @return uint8_t - estimated reads
+ */
+static uint8_t sketch_estimate(const struct Tiers *const tiers, const uint64_t hash)
+{
+	uint8_t estimate = UINT8_MAX;
+	for (size_t row = 0; row < TIER_SKETCH_ROWS; ++row) {
+		const uint8_t count = tiers->sketch[sketch_slot(hash, row)];
+		if (count < estimate) {
+			estimate = count;
+		}
+	}
+
+	return estimate;
+}
+
+/**
+ * @brief sketch_add - counts a read. every SKETCH_PERIOD reads, every counter is halved, so old reads count for less & less
+ * @param struct Tiers *const tiers - tiers
+ * @param const uint64_t hash - from note_hash
+ */
+static void sketch_add(struct Tiers *const tiers, const uint64_t hash)
+{
+	for (size_t row = 0; row < TIER_SKETCH_ROWS; ++row) {
+		uint8_t *const count = &tiers->sketch[sketch_slot(hash, row)];
+		if (*count < UINT8_MAX) {
+			++*count;
+		}
+	}
+
+	if (++tiers->sketch_adds >= SKETCH_PERIOD) {
+		for (size_t i = 0; i < TIER_SKETCH_ROWS * NOTICEBOARD_TIER_SKETCH_WIDTH; ++i) {
+			tiers->sketch[i] >>= 1;
+		}
+		tiers->sketch_adds = 0;
+	}
+}
+
+/**
+ * @brief hot_find - looks a note up in the hot tier
+ * @param const struct Tiers *const tiers - tiers
+ * @param const uint64_t hash - from note_hash
+ * @param const uint32_t uid - owner
+ * @param const char *const sbj - subject
+ * @param const size_t sbj_len - length of sbj
+ * @return struct HotNote* - its slot, NULL if it isn't hot
+ */
+static struct HotNote *hot_find(const struct Tiers *const tiers, const uint64_t hash, const uint32_t uid, const char *const sbj, const size_t sbj_len)
+{
+	if (tiers->hot_cap == 0) {
+		return NULL;
+	}
+
+	const size_t mask = tiers->hot_cap - 1;
+	for (size_t slot = (size_t)hash & mask; tiers->hot[slot].sbj_len != 0; slot = (slot + 1) & mask) { /* never full, so there's always an empty slot to stop at */
+		struct HotNote *const note = &tiers->hot[slot];
+		if (note->hash == hash && note->uid == uid && note->sbj_len == sbj_len && memcmp(note->sbj, sbj, sbj_len) == 0) {
+			return note;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief hot_copy - copies bytes out of a hot note's chain of blocks
+ * @param const struct Tiers *const tiers - tiers
+ * @param const struct HotNote *const note - hot note
+ * @param const size_t offset - where in the note to start
+ * @param const size_t len - bytes to copy. at least 1, & offset + len must be within note->len
+ * @param uint8_t *const buf - filled
+ */
+static void hot_copy(const struct Tiers *const tiers, const struct HotNote *const note, const size_t offset, const size_t len, uint8_t *const buf)
+{
+	uint32_t block = note->first_block;
+	for (size_t skip = offset / NOTICEBOARD_HOT_BLOCK_LEN; skip > 0; --skip) {
+		block = tiers->block_next[block];
+	}
+
+	size_t within = offset % NOTICEBOARD_HOT_BLOCK_LEN;
+	for (size_t done = 0; done < len; block = tiers->block_next[block], within = 0) {
+		const size_t chunk = (len - done < NOTICEBOARD_HOT_BLOCK_LEN - within ? len - done : NOTICEBOARD_HOT_BLOCK_LEN - within);
+		memcpy(buf + done, tiers->arena + (size_t)block * NOTICEBOARD_HOT_BLOCK_LEN + within, chunk);
+		done += chunk;
+	}
+}
+
+/**
+ * @brief hot_evict - drops a note from the hot tier, returning its blocks to the free list
+ * Later notes of the same probe run are shifted back into the gap, so lookups never need tombstones to carry on past it
+ * @param struct Tiers *const tiers - tiers
+ * @param const size_t slot - slot of the note
+ */
+static void hot_evict(struct Tiers *const tiers, const size_t slot)
+{
+	for (uint32_t block = tiers->hot[slot].first_block; block != TIER_NO_BLOCK;) {
+		const uint32_t next = tiers->block_next[block];
+		tiers->block_next[block] = tiers->free_block;
+		tiers->free_block = block;
+		++tiers->free_blocks;
+		block = next;
+	}
+
+	const size_t mask = tiers->hot_cap - 1;
+	size_t hole = slot;
+	for (size_t next = (hole + 1) & mask; tiers->hot[next].sbj_len != 0; next = (next + 1) & mask) {
+		const size_t home = (size_t)tiers->hot[next].hash & mask;
+		if (((next - home) & mask) >= ((next - hole) & mask)) { /* the hole is on its probe path, so it can move up into it */
+			tiers->hot[hole] = tiers->hot[next];
+			hole = next;
+		}
+	}
+	tiers->hot[hole].sbj_len = 0;
+	--tiers->hot_count;
+}
+
+/**
+ * @brief hot_victim - samples the next few hot notes round from the clock hand, for the least read
+ * @param struct Tiers *const tiers - tiers
+ * @return size_t - slot of the least read, SIZE_MAX if there are no hot notes
+ */
+static size_t hot_victim(struct Tiers *const tiers)
+{
+	size_t victim = SIZE_MAX;
+	uint8_t victim_reads = 0;
+
+	for (size_t seen = 0, looked = 0; seen < HOT_SAMPLE && looked < tiers->hot_cap; ++looked) {
+		const size_t slot = tiers->hand;
+		tiers->hand = (tiers->hand + 1) & (tiers->hot_cap - 1);
+		if (tiers->hot[slot].sbj_len == 0) {
+			continue;
+		}
+
+		++seen;
+		const uint8_t reads = sketch_estimate(tiers, tiers->hot[slot].hash);
+		if (victim == SIZE_MAX || reads < victim_reads) {
+			victim = slot;
+			victim_reads = reads;
+		}
+	}
+
+	return victim;
+}
+
+/**
+ * @brief hot_place - copies a note into free blocks & a slot of the hot tier. whether it ought to be hot is the caller's to decide
+ * @param struct Tiers *const tiers - tiers, with at least len's worth of free blocks & a note to spare under NOTICEBOARD_HOT_NOTES
+ * @param const uint64_t hash - from note_hash
+ * @param const uint32_t uid - owner
+ * @param const char *const sbj - subject
+ * @param const size_t sbj_len - length of sbj
+ * @param const uint8_t *const data - start of the note
+ * @param const uint32_t len - length of data. 1 to MAX_EXTRA_DATA_LEN
+ * @param const int whole - boolean. data is the whole note
+ */
+static void hot_place(struct Tiers *const tiers, const uint64_t hash, const uint32_t uid, const char *const sbj, const size_t sbj_len, const uint8_t *const data, const uint32_t len, const int whole)
+{
+	const size_t needed = ((size_t)len + NOTICEBOARD_HOT_BLOCK_LEN - 1) / NOTICEBOARD_HOT_BLOCK_LEN;
+	const uint32_t first_block = tiers->free_block;
+	uint32_t block = first_block, last_block = first_block;
+	for (size_t done = 0; done < len; last_block = block, block = tiers->block_next[block]) {
+		const size_t chunk = (len - done < NOTICEBOARD_HOT_BLOCK_LEN ? len - done : NOTICEBOARD_HOT_BLOCK_LEN);
+		memcpy(tiers->arena + (size_t)block * NOTICEBOARD_HOT_BLOCK_LEN, data + done, chunk);
+		done += chunk;
+	}
+	tiers->free_block = block;
+	tiers->block_next[last_block] = TIER_NO_BLOCK;
+	tiers->free_blocks -= needed;
+
+	const size_t mask = tiers->hot_cap - 1;
+	size_t slot = (size_t)hash & mask;
+	while (tiers->hot[slot].sbj_len != 0) {
+		slot = (slot + 1) & mask;
+	}
+	struct HotNote *const note = &tiers->hot[slot];
+	note->hash = hash;
+	note->uid = uid;
+	note->len = len;
+	note->first_block = first_block;
+	note->whole = (uint8_t)(whole != 0);
+	note->sbj_len = (uint8_t)sbj_len;
+	memcpy(note->sbj, sbj, sbj_len);
+	++tiers->hot_count;
+}
+
+/**
+ * @brief hot_admit - admits a note to the hot tier, if it's read often enough - & more often than whatever it would push out
+ * @param struct Tiers *const tiers - tiers
+ * @param const uint64_t hash - from note_hash
+ * @param const uint32_t uid - owner
+ * @param const char *const sbj - subject
+ * @param const size_t sbj_len - length of sbj
+ * @param const uint8_t *const data - start of the note
+ * @param const uint32_t len - length of data. at most MAX_EXTRA_DATA_LEN
+ * @param const int whole - boolean. data is the whole note
+ */
+static void hot_admit(struct Tiers *const tiers, const uint64_t hash, const uint32_t uid, const char *const sbj, const size_t sbj_len, const uint8_t *const data, const uint32_t len, const int whole)
+{
+	const size_t needed = ((size_t)len + NOTICEBOARD_HOT_BLOCK_LEN - 1) / NOTICEBOARD_HOT_BLOCK_LEN;
+	if (tiers->hot_cap == 0 || len == 0 || needed > HOT_BLOCKS || hot_find(tiers, hash, uid, sbj, sbj_len) != NULL) {
+		return;
+	}
+
+	const uint8_t reads = sketch_estimate(tiers, hash);
+	if (reads < NOTICEBOARD_HOT_MIN_READS) {
+		return;
+	}
+
+	while (tiers->free_blocks < needed || tiers->hot_count >= NOTICEBOARD_HOT_NOTES) {
+		const size_t victim = hot_victim(tiers);
+		if (victim == SIZE_MAX || sketch_estimate(tiers, tiers->hot[victim].hash) >= reads) { /* not worth more than what it would replace */
+			return;
+		}
+		hot_evict(tiers, victim);
+	}
+
+	hot_place(tiers, hash, uid, sbj, sbj_len, data, len, whole);
+}
+
+/**
+ * @brief unpack_note - writes a packed note back out as a plain file, then kills its record
+ * The file is synced before the record dies, & keeps the note's creation time as its mtime (as a rescan expects)
+ * @param struct Tiers *const tiers - tiers
+ * @param const struct Store *const store - opened store, with an index
+ * @param const int uid_dir_fd - directory handle of the user's notes
+ * @param const uid_t uid - owner
+ * @param const char *const sbj - null terminated subject
+ * @param const uint64_t pack_offset - its record
+ * @param const int64_t created_ns - creation time, nanoseconds since the epoch
+ * @param const uint8_t *const data - the whole note
+ * @param const uint32_t len - length of data
+ * @return int - zero is success, non-zero is failure
+ * 1 is error (the note stays packed)
+ */
+static int unpack_note(struct Tiers *const tiers, const struct Store *const store, const int uid_dir_fd, const uid_t uid, const char *const sbj, const uint64_t pack_offset, const int64_t created_ns, const uint8_t *const data, const uint32_t len)
+{
+	const int note_fd = openat(uid_dir_fd, sbj, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, STORE_NOTE_PERMISSIONS);
+	if (note_fd == -1) {
+		fprintf(stderr, "Error creating file to unpack note %s into (errno %d: %s)\n", sbj, errno, strerror(errno));
+		return 1;
+	}
+
+	const struct timespec times[2] = { { .tv_sec = 0, .tv_nsec = UTIME_NOW }, { .tv_sec = (time_t)(created_ns / 1000000000), .tv_nsec = (long)(created_ns % 1000000000) } };
+	if (write_all(note_fd, data, len) != 0 || futimens(note_fd, times) != 0 || fdatasync(note_fd) != 0) {
+		fprintf(stderr, "Error writing unpacked note %s (errno %d: %s)\n", sbj, errno, strerror(errno));
+		close(note_fd);
+		unlinkat(uid_dir_fd, sbj, 0);
+		return 1;
+	}
+	close(note_fd);
+
+	if (pack_kill(uid_dir_fd, pack_offset) != 0) { /* a live record would bring the note back were it ever removed - keep it packed instead */
+		unlinkat(uid_dir_fd, sbj, 0);
+		return 1;
+	}
+	index_set_pack(store->index, uid, sbj, 0);
+	++tiers->unpacked;
+
+	fprintf(stdout, "Unpacked note titled %s of uid %u\n", sbj, (unsigned int)uid);
+
+	return 0;
+}
+
+/**
+ * @brief compact_end - ends the compaction under way, abandoning it if it isn't finished
+ * @param struct Tiers *const tiers - tiers
+ */
+static void compact_end(struct Tiers *const tiers)
+{
+	pack_compact_abandon(&tiers->compaction);
+	free(tiers->moves);
+	tiers->moves = NULL;
+	tiers->move_count = 0;
+	tiers->move_cap = 0;
+}
+
+int tier_init(struct Tiers *const tiers, const int64_t now_ns)
+{
+	memset(tiers, '\0', sizeof(*tiers));
+	tiers->free_block = TIER_NO_BLOCK;
+	tiers->usage_uid = UINT64_MAX;
+	tiers->compaction.dir_fd = -1;
+	tiers->compaction.old_fd = -1;
+	tiers->compaction.fd = -1;
+	tiers->lap_started_ns = now_ns;
+	tiers->last_lap_started_ns = now_ns;
+
+	tiers->sketch = calloc(TIER_SKETCH_ROWS * NOTICEBOARD_TIER_SKETCH_WIDTH, sizeof(*tiers->sketch));
+	if (tiers->sketch == NULL) {
+		goto fail;
+	}
+
+	if (HOT_BLOCKS > 0) {
+		size_t hot_cap = 1;
+		while (hot_cap < (size_t)NOTICEBOARD_HOT_NOTES * 2) { /* load factor at most a half */
+			hot_cap *= 2;
+		}
+
+		tiers->arena = malloc(HOT_BLOCKS * NOTICEBOARD_HOT_BLOCK_LEN);
+		tiers->block_next = malloc(HOT_BLOCKS * sizeof(*tiers->block_next));
+		tiers->hot = calloc(hot_cap, sizeof(*tiers->hot));
+		if (tiers->arena == NULL || tiers->block_next == NULL || tiers->hot == NULL) {
+			goto fail;
+		}
+
+		const size_t blocks = HOT_BLOCKS; /* as a variable, so a disabled hot tier doesn't trip comparisons against 0 */
+		for (size_t i = 0; i < blocks; ++i) {
+			tiers->block_next[i] = (i + 1 < blocks ? (uint32_t)(i + 1) : TIER_NO_BLOCK);
+		}
+		tiers->free_block = 0;
+		tiers->free_blocks = blocks;
+		tiers->hot_cap = hot_cap;
+	}
+
+	return 0;
+
+fail:
+	fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+	tier_free(tiers);
+	return 1;
+}
+
+void tier_free(struct Tiers *const tiers)
+{
+	compact_end(tiers);
+	free(tiers->arena);
+	free(tiers->block_next);
+	free(tiers->hot);
+	free(tiers->sketch);
+	tiers->arena = NULL;
+	tiers->block_next = NULL;
+	tiers->hot = NULL;
+	tiers->sketch = NULL;
+	tiers->hot_cap = 0;
+	tiers->hot_count = 0;
+}
+
+int tier_save(const struct Tiers *const tiers)
+{
+	const size_t sketch_len = (size_t)TIER_SKETCH_ROWS * NOTICEBOARD_TIER_SKETCH_WIDTH;
+	size_t state_len = sizeof(struct TierStateHeader) + sketch_len;
+	for (size_t slot = 0; slot < tiers->hot_cap; ++slot) {
+		if (tiers->hot[slot].sbj_len != 0) {
+			state_len += sizeof(struct TierStateNote) + tiers->hot[slot].len;
+		}
+	}
+
+	const int state_fd = memfd_create("noticeboard-tiers", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (state_fd == -1 || ftruncate(state_fd, (off_t)state_len) != 0) {
+		fprintf(stderr, "Error creating hot tier state to hand over (errno %d: %s)\n", errno, strerror(errno));
+		if (state_fd != -1) {
+			close(state_fd);
+		}
+		return -1;
+	}
+
+	uint8_t *const state = mmap(NULL, state_len, PROT_READ | PROT_WRITE, MAP_SHARED, state_fd, 0);
+	if (state == MAP_FAILED) {
+		fprintf(stderr, "Error mapping hot tier state to hand over (errno %d: %s)\n", errno, strerror(errno));
+		close(state_fd);
+		return -1;
+	}
+
+	const struct TierStateHeader header = { .magic = TIER_STATE_MAGIC, .version = TIER_STATE_VERSION, .sketch_width = NOTICEBOARD_TIER_SKETCH_WIDTH, .sketch_rows = TIER_SKETCH_ROWS, .sketch_adds = tiers->sketch_adds, .hot_count = tiers->hot_count };
+	memcpy(state, &header, sizeof(header));
+	memcpy(state + sizeof(header), tiers->sketch, sketch_len);
+
+	uint8_t *pos = state + sizeof(header) + sketch_len;
+	for (size_t slot = 0; slot < tiers->hot_cap; ++slot) {
+		const struct HotNote *const note = &tiers->hot[slot];
+		if (note->sbj_len == 0) {
+			continue;
+		}
+
+		struct TierStateNote record = { .uid = note->uid, .len = note->len, .whole = note->whole, .sbj_len = note->sbj_len };
+		memcpy(record.sbj, note->sbj, note->sbj_len);
+		memcpy(pos, &record, sizeof(record));
+		hot_copy(tiers, note, 0, note->len, pos + sizeof(record));
+		pos += sizeof(record) + note->len;
+	}
+
+	if (munmap(state, state_len) != 0 || fcntl(state_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) { /* the new server reads it as is - nothing can change it underneath */
+		fprintf(stderr, "Error sealing hot tier state to hand over (errno %d: %s)\n", errno, strerror(errno));
+		close(state_fd);
+		return -1;
+	}
+
+	return state_fd;
+}
+
+int tier_restore(struct Tiers *const tiers, const struct Store *const store, const int state_fd, const int64_t now_ns)
+{
+	struct stat statbuf;
+	if (fstat(state_fd, &statbuf) != 0 || statbuf.st_size < (off_t)sizeof(struct TierStateHeader)) {
+		fprintf(stderr, "Hot tier state handed over is unusable - starting cold\n");
+		return 1;
+	}
+	const size_t state_len = (size_t)statbuf.st_size;
+
+	uint8_t *const state = mmap(NULL, state_len, PROT_READ, MAP_PRIVATE, state_fd, 0);
+	if (state == MAP_FAILED) {
+		fprintf(stderr, "Error mapping hot tier state handed over (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	struct TierStateHeader header;
+	memcpy(&header, state, sizeof(header));
+	const size_t sketch_len = (size_t)TIER_SKETCH_ROWS * NOTICEBOARD_TIER_SKETCH_WIDTH;
+	const size_t saved_sketch_len = (size_t)header.sketch_rows * header.sketch_width;
+	if (header.magic != TIER_STATE_MAGIC || header.version != TIER_STATE_VERSION || saved_sketch_len > state_len - sizeof(header)) {
+		fprintf(stderr, "Hot tier state handed over is unusable - starting cold\n");
+		munmap(state, state_len);
+		return 1;
+	}
+
+	if (header.sketch_width == NOTICEBOARD_TIER_SKETCH_WIDTH && header.sketch_rows == TIER_SKETCH_ROWS) { /* counters sit where the hashes put them, so a sketch of another shape means nothing here */
+		memcpy(tiers->sketch, state + sizeof(header), sketch_len);
+		tiers->sketch_adds = (size_t)header.sketch_adds;
+	}
+
+	size_t restored = 0;
+	size_t pos = sizeof(header) + saved_sketch_len;
+	for (uint64_t i = 0; i < header.hot_count && tiers->hot_cap > 0; ++i) {
+		struct TierStateNote record;
+		if (state_len - pos < sizeof(record)) {
+			break;
+		}
+		memcpy(&record, state + pos, sizeof(record));
+		pos += sizeof(record);
+		if (record.len < 1 || record.len > MAX_EXTRA_DATA_LEN || record.sbj_len < 1 || record.sbj_len > MAX_SBJ_LEN || state_len - pos < record.len) {
+			break;
+		}
+		const uint8_t *const data = state + pos;
+		pos += record.len;
+
+		char sbj[MAX_SBJ_LEN + 1];
+		memcpy(sbj, record.sbj, record.sbj_len);
+		sbj[record.sbj_len] = '\0';
+		const size_t needed = ((size_t)record.len + NOTICEBOARD_HOT_BLOCK_LEN - 1) / NOTICEBOARD_HOT_BLOCK_LEN;
+		const uint64_t hash = note_hash(record.uid, sbj, record.sbj_len);
+		const struct IndexEntry *const entry = index_find(store->index, (uid_t)record.uid, sbj);
+		if (entry == NULL || (entry->expires_ns != 0 && entry->expires_ns <= now_ns) || (record.whole ? record.len != entry->size : record.len > entry->size) || hot_find(tiers, hash, record.uid, sbj, record.sbj_len) != NULL) { /* gone or changed since - the index is as the old server left it */
+			continue;
+		}
+		if (needed > tiers->free_blocks || tiers->hot_count >= NOTICEBOARD_HOT_NOTES) { /* a smaller hot tier than the old server's. the rest are read back in as they're wanted */
+			continue;
+		}
+
+		hot_place(tiers, hash, record.uid, sbj, record.sbj_len, data, record.len, record.whole);
+		++restored;
+	}
+	munmap(state, state_len);
+
+	fprintf(stdout, "Restored %lu hot note(s) of %llu handed over\n", (unsigned long)restored, (unsigned long long)header.hot_count);
+
+	return 0;
+}
+
+int tier_read(struct Tiers *const tiers, const struct Store *const store, const uid_t uid, const char *const sbj, const uint64_t offset, const uint32_t length, uint8_t *const buf, uint32_t *const len, const int64_t now_ns)
+{
+	const size_t sbj_len = strlen(sbj);
+	const uint64_t hash = note_hash((uint32_t)uid, sbj, sbj_len);
+	sketch_add(tiers, hash);
+	const struct IndexEntry *const entry = index_touch(store->index, uid, sbj, now_ns);
+
+	const struct HotNote *const note = hot_find(tiers, hash, (uint32_t)uid, sbj, sbj_len);
+	if (note != NULL && (note->whole || offset + length <= note->len)) { /* nothing past what's held is wanted */
+		*len = (offset >= note->len ? 0 : (note->len - offset < length ? (uint32_t)(note->len - offset) : length));
+		if (*len > 0) {
+			hot_copy(tiers, note, (size_t)offset, *len, buf);
+		}
+		++tiers->hot_hits;
+		return 0;
+	}
+
+	if (entry == NULL || entry->pack_offset == 0) {
+		return 1;
+	}
+
+	const uint64_t pack_offset = entry->pack_offset;
+	const int64_t created_ns = entry->created_ns;
+	const int uid_dir_fd = store_uid_dir(store, uid, 0);
+	if (uid_dir_fd == -1) {
+		fprintf(stderr, "Error opening notes directory of uid %u (errno %d: %s)\n", (unsigned int)uid, errno, strerror(errno));
+		return 2;
+	}
+
+	uint32_t note_len;
+	if (pack_read(uid_dir_fd, pack_offset, sbj, cold_buf, &note_len) != 0) {
+		close(uid_dir_fd);
+		return 2;
+	}
+	++tiers->cold_reads;
+
+	*len = (offset >= note_len ? 0 : (note_len - offset < length ? (uint32_t)(note_len - offset) : length));
+	if (*len > 0) {
+		memcpy(buf, cold_buf + offset, *len);
+	}
+
+	hot_admit(tiers, hash, (uint32_t)uid, sbj, sbj_len, cold_buf, (note_len < MAX_EXTRA_DATA_LEN ? note_len : MAX_EXTRA_DATA_LEN), note_len <= MAX_EXTRA_DATA_LEN);
+	if (sketch_estimate(tiers, hash) >= NOTICEBOARD_WARM_MIN_READS) { /* read often enough to be worth a file again. on failure, it just stays cold */
+		unpack_note(tiers, store, uid_dir_fd, uid, sbj, pack_offset, created_ns, cold_buf, note_len);
+	}
+	close(uid_dir_fd);
+
+	return 0;
+}
+
+void tier_offer(struct Tiers *const tiers, const struct Store *const store, const uid_t uid, const char *const sbj, const uint8_t *const data, const uint32_t len)
+{
+	if (tiers->hot_cap == 0) {
+		return;
+	}
+
+	const struct IndexEntry *const entry = index_find(store->index, uid, sbj);
+	if (entry != NULL) {
+		hot_admit(tiers, note_hash((uint32_t)uid, sbj, strlen(sbj)), (uint32_t)uid, sbj, strlen(sbj), data, len, len >= entry->size);
+	}
+}
+
+void tier_forget(struct Tiers *const tiers, const uid_t uid, const char *const sbj)
+{
+	const size_t sbj_len = strlen(sbj);
+	const struct HotNote *const note = hot_find(tiers, note_hash((uint32_t)uid, sbj, sbj_len), (uint32_t)uid, sbj, sbj_len);
+	if (note != NULL) {
+		hot_evict(tiers, (size_t)(note - tiers->hot));
+	}
+}
+
+int tier_unpack(struct Tiers *const tiers, const struct Store *const store, const int uid_dir_fd, const uid_t uid, const char *const sbj)
+{
+	const struct IndexEntry *const entry = index_find(store->index, uid, sbj);
+	if (entry == NULL || entry->pack_offset == 0) {
+		return 0;
+	}
+
+	uint32_t note_len;
+	if (pack_read(uid_dir_fd, entry->pack_offset, sbj, cold_buf, &note_len) != 0) {
+		return 1;
+	}
+
+	return unpack_note(tiers, store, uid_dir_fd, uid, sbj, entry->pack_offset, entry->created_ns, cold_buf, note_len);
+}
+
+int tier_remove_packed(struct Tiers *const tiers, const struct Store *const store, const int uid_dir_fd, const uid_t uid, const char *const sbj)
+{
+	const struct IndexEntry *const entry = index_find(store->index, uid, sbj);
+	if (entry == NULL || entry->pack_offset == 0) {
+		fprintf(stderr, "Cannot delete non-existant note\n");
+		return 1;
+	}
+
+	if (pack_kill(uid_dir_fd, entry->pack_offset) != 0) {
+		return 1;
+	}
+	index_remove(store->index, uid, sbj);
+	tier_forget(tiers, uid, sbj);
+
+	return 0;
+}
+
+/**
+ * @brief packable - whether the packer should pack a note
+ * @param const struct Tiers *const tiers - tiers
+ * @param const struct IndexEntry *const entry - the note
+ * @param const int crowded - boolean. there are more warm notes than NOTICEBOARD_WARM_NOTES
+ * @param const int64_t now_ns - current time (realtime clock, nanoseconds)
+ * @return int - boolean
+ */
+static int packable(const struct Tiers *const tiers, const struct IndexEntry *const entry, const int crowded, const int64_t now_ns)
+{
+	if (entry->pack_offset != 0 || entry->expires_ns != 0 || entry->size < 1 || entry->size > NOTICEBOARD_COLD_MAX_LEN) {
+		return 0;
+	}
+
+	const uint64_t hash = note_hash(entry->uid, entry->sbj, entry->sbj_len);
+	if (sketch_estimate(tiers, hash) >= NOTICEBOARD_WARM_MIN_READS || hot_find(tiers, hash, entry->uid, entry->sbj, entry->sbj_len) != NULL) {
+		return 0;
+	}
+
+	return (now_ns - entry->read_ns >= (int64_t)NOTICEBOARD_COLD_AFTER_S * 1000000000 || (crowded && entry->read_ns < tiers->last_lap_started_ns));
+}
+
+/**
+ * @brief pack_wasteful - whether a user's pack is mostly dead records
+ * @param const int uid_dir_fd - directory handle of the user's notes
+ * @return int - boolean
+ */
+static int pack_wasteful(const int uid_dir_fd)
+{
+	uint64_t end, dead;
+
+	return (pack_usage(uid_dir_fd, &end, &dead) == 0 && dead > end / 2);
+}
+
+/**
+ * @brief compact_start - starts compacting a user's pack. the packer's following passes carry it on (see compact_step)
+ * @param struct Tiers *const tiers - tiers, with no compaction under way
+ * @param const int uid_dir_fd - directory handle of the user's notes
+ * @param const uint32_t uid - owner
+ */
+static void compact_start(struct Tiers *const tiers, const int uid_dir_fd, const uint32_t uid)
+{
+	if (pack_compact_begin(uid_dir_fd, &tiers->compaction) != 0) {
+		return;
+	}
+	tiers->compact_uid = uid;
+	tiers->compact_len = 0;
+
+	fprintf(stdout, "Compacting pack of uid %u\n", uid);
+}
+
+/**
+ * @brief compact_step - carries on the compaction under way, copying up to NOTICEBOARD_PACK_BATCH of the user's packed notes (NOTICEBOARD_PACK_PASS_BYTES at most) to the new pack
+ * Once every note's copied, drops the copies of any removed or unpacked since, finishes the compaction & moves the index over to the new pack
+ * @param struct Tiers *const tiers - tiers, with a compaction under way
+ * @param const struct Store *const store - opened store, with an index
+ */
+static void compact_step(struct Tiers *const tiers, const struct Store *const store)
+{
+	struct Index *const index = store->index;
+	const uid_t uid = (uid_t)tiers->compact_uid;
+
+	struct PackNote batch[NOTICEBOARD_PACK_BATCH];
+	uint64_t from[NOTICEBOARD_PACK_BATCH];
+	size_t batch_count = 0, batch_bytes = 0;
+	int copied = 1;
+	for (size_t scanned = 0;; ++scanned) {
+		const struct IndexEntry *const entry = index_next(index, uid, tiers->compact_sbj, tiers->compact_len);
+		if (entry == NULL || entry->uid != tiers->compact_uid) {
+			break;
+		}
+		if (scanned == NOTICEBOARD_PACK_SCAN || (entry->pack_offset != 0 && (batch_count == NOTICEBOARD_PACK_BATCH || (batch_count > 0 && batch_bytes + entry->size > NOTICEBOARD_PACK_PASS_BYTES)))) { /* carry on from here next time */
+			copied = 0;
+			break;
+		}
+
+		tiers->compact_len = entry->sbj_len;
+		memcpy(tiers->compact_sbj, entry->sbj, entry->sbj_len);
+		if (entry->pack_offset == 0) {
+			continue;
+		}
+
+		memcpy(batch[batch_count].sbj, entry->sbj, entry->sbj_len);
+		batch[batch_count].sbj[entry->sbj_len] = '\0';
+		batch[batch_count].created_ns = entry->created_ns;
+		batch[batch_count].offset = entry->pack_offset;
+		from[batch_count] = entry->pack_offset;
+		batch_bytes += entry->size;
+		++batch_count;
+	}
+
+	if (batch_count > 0) {
+		if (tiers->move_count + batch_count > tiers->move_cap) {
+			const size_t new_cap = (tiers->move_cap == 0 ? 64 : tiers->move_cap * 2) + batch_count;
+			struct TierMove *const grown = realloc(tiers->moves, new_cap * sizeof(*grown));
+			if (grown == NULL) {
+				fprintf(stderr, "Error allocating necessary heap memory (errno %d: %s)\n", errno, strerror(errno));
+				compact_end(tiers);
+				return;
+			}
+			tiers->moves = grown;
+			tiers->move_cap = new_cap;
+		}
+
+		if (pack_compact_copy(&tiers->compaction, batch, batch_count) != 0) {
+			compact_end(tiers);
+			return;
+		}
+		for (size_t i = 0; i < batch_count; ++i) {
+			struct TierMove *const move = &tiers->moves[tiers->move_count++];
+			move->from = from[i];
+			move->to = batch[i].offset;
+			memcpy(move->sbj, batch[i].sbj, sizeof(move->sbj));
+		}
+	}
+
+	if (!copied) {
+		return;
+	}
+
+	for (size_t i = 0; i < tiers->move_count; ++i) { /* a note removed or unpacked since it was copied mustn't come back to life in the new pack */
+		const struct TierMove *const move = &tiers->moves[i];
+		const struct IndexEntry *const entry = index_find(index, uid, move->sbj);
+		if ((entry == NULL || entry->pack_offset != move->from) && move->to != 0 && pack_compact_drop(&tiers->compaction, move->to) != 0) {
+			compact_end(tiers);
+			return;
+		}
+	}
+	if (pack_compact_finish(&tiers->compaction) != 0) {
+		compact_end(tiers);
+		return;
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < tiers->move_count; ++i) {
+		const struct TierMove *const move = &tiers->moves[i];
+		const struct IndexEntry *const entry = index_find(index, uid, move->sbj);
+		if (entry == NULL || entry->pack_offset != move->from) {
+			continue;
+		}
+
+		if (move->to != 0) {
+			index_set_pack(index, uid, move->sbj, move->to);
+			++kept;
+		} else { /* its record was corrupt - the note's gone */
+			index_remove(index, uid, move->sbj);
+			tier_forget(tiers, uid, move->sbj);
+		}
+	}
+	compact_end(tiers);
+
+	fprintf(stdout, "Compacted pack of uid %u - %lu note(s) kept\n", (unsigned int)uid, (unsigned long)kept);
+}
+
+size_t tier_pack(struct Tiers *const tiers, const struct Store *const store, const int64_t now_ns)
+{
+	if (tiers->compaction.dir_fd != -1) {
+		compact_step(tiers, store);
+		return 0;
+	}
+
+	struct Index *const index = store->index;
+	const int crowded = (NOTICEBOARD_WARM_NOTES > 0 && index->count - index->packed > (size_t)NOTICEBOARD_WARM_NOTES);
+
+	struct PackNote batch[NOTICEBOARD_PACK_BATCH];
+	size_t batch_count = 0, batch_bytes = 0;
+	uint32_t pass_uid = 0;
+	int compact = 0;
+
+	for (size_t scanned = 0; scanned < NOTICEBOARD_PACK_SCAN; ++scanned) {
+		const struct IndexEntry *const entry = index_next(index, (uid_t)tiers->cursor_uid, tiers->cursor_sbj, tiers->cursor_len);
+		if (entry == NULL) { /* lap done - the next pass starts over */
+			tiers->cursor_uid = 0;
+			tiers->cursor_len = 0;
+			tiers->last_lap_started_ns = tiers->lap_started_ns;
+			tiers->lap_started_ns = now_ns;
+			tiers->usage_uid = UINT64_MAX;
+			break;
+		}
+		const int pack = packable(tiers, entry, crowded, now_ns);
+		if (batch_count > 0 && (entry->uid != pass_uid || (pack && batch_bytes + entry->size > NOTICEBOARD_PACK_PASS_BYTES))) { /* one user, & so many bytes, per pass - carry on from here next time */
+			break;
+		}
+
+		tiers->cursor_uid = entry->uid;
+		tiers->cursor_len = entry->sbj_len;
+		memcpy(tiers->cursor_sbj, entry->sbj, entry->sbj_len);
+
+		if (entry->pack_offset != 0 && entry->uid != tiers->usage_uid && batch_count == 0) { /* first packed note seen of this user this lap - is their pack worth compacting? */
+			tiers->usage_uid = entry->uid;
+			const int uid_dir_fd = store_uid_dir(store, (uid_t)entry->uid, 0);
+			if (uid_dir_fd != -1) {
+				compact = pack_wasteful(uid_dir_fd);
+				close(uid_dir_fd);
+			}
+			if (compact) {
+				pass_uid = entry->uid;
+				break;
+			}
+		}
+
+		if (pack) {
+			pass_uid = entry->uid;
+			batch_bytes += entry->size;
+			memcpy(batch[batch_count].sbj, entry->sbj, entry->sbj_len);
+			batch[batch_count].sbj[entry->sbj_len] = '\0';
+			batch[batch_count].created_ns = entry->created_ns;
+			if (++batch_count == NOTICEBOARD_PACK_BATCH) {
+				break;
+			}
+		}
+	}
+
+	if (batch_count == 0 && !compact) {
+		return 0;
+	}
+
+	const int uid_dir_fd = store_uid_dir(store, (uid_t)pass_uid, 0);
+	if (uid_dir_fd == -1) {
+		fprintf(stderr, "Error opening notes directory of uid %u (errno %d: %s)\n", pass_uid, errno, strerror(errno));
+		return 0;
+	}
+
+	size_t packed = 0;
+	if (batch_count > 0 && pack_add(uid_dir_fd, batch, batch_count) == 0) {
+		for (size_t i = 0; i < batch_count; ++i) {
+			if (batch[i].offset != 0) {
+				index_set_pack(index, (uid_t)pass_uid, batch[i].sbj, batch[i].offset);
+				++packed;
+			}
+		}
+		tiers->packed += packed;
+		tiers->usage_uid = pass_uid;
+		compact = pack_wasteful(uid_dir_fd);
+
+		fprintf(stdout, "Packed %lu note(s) of uid %u\n", (unsigned long)packed, pass_uid);
+	}
+
+	if (compact) {
+		compact_start(tiers, uid_dir_fd, pass_uid);
+	}
+	close(uid_dir_fd);
+
+	return packed;
+}
@@ -0,0 +1,201 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "timer_wheel.h"
+
+/**
+ * @brief Definitions of the hierarchical timer wheel
+ */
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+#define WHEEL_SPAN ((uint64_t)1 << (TIMER_SLOT_BITS * TIMER_LEVELS)) /* ticks covered before timers have to be parked */
+
+/**
+ * @brief list_append - links a timer in at the tail of a circular list
+ * @param struct TimerLink *const list - sentinel
+ * @param struct TimerLink *const link - unlinked timer
+ */
+static inline void list_append(struct TimerLink *const list, struct TimerLink *const link)
+{
+	link->prev = list->prev;
+	link->next = list;
+	list->prev->next = link;
+	list->prev = link;
+}
+
+/**
+ * @brief list_unlink - unlinks a timer from whichever list it's on, marking it unscheduled
+ * @param struct TimerLink *const link - linked timer
+ */
+static inline void list_unlink(struct TimerLink *const link)
+{
+	link->prev->next = link->next;
+	link->next->prev = link->prev;
+	link->prev = link->next = NULL;
+}
+
+/**
+ * @brief file_timer - links a timer into the slot its expiry belongs in, relative to the wheel's current position
+ * @param struct TimerWheel *const wheel - wheel
+ * @param struct TimerLink *const link - unlinked timer, expires already set
+ */
+static void file_timer(struct TimerWheel *const wheel, struct TimerLink *const link)
+{
+	uint64_t expires = link->expires < wheel->current ? wheel->current : link->expires;
+	uint64_t delta = expires - wheel->current;
+	if (delta >= WHEEL_SPAN) { /* park it as far out as the wheel goes. it's re-filed, with its real expiry, when that slot cascades */
+		delta = WHEEL_SPAN - 1;
+		expires = wheel->current + delta;
+	}
+
+	unsigned int level = 0;
+	while (level < TIMER_LEVELS - 1 && delta >= ((uint64_t)1 << (TIMER_SLOT_BITS * (level + 1)))) {
+		++level;
+	}
+
+	list_append(&wheel->slots[level][(expires >> (TIMER_SLOT_BITS * level)) & SLOT_MASK], link);
+}
+
+/**
+ * @brief cascade - re-files every timer of one slot of a higher level, which lands them in lower levels
+ * @param struct TimerWheel *const wheel - wheel
+ * @param const unsigned int level - level, 1 or above
+ * @return unsigned int - index of slot cascaded. 0 means the level wrapped, so the next level up is due to cascade too
+ */
+static unsigned int cascade(struct TimerWheel *const wheel, const unsigned int level)
+{
+	const unsigned int index = (unsigned int)(wheel->current >> (TIMER_SLOT_BITS * level)) & SLOT_MASK;
+	struct TimerLink *const slot = &wheel->slots[level][index];
+
+	struct TimerLink pending; /* detach the whole slot first - re-filing may put timers straight back into it */
+	timer_list_init(&pending);
+	if (slot->next != slot) {
+		pending.next = slot->next;
+		pending.prev = slot->prev;
+		pending.next->prev = &pending;
+		pending.prev->next = &pending;
+		slot->next = slot->prev = slot;
+	}
+
+	while (pending.next != &pending) {
+		struct TimerLink *const link = pending.next;
+		list_unlink(link);
+		file_timer(wheel, link);
+	}
+
+	return index;
+}
+
+void timer_wheel_init(struct TimerWheel *const wheel, const uint64_t now)
+{
+	for (unsigned int level = 0; level < TIMER_LEVELS; ++level) {
+		for (unsigned int slot = 0; slot < TIMER_SLOTS; ++slot) {
+			timer_list_init(&wheel->slots[level][slot]);
+		}
+	}
+	wheel->current = now;
+	wheel->count = 0;
+}
+
+void timer_link_init(struct TimerLink *const link)
+{
+	link->prev = link->next = NULL;
+	link->expires = 0;
+}
+
+int timer_scheduled(const struct TimerLink *const link)
+{
+	return link->next != NULL;
+}
+
+void timer_schedule(struct TimerWheel *const wheel, struct TimerLink *const link, const uint64_t expires)
+{
+	if (timer_scheduled(link)) {
+		list_unlink(link);
+	} else {
+		++wheel->count;
+	}
+
+	link->expires = expires;
+	file_timer(wheel, link);
+}
+
+void timer_cancel(struct TimerWheel *const wheel, struct TimerLink *const link)
+{
+	if (!timer_scheduled(link)) {
+		return;
+	}
+
+	list_unlink(link);
+	--wheel->count;
+}
+
+size_t timer_expire(struct TimerWheel *const wheel, const uint64_t now, struct TimerLink *const expired)
+{
+	size_t expired_count = 0;
+
+	while (wheel->current <= now) {
+		if (wheel->count == 0) { /* nothing to find - jump straight there rather than walk every tick */
+			wheel->current = now + 1;
+			break;
+		}
+
+		const unsigned int index = (unsigned int)wheel->current & SLOT_MASK;
+		if (index == 0) {
+			for (unsigned int level = 1; level < TIMER_LEVELS && cascade(wheel, level) == 0; ++level)
+				;
+		}
+
+		struct TimerLink *const slot = &wheel->slots[0][index];
+		while (slot->next != slot) {
+			struct TimerLink *const link = slot->next;
+			list_unlink(link);
+			list_append(expired, link);
+			--wheel->count;
+			++expired_count;
+		}
+
+		++wheel->current;
+	}
+
+	return expired_count;
+}
+
+void timer_list_init(struct TimerLink *const list)
+{
+	list->prev = list->next = list;
+	list->expires = 0;
+}
+
+struct TimerLink *timer_list_pop(struct TimerLink *const list)
+{
+	if (list->next == list) {
+		return NULL;
+	}
+
+	struct TimerLink *const link = list->next;
+	list_unlink(link);
+
+	return link;
+}
+
+int64_t timer_next(const struct TimerWheel *const wheel)
+{
+	if (wheel->count == 0) {
+		return -1;
+	}
+
+	/* first occupied slot of the bottom level before it next wraps. if there's none, the wrap itself - that's when anything higher up could cascade into reach */
+	const unsigned int start = (unsigned int)wheel->current & SLOT_MASK;
+	if (start == 0) { /* wrapping now - whatever cascades down could be due straight away */
+		return 0;
+	}
+	for (unsigned int index = start; index < TIMER_SLOTS; ++index) {
+		const struct TimerLink *const slot = &wheel->slots[0][index];
+		if (slot->next != slot) {
+			return (int64_t)(index - start);
+		}
+	}
+
+	return (int64_t)(TIMER_SLOTS - start);
+}
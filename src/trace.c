@@ -0,0 +1,80 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "store.h"
+#include "util.h"
+#include "trace.h"
+
+/**
+ * @brief Definitions of the request trace ring
+ */
+
+#if NOTICEBOARD_TRACE_RING > 0
+static struct TraceRecord trace_ring[NOTICEBOARD_TRACE_RING];
+static uint64_t trace_recorded = 0; /* records ever committed. the next goes in slot trace_recorded % NOTICEBOARD_TRACE_RING */
+#endif /* if NOTICEBOARD_TRACE_RING > 0 */
+
+void trace_commit(const struct TraceRecord *const record)
+{
+#if NOTICEBOARD_TRACE_RING > 0
+	trace_ring[trace_recorded % NOTICEBOARD_TRACE_RING] = *record;
+	++trace_recorded;
+#else
+	(void)record;
+#endif /* if NOTICEBOARD_TRACE_RING > 0 */
+}
+
+int trace_dump(const int dir_fd, const char *const name)
+{
+#if NOTICEBOARD_TRACE_RING > 0
+	const size_t count = (trace_recorded < NOTICEBOARD_TRACE_RING ? (size_t)trace_recorded : NOTICEBOARD_TRACE_RING);
+	const size_t oldest = (trace_recorded < NOTICEBOARD_TRACE_RING ? 0 : (size_t)(trace_recorded % NOTICEBOARD_TRACE_RING)); /* once it has wrapped, the oldest is the next to be overwritten */
+	const struct TraceDumpHeader header = { .magic = TRACE_DUMP_MAGIC, .version = TRACE_DUMP_VERSION, .record_count = count, .recorded = trace_recorded };
+
+	/* write alongside, then rename over - a reader never sees half a dump */
+	char tmp_name[NAME_MAX + 1];
+	if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", name) >= (int)sizeof(tmp_name)) {
+		fprintf(stderr, "Trace dump name is too long\n");
+		return 2;
+	}
+
+	const int fd = openat(dir_fd, tmp_name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, STORE_NOTE_PERMISSIONS);
+	if (fd == -1) {
+		fprintf(stderr, "Error creating trace dump (errno %d: %s)\n", errno, strerror(errno));
+		return 2;
+	}
+
+	if (write_all(fd, &header, sizeof(header)) != 0 || write_all(fd, trace_ring + oldest, (count - oldest) * sizeof(trace_ring[0])) != 0 || write_all(fd, trace_ring, oldest * sizeof(trace_ring[0])) != 0) { /* oldest to the end, then the start up to it */
+		fprintf(stderr, "Error writing trace dump (errno %d: %s)\n", errno, strerror(errno));
+		close(fd);
+		unlinkat(dir_fd, tmp_name, 0);
+		return 2;
+	}
+	close(fd); /* no fsync - a dump is only worth having whilst the server that made it is up */
+
+	if (renameat(dir_fd, tmp_name, dir_fd, name) != 0) {
+		fprintf(stderr, "Error replacing trace dump (errno %d: %s)\n", errno, strerror(errno));
+		unlinkat(dir_fd, tmp_name, 0);
+		return 2;
+	}
+
+	fprintf(stdout, "Dumped trace of %lu request(s) (%llu traced since startup)\n", (unsigned long)count, (unsigned long long)trace_recorded);
+
+	return 0;
+#else
+	(void)dir_fd;
+	(void)name;
+	fprintf(stderr, "Trace ring is off - rebuild with NOTICEBOARD_TRACE_RING set to keep one\n");
+	return 1;
+#endif /* if NOTICEBOARD_TRACE_RING > 0 */
+}
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "store.h"
+#include "index.h"
+#include "archive.h"
+#include "util.h"
+#include "transfer.h"
+
+/**
+ * @brief Definitions of running an export or import in the background
+ */
+
+/**
+ * @brief report_note - archive_import's imported callback, in the child. tells the server of a note it's just created
+ * a failure is only reported - the server may have gone, but the import carries on regardless
+ * @param void *const ctx - write end of the report pipe (int *)
+ */
+static void report_note(const uid_t uid, const char *const sbj, const uint32_t size, const int64_t expires_ns, void *const ctx)
+{
+	struct TransferReport report;
+	memset(&report, '\0', sizeof(report));
+	report.expires_ns = expires_ns;
+	report.uid = (uint32_t)uid;
+	report.size = size;
+	report.sbj_len = (uint8_t)strlen(sbj); /* archive_import only creates valid subjects */
+	memcpy(report.sbj, sbj, report.sbj_len);
+
+	if (write_all(*(const int *)ctx, &report, sizeof(report)) != 0) {
+		fprintf(stderr, "Error reporting imported note %u/%s (errno %d: %s)\n", (unsigned int)uid, sbj, errno, strerror(errno));
+	}
+}
+
+/**
+ * @brief index_report - indexes a note the child has imported, unless it's been removed (or replaced) since
+ * @param const struct Store *const store - opened store, with its index
+ * @param const struct TransferReport *const report - the child's report
+ * @param int *const dir_fd - directory handle of dir_uid's notes, kept open across reports. -1 if none is open yet
+ * @param uid_t *const dir_uid - owner of dir_fd
+ */
+static void index_report(const struct Store *const store, const struct TransferReport *const report, int *const dir_fd, uid_t *const dir_uid)
+{
+	if (store->index == NULL || report->sbj_len > MAX_SBJ_LEN) {
+		return;
+	}
+
+	char sbj[MAX_SBJ_LEN + 1];
+	memcpy(sbj, report->sbj, report->sbj_len);
+	sbj[report->sbj_len] = '\0';
+
+	if (*dir_fd == -1 || *dir_uid != (uid_t)report->uid) {
+		if (*dir_fd != -1) {
+			close(*dir_fd);
+		}
+		*dir_uid = (uid_t)report->uid;
+		*dir_fd = store_uid_dir(store, *dir_uid, 0);
+	}
+
+	struct stat statbuf;
+	if (*dir_fd == -1 || fstatat(*dir_fd, sbj, &statbuf, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(statbuf.st_mode)) { /* removed whilst the report was on its way */
+		return;
+	}
+	if (index_find(store->index, (uid_t)report->uid, sbj) != NULL) { /* removed & added again - the index already has the newer note */
+		return;
+	}
+
+	index_insert(store->index, (uid_t)report->uid, sbj, (uint32_t)statbuf.st_size, clock_ns(CLOCK_REALTIME), report->expires_ns); /* its length as it is now - it may have been appended to. schedules its expiry too */
+}
+
+/**
+ * @brief transfer_finish - reaps the child of a finished transfer & reports how it went
+ * @param struct Transfer *const transfer - transfer whose last report has arrived, or whose child has gone
+ * @param const struct Store *const store - opened store, with its index
+ */
+static void transfer_finish(struct Transfer *const transfer, const struct Store *const store)
+{
+	close(transfer->report_fd);
+	transfer->report_fd = -1;
+
+	int status = 0;
+	while (waitpid(transfer->pid, &status, 0) == -1 && errno == EINTR);
+	transfer->pid = 0;
+
+	if (transfer->result == -1) {
+		fprintf(stderr, "%s ended without finishing%s\n", (transfer->cmd == EXPORT ? "Export" : "Import"), (WIFSIGNALED(status) ? " - killed" : ""));
+		if (transfer->cmd == IMPORT && store->index != NULL && store->index->complete) { /* it may have created a note it never got to report */
+			store->index->complete = 0;
+			fprintf(stderr, "Index can no longer vouch for every note - it'll be rebuilt at the next start\n");
+		}
+		return;
+	}
+
+	fprintf((transfer->result != 0 ? stderr : stdout), "%s %llu note(s) (%llu bytes, %llu skipped as already present, %llu as expired)%s\n", (transfer->cmd == EXPORT ? "Exported" : "Imported"), (unsigned long long)transfer->stats.notes, (unsigned long long)transfer->stats.bytes, (unsigned long long)transfer->stats.skipped, (unsigned long long)transfer->stats.expired, (transfer->result != 0 ? " before failing" : ""));
+}
+
+void transfer_init(struct Transfer *const transfer)
+{
+	memset(transfer, '\0', sizeof(*transfer));
+	transfer->pid = 0;
+	transfer->report_fd = -1;
+	transfer->session = NULL;
+}
+
+int transfer_start(struct Transfer *const transfer, const struct Store *const store, const enum request_command cmd, const int archive_fd)
+{
+	if (transfer->pid != 0) {
+		close(archive_fd);
+		return 1;
+	}
+
+	int report_fds[2];
+	if (pipe2(report_fds, O_CLOEXEC) != 0) {
+		fprintf(stderr, "Error creating report pipe (errno %d: %s)\n", errno, strerror(errno));
+		close(archive_fd);
+		return 2;
+	}
+
+	fflush(NULL); /* else whatever's buffered would be written twice - once by each process */
+	const pid_t pid = fork();
+	if (pid == -1) {
+		fprintf(stderr, "Error starting %s (errno %d: %s)\n", (cmd == EXPORT ? "export" : "import"), errno, strerror(errno));
+		close(report_fds[0]);
+		close(report_fds[1]);
+		close(archive_fd);
+		return 2;
+	}
+
+	if (pid == 0) { /* child - stream the archive, then go. the server's state here is only a copy, so nothing is cleaned up */
+		close(report_fds[0]);
+		struct TransferReport last;
+		memset(&last, '\0', sizeof(last));
+		last.result = (cmd == EXPORT ? archive_export(store, archive_fd, &last.stats) : archive_import(store, archive_fd, report_note, &report_fds[1], &last.stats));
+		close(archive_fd);
+		if (write_all(report_fds[1], &last, sizeof(last)) != 0) {
+			fprintf(stderr, "Error reporting outcome of %s (errno %d: %s)\n", (cmd == EXPORT ? "export" : "import"), errno, strerror(errno));
+		}
+		fflush(NULL);
+		_exit(last.result);
+	}
+
+	close(report_fds[1]);
+	close(archive_fd);
+	const int flags = fcntl(report_fds[0], F_GETFL);
+	if (flags == -1 || fcntl(report_fds[0], F_SETFL, flags | O_NONBLOCK) != 0) { /* the child carries on - its reports are just read as they come */
+		fprintf(stderr, "Error making report pipe non-blocking (errno %d: %s)\n", errno, strerror(errno));
+	}
+
+	transfer->pid = pid;
+	transfer->report_fd = report_fds[0];
+	transfer->cmd = cmd;
+	transfer->session = NULL;
+	transfer->finished = 0;
+	transfer->result = 0;
+	memset(&transfer->stats, '\0', sizeof(transfer->stats));
+	transfer->buf_len = 0;
+	fprintf(stdout, "Started %s in the background (pid %d)\n", (cmd == EXPORT ? "export" : "import"), (int)pid);
+
+	return 0;
+}
+
+int transfer_poll(struct Transfer *const transfer, const struct Store *const store)
+{
+	if (transfer->pid == 0) {
+		return 0;
+	}
+
+	int dir_fd = -1; /* kept open across the batch - archives hold each user's notes together */
+	uid_t dir_uid = 0;
+
+	for (size_t reports = 0; reports < NOTICEBOARD_TRANSFER_BATCH && !transfer->finished;) {
+		const ssize_t bytes_read = read(transfer->report_fd, transfer->buf + transfer->buf_len, sizeof(transfer->buf) - transfer->buf_len);
+		if (bytes_read == -1 && errno == EINTR) {
+			continue;
+		} else if (bytes_read == -1 && errno == EAGAIN) {
+			break;
+		} else if (bytes_read <= 0) { /* child's gone without its last report */
+			if (bytes_read == -1) {
+				fprintf(stderr, "Error reading transfer reports (errno %d: %s)\n", errno, strerror(errno));
+			}
+			transfer->finished = 1;
+			transfer->result = -1;
+			break;
+		}
+
+		transfer->buf_len += (size_t)bytes_read;
+		if (transfer->buf_len < sizeof(transfer->buf)) {
+			continue;
+		}
+		transfer->buf_len = 0;
+		++reports;
+
+		struct TransferReport report;
+		memcpy(&report, transfer->buf, sizeof(report));
+		if (report.sbj_len == 0) {
+			transfer->finished = 1;
+			transfer->result = report.result;
+			transfer->stats = report.stats;
+		} else {
+			index_report(store, &report, &dir_fd, &dir_uid);
+		}
+	}
+
+	if (dir_fd != -1) {
+		close(dir_fd);
+	}
+
+	if (!transfer->finished) {
+		return 0;
+	}
+
+	transfer_finish(transfer, store);
+	return 1;
+}
+
+void transfer_abort(struct Transfer *const transfer, const struct Store *const store)
+{
+	if (transfer->pid == 0) {
+		return;
+	}
+
+	fprintf(stderr, "Stopping %s part way through\n", (transfer->cmd == EXPORT ? "export" : "import"));
+	kill(transfer->pid, SIGKILL);
+
+	const int flags = fcntl(transfer->report_fd, F_GETFL); /* so what's left is read through to the end, rather than given up on whilst the child's still dying */
+	if (flags != -1) {
+		fcntl(transfer->report_fd, F_SETFL, flags & ~O_NONBLOCK);
+	}
+	while (!transfer_poll(transfer, store));
+}
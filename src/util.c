@@ -0,0 +1,66 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#include "util.h"
+
+/**
+ * @brief Definitions of small helpers shared by the server's modules & the tools
+ */
+
+int write_all(const int fd, const void *const buf, const size_t len)
+{
+	for (size_t done = 0; done < len;) {
+		const ssize_t ret = write(fd, (const uint8_t *)buf + done, len - done);
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			return 1;
+		}
+		done += (size_t)ret;
+	}
+
+	return 0;
+}
+
+int pread_all(const int fd, void *const buf, const size_t len, const uint64_t offset)
+{
+	for (size_t done = 0; done < len;) {
+		const ssize_t ret = pread(fd, (uint8_t *)buf + done, len - done, (off_t)(offset + done));
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			return 1;
+		}
+		done += (size_t)ret;
+	}
+
+	return 0;
+}
+
+int pwrite_all(const int fd, const void *const buf, const size_t len, const uint64_t offset)
+{
+	for (size_t done = 0; done < len;) {
+		const ssize_t ret = pwrite(fd, (const uint8_t *)buf + done, len - done, (off_t)(offset + done));
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			return 1;
+		}
+		done += (size_t)ret;
+	}
+
+	return 0;
+}
+
+int64_t clock_ns(const clockid_t clock)
+{
+	struct timespec now;
+	clock_gettime(clock, &now);
+
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
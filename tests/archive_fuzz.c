@@ -0,0 +1,657 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <endian.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/xattr.h>
+
+#include "constraints.h"
+#include "subject.h"
+#include "store.h"
+#include "pack.h"
+#include "util.h"
+#include "archive.h"
+#include "fixture.h"
+
+/**
+ * @brief Archive fuzz test, ran by `make check`
+ * - round trip: a store of random notes - plain, packed, expiring & already expired, owned by a few users - is exported. the archive is parsed here, independently, against the layout archive.h documents, & must hold exactly the notes which hadn't expired. it's then imported into an empty store, which must end up holding exactly those notes, expiry & all - & importing it again must skip every one
+ * - built archives: written here, version 1 or 2, with empty bodies, bodies spanning several ARCHIVE_IO_LEN chunks, expiries already passed & repeated subjects. imported, the store must hold what reference_parse says
+ * - hostile archives: built ones with bytes changed, inserted, or cut off, a length made huge, the trailer's count put out, or an expiry made negative. import must refuse one (2) exactly when reference_parse does, & the store must hold exactly the notes of the records before the damage - none cut short, none garbled
+ * Expiring notes need user xattrs. where the filesystem under $TMPDIR has none, they're left out (& the summary says so)
+ * Usage: archive_fuzz [COUNT [SEED]] - 300 rounds from seed 1 by default. exits non-zero on any failure
+ */
+
+#define ROUND_NOTES 24
+#define HOUR_NS (3600ll * 1000000000ll) /* expiries are at least this far from now, so none passes mid-round */
+
+/**
+ * @brief ArchivedNote (struct) - one note, as a record of an archive
+ */
+struct ArchivedNote {
+	uid_t uid;
+
+	char sbj[MAX_SBJ_LEN + 1];
+
+	int64_t expires_ns; /* 0 for never */
+
+	const uint8_t *body;
+
+	uint32_t len;
+};
+
+/**
+ * @brief Buffer (struct) - an archive being built in memory
+ */
+struct Buffer {
+	uint8_t *data;
+
+	size_t len, cap;
+};
+
+/**
+ * @brief ArchiveTotals (struct) - running totals, for the summary
+ */
+struct ArchiveTotals {
+	unsigned long long exported, packed, expiring, imported, built, hostile, refused;
+};
+
+static int xattrs = 1; /* boolean. the filesystem takes user xattrs, so expiring notes can be tested */
+
+/**
+ * @brief buffer_put - appends bytes to a Buffer, growing it as needed
+ */
+static void buffer_put(struct Buffer *const buffer, const void *const data, const size_t len)
+{
+	if (len == 0) {
+		return;
+	}
+	if (buffer->len + len > buffer->cap) {
+		buffer->cap = (buffer->len + len) * 2;
+		buffer->data = realloc(buffer->data, buffer->cap);
+		if (buffer->data == NULL) {
+			abort();
+		}
+	}
+	memcpy(buffer->data + buffer->len, data, len);
+	buffer->len += len;
+}
+
+static void buffer_put32(struct Buffer *const buffer, const uint32_t value)
+{
+	const uint32_t encoded = htole32(value);
+	buffer_put(buffer, &encoded, sizeof(encoded));
+}
+
+static void buffer_put64(struct Buffer *const buffer, const uint64_t value)
+{
+	const uint64_t encoded = htole64(value);
+	buffer_put(buffer, &encoded, sizeof(encoded));
+}
+
+/**
+ * @brief archive_build - lays out an archive of the given records, as archive.h documents it
+ * @param struct Buffer *const buffer - emptied & filled
+ * @param const uint32_t version - ARCHIVE_VERSION, or ARCHIVE_VERSION_NO_EXPIRY (expiries are then left out)
+ */
+static void archive_build(struct Buffer *const buffer, const uint32_t version, const struct ArchivedNote *const notes, const size_t count)
+{
+	buffer->len = 0;
+	buffer_put32(buffer, ARCHIVE_MAGIC);
+	buffer_put32(buffer, version);
+	for (size_t i = 0; i < count; ++i) {
+		buffer_put32(buffer, (uint32_t)notes[i].uid);
+		buffer_put32(buffer, (uint32_t)strlen(notes[i].sbj));
+		buffer_put(buffer, notes[i].sbj, strlen(notes[i].sbj));
+		if (version > ARCHIVE_VERSION_NO_EXPIRY) {
+			buffer_put64(buffer, (uint64_t)notes[i].expires_ns);
+		}
+		buffer_put32(buffer, notes[i].len);
+		buffer_put(buffer, notes[i].body, notes[i].len);
+	}
+	buffer_put32(buffer, 0);
+	buffer_put32(buffer, 0);
+	buffer_put64(buffer, count);
+}
+
+/**
+ * @brief get32 - a little endian uint32_t out of an archive, if there's one left
+ * @return int - zero is success, non-zero is the archive ran out
+ */
+static int get32(const uint8_t *const buf, const size_t len, size_t *const pos, uint32_t *const value)
+{
+	if (len - *pos < sizeof(*value)) {
+		return 1;
+	}
+	memcpy(value, buf + *pos, sizeof(*value));
+	*value = le32toh(*value);
+	*pos += sizeof(*value);
+
+	return 0;
+}
+
+static int get64(const uint8_t *const buf, const size_t len, size_t *const pos, uint64_t *const value)
+{
+	if (len - *pos < sizeof(*value)) {
+		return 1;
+	}
+	memcpy(value, buf + *pos, sizeof(*value));
+	*value = le64toh(*value);
+	*pos += sizeof(*value);
+
+	return 0;
+}
+
+/**
+ * @brief reference_parse - reads an archive from the layout as documented, record by record, up to its trailer or the first thing wrong with it
+ * a subject is good if a request could have created it - subject_check passes it whole, with nothing trimmed
+ * @param const uint8_t *const buf - archive
+ * @param const size_t len - length of buf
+ * @param struct ArchivedNote *const notes - filled with every whole, good record before the trailer or damage. bodies point into buf. room for len / 16 + 1
+ * @param size_t *const count - filled with number of notes
+ * @param uint32_t *const version - filled with the archive's version. 0 if it's not an archive
+ * @return int - zero is a whole, good archive, non-zero is malformed
+ */
+static int reference_parse(const uint8_t *const buf, const size_t len, struct ArchivedNote *const notes, size_t *const count, uint32_t *const version)
+{
+	*count = 0;
+	*version = 0;
+
+	size_t pos = 0;
+	uint32_t magic, read_version;
+	if (get32(buf, len, &pos, &magic) != 0 || get32(buf, len, &pos, &read_version) != 0 || magic != ARCHIVE_MAGIC || read_version < ARCHIVE_VERSION_NO_EXPIRY || read_version > ARCHIVE_VERSION) {
+		return 1;
+	}
+	*version = read_version;
+
+	for (;;) {
+		uint32_t uid, sbj_len, body_len;
+		if (get32(buf, len, &pos, &uid) != 0 || get32(buf, len, &pos, &sbj_len) != 0) {
+			return 1;
+		}
+		if (sbj_len == 0) {
+			uint64_t records;
+			return (get64(buf, len, &pos, &records) != 0 || uid != 0 || records != *count);
+		}
+		if (sbj_len > MAX_SBJ_LEN || len - pos < sbj_len) {
+			return 1;
+		}
+
+		struct ArchivedNote *const note = &notes[*count];
+		memcpy(note->sbj, buf + pos, sbj_len);
+		note->sbj[sbj_len] = '\0';
+		pos += sbj_len;
+		uint64_t expires = 0;
+		if ((read_version > ARCHIVE_VERSION_NO_EXPIRY && get64(buf, len, &pos, &expires) != 0) || get32(buf, len, &pos, &body_len) != 0) {
+			return 1;
+		}
+
+		size_t offset, trimmed_len;
+		if ((int64_t)expires < 0 || subject_check((const uint8_t *)note->sbj, sbj_len, &offset, &trimmed_len) != 0 || offset != 0 || trimmed_len != sbj_len || len - pos < body_len) {
+			return 1;
+		}
+		note->uid = (uid_t)uid;
+		note->expires_ns = (int64_t)expires;
+		note->body = buf + pos;
+		note->len = body_len;
+		pos += body_len;
+		++*count;
+	}
+}
+
+/**
+ * @brief StoreCheck (struct) - what check_uid expects a store to hold
+ */
+struct StoreCheck {
+	const struct ArchivedNote *notes;
+
+	int *found; /* one per note */
+
+	size_t count;
+
+	size_t visited;
+};
+
+/**
+ * @brief check_uid - store_for_each_uid visitor holding every note of one user to what's expected
+ */
+static int check_uid(const uid_t uid, const int uid_dir_fd, void *const ctx)
+{
+	struct StoreCheck *const check = ctx;
+
+	const int scan_fd = dup(uid_dir_fd);
+	DIR *const dir = (scan_fd == -1 ? NULL : fdopendir(scan_fd));
+	if (dir == NULL) {
+		fixture_fail("Couldn't list notes of uid %u", (unsigned int)uid);
+		if (scan_fd != -1) {
+			close(scan_fd);
+		}
+		return 0;
+	}
+
+	static uint8_t body[2 * ARCHIVE_IO_LEN];
+	for (struct dirent *entry; (entry = readdir(dir)) != NULL;) {
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+		++check->visited;
+
+		size_t which = check->count;
+		for (size_t i = 0; i < check->count && which == check->count; ++i) {
+			which = (check->notes[i].uid == uid && strcmp(check->notes[i].sbj, entry->d_name) == 0 ? i : which);
+		}
+		if (which == check->count) {
+			fixture_fail("Store holds note %u/%s, which it shouldn't", (unsigned int)uid, entry->d_name);
+			continue;
+		}
+		const struct ArchivedNote *const note = &check->notes[which];
+		check->found[which] = 1;
+
+		const int note_fd = openat(uid_dir_fd, entry->d_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+		struct stat statbuf;
+		if (note_fd == -1 || fstat(note_fd, &statbuf) != 0 || (size_t)statbuf.st_size > sizeof(body) || pread_all(note_fd, body, (size_t)statbuf.st_size, 0) != 0) {
+			fixture_fail("Couldn't read note %u/%s", (unsigned int)uid, entry->d_name);
+		} else if ((uint64_t)statbuf.st_size != note->len || memcmp(body, note->body, note->len) != 0) {
+			fixture_fail("Note %u/%s holds %lld byte(s), not the %u archived", (unsigned int)uid, entry->d_name, (long long)statbuf.st_size, (unsigned int)note->len);
+		} else if (store_note_expiry(note_fd) != note->expires_ns) {
+			fixture_fail("Note %u/%s expires at %lld, not %lld as archived", (unsigned int)uid, entry->d_name, (long long)store_note_expiry(note_fd), (long long)note->expires_ns);
+		}
+		if (note_fd != -1) {
+			close(note_fd);
+		}
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+/**
+ * @brief check_store - a store must hold exactly the notes given - as plain files, expiry & all
+ * @param const struct Store *const store - store imported into
+ * @param const struct ArchivedNote *const notes - notes it should hold. (uid, subject) unique
+ * @param const size_t count - number of notes
+ * @param const char *const what - what's being checked, for failures
+ */
+static void check_store(const struct Store *const store, const struct ArchivedNote *const notes, const size_t count, const char *const what)
+{
+	int *const found = calloc(count + 1, sizeof(*found));
+	struct StoreCheck check = { .notes = notes, .found = found, .count = count, .visited = 0 };
+	if (found == NULL || store_for_each_uid(store, check_uid, &check) != 0) {
+		fixture_fail("Couldn't walk the store after %s", what);
+	}
+	for (size_t i = 0; found != NULL && i < count; ++i) {
+		if (!found[i]) {
+			fixture_fail("Note %u/%s is missing after %s", (unsigned int)notes[i].uid, notes[i].sbj, what);
+		}
+	}
+	free(found);
+}
+
+/**
+ * @brief expected_notes - the notes an import of some records should leave in an empty store - those not expired, the first of each name
+ * @param const struct ArchivedNote *const records - records, in archive order
+ * @param const size_t count - number of records
+ * @param struct ArchivedNote *const notes - filled. room for count
+ * @param const int64_t now_ns - when the import runs
+ * @return size_t - number of notes
+ */
+static size_t expected_notes(const struct ArchivedNote *const records, const size_t count, struct ArchivedNote *const notes, const int64_t now_ns)
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (records[i].expires_ns != 0 && records[i].expires_ns <= now_ns) {
+			continue;
+		}
+		int seen = 0;
+		for (size_t j = 0; j < kept && !seen; ++j) {
+			seen = (notes[j].uid == records[i].uid && strcmp(notes[j].sbj, records[i].sbj) == 0);
+		}
+		if (!seen) {
+			notes[kept++] = records[i];
+		}
+	}
+
+	return kept;
+}
+
+/**
+ * @brief import_buffer - imports an archive held in memory into a fresh, empty store, & checks what it leaves against reference_parse
+ * @param const struct Buffer *const archive - archive
+ * @param struct ArchiveTotals *const totals - totals
+ * @return int - archive_import's return. -1 if the store couldn't be set up
+ */
+static int import_buffer(const struct Buffer *const archive, struct ArchiveTotals *const totals)
+{
+	struct ArchivedNote *const records = malloc((archive->len / 16 + 1) * sizeof(*records));
+	struct ArchivedNote *const notes = malloc((archive->len / 16 + 1) * sizeof(*notes));
+	size_t record_count;
+	uint32_t version;
+	const int malformed = reference_parse(archive->data, archive->len, records, &record_count, &version);
+	const size_t note_count = expected_notes(records, record_count, notes, clock_ns(CLOCK_REALTIME));
+
+	struct FixtureStore fixture;
+	const int fd = memfd_create("archive", MFD_CLOEXEC);
+	if (fd == -1 || write_all(fd, archive->data, archive->len) != 0 || lseek(fd, 0, SEEK_SET) != 0 || fixture_store_open(&fixture) != 0) {
+		fixture_fail("Couldn't set up an import");
+		if (fd != -1) {
+			close(fd);
+		}
+		free(records);
+		free(notes);
+		return -1;
+	}
+
+	struct ArchiveStats stats;
+	const int ret = archive_import(&fixture.store, fd, NULL, NULL, &stats);
+	close(fd);
+	if (ret != (malformed ? 2 : 0)) {
+		fixture_fail("archive_import of a %s archive (version %u, %lu byte(s), %lu good record(s)) gave %d", (malformed ? "malformed" : "good"), (unsigned int)version, (unsigned long)archive->len, (unsigned long)record_count, ret);
+	} else if (stats.notes != note_count) {
+		fixture_fail("archive_import imported %llu note(s), rather than %lu", (unsigned long long)stats.notes, (unsigned long)note_count);
+	}
+	check_store(&fixture.store, notes, note_count, (malformed ? "a malformed import" : "an import"));
+	totals->imported += stats.notes;
+	totals->refused += (unsigned long long)(ret != 0);
+
+	fixture_store_close(&fixture);
+	free(records);
+	free(notes);
+
+	return ret;
+}
+
+/**
+ * @brief random_note - fills in a random note. bodies are mostly short, but one in a while spans several ARCHIVE_IO_LEN chunks
+ * @param uint8_t **const body - filled with the body (caller frees)
+ */
+static void random_note(uint64_t *const state, struct ArchivedNote *const note, const size_t id, uint8_t **const body, const int64_t now_ns)
+{
+	static const uid_t uids[] = { 0, 1, 1000, 65534, 4294967294u };
+	note->uid = uids[fixture_random(state) % (sizeof(uids) / sizeof(*uids))];
+	const int len = snprintf(note->sbj, sizeof(note->sbj), "%lu", (unsigned long)id);
+	for (size_t i = (size_t)len, pad = fixture_random(state) % (MAX_SBJ_LEN - (size_t)len + 1); pad > 0; --pad, ++i) {
+		note->sbj[i] = "abcxyz_-+ ABC"[fixture_random(state) % 13];
+		note->sbj[i + 1] = '\0';
+	}
+
+	switch (fixture_random(state) % 6) {
+		case 0:
+			note->expires_ns = (xattrs ? now_ns + HOUR_NS + (int64_t)(fixture_random(state) % (uint64_t)HOUR_NS) : 0);
+			break;
+		case 1:
+			note->expires_ns = now_ns - HOUR_NS - (int64_t)(fixture_random(state) % (uint64_t)HOUR_NS);
+			break;
+		default:
+			note->expires_ns = 0;
+			break;
+	}
+
+	note->len = (uint32_t)(fixture_random(state) % 64 == 0 ? ARCHIVE_IO_LEN / 2 + fixture_random(state) % ARCHIVE_IO_LEN : fixture_len(state, 3000));
+	*body = malloc(note->len + 1);
+	fixture_body(state, *body, note->len);
+	note->body = *body;
+}
+
+/**
+ * @brief round_trip - exports a random store, checks the archive, then imports it (twice) into an empty store
+ */
+static void round_trip(uint64_t *const state, struct ArchiveTotals *const totals)
+{
+	struct FixtureStore source;
+	if (fixture_store_open(&source) != 0) {
+		fixture_fail("Couldn't set up a store to export");
+		return;
+	}
+
+	const int64_t now_ns = clock_ns(CLOCK_REALTIME);
+	struct ArchivedNote notes[ROUND_NOTES], exportable[ROUND_NOTES];
+	uint8_t *bodies[ROUND_NOTES];
+	const size_t count = fixture_random(state) % (ROUND_NOTES + 1);
+	size_t exportable_count = 0;
+	for (size_t i = 0; i < count; ++i) {
+		struct ArchivedNote *const note = &notes[i];
+		random_note(state, note, i, &bodies[i], now_ns);
+		if (fixture_write_note(&source.store, note->uid, note->sbj, note->body, note->len) != 0) {
+			fixture_fail("Couldn't write note %s", note->sbj);
+			continue;
+		}
+
+		const int uid_dir_fd = store_uid_dir(&source.store, note->uid, 0);
+		if (note->expires_ns != 0) { /* as an add with a time to live leaves it */
+			const int note_fd = openat(uid_dir_fd, note->sbj, O_WRONLY | O_NOFOLLOW | O_CLOEXEC);
+			const uint64_t expires_le = htole64((uint64_t)note->expires_ns);
+			if (note_fd == -1 || fchmod(note_fd, STORE_EXPIRING_NOTE_PERMISSIONS) != 0 || fsetxattr(note_fd, STORE_EXPIRY_XATTR, &expires_le, sizeof(expires_le), 0) != 0) {
+				fixture_fail("Couldn't make note %s expire", note->sbj);
+			}
+			if (note_fd != -1) {
+				close(note_fd);
+			}
+			totals->expiring += (unsigned long long)(note->expires_ns > now_ns);
+		} else if (note->len > 0 && note->len <= NOTICEBOARD_COLD_MAX_LEN && fixture_random(state) % 2 == 0) { /* expiring notes are never packed */
+			struct PackNote packed = { .created_ns = now_ns, .offset = 0 };
+			memcpy(packed.sbj, note->sbj, sizeof(packed.sbj));
+			if (pack_add(uid_dir_fd, &packed, 1) != 0 || packed.offset == 0) {
+				fixture_fail("Couldn't pack note %s", note->sbj);
+			}
+			++totals->packed;
+		}
+		close(uid_dir_fd);
+
+		if (note->expires_ns == 0 || note->expires_ns > now_ns) {
+			exportable[exportable_count++] = *note;
+		}
+	}
+
+	struct ArchiveStats stats;
+	const int fd = memfd_create("archive", MFD_CLOEXEC);
+	struct stat statbuf;
+	struct Buffer archive = { .data = NULL, .len = 0, .cap = 0 };
+	if (fd == -1 || archive_export(&source.store, fd, &stats) != 0 || fstat(fd, &statbuf) != 0) {
+		fixture_fail("archive_export failed");
+		goto end;
+	}
+	archive.len = archive.cap = (size_t)statbuf.st_size;
+	archive.data = malloc(archive.len + 1);
+	if (archive.data == NULL || pread_all(fd, archive.data, archive.len, 0) != 0) {
+		fixture_fail("Couldn't read the archive back");
+		goto end;
+	}
+	totals->exported += stats.notes;
+
+	struct ArchivedNote *const records = malloc((archive.len / 16 + 1) * sizeof(*records));
+	size_t record_count;
+	uint32_t version;
+	if (reference_parse(archive.data, archive.len, records, &record_count, &version) != 0 || version != ARCHIVE_VERSION) {
+		fixture_fail("Exported archive of %lu note(s) is malformed, after %lu record(s)", (unsigned long)exportable_count, (unsigned long)record_count);
+	} else if (record_count != exportable_count || stats.notes != exportable_count) {
+		fixture_fail("Export holds %lu record(s) (%llu counted), rather than %lu", (unsigned long)record_count, (unsigned long long)stats.notes, (unsigned long)exportable_count);
+	} else {
+		for (size_t i = 0; i < exportable_count; ++i) {
+			const struct ArchivedNote *const expect = &exportable[i];
+			size_t j = 0;
+			while (j < record_count && (records[j].uid != expect->uid || strcmp(records[j].sbj, expect->sbj) != 0)) {
+				++j;
+			}
+			if (j == record_count || records[j].expires_ns != expect->expires_ns || records[j].len != expect->len || memcmp(records[j].body, expect->body, expect->len) != 0) {
+				fixture_fail("Export %s note %u/%s as it was", (j == record_count ? "lacks" : "doesn't hold"), (unsigned int)expect->uid, expect->sbj);
+			}
+		}
+	}
+	free(records);
+
+	struct FixtureStore target;
+	if (lseek(fd, 0, SEEK_SET) != 0 || fixture_store_open(&target) != 0) {
+		fixture_fail("Couldn't set up a store to import to");
+		goto end;
+	}
+	if (archive_import(&target.store, fd, NULL, NULL, &stats) != 0 || stats.notes != exportable_count) {
+		fixture_fail("archive_import of an export of %lu note(s) imported %llu", (unsigned long)exportable_count, (unsigned long long)stats.notes);
+	}
+	totals->imported += stats.notes;
+	check_store(&target.store, exportable, exportable_count, "importing an export");
+
+	if (lseek(fd, 0, SEEK_SET) != 0 || archive_import(&target.store, fd, NULL, NULL, &stats) != 0 || stats.notes != 0 || stats.skipped != exportable_count) {
+		fixture_fail("archive_import of an export over itself imported %llu & skipped %llu, of %lu", (unsigned long long)stats.notes, (unsigned long long)stats.skipped, (unsigned long)exportable_count);
+	}
+	check_store(&target.store, exportable, exportable_count, "importing an export twice");
+	fixture_store_close(&target);
+
+end:
+	if (fd != -1) {
+		close(fd);
+	}
+	free(archive.data);
+	for (size_t i = 0; i < count; ++i) {
+		free(bodies[i]);
+	}
+	fixture_store_close(&source);
+}
+
+/**
+ * @brief built - builds an archive of random records, then imports it - as is, or damaged
+ * @param const int damage - boolean. damage it first
+ */
+static void built(uint64_t *const state, const int damage, struct ArchiveTotals *const totals)
+{
+	const int64_t now_ns = clock_ns(CLOCK_REALTIME);
+	struct ArchivedNote notes[ROUND_NOTES];
+	uint8_t *bodies[ROUND_NOTES];
+	const size_t count = fixture_random(state) % (ROUND_NOTES + 1);
+	for (size_t i = 0; i < count; ++i) {
+		random_note(state, &notes[i], i, &bodies[i], now_ns);
+		if (i > 0 && fixture_random(state) % 8 == 0) { /* the same name again - first one wins */
+			notes[i].uid = notes[i - 1].uid;
+			memcpy(notes[i].sbj, notes[i - 1].sbj, sizeof(notes[i].sbj));
+		}
+	}
+
+	const uint32_t version = (fixture_random(state) % 4 == 0 ? ARCHIVE_VERSION_NO_EXPIRY : ARCHIVE_VERSION);
+	if (version == ARCHIVE_VERSION_NO_EXPIRY) {
+		for (size_t i = 0; i < count; ++i) {
+			notes[i].expires_ns = 0;
+		}
+	} else if (damage && count > 0 && fixture_random(state) % 4 == 0) { /* an expiry no add could have set */
+		notes[fixture_random(state) % count].expires_ns = INT64_MIN + (int64_t)(fixture_random(state) % 1000);
+	}
+	struct Buffer archive = { .data = NULL, .len = 0, .cap = 0 };
+	archive_build(&archive, version, notes, count);
+
+	if (damage) {
+		++totals->hostile;
+		for (size_t changes = 1 + fixture_random(state) % 3; changes > 0 && archive.len > 0; --changes) {
+			const size_t at = fixture_random(state) % archive.len;
+			switch (fixture_random(state) % 6) {
+				case 0: /* cut off */
+					archive.len = at;
+					break;
+				case 1: /* a length made huge */
+					if (archive.len - at >= 4) {
+						const uint32_t huge = htole32((uint32_t)(fixture_random(state) % 2 == 0 ? UINT32_MAX - fixture_random(state) % 16 : 2 * ARCHIVE_IO_LEN + fixture_random(state) % ARCHIVE_IO_LEN));
+						memcpy(archive.data + at, &huge, sizeof(huge));
+					}
+					break;
+				case 2: { /* bytes slipped in */
+					struct Buffer spliced = { .data = NULL, .len = 0, .cap = 0 };
+					uint8_t extra[8];
+					const size_t extra_len = 1 + fixture_random(state) % sizeof(extra);
+					fixture_body(state, extra, extra_len);
+					buffer_put(&spliced, archive.data, at);
+					buffer_put(&spliced, extra, extra_len);
+					buffer_put(&spliced, archive.data + at, archive.len - at);
+					free(archive.data);
+					archive = spliced;
+					break;
+				}
+				case 3: /* the trailer's count off by one */
+					if (archive.len >= 8) {
+						uint64_t records;
+						memcpy(&records, archive.data + archive.len - 8, sizeof(records));
+						records = htole64(le64toh(records) + (fixture_random(state) % 2 == 0 ? 1 : (uint64_t)-1));
+						memcpy(archive.data + archive.len - 8, &records, sizeof(records));
+					}
+					break;
+				default: /* a byte changed */
+					archive.data[at] ^= (uint8_t)(1 + fixture_random(state) % 255);
+					break;
+			}
+		}
+	} else {
+		++totals->built;
+	}
+
+	import_buffer(&archive, totals);
+
+	free(archive.data);
+	for (size_t i = 0; i < count; ++i) {
+		free(bodies[i]);
+	}
+}
+
+/**
+ * @brief probe_xattrs - whether notes here can carry their expiry
+ * @return int - Boolean. 1 if user xattrs can be set
+ */
+static int probe_xattrs(void)
+{
+	struct FixtureStore fixture;
+	if (fixture_store_open(&fixture) != 0) {
+		return 0;
+	}
+
+	const uint8_t body = 'x';
+	const int uid_dir_fd = (fixture_write_note(&fixture.store, 0, "probe", &body, 1) == 0 ? store_uid_dir(&fixture.store, 0, 0) : -1);
+	const int note_fd = (uid_dir_fd == -1 ? -1 : openat(uid_dir_fd, "probe", O_WRONLY | O_CLOEXEC));
+	const uint64_t value = 0;
+	const int supported = (note_fd != -1 && fsetxattr(note_fd, STORE_EXPIRY_XATTR, &value, sizeof(value), 0) == 0);
+	if (note_fd != -1) {
+		close(note_fd);
+	}
+	if (uid_dir_fd != -1) {
+		close(uid_dir_fd);
+	}
+	fixture_store_close(&fixture);
+
+	return supported;
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned long long count = (argc > 1 ? strtoull(argv[1], NULL, 10) : 300);
+	uint64_t state = (argc > 2 ? strtoull(argv[2], NULL, 10) : 1);
+	if (state == 0) {
+		state = 1;
+	}
+
+	if (fixture_quiet() != 0) {
+		return 3;
+	}
+	xattrs = probe_xattrs();
+
+	struct ArchiveTotals totals;
+	memset(&totals, '\0', sizeof(totals));
+	for (unsigned long long n = 0; n < count; ++n) {
+		switch (n % 3) {
+			case 0:
+				round_trip(&state, &totals);
+				break;
+			case 1:
+				built(&state, 0, &totals);
+				break;
+			default:
+				built(&state, 1, &totals);
+				break;
+		}
+	}
+
+	return fixture_finish("%llu round(s): %llu note(s) exported (%llu packed, %llu expiring%s), %llu imported, %llu archive(s) built & %llu damaged, %llu refused", count, totals.exported, totals.packed, totals.expiring, (xattrs ? "" : " - no user xattrs here"), totals.imported, totals.built, totals.hostile, totals.refused);
+}
@@ -0,0 +1,198 @@
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "fixture.h"
+
+/**
+ * @brief Definitions shared by the pack, tier, timer wheel & archive fuzz tests
+ */
+
+static FILE *report = NULL; /* the real stdout, once fixture_quiet has moved it */
+static unsigned long long failures = 0;
+
+int fixture_quiet(void)
+{
+	const int report_fd = dup(STDOUT_FILENO);
+	if (report_fd == -1 || (report = fdopen(report_fd, "w")) == NULL) {
+		perror("dup");
+		return 1;
+	}
+	if (freopen("/dev/null", "w", stdout) == NULL || freopen("/dev/null", "w", stderr) == NULL) {
+		fprintf(report, "Error redirecting output to /dev/null (errno %d: %s)\n", errno, strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+void fixture_fail(const char *const format, ...)
+{
+	if (failures++ >= FIXTURE_REPORT_MAX) {
+		return;
+	}
+
+	va_list args;
+	va_start(args, format);
+	fputs("Failure: ", (report != NULL ? report : stdout));
+	vfprintf((report != NULL ? report : stdout), format, args);
+	fputc('\n', (report != NULL ? report : stdout));
+	va_end(args);
+}
+
+int fixture_finish(const char *const format, ...)
+{
+	FILE *const out = (report != NULL ? report : stdout);
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(out, format, args);
+	va_end(args);
+	fprintf(out, ", %llu failure(s)\n", failures);
+	fflush(out);
+
+	return (failures != 0);
+}
+
+uint64_t fixture_random(uint64_t *const state)
+{
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+
+	return x;
+}
+
+void fixture_body(uint64_t *const state, uint8_t *const buf, const size_t len)
+{
+	static const char *const words[] = { "the", "note", "board", "server", "of", "a", "pack", "record", "is", "and", "to", "expires", "read", "cold", "hot", "warm" };
+
+	switch (fixture_random(state) % 4) {
+		case 0: /* incompressible - stored as is */
+			for (size_t i = 0; i < len; ++i) {
+				buf[i] = (uint8_t)fixture_random(state);
+			}
+			break;
+		case 1: /* runs - long matches overlapping what they copy */
+			for (size_t i = 0; i < len;) {
+				const uint8_t byte = (uint8_t)fixture_random(state);
+				for (size_t run = 1 + fixture_random(state) % 600; run > 0 && i < len; --run) {
+					buf[i++] = byte;
+				}
+			}
+			break;
+		case 2: /* text */
+			for (size_t i = 0; i < len;) {
+				const char *const word = words[fixture_random(state) % (sizeof(words) / sizeof(*words))];
+				for (size_t j = 0; word[j] != '\0' && i < len; ++j) {
+					buf[i++] = (uint8_t)word[j];
+				}
+				if (i < len) {
+					buf[i++] = ' ';
+				}
+			}
+			break;
+		default: { /* one phrase repeated, with the odd byte changed */
+			uint8_t phrase[64];
+			const size_t phrase_len = 1 + fixture_random(state) % sizeof(phrase);
+			for (size_t i = 0; i < phrase_len; ++i) {
+				phrase[i] = (uint8_t)fixture_random(state);
+			}
+			for (size_t i = 0; i < len; ++i) {
+				buf[i] = (fixture_random(state) % 97 == 0 ? (uint8_t)fixture_random(state) : phrase[i % phrase_len]);
+			}
+			break;
+		}
+	}
+}
+
+size_t fixture_len(uint64_t *const state, const size_t max)
+{
+	switch (fixture_random(state) % 8) {
+		case 0:
+			return (max < 16 ? max : fixture_random(state) % 16);
+		case 1:
+			return max - (max < 16 ? 0 : fixture_random(state) % 16);
+		case 2:
+		case 3:
+			return fixture_random(state) % (max + 1);
+		default:
+			return fixture_random(state) % ((max < 2048 ? max : 2048) + 1);
+	}
+}
+
+int fixture_store_open(struct FixtureStore *const fixture)
+{
+	const char *tmp_dir = getenv("TMPDIR");
+	if (tmp_dir == NULL || tmp_dir[0] == '\0') {
+		tmp_dir = "/tmp";
+	}
+
+	if (snprintf(fixture->path, sizeof(fixture->path), "%s/noticeboard_check.XXXXXX", tmp_dir) >= (int)sizeof(fixture->path) || mkdtemp(fixture->path) == NULL) {
+		fprintf(stderr, "Error creating notes directory under %s (errno %d: %s)\n", tmp_dir, errno, strerror(errno));
+		return 1;
+	}
+
+	if (store_open(&fixture->store, fixture->path) != 0) {
+		rmdir(fixture->path);
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief remove_entry - nftw callback deleting whatever it's given. directories come after their contents (FTW_DEPTH)
+ */
+static int remove_entry(const char *const path, const struct stat *const statbuf, const int type, struct FTW *const ftw)
+{
+	(void)statbuf;
+	(void)ftw;
+
+	if ((type == FTW_DP ? rmdir(path) : unlink(path)) != 0) {
+		fprintf(stderr, "Error deleting %s (errno %d: %s)\n", path, errno, strerror(errno));
+	}
+
+	return 0;
+}
+
+void fixture_store_close(struct FixtureStore *const fixture)
+{
+	store_close(&fixture->store);
+	nftw(fixture->path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+int fixture_write_note(const struct Store *const store, const uid_t uid, const char *const sbj, const uint8_t *const body, const size_t len)
+{
+	const int uid_dir_fd = store_uid_dir(store, uid, 1);
+	if (uid_dir_fd == -1) {
+		fprintf(stderr, "Error opening notes directory of uid %u (errno %d: %s)\n", (unsigned int)uid, errno, strerror(errno));
+		return 1;
+	}
+
+	const int note_fd = openat(uid_dir_fd, sbj, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, STORE_NOTE_PERMISSIONS);
+	close(uid_dir_fd);
+	if (note_fd == -1 || write_all(note_fd, body, len) != 0) {
+		fprintf(stderr, "Error writing note %s (errno %d: %s)\n", sbj, errno, strerror(errno));
+		if (note_fd != -1) {
+			close(note_fd);
+		}
+		return 1;
+	}
+	close(note_fd);
+
+	return 0;
+}
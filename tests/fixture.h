@@ -0,0 +1,98 @@
+#ifndef FIXTURE_H
+#define FIXTURE_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "store.h"
+
+/**
+ * @brief Declarations shared by the pack, tier, timer wheel & archive fuzz tests
+ * - a xorshift generator, so every run from the same seed is the same run
+ * - note bodies of every kind the packer meets - incompressible, runs, text & repeats
+ * - a throwaway store, in a fresh directory under $TMPDIR (or /tmp) that's deleted afterwards
+ */
+
+#define FIXTURE_REPORT_MAX 10 /* failures printed before the rest are only counted */
+
+/**
+ * @brief FixtureStore (struct) - a throwaway store & where it lives
+ */
+struct FixtureStore {
+	struct Store store;
+
+	char path[PATH_MAX];
+};
+
+/**
+ * @brief fixture_quiet - sends stdout & stderr to /dev/null, as the code under test logs every note it touches. the test's own report goes to the real stdout (see fixture_fail & fixture_finish)
+ * @return int - zero is success, non-zero is failure
+ * 1 is error redirecting
+ */
+int fixture_quiet(void);
+
+/**
+ * @brief fixture_fail - counts a failure, printing it if it's one of the first FIXTURE_REPORT_MAX
+ * @param const char *const format - printf format of what failed
+ */
+void fixture_fail(const char *const format, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * @brief fixture_finish - prints the test's summary, followed by how many failures there were
+ * @param const char *const format - printf format of the summary
+ * @return int - exit code. 0 if nothing failed, 1 otherwise
+ */
+int fixture_finish(const char *const format, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * @brief fixture_random - steps a xorshift64 generator
+ * @param uint64_t *const state - generator state. never zero
+ * @return uint64_t - next value
+ */
+uint64_t fixture_random(uint64_t *const state);
+
+/**
+ * @brief fixture_body - fills in a random note body, of a random kind - random bytes, runs of one byte, text of a few dozen words, or one short phrase repeated with the odd byte changed
+ * @param uint64_t *const state - xorshift state
+ * @param uint8_t *const buf - filled with the body
+ * @param const size_t len - length to fill
+ */
+void fixture_body(uint64_t *const state, uint8_t *const buf, const size_t len);
+
+/**
+ * @brief fixture_len - picks a random length up to a maximum, favouring short ones & the edges (0, 1, max) over the middle
+ * @param uint64_t *const state - xorshift state
+ * @param const size_t max - longest allowed
+ * @return size_t - length
+ */
+size_t fixture_len(uint64_t *const state, const size_t max);
+
+/**
+ * @brief fixture_store_open - creates an empty notes directory & opens a store on it
+ * @param struct FixtureStore *const fixture - struct to fill
+ * @return int - zero is success, non-zero is failure
+ * 1 is error creating or opening the directory
+ */
+int fixture_store_open(struct FixtureStore *const fixture);
+
+/**
+ * @brief fixture_store_close - closes a store from fixture_store_open & deletes everything in it
+ * @param struct FixtureStore *const fixture - fixture
+ */
+void fixture_store_close(struct FixtureStore *const fixture);
+
+/**
+ * @brief fixture_write_note - writes a note as a plain file, as an ADD would (not indexed)
+ * @param const struct Store *const store - opened store
+ * @param const uid_t uid - owner
+ * @param const char *const sbj - null terminated subject
+ * @param const uint8_t *const body - note body
+ * @param const size_t len - length of body
+ * @return int - zero is success, non-zero is failure
+ * 1 is error writing
+ */
+int fixture_write_note(const struct Store *const store, const uid_t uid, const char *const sbj, const uint8_t *const body, const size_t len);
+
+#endif /* FIXTURE_H */
@@ -0,0 +1,879 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "constraints.h"
+#include "store.h"
+#include "util.h"
+#include "pack.h"
+#include "fixture.h"
+
+/**
+ * @brief Pack & codec fuzz test, ran by `make check`
+ * - round trip: random notes (every kind fixture_body makes, up to NOTICEBOARD_COLD_MAX_LEN long, plus empty, missing & overlong ones pack_add must skip) are packed, sometimes over a torn append. each is read back through pack_read & pack_for_each, & the pack itself is parsed here, independently, against the layout pack.h documents - header, records, checksums, & compressed bodies through reference_decompress rather than pack.c's own decoder
+ * - kills & compaction: random records are killed, the rest compacted a few at a time - with the odd note killed part way through & its copy dropped - & the new pack must hold exactly what's left
+ * - hostile bodies: packs written here of one compressed record, its body random, built of random sequences, or a real body mutated. pack_read must accept it exactly when reference_decompress does (& the length matches), & then give back what it gives
+ * - corruption: a byte changed in a record's subject or body must always be refused. anything else changed anywhere must never be read past, & notes added after must still read back
+ * Compressed bodies (LZ4 style) are sequences of: a token (literal count in the high nibble, match length less REFERENCE_MIN_MATCH in the low, 15 in either extended by the bytes following - each added on - up to one that isn't 255), the literals, then a 16 bit little endian offset back into the output & the match length's extension. the last sequence is literals only
+ * Usage: pack_fuzz [COUNT [SEED]] - 2000 rounds from seed 1 by default. exits non-zero on any failure
+ */
+
+#define REFERENCE_MIN_MATCH 4
+#define ROUND_NOTES 12 /* most notes packed per batch - two batches a round */
+#define CORRUPT_NOTES 6
+
+/**
+ * @brief Expect (struct) - a note as the test believes it's packed
+ */
+struct Expect {
+	char sbj[MAX_SBJ_LEN + 1];
+
+	int64_t created_ns;
+
+	uint8_t *body;
+
+	size_t len;
+
+	uint64_t offset; /* its record. 0 if it has none */
+
+	int live; /* boolean. its record should be live */
+};
+
+/**
+ * @brief PackStats (struct) - running totals, for the summary
+ */
+struct PackStats {
+	unsigned long long packed, compressed, killed, compactions, dropped, hostile_accepted, hostile_refused, corrupted;
+};
+
+static uint8_t read_buf[NOTICEBOARD_COLD_MAX_LEN];
+static uint8_t reference_buf[NOTICEBOARD_COLD_MAX_LEN];
+static uint8_t stored_buf[NOTICEBOARD_COLD_MAX_LEN];
+
+/**
+ * @brief fnv1a - FNV-1a (32 bit), as records' checksums are, carried on from an earlier hash
+ */
+static uint32_t fnv1a(uint32_t hash, const uint8_t *const buf, const size_t len)
+{
+	for (size_t i = 0; i < len; ++i) {
+		hash = (hash ^ buf[i]) * 16777619u;
+	}
+
+	return hash;
+}
+
+/**
+ * @brief reference_length - reads a length's extension bytes, as the format describes
+ * @return int - zero is success, non-zero is the input ran out
+ */
+static int reference_length(const uint8_t *const src, const size_t len, size_t *const in, size_t *const value)
+{
+	for (;;) {
+		if (*in >= len) {
+			return 1;
+		}
+		const uint8_t byte = src[(*in)++];
+		*value += byte;
+		if (byte != 255) {
+			return 0;
+		}
+	}
+}
+
+/**
+ * @brief reference_decompress - decodes a compressed body from the format as documented above
+ * @param const uint8_t *const src - compressed body
+ * @param const size_t len - length of src
+ * @param uint8_t *const dst - output
+ * @param const size_t cap - capacity of dst
+ * @param size_t *const out_len - filled with decoded length
+ * @return int - zero is success, non-zero is malformed (or longer than cap)
+ */
+static int reference_decompress(const uint8_t *const src, const size_t len, uint8_t *const dst, const size_t cap, size_t *const out_len)
+{
+	size_t in = 0, out = 0;
+	while (in < len) {
+		const uint8_t token = src[in++];
+
+		size_t literals = token >> 4;
+		if (literals == 15 && reference_length(src, len, &in, &literals) != 0) {
+			return 1;
+		}
+		if (in + literals > len || out + literals > cap) {
+			return 1;
+		}
+		for (size_t i = 0; i < literals; ++i) {
+			dst[out++] = src[in++];
+		}
+		if (in == len) {
+			break;
+		}
+
+		if (in + 2 > len) {
+			return 1;
+		}
+		const size_t offset = (size_t)src[in] + ((size_t)src[in + 1] << 8);
+		in += 2;
+		size_t match = token & 0x0F;
+		if (match == 15 && reference_length(src, len, &in, &match) != 0) {
+			return 1;
+		}
+		match += REFERENCE_MIN_MATCH;
+		if (offset < 1 || offset > out || out + match > cap) {
+			return 1;
+		}
+		for (size_t i = 0; i < match; ++i, ++out) {
+			dst[out] = dst[out - offset];
+		}
+	}
+
+	*out_len = out;
+	return 0;
+}
+
+/**
+ * @brief get32 / get64 - little endian integers out of a pack
+ */
+static uint32_t get32(const uint8_t *const buf)
+{
+	uint32_t value;
+	memcpy(&value, buf, sizeof(value));
+
+	return le32toh(value);
+}
+
+static uint64_t get64(const uint8_t *const buf)
+{
+	uint64_t value;
+	memcpy(&value, buf, sizeof(value));
+
+	return le64toh(value);
+}
+
+/**
+ * @brief put_record - lays out a header & one record, as pack.h documents them
+ * @param uint8_t *const buf - filled. PACK_HEADER_LEN + PACK_RECORD_FIXED_LEN + sbj_len + stored_len long
+ * @return size_t - bytes laid out
+ */
+static size_t put_record(uint8_t *const buf, const uint8_t flags, const char *const sbj, const uint32_t raw_len, const uint8_t *const stored, const uint32_t stored_len)
+{
+	const size_t sbj_len = strlen(sbj);
+	const size_t len = PACK_HEADER_LEN + PACK_RECORD_FIXED_LEN + sbj_len + stored_len;
+	memset(buf, '\0', PACK_HEADER_LEN + PACK_RECORD_FIXED_LEN);
+
+	const uint32_t magic = htole32(PACK_MAGIC), version = htole32(PACK_VERSION);
+	const uint64_t end = htole64(len);
+	memcpy(buf, &magic, sizeof(magic));
+	memcpy(buf + 4, &version, sizeof(version));
+	memcpy(buf + 8, &end, sizeof(end));
+
+	uint8_t *const record = buf + PACK_HEADER_LEN;
+	const uint32_t raw = htole32(raw_len), stored_le = htole32(stored_len), checksum = htole32(fnv1a(fnv1a(2166136261u, (const uint8_t *)sbj, sbj_len), stored, stored_len));
+	record[0] = flags;
+	record[1] = (uint8_t)sbj_len;
+	memcpy(record + 4, &raw, sizeof(raw));
+	memcpy(record + 8, &stored_le, sizeof(stored_le));
+	memcpy(record + 12, &checksum, sizeof(checksum));
+	memcpy(record + PACK_RECORD_FIXED_LEN, sbj, sbj_len);
+	memmove(record + PACK_RECORD_FIXED_LEN + sbj_len, stored, stored_len);
+
+	return len;
+}
+
+/**
+ * @brief read_pack - reads a user's whole pack
+ * @param size_t *const len - filled with its length
+ * @return uint8_t* - the pack (caller frees). NULL if there's none
+ */
+static uint8_t *read_pack(const int uid_dir_fd, size_t *const len)
+{
+	const int fd = openat(uid_dir_fd, NOTICEBOARD_PACK_NAME, O_RDONLY | O_CLOEXEC);
+	struct stat statbuf;
+	if (fd == -1 || fstat(fd, &statbuf) != 0) {
+		if (fd != -1) {
+			close(fd);
+		}
+		return NULL;
+	}
+
+	uint8_t *const pack = malloc((size_t)statbuf.st_size + 1);
+	if (pack == NULL || pread_all(fd, pack, (size_t)statbuf.st_size, 0) != 0) {
+		free(pack);
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+	*len = (size_t)statbuf.st_size;
+
+	return pack;
+}
+
+/**
+ * @brief VisitCtx (struct) - what verify_visit expects pack_for_each to visit
+ */
+struct VisitCtx {
+	const struct Expect *expects;
+
+	size_t count;
+
+	uint64_t last_offset;
+
+	size_t visited;
+};
+
+/**
+ * @brief verify_visit - pack_visitor checking each live record against the note expected there, & that they come in order
+ */
+static int verify_visit(const struct PackRecord *const record, void *const ctx)
+{
+	struct VisitCtx *const visit = ctx;
+	if (record->offset <= visit->last_offset) {
+		fixture_fail("pack_for_each visited offset %llu after %llu", (unsigned long long)record->offset, (unsigned long long)visit->last_offset);
+	}
+	visit->last_offset = record->offset;
+	++visit->visited;
+
+	for (size_t i = 0; i < visit->count; ++i) {
+		const struct Expect *const expect = &visit->expects[i];
+		if (expect->offset == record->offset) {
+			if (!expect->live || strcmp(expect->sbj, record->sbj) != 0 || record->sbj_len != strlen(expect->sbj) || record->raw_len != expect->len || record->created_ns != expect->created_ns) {
+				fixture_fail("pack_for_each visited %s at offset %llu, which should be %s%s", record->sbj, (unsigned long long)record->offset, expect->sbj, (expect->live ? "" : " (dead)"));
+			}
+			return 0;
+		}
+	}
+
+	fixture_fail("pack_for_each visited %s at offset %llu, where no note should be", record->sbj, (unsigned long long)record->offset);
+	return 0;
+}
+
+/**
+ * @brief count_visit - pack_visitor only counting, & checking what it's given is in bounds
+ */
+static int count_visit(const struct PackRecord *const record, void *const ctx)
+{
+	if (record->sbj_len < 1 || record->sbj_len > MAX_SBJ_LEN || strlen(record->sbj) != record->sbj_len || record->raw_len > NOTICEBOARD_COLD_MAX_LEN) {
+		fixture_fail("pack_for_each visited a malformed record at offset %llu", (unsigned long long)record->offset);
+	}
+	++*(size_t *)ctx;
+
+	return 0;
+}
+
+/**
+ * @brief verify_pack - parses a user's pack by hand & reads every note through pack.h, checking both against what's expected
+ * @param const int uid_dir_fd - directory handle of the user's notes
+ * @param const struct Expect *const expects - every note packed (or meant to be) this round
+ * @param const size_t count - number of expects
+ * @param struct PackStats *const stats - compressed records are counted
+ */
+static void verify_pack(const int uid_dir_fd, const struct Expect *const expects, const size_t count, struct PackStats *const stats)
+{
+	size_t live = 0;
+	for (size_t i = 0; i < count; ++i) {
+		live += (size_t)(expects[i].offset != 0 && expects[i].live);
+	}
+
+	size_t pack_len = 0;
+	uint8_t *const pack = read_pack(uid_dir_fd, &pack_len);
+	uint64_t end = 0, dead = 0;
+	if (pack == NULL) {
+		for (size_t i = 0; i < count; ++i) {
+			if (expects[i].offset != 0 && expects[i].live) {
+				fixture_fail("Note %s should be packed, but there's no pack", expects[i].sbj);
+			}
+		}
+	} else if (pack_len < PACK_HEADER_LEN || get32(pack) != PACK_MAGIC || get32(pack + 4) != PACK_VERSION || (end = get64(pack + 8)) < PACK_HEADER_LEN || end > pack_len) {
+		fixture_fail("Pack header is malformed (length %lu, end %llu)", (unsigned long)pack_len, (unsigned long long)end);
+	} else {
+		uint64_t dead_found = 0;
+		size_t live_found = 0;
+		for (uint64_t offset = PACK_HEADER_LEN; offset < end;) {
+			const uint8_t *const record = pack + offset;
+			const uint8_t flags = record[0], sbj_len = record[1];
+			const uint32_t raw_len = get32(record + 4), stored_len = get32(record + 8), checksum = get32(record + 12);
+			const int64_t created_ns = (int64_t)get64(record + 16);
+			if (offset + PACK_RECORD_FIXED_LEN > end || sbj_len < 1 || sbj_len > MAX_SBJ_LEN || record[2] != 0 || record[3] != 0 || (flags & ~(PACK_FLAG_LIVE | PACK_FLAG_COMPRESSED)) != 0 || stored_len > raw_len || raw_len > NOTICEBOARD_COLD_MAX_LEN || offset + PACK_RECORD_FIXED_LEN + sbj_len + stored_len > end) {
+				fixture_fail("Record at offset %llu is malformed", (unsigned long long)offset);
+				break;
+			}
+			const uint8_t *const stored = record + PACK_RECORD_FIXED_LEN + sbj_len;
+			if (fnv1a(fnv1a(2166136261u, record + PACK_RECORD_FIXED_LEN, sbj_len), stored, stored_len) != checksum) {
+				fixture_fail("Record at offset %llu has the wrong checksum", (unsigned long long)offset);
+			}
+
+			const uint8_t *body = stored;
+			size_t body_len = stored_len;
+			if (flags & PACK_FLAG_COMPRESSED) {
+				++stats->compressed;
+				if (reference_decompress(stored, stored_len, reference_buf, sizeof(reference_buf), &body_len) != 0) {
+					fixture_fail("Record at offset %llu doesn't decompress", (unsigned long long)offset);
+					body_len = SIZE_MAX;
+				}
+				body = reference_buf;
+			}
+
+			const struct Expect *expect = NULL;
+			for (size_t i = 0; i < count && expect == NULL; ++i) {
+				expect = (expects[i].offset == offset ? &expects[i] : NULL);
+			}
+			if (expect == NULL) {
+				fixture_fail("Record at offset %llu isn't one that was packed", (unsigned long long)offset);
+			} else if (!!(flags & PACK_FLAG_LIVE) != expect->live || sbj_len != strlen(expect->sbj) || memcmp(record + PACK_RECORD_FIXED_LEN, expect->sbj, sbj_len) != 0 || created_ns != expect->created_ns || raw_len != expect->len || body_len != expect->len || memcmp(body, expect->body, expect->len) != 0) {
+				fixture_fail("Record at offset %llu doesn't hold note %s as it was packed", (unsigned long long)offset, expect->sbj);
+			}
+
+			if (flags & PACK_FLAG_LIVE) {
+				++live_found;
+			} else {
+				dead_found += PACK_RECORD_FIXED_LEN + sbj_len + stored_len;
+			}
+			offset += PACK_RECORD_FIXED_LEN + sbj_len + stored_len;
+		}
+
+		dead = get64(pack + 16);
+		if (dead != dead_found || live_found != live) {
+			fixture_fail("Pack counts %llu dead byte(s) & has %lu live record(s), rather than %llu & %lu", (unsigned long long)dead, (unsigned long)live_found, (unsigned long long)dead_found, (unsigned long)live);
+		}
+	}
+	free(pack);
+
+	uint64_t usage_end, usage_dead;
+	if (pack_usage(uid_dir_fd, &usage_end, &usage_dead) != 0 || usage_end != end || usage_dead != dead) {
+		fixture_fail("pack_usage disagrees with the pack's header");
+	}
+
+	struct VisitCtx visit = { .expects = expects, .count = count, .last_offset = 0, .visited = 0 };
+	if (pack_for_each(uid_dir_fd, verify_visit, &visit) != 0 || visit.visited != live) {
+		fixture_fail("pack_for_each visited %lu record(s) of %lu", (unsigned long)visit.visited, (unsigned long)live);
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		const struct Expect *const expect = &expects[i];
+		if (expect->offset == 0) {
+			continue;
+		}
+		uint32_t len = 0;
+		const int ret = pack_read(uid_dir_fd, expect->offset, expect->sbj, read_buf, &len);
+		if (expect->live && (ret != 0 || len != expect->len || memcmp(read_buf, expect->body, expect->len) != 0)) {
+			fixture_fail("pack_read of %s gave %d, %u byte(s) - not the %lu packed", expect->sbj, ret, (unsigned int)len, (unsigned long)expect->len);
+		} else if (!expect->live && ret != 2 && pack != NULL) {
+			fixture_fail("pack_read of dead note %s gave %d", expect->sbj, ret);
+		}
+	}
+}
+
+/**
+ * @brief pack_batch - writes a batch of random notes as plain files & packs them
+ * @param uint64_t *const state - xorshift state
+ * @param const struct Store *const store - store
+ * @param const uid_t uid - owner
+ * @param const int uid_dir_fd - directory handle of the user's notes
+ * @param struct Expect *const expects - notes so far. the batch is added on
+ * @param size_t *const count - number of expects. advanced
+ * @param struct PackStats *const stats - totals
+ */
+static void pack_batch(uint64_t *const state, const struct Store *const store, const uid_t uid, const int uid_dir_fd, struct Expect *const expects, size_t *const count, struct PackStats *const stats)
+{
+	struct PackNote notes[ROUND_NOTES];
+	int packable[ROUND_NOTES];
+	const size_t batch = 1 + fixture_random(state) % ROUND_NOTES;
+	for (size_t i = 0; i < batch; ++i) {
+		struct Expect *const expect = &expects[*count + i];
+		const size_t sbj_len = (size_t)snprintf(expect->sbj, sizeof(expect->sbj), "n%lu_", (unsigned long)(*count + i));
+		for (size_t j = sbj_len, pad = fixture_random(state) % (MAX_SBJ_LEN - sbj_len + 1); pad > 0; --pad, ++j) {
+			expect->sbj[j] = (char)('a' + fixture_random(state) % 26);
+			expect->sbj[j + 1] = '\0';
+		}
+		expect->created_ns = (int64_t)(fixture_random(state) >> 2);
+		expect->len = fixture_len(state, NOTICEBOARD_COLD_MAX_LEN);
+		if (fixture_random(state) % 16 == 0) {
+			expect->len = NOTICEBOARD_COLD_MAX_LEN + 1; /* too long to pack */
+		}
+		expect->body = malloc(expect->len + 1);
+		fixture_body(state, expect->body, expect->len);
+		expect->offset = 0;
+		expect->live = 0;
+
+		const int missing = (fixture_random(state) % 16 == 0);
+		if (!missing && fixture_write_note(store, uid, expect->sbj, expect->body, expect->len) != 0) {
+			fixture_fail("Couldn't write note %s", expect->sbj);
+		}
+		packable[i] = (!missing && expect->len >= 1 && expect->len <= NOTICEBOARD_COLD_MAX_LEN);
+
+		memcpy(notes[i].sbj, expect->sbj, sizeof(notes[i].sbj));
+		notes[i].created_ns = expect->created_ns;
+		notes[i].offset = UINT64_MAX;
+	}
+
+	if (pack_add(uid_dir_fd, notes, batch) != 0) {
+		fixture_fail("pack_add failed");
+	}
+	for (size_t i = 0; i < batch; ++i) {
+		struct Expect *const expect = &expects[*count + i];
+		struct stat statbuf;
+		const int file = (fstatat(uid_dir_fd, expect->sbj, &statbuf, AT_SYMLINK_NOFOLLOW) == 0);
+		if ((notes[i].offset != 0) != packable[i] || (notes[i].offset != 0 && file)) {
+			fixture_fail("pack_add %s note %s of %lu byte(s)%s", (notes[i].offset != 0 ? "packed" : "skipped"), expect->sbj, (unsigned long)expect->len, (file ? ", leaving its file" : ""));
+		}
+		if (file) {
+			unlinkat(uid_dir_fd, expect->sbj, 0);
+		}
+		expect->offset = notes[i].offset;
+		expect->live = (notes[i].offset != 0);
+		stats->packed += (unsigned long long)expect->live;
+	}
+	*count += batch;
+}
+
+/**
+ * @brief round_trip - one round of packing, killing & compacting a user's notes
+ */
+static void round_trip(uint64_t *const state, const struct Store *const store, const uid_t uid, const int uid_dir_fd, struct PackStats *const stats)
+{
+	struct Expect expects[ROUND_NOTES * 2];
+	size_t count = 0;
+
+	pack_batch(state, store, uid, uid_dir_fd, expects, &count, stats);
+	if (fixture_random(state) % 2 == 0) {
+		const int fd = openat(uid_dir_fd, NOTICEBOARD_PACK_NAME, O_WRONLY | O_APPEND | O_CLOEXEC);
+		struct stat statbuf;
+		if (fd != -1 && fstat(fd, &statbuf) == 0 && statbuf.st_size >= PACK_HEADER_LEN) { /* a torn append - past the end, so written over. only ever after a whole header */
+			uint8_t junk[512];
+			const size_t junk_len = 1 + fixture_random(state) % sizeof(junk);
+			fixture_body(state, junk, junk_len);
+			if (write_all(fd, junk, junk_len) != 0) {
+				fixture_fail("Couldn't append to pack");
+			}
+		}
+		if (fd != -1) {
+			close(fd);
+		}
+		pack_batch(state, store, uid, uid_dir_fd, expects, &count, stats);
+	}
+	verify_pack(uid_dir_fd, expects, count, stats);
+
+	for (size_t i = 0; i < count; ++i) {
+		if (expects[i].live && fixture_random(state) % 3 == 0) {
+			if (pack_kill(uid_dir_fd, expects[i].offset) != 0) {
+				fixture_fail("pack_kill of %s failed", expects[i].sbj);
+			}
+			expects[i].live = 0;
+			++stats->killed;
+		}
+	}
+	verify_pack(uid_dir_fd, expects, count, stats);
+
+	uint64_t end, dead;
+	if (fixture_random(state) % 2 == 0 && pack_usage(uid_dir_fd, &end, &dead) == 0 && end != 0) { /* as tier.c, only once there's a pack */
+		struct PackCompaction compaction;
+		if (pack_compact_begin(uid_dir_fd, &compaction) != 0) {
+			fixture_fail("pack_compact_begin failed");
+			goto end;
+		}
+		++stats->compactions;
+
+		uint64_t moved_to[ROUND_NOTES * 2] = {0};
+		for (size_t i = 0; i < count;) {
+			struct PackNote notes[4];
+			size_t which[4];
+			size_t batch = 0;
+			for (const size_t want = 1 + fixture_random(state) % 4; i < count && batch < want; ++i) {
+				if (!expects[i].live) {
+					continue;
+				}
+				memcpy(notes[batch].sbj, expects[i].sbj, sizeof(notes[batch].sbj));
+				notes[batch].created_ns = expects[i].created_ns;
+				notes[batch].offset = expects[i].offset;
+				which[batch++] = i;
+			}
+			if (batch > 0 && pack_compact_copy(&compaction, notes, batch) != 0) {
+				fixture_fail("pack_compact_copy failed");
+				goto end;
+			}
+			for (size_t j = 0; j < batch; ++j) {
+				moved_to[which[j]] = notes[j].offset;
+				if (notes[j].offset == 0) {
+					fixture_fail("pack_compact_copy left %s behind", expects[which[j]].sbj);
+				}
+			}
+
+			for (size_t j = 0; j < i; ++j) { /* removed or unpacked whilst the compaction's under way */
+				if (expects[j].live && moved_to[j] != 0 && fixture_random(state) % 8 == 0) {
+					if (pack_kill(uid_dir_fd, expects[j].offset) != 0 || pack_compact_drop(&compaction, moved_to[j]) != 0) {
+						fixture_fail("Killing %s mid-compaction failed", expects[j].sbj);
+						goto end;
+					}
+					expects[j].live = 0;
+					++stats->dropped;
+				}
+			}
+		}
+
+		if (pack_compact_finish(&compaction) != 0) {
+			fixture_fail("pack_compact_finish failed");
+			goto end;
+		}
+		for (size_t i = 0; i < count; ++i) { /* in the new pack - its copy if it was copied, nothing if not */
+			expects[i].offset = moved_to[i];
+		}
+		verify_pack(uid_dir_fd, expects, count, stats);
+	}
+
+end:
+	for (size_t i = 0; i < count; ++i) {
+		free(expects[i].body);
+	}
+}
+
+/**
+ * @brief put_len - writes a length's extension bytes, if the nibble it's given overflows
+ * @param uint8_t *const buf - filled
+ * @param const size_t value - length
+ * @param const size_t nibble_max - what the nibble holds at most (15) - anything from there on is extended
+ * @return size_t - bytes written
+ */
+static size_t put_len(uint8_t *const buf, const size_t value, const size_t nibble_max)
+{
+	if (value < nibble_max) {
+		return 0;
+	}
+
+	size_t len = 0;
+	for (size_t rem = value - nibble_max;; rem -= 255) {
+		buf[len++] = (uint8_t)(rem < 255 ? rem : 255);
+		if (rem < 255) {
+			return len;
+		}
+	}
+}
+
+/**
+ * @brief hostile_body - makes up a compressed body for hostile
+ * @param uint64_t *const state - xorshift state
+ * @param const int uid_dir_fd - directory handle of a user's notes, for packing a real body to mutate
+ * @param const struct Store *const store - store
+ * @param const uid_t uid - owner
+ * @param size_t *const intended - filled with the length the body was meant to decode to, so the record can claim it - a decoder missing a check then gives exactly what's claimed, rather than being caught out by chance
+ * @return size_t - length of the body, in stored_buf
+ */
+static size_t hostile_body(uint64_t *const state, const int uid_dir_fd, const struct Store *const store, const uid_t uid, size_t *const intended)
+{
+	size_t len = 0;
+	switch (fixture_random(state) % 4) {
+		case 0: /* noise */
+			len = fixture_len(state, 512);
+			for (size_t i = 0; i < len; ++i) {
+				stored_buf[i] = (uint8_t)fixture_random(state);
+			}
+			*intended = fixture_random(state) % 4096;
+			return len;
+		case 1:
+		case 2: { /* sequences built to the format, mostly valid - each with at most one flaw, right at an edge the decoder must check */
+			const int flaw = (int)(fixture_random(state) % 10); /* 0 to 5 - see below. 6 & up - none */
+			const size_t sequences = 1 + fixture_random(state) % 12, flawed = fixture_random(state) % sequences;
+			size_t out = 0, offset_at = 0;
+			for (size_t i = 0; i < sequences; ++i) {
+				const int last = (i + 1 == sequences);
+				size_t literals = (fixture_random(state) % 4 == 0 ? 15 + fixture_random(state) % 600 : fixture_random(state) % 16);
+				if (out == 0 && literals == 0) {
+					literals = 1;
+				}
+				size_t match = (fixture_random(state) % 4 == 0 ? 19 + fixture_random(state) % 4000 : REFERENCE_MIN_MATCH + fixture_random(state) % 15);
+				size_t offset = 1 + fixture_random(state) % (out + literals < 65535 ? out + literals : 65535);
+				if (i == flawed) {
+					switch (flaw) {
+						case 0: /* offset 0 */
+							offset = 0;
+							break;
+						case 1: /* offset reaching back before the output */
+							offset = (out + literals < 65535 ? out + literals + 1 : offset);
+							break;
+						case 2: /* output one past the cap, by a match */
+							if (out + literals < NOTICEBOARD_COLD_MAX_LEN) {
+								match = NOTICEBOARD_COLD_MAX_LEN - out - literals + 1;
+							}
+							break;
+						case 3: /* output exactly at the cap - fine */
+							if (out + literals < NOTICEBOARD_COLD_MAX_LEN - REFERENCE_MIN_MATCH) {
+								match = NOTICEBOARD_COLD_MAX_LEN - out - literals;
+							}
+							break;
+						default:
+							break;
+					}
+				}
+				if (len + literals + match / 255 + 16 > sizeof(stored_buf)) {
+					break;
+				}
+
+				stored_buf[len++] = (uint8_t)(((literals < 15 ? literals : 15) << 4) | (match - REFERENCE_MIN_MATCH < 15 ? match - REFERENCE_MIN_MATCH : 15));
+				len += put_len(stored_buf + len, literals, 15);
+				for (size_t j = 0; j < literals; ++j) {
+					stored_buf[len++] = (uint8_t)fixture_random(state);
+				}
+				out += literals;
+				if (last && !(i == flawed && flaw == 4)) { /* literals only, as the last must be - unless that's the flaw */
+					break;
+				}
+
+				if (i == flawed) {
+					offset_at = len;
+				}
+				stored_buf[len++] = (uint8_t)(offset & 0xFF);
+				stored_buf[len++] = (uint8_t)(offset >> 8);
+				len += put_len(stored_buf + len, match - REFERENCE_MIN_MATCH, 15);
+				out += match;
+			}
+			if (flaw == 5 && len > 0) { /* cut short - anywhere, or part way through an offset */
+				len = (offset_at != 0 && fixture_random(state) % 2 == 0 ? offset_at + 1 : fixture_random(state) % len);
+			}
+			*intended = out;
+			return len;
+		}
+		default: { /* a real compressed body, mutated */
+			uint8_t body[4096];
+			const size_t body_len = 64 + fixture_random(state) % (sizeof(body) - 64);
+			fixture_body(state, body, body_len);
+			struct PackNote note = { .sbj = "real", .created_ns = 0, .offset = 0 };
+			unlinkat(uid_dir_fd, NOTICEBOARD_PACK_NAME, 0);
+			if (fixture_write_note(store, uid, note.sbj, body, body_len) != 0 || pack_add(uid_dir_fd, &note, 1) != 0 || note.offset == 0) {
+				fixture_fail("Couldn't pack a note to mutate");
+				return 0;
+			}
+
+			size_t pack_len;
+			uint8_t *const pack = read_pack(uid_dir_fd, &pack_len);
+			if (pack == NULL) {
+				fixture_fail("Couldn't read back a pack to mutate");
+				return 0;
+			}
+			len = get32(pack + note.offset + 8);
+			*intended = body_len;
+			memcpy(stored_buf, pack + note.offset + PACK_RECORD_FIXED_LEN + strlen(note.sbj), len);
+			free(pack);
+
+			switch (fixture_random(state) % 3) {
+				case 0:
+					for (size_t changes = 1 + fixture_random(state) % 3; changes > 0 && len > 0; --changes) {
+						stored_buf[fixture_random(state) % len] ^= (uint8_t)(1 + fixture_random(state) % 255);
+					}
+					break;
+				case 1:
+					len = (len > 0 ? fixture_random(state) % len : 0);
+					break;
+				default:
+					for (size_t extra = 1 + fixture_random(state) % 8; extra > 0; --extra) {
+						stored_buf[len++] = (uint8_t)fixture_random(state);
+					}
+					break;
+			}
+			return len;
+		}
+	}
+}
+
+/**
+ * @brief hostile - packs one record with a hostile compressed body, & holds pack_read to reference_decompress on it
+ */
+static void hostile(uint64_t *const state, const struct Store *const store, const uid_t uid, const int uid_dir_fd, struct PackStats *const stats)
+{
+	size_t intended = 0;
+	const size_t stored_len = hostile_body(state, uid_dir_fd, store, uid, &intended);
+
+	size_t reference_len = 0;
+	const int reference_ok = (reference_decompress(stored_buf, stored_len, reference_buf, sizeof(reference_buf), &reference_len) == 0);
+	uint32_t raw_len = (uint32_t)(stored_len + fixture_random(state) % (NOTICEBOARD_COLD_MAX_LEN - stored_len + 1));
+	if (fixture_random(state) % 4 != 0 && intended >= stored_len && intended <= NOTICEBOARD_COLD_MAX_LEN) {
+		raw_len = (uint32_t)intended;
+	}
+	const int expect_ok = (reference_ok && raw_len == reference_len && stored_len <= raw_len);
+
+	static uint8_t pack[PACK_HEADER_LEN + PACK_RECORD_FIXED_LEN + MAX_SBJ_LEN + NOTICEBOARD_COLD_MAX_LEN];
+	const size_t pack_len = put_record(pack, PACK_FLAG_LIVE | PACK_FLAG_COMPRESSED, "hostile", raw_len, stored_buf, (uint32_t)stored_len);
+	const int fd = openat(uid_dir_fd, NOTICEBOARD_PACK_NAME, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, STORE_NOTE_PERMISSIONS);
+	if (fd == -1 || write_all(fd, pack, pack_len) != 0) {
+		fixture_fail("Couldn't write hostile pack");
+		if (fd != -1) {
+			close(fd);
+		}
+		return;
+	}
+	close(fd);
+
+	uint32_t len = 0;
+	const int ret = pack_read(uid_dir_fd, PACK_HEADER_LEN, "hostile", read_buf, &len);
+	if (ret == 1 || (ret == 0) != expect_ok) {
+		fixture_fail("pack_read gave %d on a hostile body of %lu byte(s), claiming %u, where the reference decoder %s %lu", ret, (unsigned long)stored_len, (unsigned int)raw_len, (reference_ok ? "decodes" : "refuses at"), (unsigned long)reference_len);
+	} else if (ret == 0 && (len != reference_len || memcmp(read_buf, reference_buf, len) != 0)) {
+		fixture_fail("pack_read decoded a hostile body of %lu byte(s) differently to the reference decoder", (unsigned long)stored_len);
+	}
+
+	if (ret == 0) {
+		++stats->hostile_accepted;
+	} else {
+		++stats->hostile_refused;
+	}
+}
+
+/**
+ * @brief corrupt - damages a pack, then reads it back. one byte of a subject or body must be caught - anything else mustn't be read past
+ */
+static void corrupt(uint64_t *const state, const struct Store *const store, const uid_t uid, const int uid_dir_fd, struct PackStats *const stats)
+{
+	struct Expect expects[CORRUPT_NOTES];
+	struct PackNote notes[CORRUPT_NOTES];
+	const size_t count = 1 + fixture_random(state) % CORRUPT_NOTES;
+	for (size_t i = 0; i < count; ++i) {
+		snprintf(expects[i].sbj, sizeof(expects[i].sbj), "c%lu", (unsigned long)i);
+		expects[i].len = 1 + fixture_random(state) % 3000;
+		expects[i].body = malloc(expects[i].len);
+		fixture_body(state, expects[i].body, expects[i].len);
+		expects[i].created_ns = 0;
+		if (fixture_write_note(store, uid, expects[i].sbj, expects[i].body, expects[i].len) != 0) {
+			fixture_fail("Couldn't write note %s", expects[i].sbj);
+		}
+		memcpy(notes[i].sbj, expects[i].sbj, sizeof(notes[i].sbj));
+		notes[i].created_ns = 0;
+	}
+	if (pack_add(uid_dir_fd, notes, count) != 0) {
+		fixture_fail("pack_add failed");
+		goto end;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		expects[i].offset = notes[i].offset;
+	}
+	++stats->corrupted;
+
+	const int fd = openat(uid_dir_fd, NOTICEBOARD_PACK_NAME, O_RDWR | O_CLOEXEC);
+	struct stat statbuf;
+	if (fd == -1 || fstat(fd, &statbuf) != 0) {
+		fixture_fail("Couldn't open pack to corrupt");
+		if (fd != -1) {
+			close(fd);
+		}
+		goto end;
+	}
+
+	if (fixture_random(state) % 2 == 0) { /* one byte of one subject or body - always caught */
+		const size_t victim = fixture_random(state) % count;
+		uint8_t fixed[PACK_RECORD_FIXED_LEN];
+		if (pread_all(fd, fixed, sizeof(fixed), expects[victim].offset) != 0) {
+			fixture_fail("Couldn't read record to corrupt");
+		} else {
+			const uint64_t at = expects[victim].offset + PACK_RECORD_FIXED_LEN + fixture_random(state) % (fixed[1] + get32(fixed + 8));
+			uint8_t byte;
+			if (pread_all(fd, &byte, 1, at) == 0) {
+				byte ^= (uint8_t)(1 + fixture_random(state) % 255);
+				pwrite_all(fd, &byte, 1, at);
+			}
+		}
+		close(fd);
+
+		for (size_t i = 0; i < count; ++i) {
+			uint32_t len = 0;
+			const int ret = pack_read(uid_dir_fd, expects[i].offset, expects[i].sbj, read_buf, &len);
+			if (i == victim ? ret != 2 : (ret != 0 || len != expects[i].len || memcmp(read_buf, expects[i].body, len) != 0)) {
+				fixture_fail("pack_read of %s gave %d after a byte of %s was changed", expects[i].sbj, ret, expects[victim].sbj);
+			}
+		}
+	} else { /* anything - header, fixed fields, or cut short */
+		if (fixture_random(state) % 4 == 0) {
+			if (ftruncate(fd, (off_t)(fixture_random(state) % (uint64_t)statbuf.st_size)) != 0) {
+				fixture_fail("Couldn't truncate pack");
+			}
+		} else {
+			for (size_t changes = 1 + fixture_random(state) % 8; changes > 0; --changes) {
+				const uint64_t at = (fixture_random(state) % 2 == 0 ? fixture_random(state) % (PACK_HEADER_LEN + PACK_RECORD_FIXED_LEN) : fixture_random(state) % (uint64_t)statbuf.st_size);
+				const uint8_t byte = (uint8_t)fixture_random(state);
+				pwrite_all(fd, &byte, 1, at);
+			}
+		}
+		close(fd);
+
+		uint64_t end, dead;
+		pack_usage(uid_dir_fd, &end, &dead);
+		size_t visited = 0;
+		pack_for_each(uid_dir_fd, count_visit, &visited);
+		for (size_t i = 0; i < count; ++i) {
+			uint32_t len = 0;
+			if (pack_read(uid_dir_fd, expects[i].offset, expects[i].sbj, read_buf, &len) == 0 && len > NOTICEBOARD_COLD_MAX_LEN) {
+				fixture_fail("pack_read of damaged %s claimed %u byte(s)", expects[i].sbj, (unsigned int)len);
+			}
+		}
+
+		struct Expect added = { .sbj = "after", .created_ns = 1, .len = 1 + fixture_random(state) % 2000, .live = 1 };
+		added.body = malloc(added.len);
+		fixture_body(state, added.body, added.len);
+		struct PackNote note = { .sbj = "after", .created_ns = 1, .offset = 0 };
+		if (fixture_write_note(store, uid, note.sbj, added.body, added.len) != 0) {
+			fixture_fail("Couldn't write note after");
+		} else if (pack_add(uid_dir_fd, &note, 1) == 0 && note.offset != 0) { /* refusing a damaged pack is fine - losing what's added to it isn't */
+			uint32_t len = 0;
+			const int ret = pack_read(uid_dir_fd, note.offset, note.sbj, read_buf, &len);
+			if (ret != 0 || len != added.len || memcmp(read_buf, added.body, len) != 0) {
+				fixture_fail("Note added to a damaged pack read back as %d, %u byte(s)", ret, (unsigned int)len);
+			}
+		}
+		unlinkat(uid_dir_fd, note.sbj, 0);
+		free(added.body);
+	}
+
+end:
+	for (size_t i = 0; i < count; ++i) {
+		unlinkat(uid_dir_fd, expects[i].sbj, 0);
+		free(expects[i].body);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned long long count = (argc > 1 ? strtoull(argv[1], NULL, 10) : 2000);
+	uint64_t state = (argc > 2 ? strtoull(argv[2], NULL, 10) : 1);
+	if (state == 0) {
+		state = 1;
+	}
+
+	struct FixtureStore fixture;
+	if (fixture_quiet() != 0 || fixture_store_open(&fixture) != 0) {
+		return 3;
+	}
+
+	struct PackStats stats;
+	memset(&stats, '\0', sizeof(stats));
+	for (unsigned long long n = 0; n < count; ++n) {
+		const uid_t uid = (uid_t)(n % 16);
+		const int uid_dir_fd = store_uid_dir(&fixture.store, uid, 1);
+		if (uid_dir_fd == -1) {
+			fixture_fail("Couldn't open notes directory of uid %u", (unsigned int)uid);
+			break;
+		}
+		unlinkat(uid_dir_fd, NOTICEBOARD_PACK_NAME, 0); /* every round starts with no pack */
+
+		switch (n % 4) {
+			case 0:
+			case 1:
+				round_trip(&state, &fixture.store, uid, uid_dir_fd, &stats);
+				break;
+			case 2:
+				hostile(&state, &fixture.store, uid, uid_dir_fd, &stats);
+				break;
+			default:
+				corrupt(&state, &fixture.store, uid, uid_dir_fd, &stats);
+				break;
+		}
+		close(uid_dir_fd);
+	}
+	fixture_store_close(&fixture);
+
+	return fixture_finish("%llu round(s): %llu note(s) packed, %llu compressed record(s) checked, %llu killed, %llu compaction(s) (%llu copies dropped), %llu hostile bodies accepted & %llu refused, %llu pack(s) damaged", count, stats.packed, stats.compressed, stats.killed, stats.compactions, stats.dropped, stats.hostile_accepted, stats.hostile_refused, stats.corrupted);
+}
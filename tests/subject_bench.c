@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "subject_reference.h"
+
+/**
+ * @brief Subject microbenchmark, ran by `make bench`
+ * Times request_sanitise_subject & subject_check's SSE2 & byte loop builds over the same pool of valid random subjects (1 to MAX_SBJ_LEN bytes), printing the best of BENCH_ROUNDS rounds in ns per check
+ * Each check includes copying the subject into a MAX_SBJ_LEN buffer, as request_decode does before checking it
+ * Usage: subject_bench [CHECKS] - 4000000 checks a round by default
+ */
+
+#define BENCH_POOL 4096 /* distinct subjects, cycled through. a power of 2 */
+#define BENCH_ROUNDS 5
+
+/**
+ * @brief BenchSubject (struct) - one subject of the pool
+ */
+struct BenchSubject {
+	uint8_t sbj[MAX_SBJ_LEN];
+
+	size_t len;
+};
+
+static volatile size_t bench_sink; /* keeps the checks' results alive */
+
+/**
+ * @brief bench_now - monotonic clock
+ * @return int64_t - nanoseconds
+ */
+static int64_t bench_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief bench_old - times request_sanitise_subject
+ * @param const struct BenchSubject *const pool - BENCH_POOL subjects
+ * @param const unsigned long checks - how many checks to time
+ * @return int64_t - nanoseconds taken
+ */
+static int64_t bench_old(const struct BenchSubject *const pool, const unsigned long checks)
+{
+	struct Request request;
+	memset(&request, 0, sizeof(request));
+	size_t sink = 0;
+
+	const int64_t start = bench_now();
+	for (unsigned long n = 0; n < checks; ++n) {
+		const struct BenchSubject *const subject = &pool[n & (BENCH_POOL - 1)];
+		memcpy(request.sbj_content, subject->sbj, subject->len);
+		request.sbj_len = (uint32_t)subject->len;
+		if (request_sanitise_subject(&request) == 0) {
+			sink += request.sbj_len;
+		}
+	}
+	const int64_t taken = bench_now() - start;
+
+	bench_sink = sink;
+	return taken;
+}
+
+/**
+ * @brief bench_check - times one build of subject_check
+ * @param int (*const check)(const uint8_t *const, const size_t, size_t *const, size_t *const) - subject_check_sse2 or subject_check_scalar
+ * @param const struct BenchSubject *const pool - BENCH_POOL subjects
+ * @param const unsigned long checks - how many checks to time
+ * @return int64_t - nanoseconds taken
+ */
+static int64_t bench_check(int (*const check)(const uint8_t *const, const size_t, size_t *const, size_t *const), const struct BenchSubject *const pool, const unsigned long checks)
+{
+	uint8_t buffer[MAX_SBJ_LEN];
+	size_t sink = 0;
+
+	const int64_t start = bench_now();
+	for (unsigned long n = 0; n < checks; ++n) {
+		const struct BenchSubject *const subject = &pool[n & (BENCH_POOL - 1)];
+		memcpy(buffer, subject->sbj, subject->len);
+		size_t offset;
+		size_t len;
+		if (check(buffer, subject->len, &offset, &len) == 0) {
+			sink += offset + len;
+		}
+	}
+	const int64_t taken = bench_now() - start;
+
+	bench_sink = sink;
+	return taken;
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned long checks = (argc > 1 ? strtoul(argv[1], NULL, 10) : 4000000);
+	if (checks == 0) {
+		fprintf(stderr, "Number of checks must be at least 1\n");
+		return 2;
+	}
+
+	static struct BenchSubject pool[BENCH_POOL];
+	uint64_t state = 1;
+	for (size_t i = 0; i < BENCH_POOL; ++i) {
+		subject_random(&state, pool[i].sbj, &pool[i].len, 0);
+	}
+
+	int64_t best[3] = {INT64_MAX, INT64_MAX, INT64_MAX};
+	for (int round = 0; round < BENCH_ROUNDS; ++round) {
+		const int64_t taken[3] = {bench_old(pool, checks), bench_check(subject_check_sse2, pool, checks), bench_check(subject_check_scalar, pool, checks)};
+		for (int i = 0; i < 3; ++i) {
+			if (taken[i] < best[i]) {
+				best[i] = taken[i];
+			}
+		}
+	}
+
+	printf("request_sanitise_subject  %6.1f ns/check\n", (double)best[0] / (double)checks);
+	printf("subject_check (SSE2)      %6.1f ns/check\n", (double)best[1] / (double)checks);
+	printf("subject_check (scalar)    %6.1f ns/check\n", (double)best[2] / (double)checks);
+
+	return 0;
+}
@@ -0,0 +1,167 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "subject_reference.h"
+
+/**
+ * @brief Subject fuzz test, ran by `make check`
+ * Holds subject_check's SSE2 & byte loop builds against each other & against request_sanitise_subject on random subjects. the builds must agree exactly. against the old check, only two differences are allowed, both deliberate:
+ * - a subject with nothing left once trimmed (only whitespace, or whitespace up to a NULL) is refused, where it was accepted as an empty filename
+ * - a full length subject with leading whitespace is cut where it ends, where the old shift left stale bytes at its tail
+ * Usage: subject_fuzz [COUNT [SEED]] - 1000000 subjects from seed 1 by default. exits non-zero on any mismatch
+ */
+
+#define FUZZ_REPORT_MAX 10 /* mismatches printed before the rest are only counted */
+
+/**
+ * @brief FuzzResult (struct) - what one check made of a subject
+ */
+struct FuzzResult {
+	int ret;
+
+	const uint8_t *sbj; /* subject once trimmed. only set when ret is zero */
+
+	size_t len;
+};
+
+/**
+ * @brief fuzz_report - prints a mismatch, with the subject in hex
+ * @param const char *const what - which comparison failed
+ * @param const uint8_t *const sbj - subject as given
+ * @param const size_t sbj_len - length of sbj
+ * @param const struct FuzzResult *const a - first result
+ * @param const struct FuzzResult *const b - second result
+ */
+static void fuzz_report(const char *const what, const uint8_t *const sbj, const size_t sbj_len, const struct FuzzResult *const a, const struct FuzzResult *const b)
+{
+	printf("Mismatch (%s) on subject of %lu byte(s):", what, (unsigned long)sbj_len);
+	for (size_t i = 0; i < sbj_len; ++i) {
+		printf(" %02x", sbj[i]);
+	}
+	printf("\n    %d, length %lu against %d, length %lu\n", a->ret, (unsigned long)a->len, b->ret, (unsigned long)b->len);
+}
+
+/**
+ * @brief fuzz_old_agrees - checks subject_check's result against request_sanitise_subject's, allowing for the two deliberate differences
+ * @param const struct FuzzResult *const now - subject_check's result
+ * @param const struct FuzzResult *const old - request_sanitise_subject's result
+ * @param const size_t sbj_len - length of the subject as given
+ * @param int *const deliberate - set to 1 if they differed in one of the allowed ways
+ * @return int - Boolean. 1 if they agree, 0 if not
+ */
+static int fuzz_old_agrees(const struct FuzzResult *const now, const struct FuzzResult *const old, const size_t sbj_len, int *const deliberate)
+{
+	*deliberate = 0;
+
+	if (old->ret != 0) { /* both refuse - the old check had no code of its own for nothing left once trimmed */
+		return (now->ret != 0);
+	}
+
+	if (old->len == 0) {
+		*deliberate = 1;
+		return (now->ret == 3);
+	}
+
+	if (now->ret != 0) {
+		return 0;
+	}
+
+	if (now->len == old->len) {
+		return (memcmp(now->sbj, old->sbj, now->len) == 0);
+	}
+
+	*deliberate = 1;
+	return (sbj_len == MAX_SBJ_LEN && old->len == MAX_SBJ_LEN && now->len < old->len && memcmp(now->sbj, old->sbj, now->len) == 0);
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned long long count = (argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000);
+	uint64_t state = (argc > 2 ? strtoull(argv[2], NULL, 10) : 1);
+	if (state == 0) {
+		state = 1;
+	}
+
+	if (freopen("/dev/null", "w", stderr) == NULL) { /* every refusal is logged - not wanted millions of times */
+		perror("freopen");
+		return 3;
+	}
+
+	static const uint32_t densities[] = {0, 2, 4, 16, 64};
+	unsigned long long accepted = 0;
+	unsigned long long refused = 0;
+	unsigned long long deliberate = 0;
+	unsigned long long mismatches = 0;
+
+	for (unsigned long long n = 0; n < count + 2; ++n) {
+		uint8_t sbj[MAX_SBJ_LEN + 1];
+		size_t sbj_len;
+		if (n < 2) { /* both lengths just out of range */
+			memset(sbj, 'a', sizeof(sbj));
+			sbj_len = (n == 0 ? 0 : MAX_SBJ_LEN + 1);
+		} else {
+			subject_random(&state, sbj, &sbj_len, densities[n % (sizeof(densities) / sizeof(densities[0]))]);
+		}
+
+		struct FuzzResult sse2 = {0};
+		size_t offset = 0;
+		sse2.ret = subject_check_sse2(sbj, sbj_len, &offset, &sse2.len);
+		sse2.sbj = sbj + offset;
+		struct FuzzResult scalar = {0};
+		scalar.ret = subject_check_scalar(sbj, sbj_len, &offset, &scalar.len);
+		scalar.sbj = sbj + offset;
+		if (sse2.ret != 0) {
+			sse2.len = 0;
+			sse2.sbj = NULL;
+		}
+		if (scalar.ret != 0) {
+			scalar.len = 0;
+			scalar.sbj = NULL;
+		}
+
+		struct Request request; /* as request_decode filled it in - a zeroed request, the subject copied in */
+		memset(&request, 0, sizeof(request));
+		struct FuzzResult old = {0};
+		if (sbj_len < 1 || sbj_len > MAX_SBJ_LEN) { /* refused before sanitising */
+			old.ret = 1;
+		} else {
+			memcpy(request.sbj_content, sbj, sbj_len);
+			request.sbj_len = (uint32_t)sbj_len;
+			old.ret = request_sanitise_subject(&request);
+			if (old.ret == 0) {
+				old.sbj = request.sbj_content;
+				old.len = request.sbj_len;
+			}
+		}
+
+		int differed = 0;
+		const char *failed = NULL;
+		const struct FuzzResult *against = NULL;
+		if (sse2.ret != scalar.ret || sse2.len != scalar.len || sse2.sbj != scalar.sbj) {
+			failed = "SSE2 against scalar";
+			against = &scalar;
+		} else if (!fuzz_old_agrees(&sse2, &old, sbj_len, &differed)) {
+			failed = "against request_sanitise_subject";
+			against = &old;
+		}
+
+		if (failed != NULL) {
+			if (mismatches < FUZZ_REPORT_MAX) {
+				fuzz_report(failed, sbj, sbj_len, &sse2, against);
+			}
+			++mismatches;
+		}
+		deliberate += (unsigned long long)differed;
+		if (sse2.ret == 0) {
+			++accepted;
+		} else {
+			++refused;
+		}
+	}
+
+	printf("%llu subject(s): %llu accepted, %llu refused, %llu deliberately unlike request_sanitise_subject, %llu mismatch(es)\n", count + 2, accepted, refused, deliberate, mismatches);
+
+	return (mismatches != 0);
+}
@@ -0,0 +1,87 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "subject_reference.h"
+
+/**
+ * @brief Definitions shared by the subject fuzz test & microbenchmark
+ */
+
+int request_sanitise_subject(struct Request *const client_request)
+{
+	for (size_t i = 0; i < client_request->sbj_len; ++i) { /* sanitise input - subject forms filename plus generally has expectation to be reasonable */
+		const char current_chr = client_request->sbj_content[i];
+		switch (current_chr) {
+			case ';':
+			case '/':
+			case '.':
+			case '\\':
+				fprintf(stderr, "Subject content field contains '%c', which is an invalid character\n", current_chr);
+				return 2;
+		}
+	}
+
+	size_t last_initial_whitespace; /* records where the last whitespace is */
+	for (last_initial_whitespace = 0; last_initial_whitespace < client_request->sbj_len; ++last_initial_whitespace) {
+		const char current_chr = client_request->sbj_content[last_initial_whitespace];
+		if (current_chr != '\t' && current_chr != '\n' && current_chr != ' ' && current_chr != '\r') {
+			break;
+		}
+	}
+
+	if (last_initial_whitespace >= MAX_SBJ_LEN) { /* we need at least one valid character to form a sbj / filename */
+		fprintf(stderr, "Subject must consist of one valid character excluding preceeding whitespace\n");
+		return 2;
+	} else if (last_initial_whitespace > 0) {
+		memmove(client_request->sbj_content, client_request->sbj_content + last_initial_whitespace, MAX_SBJ_LEN - last_initial_whitespace); /* memcpy as it was, but the two overlap - memmove is what it meant */
+	}
+
+	uint8_t *const end_of_sbj = memchr(client_request->sbj_content, '\0', MAX_SBJ_LEN); /* we need to make sure that, if the null terminator was passed in with client_request.sbj_content, that we account for its length to the byte prior */
+	if (end_of_sbj != NULL) {
+		client_request->sbj_len = end_of_sbj - client_request->sbj_content;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief random_next - steps a xorshift64 generator
+ * @param uint64_t *const state - generator state. never zero
+ * @return uint64_t - next value
+ */
+static uint64_t random_next(uint64_t *const state)
+{
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+
+	return x;
+}
+
+void subject_random(uint64_t *const state, uint8_t *const sbj, size_t *const sbj_len, const uint32_t special_one_in)
+{
+	static const char plain[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-";
+	static const char special[] = " \t\n\r;/.\\"; /* plus NULL */
+	static const char space[] = " \t\n\r";
+
+	*sbj_len = 1 + random_next(state) % MAX_SBJ_LEN;
+	for (size_t i = 0; i < *sbj_len; ++i) {
+		const uint64_t pick = random_next(state);
+		if (special_one_in != 0 && pick % special_one_in == 0) {
+			const size_t which = (pick >> 32) % sizeof(special); /* sizeof counts the NULL */
+			sbj[i] = (uint8_t)special[which];
+		} else {
+			sbj[i] = (uint8_t)plain[(pick >> 32) % (sizeof(plain) - 1)];
+		}
+	}
+
+	if (special_one_in != 0 && random_next(state) % 4 == 0) {
+		const size_t leading = random_next(state) % (*sbj_len + 1);
+		for (size_t i = 0; i < leading; ++i) {
+			sbj[i] = (uint8_t)space[random_next(state) % (sizeof(space) - 1)];
+		}
+	}
+}
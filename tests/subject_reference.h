@@ -0,0 +1,38 @@
+#ifndef SUBJECT_REFERENCE_H
+#define SUBJECT_REFERENCE_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "request.h"
+
+/**
+ * @brief Declarations shared by the subject fuzz test & microbenchmark
+ * - subject_check is built twice for them - once as the build targets it (SSE2 on x86-64) & once with __SSE2__ undefined (the byte loop) - under the names below
+ * - request_sanitise_subject is the byte-at-a-time check subject_check replaced, kept as it was (bar its overlapping memcpy, now a memmove) so both can be held against it
+ */
+
+int subject_check_sse2(const uint8_t *const sbj, const size_t sbj_len, size_t *const offset, size_t *const len);
+
+int subject_check_scalar(const uint8_t *const sbj, const size_t sbj_len, size_t *const offset, size_t *const len);
+
+/**
+ * @brief request_sanitise_subject - validates & normalises a received subject in place, as the server did before subject_check
+ * subject forms a filename so path characters are refused, leading whitespace is stripped and the length is cut at any NULL terminator
+ * @param struct Request *const client_request - request with sbj_len & sbj_content filled in
+ * @return int - zero is success, non-zero is failure
+ * 2 is invalid subject
+ */
+int request_sanitise_subject(struct Request *const client_request);
+
+/**
+ * @brief subject_random - fills in a random subject, 1 to MAX_SBJ_LEN bytes long
+ * @param uint64_t *const state - xorshift state. any non-zero value to start
+ * @param uint8_t *const sbj - filled with the subject. at least MAX_SBJ_LEN bytes
+ * @param size_t *const sbj_len - filled with its length
+ * @param const uint32_t special_one_in - roughly 1 in how many bytes are whitespace, NULL or a refused character (& 1 in 4 subjects get a leading run of whitespace). 0 for a plain subject that's always valid
+ */
+void subject_random(uint64_t *const state, uint8_t *const sbj, size_t *const sbj_len, const uint32_t special_one_in);
+
+#endif /* SUBJECT_REFERENCE_H */
@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "constraints.h"
+#include "store.h"
+#include "index.h"
+#include "pack.h"
+#include "tier.h"
+#include "util.h"
+#include "fixture.h"
+
+/**
+ * @brief Tier fuzz test, ran by `make check`
+ * - a few users' notes are added, read whole & in ranges, appended to & removed at random, through tier_read, tier_offer, tier_unpack, tier_remove_packed & tier_forget just as client_handling drives them - while the clock jumps ahead & the packer runs, packing idle notes & compacting packs once they're mostly removed notes
+ * - every read must give back exactly what a plain model of the notes holds - whether it's served hot, warm or cold - & every read that's left to the file (tier_read's 1) must only be of a note that isn't packed
+ * - every so often (& at the end) the index must hold exactly the model's notes, each a plain file holding its body or packed (with no file) in a record holding it - & every live record in a pack must be one the index points at
+ * Built against a tier.c with a small arena, batches & passes (see the Makefile), so the hot tier evicts & compactions take several passes
+ * Usage: tier_fuzz [COUNT [SEED]] - 20000 steps from seed 1 by default. exits non-zero on any failure
+ */
+
+#define FUZZ_UIDS 4
+#define FUZZ_NOTES 48 /* per user */
+#define FUZZ_MAX_LEN (NOTICEBOARD_COLD_MAX_LEN + 4096) /* a few notes grow past what's ever packed */
+#define VERIFY_EVERY 64
+#define NS_PER_S 1000000000ll
+
+/**
+ * @brief ModelNote (struct) - a note as the test believes it is
+ */
+struct ModelNote {
+	uint8_t *body; /* FUZZ_MAX_LEN bytes */
+
+	size_t len;
+
+	int live; /* boolean. the note exists */
+};
+
+/**
+ * @brief TierTotals (struct) - running totals, for the summary
+ */
+struct TierTotals {
+	unsigned long long reads, file_reads, appends, removes, packer_passes, compactions;
+};
+
+static struct ModelNote model[FUZZ_UIDS][FUZZ_NOTES];
+static uint8_t read_buf[MAX_EXTRA_DATA_LEN];
+static uint8_t file_buf[FUZZ_MAX_LEN];
+
+/**
+ * @brief note_sbj - subject of the model's nth note
+ */
+static void note_sbj(const size_t n, char *const sbj)
+{
+	snprintf(sbj, MAX_SBJ_LEN + 1, "note_%lu", (unsigned long)n);
+}
+
+/**
+ * @brief read_file - reads part of a note's plain file, as execute_request would
+ * @return int - zero is success, non-zero is failure
+ */
+static int read_file(const struct Store *const store, const uid_t uid, const char *const sbj, const uint64_t offset, const uint32_t length, uint8_t *const buf, uint32_t *const len)
+{
+	const int uid_dir_fd = store_uid_dir(store, uid, 0);
+	const int note_fd = (uid_dir_fd == -1 ? -1 : openat(uid_dir_fd, sbj, O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+	if (uid_dir_fd != -1) {
+		close(uid_dir_fd);
+	}
+	struct stat statbuf;
+	if (note_fd == -1 || fstat(note_fd, &statbuf) != 0) {
+		if (note_fd != -1) {
+			close(note_fd);
+		}
+		return 1;
+	}
+
+	const uint64_t size = (uint64_t)statbuf.st_size;
+	*len = (offset >= size ? 0 : (size - offset < length ? (uint32_t)(size - offset) : length));
+	const int ret = (*len > 0 ? pread_all(note_fd, buf, *len, offset) : 0);
+	close(note_fd);
+
+	return ret;
+}
+
+/**
+ * @brief check_read - a read's result against the model
+ */
+static void check_read(const struct ModelNote *const note, const uid_t uid, const char *const sbj, const uint64_t offset, const uint32_t length, const uint8_t *const buf, const uint32_t len, const char *const how)
+{
+	const size_t expect = (offset >= note->len ? 0 : (note->len - offset < length ? note->len - offset : length));
+	if (len != expect || (len > 0 && memcmp(buf, note->body + offset, len) != 0)) {
+		fixture_fail("Reading %u byte(s) at %llu of %u/%s (%lu long) %s gave %u byte(s)%s", (unsigned int)length, (unsigned long long)offset, (unsigned int)uid, sbj, (unsigned long)note->len, how, (unsigned int)len, (len == expect ? " - the wrong ones" : ""));
+	}
+}
+
+/**
+ * @brief do_read - a GET or GET_RANGE, as client_handling serves one
+ */
+static void do_read(uint64_t *const state, const struct Store *const store, const uid_t uid, const char *const sbj, const struct ModelNote *const note, const int64_t now_ns, struct TierTotals *const totals)
+{
+	const int range = (fixture_random(state) % 2 == 0);
+	uint64_t offset = 0;
+	uint32_t length = MAX_EXTRA_DATA_LEN;
+	if (range) {
+		offset = (fixture_random(state) % 8 == 0 ? note->len + fixture_random(state) % 100 : fixture_random(state) % (note->len + 1));
+		length = 1 + (uint32_t)(fixture_random(state) % MAX_EXTRA_DATA_LEN);
+	}
+	++totals->reads;
+
+	uint32_t len = 0;
+	const int served = tier_read(store->tiers, store, uid, sbj, offset, length, read_buf, &len, now_ns);
+	if (served == 0) {
+		check_read(note, uid, sbj, offset, length, read_buf, len, "hot or cold");
+		return;
+	} else if (served != 1) {
+		fixture_fail("tier_read of %u/%s gave %d", (unsigned int)uid, sbj, served);
+		return;
+	}
+
+	const struct IndexEntry *const entry = index_find(store->index, uid, sbj);
+	if (entry != NULL && entry->pack_offset != 0) {
+		fixture_fail("tier_read left packed note %u/%s to be read from its file", (unsigned int)uid, sbj);
+		return;
+	}
+	++totals->file_reads;
+	if (read_file(store, uid, sbj, offset, length, read_buf, &len) != 0) {
+		fixture_fail("Couldn't read warm note %u/%s from its file", (unsigned int)uid, sbj);
+		return;
+	}
+	check_read(note, uid, sbj, offset, length, read_buf, len, "from its file");
+
+	if (!range) {
+		tier_offer(store->tiers, store, uid, sbj, read_buf, len);
+	}
+}
+
+/**
+ * @brief do_append - an APPEND, as client_handling serves one - a packed note's unpacked first
+ */
+static void do_append(uint64_t *const state, const struct Store *const store, const uid_t uid, const char *const sbj, struct ModelNote *const note, struct TierTotals *const totals)
+{
+	const size_t extra = (note->len < FUZZ_MAX_LEN ? 1 + fixture_random(state) % (FUZZ_MAX_LEN - note->len < 3000 ? FUZZ_MAX_LEN - note->len : 3000) : 0);
+	if (extra == 0) {
+		return;
+	}
+
+	const int uid_dir_fd = store_uid_dir(store, uid, 0);
+	if (uid_dir_fd == -1 || tier_unpack(store->tiers, store, uid_dir_fd, uid, sbj) != 0) {
+		fixture_fail("Couldn't unpack %u/%s to append to it", (unsigned int)uid, sbj);
+		if (uid_dir_fd != -1) {
+			close(uid_dir_fd);
+		}
+		return;
+	}
+
+	fixture_body(state, note->body + note->len, extra);
+	const int note_fd = openat(uid_dir_fd, sbj, O_WRONLY | O_APPEND | O_NOFOLLOW | O_CLOEXEC);
+	close(uid_dir_fd);
+	if (note_fd == -1 || write_all(note_fd, note->body + note->len, extra) != 0) {
+		fixture_fail("Couldn't append to %u/%s - %s", (unsigned int)uid, sbj, (note_fd == -1 ? "it has no file once unpacked" : "error writing"));
+		if (note_fd != -1) {
+			close(note_fd);
+		}
+		return;
+	}
+	close(note_fd);
+	note->len += extra;
+	++totals->appends;
+
+	const struct IndexEntry *const entry = index_find(store->index, uid, sbj);
+	if (entry == NULL) {
+		fixture_fail("Index lost %u/%s", (unsigned int)uid, sbj);
+		return;
+	}
+	index_insert(store->index, uid, sbj, (uint32_t)note->len, entry->created_ns, entry->expires_ns);
+	tier_forget(store->tiers, uid, sbj);
+}
+
+/**
+ * @brief do_remove - a REMOVE, as client_handling serves one
+ */
+static void do_remove(const struct Store *const store, const uid_t uid, const char *const sbj, struct ModelNote *const note, struct TierTotals *const totals)
+{
+	const int uid_dir_fd = store_uid_dir(store, uid, 0);
+	const struct IndexEntry *const entry = index_find(store->index, uid, sbj);
+	if (uid_dir_fd == -1 || entry == NULL) {
+		fixture_fail("Couldn't find %u/%s to remove it", (unsigned int)uid, sbj);
+	} else if (entry->pack_offset != 0) {
+		if (tier_remove_packed(store->tiers, store, uid_dir_fd, uid, sbj) != 0) {
+			fixture_fail("tier_remove_packed of %u/%s failed", (unsigned int)uid, sbj);
+		}
+	} else {
+		if (unlinkat(uid_dir_fd, sbj, 0) != 0) {
+			fixture_fail("Warm note %u/%s has no file to remove", (unsigned int)uid, sbj);
+		}
+		index_remove(store->index, uid, sbj);
+		tier_forget(store->tiers, uid, sbj);
+	}
+	if (uid_dir_fd != -1) {
+		close(uid_dir_fd);
+	}
+
+	note->live = 0;
+	++totals->removes;
+}
+
+/**
+ * @brief PackCheck (struct) - what check_record checks a user's pack against
+ */
+struct PackCheck {
+	const struct Index *index;
+
+	uid_t uid;
+};
+
+/**
+ * @brief check_record - pack_visitor. every live record must be the one its note's indexed at - a note removed or unpacked mustn't linger in its pack, to come back in an export
+ */
+static int check_record(const struct PackRecord *const record, void *const ctx)
+{
+	const struct PackCheck *const check = ctx;
+	const struct IndexEntry *const entry = index_find(check->index, check->uid, record->sbj);
+	if (entry == NULL || entry->pack_offset != record->offset) {
+		fixture_fail("Pack of uid %u has a live record of %s at %llu, which the index %s", (unsigned int)check->uid, record->sbj, (unsigned long long)record->offset, (entry == NULL ? "doesn't hold" : "has elsewhere"));
+	}
+
+	return 0;
+}
+
+/**
+ * @brief verify - the index & store must hold exactly the model's notes, each as a plain file or a packed record
+ */
+static void verify(const struct Store *const store)
+{
+	for (uid_t uid = 0; uid < FUZZ_UIDS; ++uid) {
+		const int uid_dir_fd = store_uid_dir(store, uid, 0);
+		size_t live = 0;
+		for (size_t n = 0; n < FUZZ_NOTES; ++n) {
+			const struct ModelNote *const note = &model[uid][n];
+			char sbj[MAX_SBJ_LEN + 1];
+			note_sbj(n, sbj);
+			const struct IndexEntry *const entry = index_find(store->index, uid, sbj);
+			struct stat statbuf;
+			const int file = (uid_dir_fd != -1 && fstatat(uid_dir_fd, sbj, &statbuf, AT_SYMLINK_NOFOLLOW) == 0);
+			if (!note->live) {
+				if (entry != NULL || file) {
+					fixture_fail("Removed note %u/%s is still %s", (unsigned int)uid, sbj, (entry != NULL ? "indexed" : "a file"));
+				}
+				continue;
+			}
+			++live;
+
+			uint32_t len = 0;
+			if (entry == NULL || entry->size != note->len) {
+				fixture_fail("Note %u/%s is %s, rather than %lu long", (unsigned int)uid, sbj, (entry == NULL ? "not indexed" : "indexed as the wrong length"), (unsigned long)note->len);
+			} else if (entry->pack_offset != 0) {
+				if (file) {
+					fixture_fail("Packed note %u/%s still has a file", (unsigned int)uid, sbj);
+				}
+				if (pack_read(uid_dir_fd, entry->pack_offset, sbj, file_buf, &len) != 0 || len != note->len || memcmp(file_buf, note->body, len) != 0) {
+					fixture_fail("Packed note %u/%s doesn't read back from its record", (unsigned int)uid, sbj);
+				}
+			} else if (read_file(store, uid, sbj, 0, (uint32_t)FUZZ_MAX_LEN, file_buf, &len) != 0 || len != note->len || memcmp(file_buf, note->body, len) != 0) {
+				fixture_fail("Warm note %u/%s doesn't read back from its file", (unsigned int)uid, sbj);
+			}
+		}
+
+		size_t indexed = 0;
+		char after[MAX_SBJ_LEN];
+		size_t after_len = 0;
+		for (const struct IndexEntry *entry; (entry = index_next(store->index, uid, after, after_len)) != NULL && entry->uid == uid; ++indexed) {
+			memcpy(after, entry->sbj, entry->sbj_len);
+			after_len = entry->sbj_len;
+		}
+		if (indexed != live) {
+			fixture_fail("Index holds %lu note(s) of uid %u, rather than %lu", (unsigned long)indexed, (unsigned int)uid, (unsigned long)live);
+		}
+
+		struct PackCheck check = { .index = store->index, .uid = uid };
+		if (uid_dir_fd != -1 && pack_for_each(uid_dir_fd, check_record, &check) != 0) {
+			fixture_fail("Pack of uid %u is unreadable", (unsigned int)uid);
+		}
+		if (uid_dir_fd != -1) {
+			close(uid_dir_fd);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned long long count = (argc > 1 ? strtoull(argv[1], NULL, 10) : 20000);
+	uint64_t state = (argc > 2 ? strtoull(argv[2], NULL, 10) : 1);
+	if (state == 0) {
+		state = 1;
+	}
+
+	struct FixtureStore fixture;
+	struct Index index;
+	static struct Tiers tiers;
+	int64_t now_ns = clock_ns(CLOCK_REALTIME);
+	if (fixture_quiet() != 0 || fixture_store_open(&fixture) != 0) {
+		return 3;
+	}
+	if (index_init(&index, 0) != 0 || tier_init(&tiers, now_ns) != 0) {
+		fixture_store_close(&fixture);
+		return 3;
+	}
+	fixture.store.index = &index;
+	fixture.store.tiers = &tiers;
+	for (size_t uid = 0; uid < FUZZ_UIDS; ++uid) {
+		for (size_t n = 0; n < FUZZ_NOTES; ++n) {
+			model[uid][n].body = malloc(FUZZ_MAX_LEN);
+			model[uid][n].len = 0;
+			model[uid][n].live = 0;
+		}
+	}
+
+	struct TierTotals totals;
+	memset(&totals, '\0', sizeof(totals));
+	for (unsigned long long step = 0; step < count; ++step) {
+		const uid_t uid = (uid_t)(fixture_random(&state) % FUZZ_UIDS);
+		const size_t n = (size_t)(fixture_random(&state) % (fixture_random(&state) % 4 == 0 ? FUZZ_NOTES : FUZZ_NOTES / 4)); /* a few notes are read far more than the rest */
+		struct ModelNote *const note = &model[uid][n];
+		char sbj[MAX_SBJ_LEN + 1];
+		note_sbj(n, sbj);
+
+		const uint64_t op = fixture_random(&state) % 16;
+		if (op < 2) { /* time passes, & the packer runs */
+			now_ns += (fixture_random(&state) % 2 == 0 ? (NOTICEBOARD_COLD_AFTER_S + 1) * NS_PER_S : (int64_t)(fixture_random(&state) % (uint64_t)NS_PER_S));
+			for (size_t passes = 1 + fixture_random(&state) % 8; passes > 0; --passes) {
+				const int compacting = (tiers.compaction.dir_fd != -1);
+				tier_pack(&tiers, &fixture.store, now_ns);
+				totals.compactions += (unsigned long long)(!compacting && tiers.compaction.dir_fd != -1);
+				++totals.packer_passes;
+			}
+		} else if (!note->live) { /* an ADD */
+			note->len = fixture_len(&state, NOTICEBOARD_COLD_MAX_LEN / 4);
+			fixture_body(&state, note->body, note->len);
+			if (fixture_write_note(&fixture.store, uid, sbj, note->body, note->len) != 0) {
+				fixture_fail("Couldn't add %u/%s", (unsigned int)uid, sbj);
+				continue;
+			}
+			index_insert(&index, uid, sbj, (uint32_t)note->len, now_ns, 0);
+			note->live = 1;
+		} else if (op < 12) {
+			do_read(&state, &fixture.store, uid, sbj, note, now_ns, &totals);
+		} else if (op < 14) {
+			do_append(&state, &fixture.store, uid, sbj, note, &totals);
+		} else {
+			do_remove(&fixture.store, uid, sbj, note, &totals);
+		}
+
+		if (step % VERIFY_EVERY == 0) {
+			verify(&fixture.store);
+		}
+	}
+	verify(&fixture.store);
+
+	const int ret = fixture_finish("%llu step(s): %llu read(s) (%llu hot, %llu cold, %llu from files), %llu append(s), %llu removal(s), %llu packer pass(es) - %llu note(s) packed, %llu unpacked, %llu compaction(s)", count, totals.reads, (unsigned long long)tiers.hot_hits, (unsigned long long)tiers.cold_reads, totals.file_reads, totals.appends, totals.removes, totals.packer_passes, (unsigned long long)tiers.packed, (unsigned long long)tiers.unpacked, totals.compactions);
+
+	for (size_t uid = 0; uid < FUZZ_UIDS; ++uid) {
+		for (size_t n = 0; n < FUZZ_NOTES; ++n) {
+			free(model[uid][n].body);
+		}
+	}
+	tier_free(&tiers);
+	index_free(&index);
+	fixture_store_close(&fixture);
+
+	return ret;
+}
@@ -0,0 +1,211 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timer_wheel.h"
+#include "fixture.h"
+
+/**
+ * @brief Timer wheel fuzz test, ran by `make check`
+ * - a few hundred timers are scheduled, moved & cancelled at random - due now, in the past, within a slot or a level, right on the edges of levels & of the span, & well beyond it (parked & re-filed)
+ * - the wheel is advanced by a tick, a little, a lot, to exactly where timer_next says, or straight to the earliest deadline - from a start that's anywhere, often just short of a level wrapping
+ * - each timer must fire in the first timer_expire whose tick has reached its deadline (its scheduling tick, if that's later) - never before, never after, never twice, & never once cancelled
+ * - count, timer_scheduled & timer_next must agree with a plain model at every step. timer_next may be early, but never later than the earliest deadline
+ * Usage: timer_fuzz [COUNT [SEED]] - 100000 steps from seed 1 by default. exits non-zero on any failure
+ */
+
+#define FUZZ_TIMERS 256
+#define WHEEL_SPAN ((uint64_t)1 << (TIMER_SLOT_BITS * TIMER_LEVELS))
+
+/**
+ * @brief FuzzTimer (struct) - a timer & what the model says of it
+ */
+struct FuzzTimer {
+	struct TimerLink link; /* first, so an expired link is its timer */
+
+	uint64_t due; /* tick it must fire at. expires, or the wheel's position when scheduled if that's later */
+
+	int scheduled; /* boolean */
+};
+
+/**
+ * @brief TimerStats (struct) - running totals, for the summary
+ */
+struct TimerStats {
+	unsigned long long scheduled, parked, cancelled, fired, advances;
+};
+
+/**
+ * @brief pick_expiry - a random deadline, relative to the wheel's position
+ */
+static uint64_t pick_expiry(uint64_t *const state, const uint64_t current)
+{
+	switch (fixture_random(state) % 10) {
+		case 0: /* past */
+			return current - (current < 5000 ? current : fixture_random(state) % 5000);
+		case 1: /* now */
+			return current;
+		case 2: /* just either side of a level's edge */
+			return current + ((uint64_t)1 << (TIMER_SLOT_BITS * (1 + fixture_random(state) % (TIMER_LEVELS - 1)))) - 2 + fixture_random(state) % 4;
+		case 3: /* just either side of the span's */
+			return current + WHEEL_SPAN - 2 + fixture_random(state) % 4;
+		case 4: /* beyond the span - parked */
+			return current + WHEEL_SPAN + fixture_random(state) % (2 * WHEEL_SPAN);
+		case 5: /* somewhere on the wheel */
+			return current + fixture_random(state) % WHEEL_SPAN;
+		case 6:
+		case 7: /* within a level or two */
+			return current + fixture_random(state) % ((uint64_t)1 << (TIMER_SLOT_BITS * 2));
+		default: /* within a slot or two */
+			return current + fixture_random(state) % (2 * TIMER_SLOTS);
+	}
+}
+
+/**
+ * @brief pick_now - a random tick to advance the wheel to
+ */
+static uint64_t pick_now(uint64_t *const state, const struct TimerWheel *const wheel, const struct FuzzTimer *const timers)
+{
+	const uint64_t current = wheel->current;
+	switch (fixture_random(state) % 8) {
+		case 0: /* behind - nothing to do */
+			return current - 1 - fixture_random(state) % 3;
+		case 1: /* where timer_next says */
+			return current + (uint64_t)(timer_next(wheel) > 0 ? timer_next(wheel) : 0);
+		case 2: { /* straight to the earliest deadline */
+			uint64_t earliest = UINT64_MAX;
+			for (size_t i = 0; i < FUZZ_TIMERS; ++i) {
+				if (timers[i].scheduled && timers[i].due < earliest) {
+					earliest = timers[i].due;
+				}
+			}
+			return (earliest != UINT64_MAX ? earliest : current);
+		}
+		case 3: /* a lot */
+			return current + fixture_random(state) % ((uint64_t)1 << (TIMER_SLOT_BITS * 3));
+		case 4:
+		case 5: /* a little */
+			return current + fixture_random(state) % (4 * TIMER_SLOTS);
+		default: /* a tick */
+			return current;
+	}
+}
+
+/**
+ * @brief check_next - holds timer_next to the model. it's allowed to be early (a wrap, when something may cascade into reach), never late
+ */
+static void check_next(const struct TimerWheel *const wheel, const struct FuzzTimer *const timers, const size_t model_count)
+{
+	const int64_t next = timer_next(wheel);
+	if ((next == -1) != (model_count == 0) || next < -1) {
+		fixture_fail("timer_next is %lld with %lu timer(s) scheduled", (long long)next, (unsigned long)model_count);
+		return;
+	}
+
+	for (size_t i = 0; i < FUZZ_TIMERS; ++i) {
+		if (timers[i].scheduled && wheel->current + (uint64_t)next > timers[i].due) {
+			fixture_fail("timer_next is %lld from tick %llu, past timer %lu due at %llu", (long long)next, (unsigned long long)wheel->current, (unsigned long)i, (unsigned long long)timers[i].due);
+			return;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned long long count = (argc > 1 ? strtoull(argv[1], NULL, 10) : 100000);
+	uint64_t state = (argc > 2 ? strtoull(argv[2], NULL, 10) : 1);
+	if (state == 0) {
+		state = 1;
+	}
+
+	if (fixture_quiet() != 0) {
+		return 3;
+	}
+
+	static struct TimerWheel wheel;
+	static struct FuzzTimer timers[FUZZ_TIMERS];
+	struct TimerStats stats;
+	memset(&stats, '\0', sizeof(stats));
+
+	const uint64_t start = (fixture_random(&state) % 2 == 0 ? (fixture_random(&state) >> 16) : ((fixture_random(&state) >> 40) << (TIMER_SLOT_BITS * TIMER_LEVELS)) - fixture_random(&state) % 100); /* anywhere, or just short of the top level wrapping */
+	timer_wheel_init(&wheel, start);
+	for (size_t i = 0; i < FUZZ_TIMERS; ++i) {
+		timer_link_init(&timers[i].link);
+		timers[i].scheduled = 0;
+	}
+	size_t model_count = 0;
+
+	for (unsigned long long n = 0; n < count; ++n) {
+		struct FuzzTimer *const timer = &timers[fixture_random(&state) % FUZZ_TIMERS];
+		switch (fixture_random(&state) % 4) {
+			case 0:
+			case 1: { /* schedule, or move */
+				const uint64_t expires = pick_expiry(&state, wheel.current);
+				timer_schedule(&wheel, &timer->link, expires);
+				model_count += (size_t)!timer->scheduled;
+				timer->scheduled = 1;
+				timer->due = (expires < wheel.current ? wheel.current : expires);
+				++stats.scheduled;
+				stats.parked += (unsigned long long)(timer->due - wheel.current >= WHEEL_SPAN);
+				break;
+			}
+			case 2: /* cancel */
+				timer_cancel(&wheel, &timer->link);
+				model_count -= (size_t)timer->scheduled;
+				stats.cancelled += (unsigned long long)timer->scheduled;
+				timer->scheduled = 0;
+				break;
+			default: { /* advance */
+				const uint64_t now = pick_now(&state, &wheel, timers);
+				struct TimerLink expired;
+				timer_list_init(&expired);
+				const size_t expired_count = timer_expire(&wheel, now, &expired);
+				++stats.advances;
+
+				size_t popped = 0;
+				for (struct TimerLink *link; (link = timer_list_pop(&expired)) != NULL; ++popped) {
+					struct FuzzTimer *const fired = (struct FuzzTimer *)link;
+					if (fired < timers || fired >= timers + FUZZ_TIMERS) {
+						fixture_fail("timer_expire gave back a link that isn't a timer");
+						continue;
+					}
+					if (!fired->scheduled) {
+						fixture_fail("Timer %lu fired at tick %llu, though it isn't scheduled", (unsigned long)(fired - timers), (unsigned long long)now);
+					} else if (fired->due > now) {
+						fixture_fail("Timer %lu due at %llu fired early, at tick %llu", (unsigned long)(fired - timers), (unsigned long long)fired->due, (unsigned long long)now);
+					}
+					model_count -= (size_t)fired->scheduled;
+					fired->scheduled = 0;
+					++stats.fired;
+				}
+				if (popped != expired_count) {
+					fixture_fail("timer_expire counted %lu expired, but gave back %lu", (unsigned long)expired_count, (unsigned long)popped);
+				}
+
+				for (size_t i = 0; i < FUZZ_TIMERS; ++i) {
+					if (timers[i].scheduled && timers[i].due <= now) {
+						fixture_fail("Timer %lu due at %llu didn't fire by tick %llu", (unsigned long)i, (unsigned long long)timers[i].due, (unsigned long long)now);
+						timer_cancel(&wheel, &timers[i].link); /* reported once */
+						timers[i].scheduled = 0;
+						--model_count;
+					}
+				}
+				break;
+			}
+		}
+
+		if (wheel.count != model_count) {
+			fixture_fail("Wheel counts %lu timer(s) scheduled, rather than %lu", (unsigned long)wheel.count, (unsigned long)model_count);
+			model_count = wheel.count;
+		}
+		for (size_t i = 0; i < FUZZ_TIMERS; ++i) {
+			if (timer_scheduled(&timers[i].link) != timers[i].scheduled) {
+				fixture_fail("timer_scheduled of timer %lu is %d, rather than %d", (unsigned long)i, timer_scheduled(&timers[i].link), timers[i].scheduled);
+			}
+		}
+		check_next(&wheel, timers, model_count);
+	}
+
+	return fixture_finish("%llu step(s) from tick %llu: %llu timer(s) scheduled (%llu parked), %llu cancelled, %llu fired over %llu advance(s)", count, (unsigned long long)start, stats.scheduled, stats.parked, stats.cancelled, stats.fired, stats.advances);
+}